@@ -2,6 +2,9 @@
 #include "..\include\mnist_loader.hpp"
 #include <iostream>
 #include <chrono>
+#include <cstring>
+#include <thread>
+#include <algorithm>
 
 using namespace nn;
 using namespace std;
@@ -37,6 +40,65 @@ auto makeNetwork(Shape<> inputShape, size_t outputSize)
 	return Network(move(args));
 }
 
+// Compares synchronous mini-batch training with asynchronous (Hogwild) training on the host
+void benchmarkAsyncTraining(const MnistData& data, uint32_t threadCount)
+{
+	const float targetAccuracy = 0.9f;
+	const uint32_t maxEpochs = 10;
+	const uint32_t batchSize = 16;
+
+	for (bool async : { false, true })
+	{
+		NetworkArgs args;
+		args.setInputShape(data.trainingData.shape().slice());
+		args.addLayerDense(32);
+		args.addLayerSigmoid();
+		args.addLayerDense(10);
+		args.addLayerSigmoid();
+		args.setLossMse();
+		args.setOptimizerGradientDescent(3.0f);
+		args.setThreadCount(threadCount);
+		args.enableAsyncTraining(async);
+		auto network = Network(move(args));
+
+		auto trainingTargets = labelToVec(data.trainingLabels);
+		float trainingTime = 0.f;
+		float timeToTarget = -1.f;
+		float accuracy = 0.f;
+		uint32_t epoch = 0;
+
+		while (epoch < maxEpochs && timeToTarget < 0.f)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			network.train(data.trainingData, trainingTargets, batchSize, 1);
+			std::chrono::duration<float> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+			trainingTime += elapsed.count();
+			++epoch;
+
+			accuracy = (float)network.test(data.testData, data.testLabels);
+			if (accuracy >= targetAccuracy)
+			{
+				timeToTarget = trainingTime;
+			}
+		}
+
+		const float samplesPerSecond = float(data.trainingData.length()) * epoch / trainingTime;
+
+		cout << (async ? "async: " : "sync:  ")
+			 << samplesPerSecond << " samples/sec, accuracy " << accuracy << " after " << epoch << " epoch(s), ";
+
+		if (timeToTarget >= 0.f)
+		{
+			cout << timeToTarget << " seconds to reach " << targetAccuracy << endl;
+		}
+		else
+		{
+			cout << "did not reach " << targetAccuracy << endl;
+		}
+	}
+}
+
 int main(int argc, char* argv[])
 {
 	MnistData data;
@@ -54,6 +116,14 @@ int main(int argc, char* argv[])
 
 	//DumpFormattedMnist(data);
 
+	// mnist benchmark [threads]
+	if (argc > 1 && strcmp(argv[1], "benchmark") == 0)
+	{
+		const uint32_t threadCount = argc > 2 ? uint32_t(atoi(argv[2])) : std::thread::hardware_concurrency();
+		benchmarkAsyncTraining(data, std::max(threadCount, 1u));
+		return 0;
+	}
+
 	auto network = makeNetwork(data.trainingData.shape().slice(), 10);
 
 
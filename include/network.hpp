@@ -18,6 +18,10 @@ public:
 
     bool isValid() const { return impl != nullptr; }
 
+    // Releases all memory used only for training (derivatives, backpropagation buffers and
+    // optimizer state). Only forward(), clasify() and test() can be used afterwards.
+    void freeze();
+
 	template<size_t N, typename T> Tensor<> forward(const Tensor<N, T>& inputs)
 	{
         static_assert(N > 1, "Expected input for forward() to have at least 2 dimensions. Note: can use Tensor::as({1, n})");
@@ -32,6 +36,25 @@ public:
         return clasify(inputs.flat(), inputs.length());
     }
 
+    // Same as above but write into caller owned tensors so no memory is allocated. outputs needs
+    // room for inputs.length() * output size floats and classes for inputs.length() labels.
+    template<size_t N, typename T> void forward(const Tensor<N, T>& inputs, Tensor<>& outputs)
+    {
+        static_assert(N > 1, "Expected input for forward() to have at least 2 dimensions. Note: can use Tensor::as({1, n})");
+        checkInputShape(inputs.shape());
+        forward(inputs.flat(), inputs.length(), outputs);
+    }
+
+    template<size_t N, typename T> void clasify(const Tensor<N, T>& inputs, Tensor<1, uint32_t>& classes)
+    {
+        static_assert(N > 1, "Expected input for clasify() to have at least 2 dimensions. Note: can use Tensor::as({1, n})");
+        checkInputShape(inputs.shape());
+        clasify(inputs.flat(), inputs.length(), classes);
+    }
+
+    // Preallocate all internal scratch for calls with up to inputCount samples
+    void reserve(size_t inputCount);
+
     // For normal training. U should be float or const float.
 	template<size_t N, typename T, typename U> void train(const Tensor<N, T> inputs, const Tensor<2, U> targets, uint32_t batchSize = 32, uint32_t epochs = 1)
 	{		
@@ -65,6 +88,8 @@ private:
 
 	Tensor<> forward(ConstTensor<> inputs, size_t inputCount);
     Tensor<1, uint32_t> clasify(ConstTensor<> inputs, size_t inputCount);
+    void forward(ConstTensor<> inputs, size_t inputCount, Tensor<>& outputs);
+    void clasify(ConstTensor<> inputs, size_t inputCount, Tensor<1, uint32_t>& classes);
 	void train(ConstTensor<> inputs, ConstTensor<> targets, size_t inputCount, uint32_t epochs, size_t batchSize);
     void train(ConstTensor<> inputs, Tensor<1, const uint32_t> targets, size_t inputCount, uint32_t epochs, size_t batchSize);
     double test(ConstTensor<> inputs, ConstTensor<> targets, size_t inputCount);
@@ -74,6 +99,7 @@ private:
     void checkLabels(Shape<> inputShape, Shape<> targetShape) const;
     void checkLossFunction() const;
     void checkOptimizer() const;
+    void checkNotFrozen() const;
 
     std::unique_ptr<class Impl> impl;
 };
@@ -91,15 +117,35 @@ public:
 
     void addLayerConv2d(uint32_t fileterCount, Shape<2> filterSize, Shape<2> filterStep = Shape<2>({ 1, 1 }));
 
+    // Convolves each channel with a filter of its own
+    void addLayerDepthwiseConv2d(Shape<2> filterSize, Shape<2> filterStep = Shape<2>({ 1, 1 }));
+
+    // A depthwise convolution followed by a 1x1 convolution with filterCount filters
+    void addLayerSeparableConv2d(uint32_t filterCount, Shape<2> filterSize, Shape<2> filterStep = Shape<2>({ 1, 1 }));
+
     void addLayerMaxPooling(Dim2 poolingSize);
 
+    // LSTM over an input of shape (time, features). Outputs the last hidden state, or the hidden
+    // state of every step with shape (time, hiddenSize) if returnSequence is set.
+    void addLayerLstm(uint32_t hiddenSize, bool returnSequence = false);
+
+    // Normalizes each channel of a (channels, height, width) output, or each element of any
+    // other, by its batch statistics. Folded into a preceding dense layer when frozen.
+    // Mini-batches are processed in chunks of at most 128 samples, so larger ones are
+    // normalized per chunk. Cannot be trained with more than one thread.
+    void addLayerBatchNorm();
+
+    // Zeroes each input with probability rate while training
+    void addLayerDropout(float rate);
+
     void addLayerSigmoid();
 
     void addLayerTanh();
 
     void addLayerRelu();
 
-    void addLayerLrelu();
+    // Leaky ReLU, alpha is the slope for negative inputs
+    void addLayerLrelu(float alpha = 0.01f);
 
     void setOptimizerGradientDescent(float learningRate = 0.01f);
 
@@ -107,13 +153,33 @@ public:
 
     void setLossMse();
 
+    // Softmax and cross entropy in one. The final layer outputs logits, so its output should
+    // not go through a sigmoid. Training accepts uint32_t labels as targets.
+    void setLossSoftmaxCrossEntropy();
+
     void enableOpenCLAcceleration(bool enable);
 
+    void setThreadCount(uint32_t threadCount);
+
+    // Lock-free (Hogwild) training: each thread updates the parameters as soon as its own
+    // mini-batch is done. Faster per sample but gradients may be stale. Requires gradient descent.
+    void enableAsyncTraining(bool enable);
+
+    // Lets a first dense layer skip the zeros of mostly empty input (e.g. images) on the host.
+    // Batches with under 25% non-zero inputs are compressed, which costs a pass over the input.
+    void enableSparseInput(bool enable);
+
+    // Create the network frozen (see Network::freeze()) so training state is never allocated
+    void setInferenceOnly(bool enable);
+
     Shape<>& getOutputShape() const;
 
 private:
     void checkAddLayer();
 
+    // Current output shape as (channels, height, width). False if it is not an image.
+    bool getImageShape(Shape<3>& shape) const;
+
     friend Network;
 
     std::unique_ptr<struct NetworkConfig> data;
@@ -3,7 +3,8 @@
 #include <cassert>
 #include <initializer_list>
 #include <array>
-#include <vector>
+#include <algorithm>
+#include <cstring>
 
 namespace nn
 {
@@ -131,6 +132,52 @@ class Shape<0>
 	static const size_t capacity = 8;
 
 public:
+	// Fixed capacity list of dimensions stored inline, so creating and copying shapes never allocates
+	class Dimensions
+	{
+	public:
+		Dimensions() : count_(0) {}
+
+		explicit Dimensions(size_t count) : count_(0) { resize(count); }
+
+		size_t size() const { return count_; }
+
+		void resize(size_t count)
+		{
+			assert(count <= capacity);
+			for (size_t i = count_; i < count; ++i)
+			{
+				values_[i] = 0;
+			}
+			count_ = uint32_t(count);
+		}
+
+		void push_back(uint32_t value)
+		{
+			assert(count_ < capacity);
+			values_[count_++] = value;
+		}
+
+		uint32_t* data() { return values_.data(); }
+		const uint32_t* data() const { return values_.data(); }
+
+		uint32_t& operator [] (size_t i) { return values_[i]; }
+		const uint32_t& operator [] (size_t i) const { return values_[i]; }
+
+		const uint32_t* begin() const { return data(); }
+		const uint32_t* end() const { return data() + count_; }
+
+		bool operator == (const Dimensions& other) const
+		{
+			return count_ == other.count_ && std::equal(begin(), end(), other.begin());
+		}
+
+	private:
+		std::array<uint32_t, capacity> values_;
+
+		uint32_t count_;
+	};
+
 	Shape() : size_(0) {}
 
 	template<size_t N, typename T> Shape(const T(&dimensions)[N])
@@ -207,13 +254,13 @@ public:
 		return Shape(dimensions(), size_);
 	}
 private:
-	Shape(const std::vector<uint32_t>& dimensions, size_t size) :
+	Shape(const Dimensions& dimensions, size_t size) :
 		size_(size / dimensions[0]), dimensions_(dimensions.size() - 1)
 	{
 		memcpy(dimensions_.data(), dimensions.data() + 1, dimensions_.size() * sizeof(dimensions_[0]));
 	}
 
-	std::vector<uint32_t> dimensions_;
+	Dimensions dimensions_;
 
 	size_t size_;
 };
@@ -241,7 +288,7 @@ template<size_t N> inline bool operator==(const Shape<0>& lhs, const Shape<N>& r
 
 inline bool operator==(const Shape<0>& lhs, const Shape<0>& rhs)
 {
-	if (rhs.dimensions().size() != rhs.dimensions().size()) return false;
+	if (lhs.dimensions().size() != rhs.dimensions().size()) return false;
 	return std::memcmp(lhs.dimensions().data(), rhs.dimensions().data(), rhs.dimensions().size() * sizeof(rhs.dimensions()[0])) == 0;
 }
 
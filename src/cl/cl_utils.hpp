@@ -3,12 +3,54 @@
 #include <stdio.h>
 #include <string>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <initializer_list>
 
 namespace nn
 {
 namespace cl
 {
-inline cl_program buildProgramFromFile(const char* fileName, cl_context context, cl_device_id device)
+// Name of every program built by buildProgramFromFile: the source file without directory or
+// extension followed by its definitions, e.g. "dense(INPUT_WIDTH=784,OUTPUT_WIDTH=10)". Lets kernels
+// be told apart across layers and shapes.
+inline std::map<cl_program, std::string>& programNames()
+{
+	static std::map<cl_program, std::string> names;
+	return names;
+}
+
+// Guards programNames() and the programs kept by buildProgramFromFile
+inline std::mutex& programMutex()
+{
+	static std::mutex mutex;
+	return mutex;
+}
+
+struct Define
+{
+	const char* name;
+	size_t value;
+};
+
+// Build options defining each name as a number, e.g. "-D INPUT_WIDTH=784 -D OUTPUT_WIDTH=10"
+inline std::string defines(std::initializer_list<Define> values)
+{
+	std::string options;
+
+	for (auto& value : values)
+	{
+		options += (options.empty() ? "-D " : " -D ") + std::string(value.name) + "=" + std::to_string(value.value);
+	}
+
+	return options;
+}
+
+// Builds the .cl file matching fileName with the given options, typically defines() of a layer's
+// fixed dimensions. Programs are kept per context, device, file and options, so each distinct
+// shape is compiled once and layers of the same shape share it.
+inline cl_program buildProgramFromFile(const char* fileName, cl_context context, cl_device_id device, const std::string& options = "")
 {
 	int error = CL_SUCCESS;
 
@@ -16,6 +58,15 @@ inline cl_program buildProgramFromFile(const char* fileName, cl_context context,
     size_t extPos = clName.find_first_of('.');
     clName.erase(extPos + 1);
     clName.append("cl");
+
+    std::lock_guard<std::mutex> lock(programMutex());
+    static std::map<std::tuple<cl_context, cl_device_id, std::string, std::string>, cl_program> programs;
+    auto& cached = programs[std::make_tuple(context, device, clName, options)];
+
+    if (cached != NULL)
+    {
+        return cached;
+    }
     
     FILE* fp = NULL;
     fopen_s(&fp, clName.c_str(), "r+b");
@@ -41,7 +92,7 @@ inline cl_program buildProgramFromFile(const char* fileName, cl_context context,
         throw std::exception("Unexpected creating program");
     }
 
-    error = clBuildProgram(program, 1, &device, NULL, NULL, NULL);
+    error = clBuildProgram(program, 1, &device, options.empty() ? NULL : options.c_str(), NULL, NULL);
 
     if (error != CL_SUCCESS)
     {
@@ -55,14 +106,24 @@ inline cl_program buildProgramFromFile(const char* fileName, cl_context context,
         throw std::exception("Unexpected error building program");
     }
 
-    return program;
-}
+    clName.erase(extPos);
+    auto name = clName.substr(clName.find_last_of("/\\") + 1);
 
-static const size_t workGroupSize = 32;
+    if (!options.empty())
+    {
+        auto list = options.substr(3);
 
-inline size_t alignSize(size_t s)
-{
-    return (s + (workGroupSize-1)) & ~(workGroupSize-1);
+        for (size_t pos; (pos = list.find(" -D ")) != std::string::npos;)
+        {
+            list.replace(pos, 4, ",");
+        }
+
+        name += "(" + list + ")";
+    }
+
+    programNames()[program] = name;
+    cached = program;
+    return program;
 }
 
 //inline size_t getStride(size_t s)
@@ -0,0 +1,379 @@
+#pragma once
+#include "cl_utils.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace nn
+{
+namespace cl
+{
+// Tuned values of one device, loaded from and appended to a text file. Every line holds a device
+// name, driver version, key and value separated by tabs, so devices can share the file and
+// a driver update starts from scratch. An empty file name keeps the values in memory only.
+class TuningCache
+{
+public:
+	TuningCache(std::string fileName, std::string device, std::string driver) :
+		fileName(std::move(fileName)),
+		device(clean(std::move(device))),
+		driver(clean(std::move(driver)))
+	{
+		std::ifstream file(this->fileName);
+		std::string line;
+
+		while (std::getline(file, line))
+		{
+			const auto first = line.find('\t');
+			const auto second = line.find('\t', first + 1);
+			const auto third = line.find('\t', second + 1);
+
+			if (third == std::string::npos ||
+				line.compare(0, first, this->device) != 0 ||
+				line.compare(first + 1, second - first - 1, this->driver) != 0)
+			{
+				continue;
+			}
+
+			const size_t value = strtoul(line.c_str() + third + 1, NULL, 10);
+
+			if (value != 0)
+			{
+				values[line.substr(second + 1, third - second - 1)] = value;
+			}
+		}
+	}
+
+	bool find(const std::string& key, size_t& value) const
+	{
+		auto it = values.find(key);
+
+		if (it == values.end())
+		{
+			return false;
+		}
+
+		value = it->second;
+		return true;
+	}
+
+	void insert(const std::string& key, size_t value)
+	{
+		values[key] = value;
+
+		if (!fileName.empty())
+		{
+			std::ofstream file(fileName, std::ios::app);
+			file << device << '\t' << driver << '\t' << key << '\t' << value << '\n';
+		}
+	}
+
+private:
+	static std::string clean(std::string s)
+	{
+		std::replace_if(s.begin(), s.end(), [](char c) { return c == '\t' || c == '\n' || c == '\r'; }, ' ');
+		s.erase(std::find(s.begin(), s.end(), '\0'), s.end());
+		return s;
+	}
+
+	std::string fileName;
+
+	std::string device;
+
+	std::string driver;
+
+	std::map<std::string, size_t> values;
+};
+
+// Shape of a launch: `rows` rows of `width` elements. Item launches have one work item per element
+// with the rows as the second dimension, group launches one work group per row.
+struct Range
+{
+	size_t width;
+
+	size_t rows;
+
+	bool groups;
+};
+
+// Chooses the work group size of launches on one device. The first launch of a kernel with a given
+// shape times every candidate size and keeps the fastest in the tuning cache. Shapes are rounded up
+// to powers of two so a smaller last batch reuses the result. The size is then looked up by kernel
+// handle, so later launches neither query OpenCL nor allocate.
+class Tuner
+{
+public:
+	static const size_t defaultSize = 32;
+
+	// Where the results are kept, an empty name keeps them in memory only. Drops the results of
+	// every device so they are reloaded from the new file.
+	static void setCacheFile(std::string fileName)
+	{
+		auto& registry = getRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		registry.fileName = std::move(fileName);
+		registry.tuners.clear();
+		registry.launches.clear();
+	}
+
+	static std::string getCacheFile()
+	{
+		auto& registry = getRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		return registry.fileName;
+	}
+
+	// Enqueues `kernel`, whose arguments must be set already, with the tuned work group size.
+	// `outputs` are the buffers the kernel writes, they are restored after timing.
+	static int enqueue(cl_command_queue queue, cl_kernel kernel, Range range, std::initializer_list<cl_mem> outputs)
+	{
+		return launch(queue, kernel, range, getLocalSize(queue, kernel, range, outputs));
+	}
+
+private:
+	// Local arrays in the kernels are sized for at most this many work items
+	static const size_t maxWorkGroupSize = 256;
+
+	static const int timedRuns = 3;
+
+	// queue, kernel, groups and the rounded up rows and width of a launch
+	using LaunchKey = std::tuple<cl_command_queue, cl_kernel, bool, size_t, size_t>;
+
+	struct Registry
+	{
+		std::mutex mutex;
+
+		std::string fileName = "nn_tuning.txt";
+
+		std::map<cl_device_id, std::unique_ptr<Tuner>> tuners;
+
+		std::map<LaunchKey, size_t> launches;
+	};
+
+	static Registry& getRegistry()
+	{
+		static Registry registry;
+		return registry;
+	}
+
+	static std::string getDeviceInfo(cl_device_id device, cl_device_info info)
+	{
+		char buffer[256] = {};
+		clGetDeviceInfo(device, info, sizeof(buffer) - 1, buffer, NULL);
+		return buffer;
+	}
+
+	static size_t nextPowerOfTwo(size_t s)
+	{
+		size_t p = 1;
+
+		while (p < s)
+		{
+			p *= 2;
+		}
+
+		return p;
+	}
+
+	static std::string getKey(cl_kernel kernel, Range range)
+	{
+		char name[128] = {};
+		cl_program program = NULL;
+		clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(name) - 1, name, NULL);
+		clGetKernelInfo(kernel, CL_KERNEL_PROGRAM, sizeof(program), &program, NULL);
+
+		std::lock_guard<std::mutex> lock(programMutex());
+		auto& names = programNames();
+		auto it = names.find(program);
+		auto key = (it != names.end() ? it->second : std::string("?")) + "." + name;
+		return key + (range.groups ? " g" : " i") + std::to_string(nextPowerOfTwo(range.rows)) + "x" + std::to_string(nextPowerOfTwo(range.width));
+	}
+
+	static int launch(cl_command_queue queue, cl_kernel kernel, Range range, size_t localSize)
+	{
+		if (range.groups)
+		{
+			const size_t globalSize = range.rows * localSize;
+			return clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &globalSize, &localSize, 0, NULL, NULL);
+		}
+
+		const size_t globalSize[2] = { (range.width + localSize - 1) / localSize * localSize, range.rows };
+		const size_t groupSize[2] = { localSize, 1 };
+		return clEnqueueNDRangeKernel(queue, kernel, range.rows > 1 ? 2 : 1, NULL, globalSize, groupSize, 0, NULL, NULL);
+	}
+
+	static size_t getLocalSize(cl_command_queue queue, cl_kernel kernel, Range range, std::initializer_list<cl_mem> outputs)
+	{
+		auto& registry = getRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		const LaunchKey launchKey(queue, kernel, range.groups, nextPowerOfTwo(range.rows), nextPowerOfTwo(range.width));
+		auto it = registry.launches.find(launchKey);
+
+		if (it != registry.launches.end())
+		{
+			return it->second;
+		}
+
+		cl_device_id device;
+
+		if (clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(device), &device, NULL) != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in cl::Tuner::getLocalSize()");
+		}
+
+		auto& tuner = registry.tuners[device];
+
+		if (!tuner)
+		{
+			tuner.reset(new Tuner(device, registry.fileName));
+		}
+
+		const size_t size = tuner->tune(queue, kernel, range, outputs);
+		registry.launches[launchKey] = size;
+		return size;
+	}
+
+	Tuner(cl_device_id device, const std::string& fileName) :
+		device(device),
+		cache(fileName, getDeviceInfo(device, CL_DEVICE_NAME), getDeviceInfo(device, CL_DRIVER_VERSION))
+	{
+	}
+
+	// The size from the tuning cache, or from timing the candidates if it has none
+	size_t tune(cl_command_queue queue, cl_kernel kernel, Range range, std::initializer_list<cl_mem> outputs)
+	{
+		const auto key = getKey(kernel, range);
+		size_t maxSize = maxWorkGroupSize;
+		clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(maxSize), &maxSize, NULL);
+		maxSize = maxSize < maxWorkGroupSize ? maxSize : maxWorkGroupSize;
+		size_t size;
+
+		if (!cache.find(key, size) || size > maxSize)
+		{
+			size = benchmark(queue, kernel, range, maxSize, outputs);
+			cache.insert(key, size);
+		}
+
+		return size;
+	}
+
+	// Times each power of two from defaultSize (or the largest one within maxSize) up to maxSize and
+	// returns the fastest. Candidates the device refuses are skipped.
+	size_t benchmark(cl_command_queue queue, cl_kernel kernel, Range range, size_t maxSize, std::initializer_list<cl_mem> outputs)
+	{
+		std::vector<std::pair<cl_mem, cl_mem>> backups;
+		int error = CL_SUCCESS;
+
+		for (auto output : outputs)
+		{
+			auto isCopied = [=](const std::pair<cl_mem, cl_mem>& b) { return b.first == output; };
+
+			if (!output || std::find_if(backups.begin(), backups.end(), isCopied) != backups.end())
+			{
+				continue;
+			}
+
+			cl_context context;
+			size_t size;
+			error |= clGetMemObjectInfo(output, CL_MEM_CONTEXT, sizeof(context), &context, NULL);
+			error |= clGetMemObjectInfo(output, CL_MEM_SIZE, sizeof(size), &size, NULL);
+			int bufferError;
+			auto backup = clCreateBuffer(context, CL_MEM_READ_WRITE, size, NULL, &bufferError);
+			error |= bufferError | clEnqueueCopyBuffer(queue, output, backup, 0, 0, size, 0, NULL, NULL);
+			backups.emplace_back(output, backup);
+		}
+
+		auto restore = [&]
+		{
+			for (auto& b : backups)
+			{
+				size_t size;
+				clGetMemObjectInfo(b.second, CL_MEM_SIZE, sizeof(size), &size, NULL);
+				error |= clEnqueueCopyBuffer(queue, b.second, b.first, 0, 0, size, 0, NULL, NULL);
+			}
+
+			error |= clFinish(queue);
+		};
+
+		size_t best = 0;
+		double bestTime = 0.0;
+		size_t localSize = defaultSize;
+
+		while (localSize > maxSize && localSize > 1)
+		{
+			localSize /= 2;
+		}
+
+		for (; localSize <= maxSize && error == CL_SUCCESS; localSize *= 2)
+		{
+			// The first run may include compiling for this size
+			if (launch(queue, kernel, range, localSize) != CL_SUCCESS)
+			{
+				continue;
+			}
+
+			double time = 0.0;
+
+			for (int run = 0; run < timedRuns; ++run)
+			{
+				restore();
+				auto start = std::chrono::steady_clock::now();
+				launch(queue, kernel, range, localSize);
+				clFinish(queue);
+				const double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				time = run == 0 ? t : std::min(time, t);
+			}
+
+			if (best == 0 || time < bestTime)
+			{
+				best = localSize;
+				bestTime = time;
+			}
+		}
+
+		restore();
+
+		for (auto& b : backups)
+		{
+			clReleaseMemObject(b.second);
+		}
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in cl::Tuner::benchmark()");
+		}
+
+		return best ? best : defaultSize;
+	}
+
+	cl_device_id device;
+
+	TuningCache cache;
+};
+
+// Launches `kernel` with one work item per each of `size` elements
+inline int enqueue(cl_command_queue queue, cl_kernel kernel, size_t size, std::initializer_list<cl_mem> outputs)
+{
+	return Tuner::enqueue(queue, kernel, { size, 1, false }, outputs);
+}
+
+// Launches `kernel` with one work item per element of `rows` rows of `width` elements
+inline int enqueueRows(cl_command_queue queue, cl_kernel kernel, size_t width, size_t rows, std::initializer_list<cl_mem> outputs)
+{
+	return Tuner::enqueue(queue, kernel, { width, rows, false }, outputs);
+}
+
+// Launches `kernel` with one work group per each of `rows` rows of `width` elements
+inline int enqueueGroups(cl_command_queue queue, cl_kernel kernel, size_t rows, size_t width, std::initializer_list<cl_mem> outputs)
+{
+	return Tuner::enqueue(queue, kernel, { width, rows, true }, outputs);
+}
+}
+}
@@ -4,8 +4,9 @@
 #include "optimizers/optimizer.hpp"
 #include "../utils/utils.hpp"
 #include "losses/loss.hpp"
-#include "cl/cl_utils.hpp"
+#include "cl/tuner.hpp"
 #include "impl.hpp"
+#include "memory_plan.hpp"
 
 namespace nn
 {
@@ -17,8 +18,11 @@ public:
 		inputBuffer(NULL),
 		outputBuffer(NULL),
 		targetBuffer(NULL),
+		classifyBuffer(NULL),
+		errorBuffer(NULL),
 		parameters(NULL),
 		derivatives(NULL),
+		parameterCache(NULL),
 		queue(NULL),
 		context(NULL),
 		device(0),
@@ -49,7 +53,11 @@ public:
 			return false;
 		}
 
+		frozen = config->inferenceOnly;
+		fuseActivations();
+
 		size_t parametersSize = 0;
+		size_t cacheSize = 0;
 		for (const auto& layer : config->layers)
 		{
 			// Setup kernels
@@ -59,27 +67,63 @@ public:
 			parametersSize += layer->getParameterCount();
 		}
 
+		// The first layer never backpropagates so never needs a cache
+		for (size_t i = 1; i < config->layers.size(); ++i)
+		{
+			cacheOffsets.push_back(cacheSize);
+			cacheSize += config->layers[i]->cl_getParameterCacheSize();
+		}
+
 		// Create 1 buffer each for parameters and derivatives
 		parameters = clCreateBuffer(context, CL_MEM_READ_WRITE, parametersSize * sizeof(float), NULL, &error);
-		derivatives = clCreateBuffer(context, CL_MEM_READ_WRITE, parametersSize * sizeof(float), NULL, &error);
+
+		if (!frozen)
+		{
+			derivatives = clCreateBuffer(context, CL_MEM_READ_WRITE, parametersSize * sizeof(float), NULL, &error);
+		}
+
+		if (!frozen && cacheSize > 0)
+		{
+			parameterCache = clCreateBuffer(context, CL_MEM_READ_WRITE, cacheSize * sizeof(float), NULL, &error);
+		}
 
 		uint32_t paramOffset = 0;
 		const size_t height = maxBatchSize;
 
 		// Create sub-buffers for each layer
-		for (const auto& layer : config->layers)
+		for (size_t i = 0; i < config->layers.size(); ++i)
 		{
+			const auto& layer = config->layers[i];
 			paramOffsets.push_back(paramOffset);
 			paramOffset  += layer->getParameterCount();
-			
-			size_t alignedOutputSize = layer->getOutputSize() * sizeof(float) * height;
-			layerError.push_back(clCreateBuffer(context, CL_MEM_READ_WRITE, alignedOutputSize, NULL, &error));
-			layerOutputs.push_back(clCreateBuffer(context, CL_MEM_READ_WRITE, alignedOutputSize, NULL, &error));
+
+			// In-place layers share the buffers of the layer before them
+			if (MemoryPlan::runsInPlace(config->layers, i, !frozen))
+			{
+				layerError.push_back(layerError.back());
+				layerOutputs.push_back(layerOutputs.back());
+			}
+			else
+			{
+				size_t alignedOutputSize = layer->getOutputSize() * sizeof(float) * height;
+				layerError.push_back(frozen ? NULL : clCreateBuffer(context, CL_MEM_READ_WRITE, alignedOutputSize, NULL, &error));
+				layerOutputs.push_back(clCreateBuffer(context, CL_MEM_READ_WRITE, alignedOutputSize, NULL, &error));
+			}
+
+			const size_t stateSize = layer->getTrainingStateSize() * sizeof(float) * height;
+			layerStates.push_back(frozen || stateSize == 0 ? NULL : clCreateBuffer(context, CL_MEM_READ_WRITE, stateSize, NULL, &error));
 
 			layer->cl_initializeParameters(queue, parameters, paramOffsets.back());
 		}
 
-		if (config->optimizer)
+		if (frozen)
+		{
+			foldLayers();
+		}
+
+		updateParameterCache();
+
+		if (config->optimizer && !frozen)
 		{
 			config->optimizer->cl_init(context, device, queue, derivatives, parametersSize);
 		}
@@ -108,21 +152,40 @@ public:
 
 	Tensor<> forward(const ConstTensor<>& inputs, size_t inputCount) final
 	{
-		forwardCommon(inputs.data(), inputCount);
-		const size_t outputsSize = inputCount * config->outputShape.size();
-		outputs = Tensor<>(outputsSize);
-		readOutputData(outputs.data(), inputCount);
+		outputs = Tensor<>(inputCount * config->outputShape.size());
+		forward(inputs, inputCount, outputs.data());
 		return outputs;
 	}
 
 	Tensor<1, uint32_t> clasify(const ConstTensor<>& inputs, size_t inputCount) final
 	{
-		forwardCommon(inputs.data(), inputCount);
 		classifications = Tensor<1, uint32_t>(inputCount);
-		classifyOutputData();
+		clasify(inputs, inputCount, classifications.data());
 		return classifications;
 	}
 
+	void forward(const ConstTensor<>& inputs, size_t inputCount, float* output) final
+	{
+		forwardCommon(inputs.data(), inputCount);
+		readOutputData(output, inputCount);
+	}
+
+	void clasify(const ConstTensor<>& inputs, size_t inputCount, uint32_t* output) final
+	{
+		forwardCommon(inputs.data(), inputCount);
+		classifyOutputData(output, inputCount);
+	}
+
+	void reserve(size_t inputCount) final
+	{
+		const uint32_t count = uint32_t(inputCount);
+		createBuffer(inputBuffer, nullptr, config->inputShape.size(), count);
+		createBuffer(outputBuffer, nullptr, config->outputShape.size(), count);
+		createBuffer(targetBuffer, nullptr, config->outputShape.size(), count);
+		createBuffer(classifyBuffer, nullptr, 1, count);
+		createBuffer(errorBuffer, nullptr, 1, count);
+	}
+
 	double test(const ConstTensor<>& inputs, const Tensor<1, const uint32_t>& targets, size_t inputCount) final
 	{
 		forwardCommon(inputs.data(), inputCount);
@@ -131,7 +194,7 @@ public:
 
 		classifications = Tensor<1, uint32_t>(inputCount);
 
-		classifyOutputData();
+		classifyOutputData(classifications.data(), inputCount);
 		//int error;
 		//auto data = clEnqueueMapBuffer(queue, targetBuffer, CL_TRUE, CL_MAP_READ, 0, 100 * sizeof(float), 0, NULL, NULL, &error);
 		//auto data1 = clEnqueueMapBuffer(queue, outputBuffer, CL_TRUE, CL_MAP_READ, 0, 1000 * sizeof(float), 0, NULL, NULL, &error);
@@ -152,8 +215,7 @@ public:
 
 		createBuffer(targetBuffer, (void*)targets.data(), config->outputShape.size(), inputCount);
 
-		int error = 0;
-		cl_mem errorBuffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, inputCount * sizeof(float), NULL, &error);
+		createBuffer(errorBuffer, nullptr, 1, inputCount);
 
 		//auto data = clEnqueueMapBuffer(queue, targetBuffer, CL_TRUE, CL_MAP_READ, 0, 100 * sizeof(float), 0, NULL, NULL, &error);
 		//auto data1 = clEnqueueMapBuffer(queue, outputBuffer, CL_TRUE, CL_MAP_READ, 0, 100 * sizeof(float), 0, NULL, NULL, &error);
@@ -162,8 +224,12 @@ public:
 
 		Tensor<> errors(inputCount);
 
-		error |= clEnqueueReadBuffer(queue, errorBuffer, CL_TRUE, 0, inputCount * sizeof(float), errors.data(), 0, NULL, NULL);
-		clReleaseMemObject(errorBuffer);
+		int error = clEnqueueReadBuffer(queue, errorBuffer, CL_TRUE, 0, inputCount * sizeof(float), errors.data(), 0, NULL, NULL);
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception();
+		}
 
 		double loss = 0;
 		for (size_t i = 0; i < errors.size(); ++i)
@@ -184,6 +250,53 @@ public:
 		trainCommon<true>(inputs.data(), targets.data(), inputCount, batchSize, epochs);
 	}
 
+	void freeze() final
+	{
+		if (frozen)
+		{
+			return;
+		}
+
+		frozen = true;
+
+		// Make sure no queued work still uses the buffers
+		clFinish(queue);
+		foldLayers();
+		clReleaseMemObject(derivatives);
+		derivatives = NULL;
+
+		if (parameterCache)
+		{
+			clReleaseMemObject(parameterCache);
+			parameterCache = NULL;
+		}
+
+		// Shared buffers are only released by their first user
+		for (size_t i = layerError.size(); i-- > 0;)
+		{
+			if (i == 0 || layerError[i] != layerError[i - 1])
+			{
+				clReleaseMemObject(layerError[i]);
+			}
+
+			layerError[i] = NULL;
+		}
+
+		for (auto& buffer : layerStates)
+		{
+			if (buffer)
+			{
+				clReleaseMemObject(buffer);
+				buffer = NULL;
+			}
+		}
+
+		if (config->optimizer)
+		{
+			config->optimizer->release();
+		}
+	}
+
 private:
 	void createBuffer(cl_mem& buffer, void* data, uint32_t width, uint32_t height)
 	{
@@ -261,6 +374,7 @@ private:
 				}
 
 				config->optimizer->cl_update(queue, parameters, derivatives, batchSize);
+				updateParameterCache();
 			}
 		}
 
@@ -276,7 +390,7 @@ private:
 	{
 		int error = clEnqueueReadBuffer(queue,
 										outputBuffer,
-										CL_FALSE,
+										CL_TRUE,
 										0,
 										count * config->outputShape.size() * sizeof(float),
 										data,
@@ -287,28 +401,23 @@ private:
 		if (error) throw std::exception();
 	}
 
-	void classifyOutputData()
+	void classifyOutputData(uint32_t* data, size_t count)
 	{
 		int error;
 
 		const uint32_t outputSize = config->outputShape.size();
 		const uint32_t outputStride = outputSize;
 
-		auto tempBuffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_USE_HOST_PTR, classifications.size() * sizeof(uint32_t), (void*)classifications.data(), &error);
+		// classifyBuffer persists between calls so nothing is allocated once it is big enough
+		createBuffer(classifyBuffer, nullptr, 1, uint32_t(count));
 
 		error = clSetKernelArg(classifyKernel, 0, sizeof(cl_mem), &outputBuffer);
-		error |= clSetKernelArg(classifyKernel, 1, sizeof(cl_mem), &tempBuffer);
+		error |= clSetKernelArg(classifyKernel, 1, sizeof(cl_mem), &classifyBuffer);
 		error |= clSetKernelArg(classifyKernel, 2, sizeof(outputStride), &outputStride);
 		error |= clSetKernelArg(classifyKernel, 3, sizeof(outputSize), &outputSize);
-		const size_t globalSize = cl::workGroupSize * classifications.size();
-
-		error |= clEnqueueNDRangeKernel(queue, classifyKernel, 1, NULL, &globalSize, &cl::workGroupSize, 0, NULL, NULL);
 
-		error |= clFlush(queue);
-		auto data = clEnqueueMapBuffer(queue, tempBuffer, CL_TRUE, CL_MAP_READ, 0, classifications.size() * sizeof(uint32_t), 0, NULL, NULL, &error);
-		error |= clEnqueueUnmapMemObject(queue, tempBuffer, data, 0, NULL, NULL);
-
-		error |= clReleaseMemObject(tempBuffer);
+		error |= cl::enqueueGroups(queue, classifyKernel, count, outputSize, { classifyBuffer });
+		error |= clEnqueueReadBuffer(queue, classifyBuffer, CL_TRUE, 0, count * sizeof(uint32_t), data, 0, NULL, NULL);
 
 		if (error != CL_SUCCESS)
 		{
@@ -316,28 +425,109 @@ private:
 		}
 	}
 
+	// Rebuilds each layer's copy of its parameters after they have changed
+	void updateParameterCache()
+	{
+		if (frozen)
+		{
+			return;
+		}
+
+		for (size_t i = 1; i < config->layers.size(); ++i)
+		{
+			const auto& layer = config->layers[i];
+
+			if (layer->cl_getParameterCacheSize() > 0)
+			{
+				layer->cl_updateParameterCache(queue, parameters, parameterCache, paramOffsets[i], cacheOffsets[i - 1]);
+			}
+		}
+	}
+
+	// Lets layers apply the activation after them in the same kernels. A fused layer reads the
+	// activation's output while backpropagating, so a layer that would run in place over that
+	// output prevents it.
+	void fuseActivations()
+	{
+		const auto& layers = config->layers;
+		fused.assign(layers.size(), false);
+
+		for (size_t i = 0; i + 1 < layers.size(); ++i)
+		{
+			const bool outputKept = i + 2 == layers.size() || !MemoryPlan::runsInPlace(layers, i + 2, !frozen);
+
+			if (outputKept && layers[i]->cl_fuseActivation(*layers[i + 1]))
+			{
+				fused[i] = true;
+				++i;
+			}
+		}
+	}
+
+	// Lets layers that are linear at inference time fold themselves into the layer before
+	void foldLayers()
+	{
+		for (size_t i = 1; i < config->layers.size(); ++i)
+		{
+			const auto& previous = config->layers[i - 1];
+
+			if (!previous->isFolded())
+			{
+				config->layers[i]->cl_foldInto(queue, *previous, parameters, paramOffsets[i - 1], paramOffsets[i]);
+			}
+		}
+	}
+
 	void releaseBuffers()
 	{
 		clReleaseMemObject(inputBuffer);
 		clReleaseMemObject(outputBuffer);
 		clReleaseMemObject(targetBuffer);
+		clReleaseMemObject(classifyBuffer);
+		clReleaseMemObject(errorBuffer);
 	}
 
 	using Layers = vector<unique_ptr<layer::Layer>>;
 
-	void forward(cl_mem input, cl_mem output, uint32_t inputOffset, uint32_t outputOffset, size_t batchSize)
+	void forward(cl_mem input, cl_mem output, uint32_t inputOffset, uint32_t outputOffset, size_t batchSize, bool training = false)
 	{
 		cl_mem layerInput = input;
 		const auto& layers = config->layers;
 
-		for (size_t i = 0; i < layers.size() - 1; ++i)
+		// Folded layers are skipped, so the last one that is not writes the output
+		size_t lastLayer = layers.size() - 1;
+
+		while (!training && layers[lastLayer]->isFolded())
 		{
-			layers[i]->cl_forward(queue, layerInput, parameters, layerOutputs[i], inputOffset, 0, paramOffsets[i], batchSize);
-			layerInput = layerOutputs[i];
-			inputOffset = 0;
+			--lastLayer;
 		}
 
-		layers.back()->cl_forward(queue, layerInput, parameters, output, inputOffset, outputOffset, paramOffsets.back(), batchSize);
+		for (size_t i = 0; i < layers.size(); ++i)
+		{
+			if (!training && layers[i]->isFolded())
+			{
+				continue;
+			}
+
+			// A fused layer writes the output of the activation after it, which is skipped
+			const size_t target = fused[i] ? i + 1 : i;
+			const bool last = target == lastLayer;
+			cl_mem layerOutput = last ? output : layerOutputs[target];
+			const uint32_t layerOutputOffset = last ? outputOffset : 0;
+
+			if (training)
+			{
+				layers[i]->cl_forwardTraining(queue, layerInput, parameters, layerOutput, layerStates[i], inputOffset, layerOutputOffset, paramOffsets[i], batchSize);
+			}
+			else
+			{
+				layers[i]->cl_forward(queue, layerInput, parameters, layerOutput, inputOffset, layerOutputOffset, paramOffsets[i], batchSize);
+			}
+
+			layerInput = layerOutputs[target];
+			inputOffset = 0;
+			i = target;
+		}
 	}
 
 	template<bool CLASSIFY>
@@ -345,7 +535,7 @@ private:
 	{
 		const size_t inputOffset = index * config->inputShape.size();
 
-		forward(input, layerOutputs.back(), inputOffset, 0, batchSize);
+		forward(input, layerOutputs.back(), inputOffset, 0, batchSize, true);
 
 		const size_t layerCount = config->layers.size();
 
@@ -355,19 +545,33 @@ private:
 
 		for (size_t i = layerCount - 1; i > 0; --i)
 		{
+			// Activations fused into the layer before are backpropagated by that layer
+			if (fused[i - 1])
+			{
+				continue;
+			}
+
 			layer::Layer& layer = *config->layers[i];
+			const size_t target = fused[i] ? i + 1 : i;
 
 			cl_mem inputError = layerError[i - 1];
 			data.input = layerOutputs[i - 1];
-			data.output = layerOutputs[i];
-			data.outputError = layerError[i];
-			layer.cl_backPropagate(queue, data, inputError, paramOffsets[i], batchSize);
+			data.output = layerOutputs[target];
+			data.outputError = layerError[target];
+			data.cache = layer.cl_getParameterCacheSize() > 0 ? parameterCache : NULL;
+			data.cacheOffset = cacheOffsets[i - 1];
+			data.state = layerStates[i];
+
+			// In-place layers may overwrite outputError with inputError
 			layer.cl_calculateDerivatives(queue, data, derivatives, paramOffsets[i], batchSize);
+			layer.cl_backPropagate(queue, data, inputError, paramOffsets[i], batchSize);
 		}
 
 		data.input = input;
-		data.output = layerOutputs.front();
-		data.outputError = layerError.front();
+		data.cache = NULL;
+		data.state = layerStates.front();
+		data.output = layerOutputs[fused.front() ? 1 : 0];
+		data.outputError = layerError[fused.front() ? 1 : 0];
 		data.inputOffset = inputOffset;
 		config->layers[0]->cl_calculateDerivatives(queue, data, derivatives, paramOffsets.front(), batchSize);
 	}
@@ -375,8 +579,13 @@ private:
 	template<bool CLASSIFY>
 	void calculateOutputDerivatives(cl_mem output, cl_mem target, uint32_t outputSize, cl_mem outputError, uint32_t first, size_t batchSize) const
 	{
+		if (config->lossFunc && config->lossFunc->supportsLabels())
+		{
+			config->lossFunc->cl_calculateLabelDerivatives(queue, output, target, outputError, first, uint32_t(batchSize), outputSize);
+			return;
+		}
+
 		uint32_t size = outputSize * batchSize;
-		size_t globalSize = cl::alignSize(size);
 
 		int error = clSetKernelArg(softmaxErrorKernel, 0, sizeof(cl_mem), &output);
 		error |= clSetKernelArg(softmaxErrorKernel, 1, sizeof(cl_mem), &target);
@@ -385,7 +594,7 @@ private:
 		error |= clSetKernelArg(softmaxErrorKernel, 4, sizeof(outputSize), &outputSize);
 		error |= clSetKernelArg(softmaxErrorKernel, 5, sizeof(size), &size);
 
-		error |= clEnqueueNDRangeKernel(queue, softmaxErrorKernel, 1, NULL, &globalSize, &cl::workGroupSize, 0, NULL, NULL);
+		error |= cl::enqueue(queue, softmaxErrorKernel, size, { outputError });
 
 		if (error != CL_SUCCESS)
 		{
@@ -429,14 +638,29 @@ private:
 
 	cl_mem targetBuffer;
 
+	// results of the classify kernel
+	cl_mem classifyBuffer;
+
+	// per sample loss used by test()
+	cl_mem errorBuffer;
+
 	// outputs of each layer
 	std::vector<cl_mem> layerOutputs;
 
 	// error of each layer output during backpropagation
 	std::vector<cl_mem> layerError;
 
+	// state each layer saves in its training forward pass, NULL if none (see Layer::getTrainingStateSize)
+	std::vector<cl_mem> layerStates;
+
+	// true for layers that apply the activation after them (see Layer::cl_fuseActivation)
+	std::vector<bool> fused;
+
 	std::vector<uint32_t> paramOffsets;
 
+	// start of each layer's block in parameterCache, from the second layer on
+	std::vector<uint32_t> cacheOffsets;
+
 	// outputs of final layer
 	Tensor<> outputs;
 
@@ -449,6 +673,9 @@ private:
 	// data used by optimiser (e.g. derivatives)
 	cl_mem derivatives;
 
+	// copies of the parameters in the layouts the layers prefer (see Layer::cl_getParameterCacheSize)
+	cl_mem parameterCache;
+
 	cl_command_queue queue;
 
 	cl_context context;
@@ -5,6 +5,9 @@
 #include "../utils/utils.hpp"
 #include "losses/loss.hpp"
 #include "impl.hpp"
+#include "thread_pool.hpp"
+#include "memory_plan.hpp"
+#include "math/gemm.hpp"
 
 namespace nn
 {
@@ -17,19 +20,40 @@ public:
 
 	bool init() final
 	{
-		size_t totalOutputs = 0;
 		size_t parameterCount = 0;
 
 		for (const auto& layer : config->layers)
 		{
-			totalOutputs += layer->getOutputSize();
 			parameterCount += layer->getParameterCount();
 		}
 
-		layerOutputs = Tensor<>(totalOutputs);
-		layerError = Tensor<>(totalOutputs);
+		frozen = config->inferenceOnly;
 		parameters = Tensor<>(parameterCount);
-		optimizerData = Tensor<>(parameterCount);
+
+		if (!frozen)
+		{
+			optimizerData = Tensor<>(parameterCount);
+		}
+
+		allocateParameterCache();
+
+		inferencePlan = MemoryPlan(config->layers, false);
+		trainingPlan = MemoryPlan(config->layers, true);
+
+		// Each thread gets its own activation arena, big enough for either plan at the maximum
+		// batch size. The first thread accumulates derivatives straight into optimizerData.
+		threadPool = make_unique<ThreadPool>(config->threadCount);
+		workspaces.resize(config->threadCount);
+
+		for (size_t i = 0; i < workspaces.size(); ++i)
+		{
+			workspaces[i].arena = Tensor<>(getArenaSize());
+
+			if (!frozen)
+			{
+				workspaces[i].derivatives = i == 0 ? optimizerData : Tensor<>(parameterCount);
+			}
+		}
 
 		float* layerParams = parameters.data();
 		for (const auto& layer : config->layers)
@@ -38,51 +62,96 @@ public:
 			layerParams += layer->getParameterCount();
 		}
 
-		if (config->optimizer)
+		if (frozen)
+		{
+			foldLayers();
+		}
+
+		updateParameterCache();
+
+		if (config->optimizer && !frozen)
 		{
 			config->optimizer->init(parameters.data(), parameterCount);
 		}
 		return true;
 	}
 
-	Tensor<> forward(const ConstTensor<>& input, size_t inputCount) final
+	void freeze() final
 	{
-		const size_t outputSize = config->layers.back()->getOutputSize();
-		const size_t inputSize = config->inputShape.size();
-		const size_t requiredSize = inputCount * outputSize;
+		if (frozen)
+		{
+			return;
+		}
 
-		outputs = Tensor<>(requiredSize);
+		frozen = true;
+		optimizerData = Tensor<>();
+		foldLayers();
 
-		float* layerOutput = outputs.data();
-		const float* layerInput = input.data();
+		// Keep only the caches forward passes use
+		allocateParameterCache();
+		updateParameterCache();
 
-		for (size_t i = 0; i < inputCount; ++i)
+		// Only the inference plan is needed from now on
+		for (auto& workspace : workspaces)
 		{
-			forward(config->layers, layerInput, parameters.data(), layerOutputs.data(), layerOutput);
-			layerInput += inputSize;
-			layerOutput += outputSize;
+			workspace.arena = Tensor<>(getArenaSize());
+			workspace.derivatives = Tensor<>();
 		}
 
+		if (config->optimizer)
+		{
+			config->optimizer->release();
+		}
+	}
+
+	Tensor<> forward(const ConstTensor<>& input, size_t inputCount) final
+	{
+		outputs = Tensor<>(inputCount * config->layers.back()->getOutputSize());
+		forward(input, inputCount, outputs.data());
 		return outputs;
 	}
 
 	Tensor<1, uint32_t> clasify(const ConstTensor<>& input, size_t inputCount) final
+	{
+		classifications = Tensor<1, uint32_t>(inputCount);
+		clasify(input, inputCount, classifications.data());
+		return classifications;
+	}
+
+	void forward(const ConstTensor<>& input, size_t inputCount, float* output) final
 	{
 		const size_t outputSize = config->layers.back()->getOutputSize();
 		const size_t inputSize = config->inputShape.size();
 
-		classifications = Tensor<1, uint32_t>(inputCount);
+		// The final layer writes straight into output
+		forEachChunk(inputCount, [&](size_t first, size_t batchSize, Workspace& workspace)
+		{
+			forward(input.data() + first * inputSize, inferencePlan, workspace.arena.data(), output + first * outputSize, batchSize);
+		});
+	}
 
-		float* networkOutput = layerOutputs.data(-ptrdiff_t(outputSize));
-		const float* layerInput = input.data();
+	void clasify(const ConstTensor<>& input, size_t inputCount, uint32_t* output) final
+	{
+		const size_t outputSize = config->layers.back()->getOutputSize();
+		const size_t inputSize = config->inputShape.size();
 
-		for (size_t i = 0; i < inputCount; ++i)
+		forEachChunk(inputCount, [&](size_t first, size_t batchSize, Workspace& workspace)
 		{
-			forward(config->layers, layerInput, parameters.data(), layerOutputs.data(), networkOutput);
-			classifications[i] = argMax(networkOutput, outputSize);
-		}
+			float* networkOutput = getNetworkOutput(inferencePlan, workspace.arena.data(), batchSize);
+			forward(input.data() + first * inputSize, inferencePlan, workspace.arena.data(), networkOutput, batchSize);
 
-		return classifications;
+			for (size_t j = 0; j < batchSize; ++j)
+			{
+				output[first + j] = uint32_t(argMax(networkOutput + j * outputSize, outputSize));
+			}
+		});
+	}
+
+	void reserve(size_t inputCount) final
+	{
+		// All host scratch is allocated up front in init(). Pick the kernels now so the first
+		// call does not pay for it.
+		math::kernels();
 	}
 
 	double test(const ConstTensor<>& input, const Tensor<1, const uint32_t>& targets, size_t inputCount) final
@@ -98,22 +167,35 @@ public:
 	template<typename T>
 	double testCommon(const ConstTensor<>& input, const Tensor<1, const T>& targets, size_t inputCount)
 	{
-		double loss = 0.0;
-
 		const size_t outputSize = config->layers.back()->getOutputSize();
 		const size_t inputSize = config->inputShape.size();
 		const size_t targetSize = getTargetSize<T>();
 
-		float* networkOutput = layerOutputs.data(-ptrdiff_t(outputSize));
-		const float* layerInput = input.data();
-		const T* target = targets.data();
+		for (auto& workspace : workspaces)
+		{
+			workspace.loss = 0.0;
+		}
 
-		for (size_t i = 0; i < inputCount; ++i)
+		forEachChunk(inputCount, [&](size_t first, size_t batchSize, Workspace& workspace)
 		{
-			forward(config->layers, layerInput, parameters.data(), layerOutputs.data(), networkOutput);
-			loss += calculateLoss(networkOutput, target, outputSize);
-			layerInput += inputSize;
-			target += targetSize;
+			float* networkOutput = getNetworkOutput(inferencePlan, workspace.arena.data(), batchSize);
+			forward(input.data() + first * inputSize, inferencePlan, workspace.arena.data(), networkOutput, batchSize);
+
+			const T* target = targets.data() + first * targetSize;
+
+			for (size_t j = 0; j < batchSize; ++j)
+			{
+				workspace.loss += calculateLoss(networkOutput + j * outputSize, target, outputSize);
+				target += targetSize;
+			}
+		});
+
+		// Sum the partial results in a fixed order so the result does not depend on scheduling
+		double loss = 0.0;
+
+		for (const auto& workspace : workspaces)
+		{
+			loss += workspace.loss;
 		}
 
 		return loss / double(inputCount);
@@ -130,16 +212,50 @@ public:
 	}
 
 private:
-	using Layers = vector<unique_ptr<layer::Layer>>;
+	struct Workspace
+	{
+		// layer outputs and errors, laid out by inferencePlan or trainingPlan
+		Tensor<> arena;
+
+		// derivatives accumulated by this thread during a batch
+		Tensor<> derivatives;
+
+		// loss (or number of correct classifications) summed by this thread during test
+		double loss;
+	};
+
+	// Splits [0, count) samples into one contiguous range per thread and calls
+	// function(first, batchSize, workspace) for each chunk of at most maxBatchSize samples.
+	template<typename F>
+	void forEachChunk(size_t count, const F& function)
+	{
+		threadPool->run([&](size_t threadIndex)
+		{
+			Workspace& workspace = workspaces[threadIndex];
+			size_t first, last;
+			ThreadPool::getRange(count, threadIndex, workspaces.size(), first, last);
+
+			while (first < last)
+			{
+				const size_t batchSize = std::min(maxBatchSize, last - first);
+				function(first, batchSize, workspace);
+				first += batchSize;
+			}
+		});
+	}
 
 	template<typename T>
 	void trainCommon(const ConstTensor<>& inputs, const Tensor<1, const T>& targets, size_t inputCount, size_t batchSize, size_t epochs)
 	{
-		float* derivatives = this->optimizerData.data();
-
 		const size_t inputSize = config->inputShape.size();
 		const size_t targetSize = getTargetSize<T>();
 
+		if (config->asyncTraining)
+		{
+			trainAsync(inputs, targets, inputCount, batchSize, epochs);
+			return;
+		}
+
 		for (size_t e = 0; e < epochs; ++e)
 		{
 			const T* target = targets.data();
@@ -151,76 +267,268 @@ private:
 				size_t batchSize = batchEnd - i;
 				config->optimizer->beginBatch(optimizerData.data());
 
-				for (; i < batchEnd; ++i)
+				// Split the mini-batch between threads
+				threadPool->run([&](size_t threadIndex)
 				{
-					train(input, target);
-					input += inputSize;
-					target += targetSize;
-				}
+					Workspace& workspace = workspaces[threadIndex];
+					size_t first, last;
+					ThreadPool::getRange(batchSize, threadIndex, workspaces.size(), first, last);
+
+					if (threadIndex > 0)
+					{
+						memset(workspace.derivatives.data(), 0, workspace.derivatives.size() * sizeof(float));
+					}
+
+					// Ranges larger than the scratch buffers are processed in chunks
+					while (first < last)
+					{
+						const size_t chunkSize = std::min(maxBatchSize, last - first);
+						train(input + first * inputSize, target + first * targetSize, chunkSize, workspace);
+						first += chunkSize;
+					}
+				});
+
+				reduceDerivatives();
 
 				config->optimizer->update(parameters.data(), optimizerData.data(), batchSize);
+				updateParameterCache();
+
+				input += inputSize * batchSize;
+				target += targetSize * batchSize;
+				i = batchEnd;
+			}
+		}
+	}
+
+	// Hogwild style training. Each thread works through its own range of samples and applies
+	// its mini-batch updates straight to the shared parameters without waiting for the others.
+	// Reads and writes of parameters race; stale or partially applied updates are tolerated
+	// in exchange for never synchronising between batches. Layers read the parameters directly,
+	// there are no parameter caches to rebuild (see getParameterCacheSize).
+	template<typename T>
+	void trainAsync(const ConstTensor<>& inputs, const Tensor<1, const T>& targets, size_t inputCount, size_t batchSize, size_t epochs)
+	{
+		const size_t inputSize = config->inputShape.size();
+		const size_t targetSize = getTargetSize<T>();
+
+		for (size_t e = 0; e < epochs; ++e)
+		{
+			threadPool->run([&](size_t threadIndex)
+			{
+				Workspace& workspace = workspaces[threadIndex];
+				size_t first, last;
+				ThreadPool::getRange(inputCount, threadIndex, workspaces.size(), first, last);
+
+				while (first < last)
+				{
+					const size_t batchEnd = std::min(first + batchSize, last);
+					config->optimizer->beginBatch(workspace.derivatives.data());
+
+					for (size_t i = first; i < batchEnd;)
+					{
+						const size_t chunkSize = std::min(maxBatchSize, batchEnd - i);
+						train(inputs.data() + i * inputSize, targets.data() + i * targetSize, chunkSize, workspace);
+						i += chunkSize;
+					}
+
+					config->optimizer->update(parameters.data(), workspace.derivatives.data(), batchEnd - first);
+					first = batchEnd;
+				}
+			});
+		}
+	}
+
+	// Lets layers that are linear at inference time fold themselves into the layer before
+	void foldLayers()
+	{
+		float* layerParams = parameters.data();
+
+		for (size_t i = 1; i < config->layers.size(); ++i)
+		{
+			const auto& previous = config->layers[i - 1];
+			float* params = layerParams + previous->getParameterCount();
+
+			if (!previous->isFolded())
+			{
+				config->layers[i]->foldInto(*previous, layerParams, params);
 			}
+
+			layerParams = params;
 		}
 	}
 
-	void forward(const Layers& layers,
-				 const float* input,
-				 const float* parameters,
-				 float* layerOutputs,
-				 float* output) const
+	// Rebuilds each layer's copy of its parameters after they have changed
+	void updateParameterCache()
+	{
+		const float* layerParams = parameters.data();
+
+		for (size_t i = 0; i < config->layers.size(); ++i)
+		{
+			const auto& layer = config->layers[i];
+
+			if (float* cache = getParameterCache(i))
+			{
+				layer->updateParameterCache(layerParams, cache);
+			}
+
+			layerParams += layer->getParameterCount();
+		}
+	}
+
+	// Size of layer i's parameter cache. Frozen networks only keep the caches forward passes use.
+	// Asynchronous training updates the parameters after every thread's mini-batch, so until the
+	// network is frozen its layers go without caches rather than rebuilding them that often.
+	size_t getParameterCacheSize(size_t i) const
+	{
+		const auto& layer = config->layers[i];
+
+		if (!frozen && config->asyncTraining)
+		{
+			return 0;
+		}
+
+		return !frozen || layer->isParameterCacheUsedForward() ? layer->getParameterCacheSize() : 0;
+	}
+
+	void allocateParameterCache()
+	{
+		size_t cacheSize = 0;
+		cacheOffsets.clear();
+
+		for (size_t i = 0; i < config->layers.size(); ++i)
+		{
+			cacheOffsets.push_back(cacheSize);
+			cacheSize += getParameterCacheSize(i);
+		}
+
+		parameterCache = cacheSize > 0 ? Tensor<>(cacheSize) : Tensor<>();
+	}
+
+	// Sums the derivatives of all threads into optimizerData. Each thread reduces one slice of the parameters.
+	void reduceDerivatives()
+	{
+		if (workspaces.size() == 1)
+		{
+			return;
+		}
+
+		threadPool->run([this](size_t threadIndex)
+		{
+			size_t first, last;
+			ThreadPool::getRange(optimizerData.size(), threadIndex, workspaces.size(), first, last);
+
+			for (size_t i = 1; i < workspaces.size(); ++i)
+			{
+				math::axpy(1.f, workspaces[i].derivatives.data() + first, optimizerData.data() + first, last - first);
+			}
+		});
+	}
+
+	// Layer i's parameter cache, or nullptr if it has none
+	const float* getParameterCache(size_t i) const
 	{
+		return getParameterCacheSize(i) > 0 ? parameterCache.data() + cacheOffsets[i] : nullptr;
+	}
+
+	float* getParameterCache(size_t i)
+	{
+		return const_cast<float*>(static_cast<const HostImpl*>(this)->getParameterCache(i));
+	}
+
+	// Floats needed per workspace arena. The training plan is only needed until the network is frozen.
+	size_t getArenaSize() const
+	{
+		const size_t size = frozen ? inferencePlan.getSize() : std::max(inferencePlan.getSize(), trainingPlan.getSize());
+		return size * maxBatchSize;
+	}
+
+	// Start of the final layer's output in an arena for a given batch size
+	float* getNetworkOutput(const MemoryPlan& plan, float* arena, size_t batchSize) const
+	{
+		return arena + plan.getOutputOffset(config->layers.size() - 1) * batchSize;
+	}
+
+	// training must only be set with the training plan
+	void forward(const float* input,
+				 const MemoryPlan& plan,
+				 float* arena,
+				 float* output,
+				 size_t batchSize,
+				 bool training = false) const
+	{
+		const auto& layers = config->layers;
 		const size_t layerCount = layers.size();
 		const float* layerInput = input;
-		const float* layerParams = parameters;
-		float* layerOutput = layerOutputs;
+		const float* layerParams = parameters.data();
 
-		for (size_t i = 0; i < layerCount - 1; ++i)
+		// Folded layers are skipped, so the last one that is not writes the output
+		size_t last = layerCount - 1;
+
+		while (!training && layers[last]->isFolded())
+		{
+			--last;
+		}
+
+		for (size_t i = 0; i < layerCount; ++i)
 		{
-			layers[i]->forward(layerInput, layerParams, layerOutput);
+			if (!training && layers[i]->isFolded())
+			{
+				layerParams += layers[i]->getParameterCount();
+				continue;
+			}
+
+			float* layerOutput = i < last ? arena + plan.getOutputOffset(i) * batchSize : output;
+
+			if (training)
+			{
+				float* state = arena + plan.getStateOffset(i) * batchSize;
+				layers[i]->forwardTrainingBatch(layerInput, layerParams, layerOutput, state, batchSize, getParameterCache(i));
+			}
+			else
+			{
+				layers[i]->forwardBatch(layerInput, layerParams, layerOutput, batchSize, getParameterCache(i));
+			}
+
 			layerInput = layerOutput;
-			layerOutput += layers[i]->getOutputSize();
 			layerParams += layers[i]->getParameterCount();
 		}
-
-		layers.back()->forward(layerInput, layerParams, output);
 	}
 
 	template<typename T>
-	void train(const float* input, T target)
+	void train(const float* input, const T* target, size_t batchSize, Workspace& workspace)
 	{
-		size_t outputSize = config->outputShape.size();
+		const size_t outputSize = config->outputShape.size();
+		const size_t layerCount = config->layers.size();
+		float* arena = workspace.arena.data();
+		float* networkOutput = getNetworkOutput(trainingPlan, arena, batchSize);
 
-		forward(config->layers,
-				input,
-				parameters.data(),
-				layerOutputs.data(),
-				layerOutputs.data(-(ptrdiff_t)outputSize));
+		forward(input, trainingPlan, arena, networkOutput, batchSize, true);
 
-		const size_t layerCount = config->layers.size();
-		const size_t layerParamCount = config->layers.back()->getParameterCount();
-		float* outputError = layerError.data(-(ptrdiff_t)outputSize);
+		float* outputError = arena + trainingPlan.getErrorOffset(layerCount - 1) * batchSize;
 
 		layer::Layer::BackPropData data;
 		data.params = parameters.end();
-		data.output = layerOutputs.data(-(ptrdiff_t)outputSize);
+		data.output = networkOutput;
 		data.outputError = outputError;
 
-		calculateOutputDerivatives(data.output, target, outputSize, outputError);
+		calculateOutputDerivatives(data.output, target, outputSize, outputError, batchSize);
 
-		float* derivatives = optimizerData.data() + parameters.size();
-		const float* layerParams = parameters.data(config->layers.back()->getParameterCount());
+		float* derivatives = workspace.derivatives.end();
 
 		for (size_t i = layerCount - 1; i > 0; --i)
 		{
 			layer::Layer& layer = *config->layers[i];
 
-			float* inputError = outputError - layer.getInputSize();
-			data.input = data.output - layer.getInputSize();
+			float* inputError = arena + trainingPlan.getErrorOffset(i - 1) * batchSize;
+			data.input = arena + trainingPlan.getOutputOffset(i - 1) * batchSize;
 			data.params -= layer.getParameterCount();
+			data.cache = getParameterCache(i);
+			data.state = arena + trainingPlan.getStateOffset(i) * batchSize;
 			derivatives -= layer.getParameterCount();
 
-			layer.backPropagate(data, inputError);
-			layer.calculateDerivatives(data, derivatives);
+			// In-place layers may overwrite outputError with inputError
+			layer.calculateDerivativesBatch(data, derivatives, batchSize);
+			layer.backPropagateBatch(data, inputError, batchSize);
 
 			outputError = inputError;
 			data.outputError = outputError;
@@ -228,20 +536,36 @@ private:
 		}
 
 		data.input = input;
+		data.cache = getParameterCache(0);
+		data.state = arena + trainingPlan.getStateOffset(0) * batchSize;
 		data.params -= config->layers[0]->getParameterCount();
 		derivatives -= config->layers[0]->getParameterCount();
-		config->layers[0]->calculateDerivatives(data, derivatives);
+		config->layers[0]->calculateDerivativesBatch(data, derivatives, batchSize);
 	}
 
-	void calculateOutputDerivatives(const float* output, const uint32_t* target, size_t outputSize, float* outputError) const
+	void calculateOutputDerivatives(const float* output, const uint32_t* target, size_t outputSize, float* outputError, size_t batchSize) const
 	{
-		memcpy(outputError, output, outputSize * sizeof(float));
-		outputError[*target] -= 1.0f;
+		if (config->lossFunc && config->lossFunc->supportsLabels())
+		{
+			config->lossFunc->calculateLabelDerivatives(output, target, outputError, batchSize, outputSize);
+			return;
+		}
+
+		memcpy(outputError, output, batchSize * outputSize * sizeof(float));
+
+		for (size_t i = 0; i < batchSize; ++i)
+		{
+			outputError[i * outputSize + target[i]] -= 1.0f;
+		}
 	}
 
-	void calculateOutputDerivatives(const float* output, const float* target, size_t outputSize, float* outputError) const
+	// One row at a time as losses such as softmax cross entropy work on whole rows
+	void calculateOutputDerivatives(const float* output, const float* target, size_t outputSize, float* outputError, size_t batchSize) const
 	{
-		return config->lossFunc->calculateDerivatives(output, target, outputError, outputSize);
+		for (size_t i = 0; i < batchSize; ++i)
+		{
+			config->lossFunc->calculateDerivatives(output + i * outputSize, target + i * outputSize, outputError + i * outputSize, outputSize);
+		}
 	}
 
 	auto calculateLoss(const float* output, const uint32_t* target, size_t outputSize) const
@@ -258,12 +582,6 @@ private:
 
 	template<> size_t getTargetSize<uint32_t>() { return 1; }
 
-	// outputs of each layer
-	Tensor<> layerOutputs;
-
-	// error of each layer output during backpropagation
-	Tensor<> layerError;
-
 	// outputs of final layer
 	Tensor<> outputs;
 
@@ -275,5 +593,25 @@ private:
 
 	// data used by optimiser (e.g. derivatives)
 	Tensor<> optimizerData;
+
+	// copies of the parameters in the layouts the layers prefer (see Layer::getParameterCacheSize)
+	Tensor<> parameterCache;
+
+	// start of each layer's block in parameterCache
+	vector<size_t> cacheOffsets;
+
+	// where layer outputs live in each workspace arena for forward only passes
+	MemoryPlan inferencePlan;
+
+	// where layer outputs and errors live in each workspace arena during training
+	MemoryPlan trainingPlan;
+
+	// scratch memory for each thread
+	vector<Workspace> workspaces;
+
+	unique_ptr<ThreadPool> threadPool;
+
+	// number of samples pushed through the layers at once
+	static const size_t maxBatchSize = 128;
 };
 }
\ No newline at end of file
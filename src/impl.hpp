@@ -16,6 +16,14 @@ public:
 
 	virtual Tensor<1, uint32_t> clasify(const ConstTensor<>& input, size_t inputCount) = 0;
 
+	// Same as above but write into caller owned memory
+	virtual void forward(const ConstTensor<>& input, size_t inputCount, float* output) = 0;
+
+	virtual void clasify(const ConstTensor<>& input, size_t inputCount, uint32_t* output) = 0;
+
+	// Preallocate all scratch memory needed to run up to inputCount samples at once
+	virtual void reserve(size_t inputCount) = 0;
+
 	virtual double test(const ConstTensor<>& input, const Tensor<1, const float>& targets, size_t inputCount) = 0;
 
 	virtual double test(const ConstTensor<> & input, const Tensor<1, const uint32_t> & targets, size_t inputCount) = 0;
@@ -24,14 +32,24 @@ public:
 
 	virtual void train(const ConstTensor<>& inputs, const Tensor<1, const uint32_t>& targets, size_t inputCount, size_t batchSize, size_t epochs) = 0;
 
+	// Release everything that is only needed for training
+	virtual void freeze() = 0;
+
+	bool isFrozen() const
+	{
+		return frozen;
+	}
+
 	const NetworkConfig& getConfig() const
 	{
 		return *config;
 	}
 
 protected:
-	Impl(unique_ptr<const NetworkConfig>&& config) : config(move(config)) {}
+	Impl(unique_ptr<const NetworkConfig>&& config) : config(move(config)), frozen(false) {}
 
 	unique_ptr<const NetworkConfig> config;
+
+	bool frozen;
 };
 }
\ No newline at end of file
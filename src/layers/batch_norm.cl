@@ -0,0 +1,191 @@
+#define MAX_WORKGROUP_SIZE (256)
+
+// CHANNELS and SPATIAL_SIZE are set by layer::BatchNorm when the program is built. Each sample
+// is CHANNELS blocks of SPATIAL_SIZE values, and
+// statistics holds channels running means followed by channels running variances.
+//
+// Apart from forward every kernel runs one work group per channel, which loops over the whole
+// batch and reduces in local memory, so no partial sums need a second pass.
+
+inline float reduceSum(__local float* temp, float value)
+{
+	const uint lid = get_local_id(0);
+	temp[lid] = value;
+
+	for (uint i = get_local_size(0) / 2; i > 0; i /= 2)
+	{
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lid < i)
+		{
+			temp[lid] += temp[lid + i];
+		}
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+	const float result = temp[0];
+
+	// temp is reused by the next reduction
+	barrier(CLK_LOCAL_MEM_FENCE);
+	return result;
+}
+
+// Index within the batch of the i'th element of channel c
+inline uint channelIndex(const uint c, const uint i)
+{
+	const uint sample = i / SPATIAL_SIZE;
+	return (sample * CHANNELS + c) * SPATIAL_SIZE + i - sample * SPATIAL_SIZE;
+}
+
+__kernel void forward(__global const float* input,
+					  __global float* output,
+					  __global const float* params,
+					  __global const float* statistics,
+					  const uint inputOffset,
+					  const uint outputOffset,
+					  const uint paramOffset,
+					  const uint size,			// batch size * input size
+					  const float epsilon)
+{
+	input += inputOffset;
+	output += outputOffset;
+	params += paramOffset;
+	uint gid = get_global_id(0);
+	uint stride = get_global_size(0);
+
+	for (uint i = gid; i < size; i += stride)
+	{
+		const uint c = i / SPATIAL_SIZE % CHANNELS;
+		const float scale = params[c] * rsqrt(statistics[CHANNELS + c] + epsilon);
+		output[i] = (input[i] - statistics[c]) * scale + params[CHANNELS + c];
+	}
+}
+
+// Writes the normalized inputs followed by the inverse standard deviation of each channel to
+// state, which is all backPropagate and calculateDerivatives need
+__kernel void forwardTraining(__global const float* input,
+							  __global float* output,
+							  __global const float* params,
+							  __global float* statistics,
+							  __global float* state,
+							  const uint inputOffset,
+							  const uint outputOffset,
+							  const uint paramOffset,
+							  const uint batchSize,
+							  const float epsilon,
+							  const float momentum)
+{
+	__local float temp[MAX_WORKGROUP_SIZE];
+	input += inputOffset;
+	output += outputOffset;
+	params += paramOffset;
+	const uint c = get_group_id(0);
+	const uint lid = get_local_id(0);
+	const uint stride = get_local_size(0);
+	const uint count = batchSize * SPATIAL_SIZE;
+	float sum = 0.f;
+
+	for (uint i = lid; i < count; i += stride)
+	{
+		sum += input[channelIndex(c, i)];
+	}
+
+	const float mean = reduceSum(temp, sum) / count;
+	sum = 0.f;
+
+	for (uint i = lid; i < count; i += stride)
+	{
+		const float x = input[channelIndex(c, i)] - mean;
+		sum += x * x;
+	}
+
+	const float variance = reduceSum(temp, sum) / count;
+	const float invStd = rsqrt(variance + epsilon);
+	const float gamma = params[c];
+	const float beta = params[CHANNELS + c];
+
+	for (uint i = lid; i < count; i += stride)
+	{
+		const uint index = channelIndex(c, i);
+		const float normalized = (input[index] - mean) * invStd;
+		state[index] = normalized;
+		output[index] = gamma * normalized + beta;
+	}
+
+	if (lid == 0)
+	{
+		const float unbiased = count > 1 ? variance * count / (count - 1) : variance;
+		state[batchSize * CHANNELS * SPATIAL_SIZE + c] = invStd;
+		statistics[c] += momentum * (mean - statistics[c]);
+		statistics[CHANNELS + c] += momentum * (unbiased - statistics[CHANNELS + c]);
+	}
+}
+
+// inputError = gamma * invStd / count * (count * outputError - sum(outputError) - x^ * sum(outputError * x^))
+// The sums are taken before anything is written so inputError may be outputError.
+__kernel void backPropagate(__global const float* outputError,
+							__global const float* state,
+							__global float* inputError,
+							__global const float* params,
+							const uint paramOffset,
+							const uint batchSize)
+{
+	__local float temp[MAX_WORKGROUP_SIZE];
+	params += paramOffset;
+	const uint c = get_group_id(0);
+	const uint lid = get_local_id(0);
+	const uint stride = get_local_size(0);
+	const uint count = batchSize * SPATIAL_SIZE;
+	float sumError = 0.f;
+	float sumErrorNormalized = 0.f;
+
+	for (uint i = lid; i < count; i += stride)
+	{
+		const uint index = channelIndex(c, i);
+		sumError += outputError[index];
+		sumErrorNormalized += outputError[index] * state[index];
+	}
+
+	sumError = reduceSum(temp, sumError);
+	sumErrorNormalized = reduceSum(temp, sumErrorNormalized);
+	const float scale = params[c] * state[batchSize * CHANNELS * SPATIAL_SIZE + c] / count;
+
+	for (uint i = lid; i < count; i += stride)
+	{
+		const uint index = channelIndex(c, i);
+		inputError[index] = scale * (count * outputError[index] - sumError - state[index] * sumErrorNormalized);
+	}
+}
+
+// derivatives holds the gamma derivatives followed by the beta derivatives
+__kernel void calculateDerivatives(__global const float* outputError,
+								   __global const float* state,
+								   __global float* derivatives,
+								   __global const float* params,
+								   const uint paramOffset,
+								   const uint batchSize)
+{
+	__local float temp[MAX_WORKGROUP_SIZE];
+	derivatives += paramOffset;
+	const uint c = get_group_id(0);
+	const uint lid = get_local_id(0);
+	const uint stride = get_local_size(0);
+	const uint count = batchSize * SPATIAL_SIZE;
+	float dGamma = 0.f;
+	float dBeta = 0.f;
+
+	for (uint i = lid; i < count; i += stride)
+	{
+		const uint index = channelIndex(c, i);
+		dGamma += outputError[index] * state[index];
+		dBeta += outputError[index];
+	}
+
+	dGamma = reduceSum(temp, dGamma);
+	dBeta = reduceSum(temp, dBeta);
+
+	if (lid == 0)
+	{
+		derivatives[c] += dGamma;
+		derivatives[CHANNELS + c] += dBeta;
+	}
+}
@@ -0,0 +1,425 @@
+#pragma once
+#include "layer.hpp"
+#include "dense.hpp"
+#include <math.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace nn
+{
+namespace layer
+{
+// Batch normalization. Each channel is normalized by the mean and variance of the batch while
+// training, then scaled and shifted by a learned gamma and beta. Channels are blocks of
+// spatialSize consecutive inputs, so a Dense output has one channel per element and a
+// convolution output has one per filter.
+//
+// Running statistics of the mean and variance are kept for inference. When the network is
+// frozen a batch norm that follows a Dense layer folds its scale and shift into the Dense
+// weights and biases and is skipped from then on.
+//
+// Training uses the statistics of each chunk of at most 128 samples the network processes at
+// once, and the network refuses to train a batch norm on more than one thread.
+//
+// The training state holds the normalized input of every sample followed by the inverse
+// standard deviation of each channel, so backpropagation never reads the input and the layer
+// can run in place.
+class BatchNorm : public Layer
+{
+public:
+	static constexpr float momentum = 0.1f;
+
+	static constexpr float epsilon = 1e-5f;
+
+	BatchNorm(size_t channels, size_t spatialSize = 1) :
+		Layer(channels * spatialSize, channels * spatialSize, 2 * channels),
+		channels(uint32_t(channels)),
+		spatialSize(uint32_t(spatialSize)),
+		runningMean(channels, 0.f),
+		runningVariance(channels, 1.f),
+		folded(false),
+		forwardKernel(NULL),
+		forwardTrainingKernel(NULL),
+		backPropagateKernel(NULL),
+		calculateDerivativesKernel(NULL),
+		runningStatistics(NULL)
+	{
+	}
+
+	~BatchNorm()
+	{
+		if (runningStatistics)
+		{
+			clReleaseMemObject(runningStatistics);
+		}
+	}
+
+	void forward(const float* input, const float* params, float* output) const final
+	{
+		forwardBatch(input, params, output, 1);
+	}
+
+	void backPropagate(const BackPropData& data, float* inputError) const final
+	{
+		backPropagateBatch(data, inputError, 1);
+	}
+
+	void calculateDerivatives(const BackPropData& data, float* derivatives) const final
+	{
+		calculateDerivativesBatch(data, derivatives, 1);
+	}
+
+	bool canRunInPlace() const final { return true; }
+
+	size_t getTrainingStateSize() const final { return inputSize + channels; }
+
+	// Normalizes with the running statistics
+	void forwardBatch(const float* input, const float* params, float* output, size_t batchSize, const float* = nullptr) const final
+	{
+		for (size_t c = 0; c < channels; ++c)
+		{
+			const float scale = getGamma(params)[c] / sqrtf(runningVariance[c] + epsilon);
+			const float shift = getBeta(params)[c] - runningMean[c] * scale;
+
+			for (size_t n = 0; n < batchSize; ++n)
+			{
+				const size_t first = n * inputSize + c * spatialSize;
+
+				for (size_t i = first; i < first + spatialSize; ++i)
+				{
+					output[i] = input[i] * scale + shift;
+				}
+			}
+		}
+	}
+
+	// Normalizes with the statistics of the batch and updates the running statistics
+	void forwardTrainingBatch(const float* input, const float* params, float* output, float* state, size_t batchSize, const float* = nullptr) const final
+	{
+		const size_t count = batchSize * spatialSize;
+		float* normalized = state;
+		float* invStd = state + batchSize * inputSize;
+		std::lock_guard<std::mutex> lock(runningMutex);
+
+		for (size_t c = 0; c < channels; ++c)
+		{
+			float mean = 0.f;
+			float variance = 0.f;
+
+			forEach(c, batchSize, [&](size_t i) { mean += input[i]; });
+			mean /= count;
+			forEach(c, batchSize, [&](size_t i) { variance += (input[i] - mean) * (input[i] - mean); });
+			variance /= count;
+
+			const float gamma = getGamma(params)[c];
+			const float beta = getBeta(params)[c];
+			invStd[c] = 1.f / sqrtf(variance + epsilon);
+
+			forEach(c, batchSize, [&](size_t i)
+			{
+				normalized[i] = (input[i] - mean) * invStd[c];
+				output[i] = gamma * normalized[i] + beta;
+			});
+
+			updateRunningStatistics(c, mean, variance, count);
+		}
+	}
+
+	// dx = gamma * invStd / count * (count * dy - sum(dy) - x^ * sum(dy * x^))
+	void backPropagateBatch(const BackPropData& data, float* inputError, size_t batchSize) const final
+	{
+		const float count = float(batchSize * spatialSize);
+		const float* normalized = data.state;
+		const float* invStd = data.state + batchSize * inputSize;
+		const float* outputError = data.outputError;
+
+		for (size_t c = 0; c < channels; ++c)
+		{
+			float sumError = 0.f;
+			float sumErrorNormalized = 0.f;
+
+			forEach(c, batchSize, [&](size_t i)
+			{
+				sumError += outputError[i];
+				sumErrorNormalized += outputError[i] * normalized[i];
+			});
+
+			const float scale = getGamma(data.params)[c] * invStd[c] / count;
+
+			forEach(c, batchSize, [&](size_t i)
+			{
+				inputError[i] = scale * (count * outputError[i] - sumError - normalized[i] * sumErrorNormalized);
+			});
+		}
+	}
+
+	void calculateDerivativesBatch(const BackPropData& data, float* derivatives, size_t batchSize) const final
+	{
+		const float* normalized = data.state;
+		const float* outputError = data.outputError;
+
+		for (size_t c = 0; c < channels; ++c)
+		{
+			float dGamma = 0.f;
+			float dBeta = 0.f;
+
+			forEach(c, batchSize, [&](size_t i)
+			{
+				dGamma += outputError[i] * normalized[i];
+				dBeta += outputError[i];
+			});
+
+			getGamma(derivatives)[c] += dGamma;
+			getBeta(derivatives)[c] += dBeta;
+		}
+	}
+
+	void initializeParameters(float* params) const final
+	{
+		std::fill_n(getGamma(params), channels, 1.f);
+		std::fill_n(getBeta(params), channels, 0.f);
+	}
+
+	// previousParams = previousParams * scale (+ shift for the biases), one scale per Dense output.
+	// Folding is applied once, later calls leave the parameters alone and return false.
+	bool foldInto(const Layer& previous, float* previousParams, const float* params) final
+	{
+		const Dense* dense = dynamic_cast<const Dense*>(&previous);
+
+		if (folded || !dense || spatialSize != 1 || dense->getOutputSize() != inputSize)
+		{
+			return false;
+		}
+
+		float* bias = dense->getBiases(previousParams);
+		float* weight = dense->getWeights(previousParams);
+		const size_t rowSize = dense->getInputSize();
+
+		for (size_t c = 0; c < channels; ++c)
+		{
+			const float scale = getGamma(params)[c] / sqrtf(runningVariance[c] + epsilon);
+			const float shift = getBeta(params)[c] - runningMean[c] * scale;
+
+			for (size_t j = 0; j < rowSize; ++j)
+			{
+				weight[c * rowSize + j] *= scale;
+			}
+
+			bias[c] = bias[c] * scale + shift;
+		}
+
+		folded = true;
+		return true;
+	}
+
+	bool isFolded() const final { return folded; }
+
+	void cl_forward(cl_command_queue queue, cl_mem input, cl_mem params, cl_mem output, uint32_t inOffset, uint32_t outOffset, uint32_t paramOffset, uint32_t batchSize) const final
+	{
+		uint32_t size = batchSize * inputSize;
+
+		int error;
+		error = clSetKernelArg(forwardKernel, 0, sizeof(cl_mem), &input);
+		error |= clSetKernelArg(forwardKernel, 1, sizeof(cl_mem), &output);
+		error |= clSetKernelArg(forwardKernel, 2, sizeof(cl_mem), &params);
+		error |= clSetKernelArg(forwardKernel, 3, sizeof(cl_mem), &runningStatistics);
+		error |= clSetKernelArg(forwardKernel, 4, sizeof(inOffset), &inOffset);
+		error |= clSetKernelArg(forwardKernel, 5, sizeof(outOffset), &outOffset);
+		error |= clSetKernelArg(forwardKernel, 6, sizeof(paramOffset), &paramOffset);
+		error |= clSetKernelArg(forwardKernel, 7, sizeof(size), &size);
+		error |= clSetKernelArg(forwardKernel, 8, sizeof(epsilon), &epsilon);
+		error |= cl::enqueue(queue, forwardKernel, size, { output });
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::batchNorm::cl_forward()");
+		}
+	}
+
+	// One work group per channel
+	void cl_forwardTraining(cl_command_queue queue, cl_mem input, cl_mem params, cl_mem output, cl_mem state, uint32_t inOffset, uint32_t outOffset, uint32_t paramOffset, uint32_t batchSize) const final
+	{
+		int error;
+		error = clSetKernelArg(forwardTrainingKernel, 0, sizeof(cl_mem), &input);
+		error |= clSetKernelArg(forwardTrainingKernel, 1, sizeof(cl_mem), &output);
+		error |= clSetKernelArg(forwardTrainingKernel, 2, sizeof(cl_mem), &params);
+		error |= clSetKernelArg(forwardTrainingKernel, 3, sizeof(cl_mem), &runningStatistics);
+		error |= clSetKernelArg(forwardTrainingKernel, 4, sizeof(cl_mem), &state);
+		error |= clSetKernelArg(forwardTrainingKernel, 5, sizeof(inOffset), &inOffset);
+		error |= clSetKernelArg(forwardTrainingKernel, 6, sizeof(outOffset), &outOffset);
+		error |= clSetKernelArg(forwardTrainingKernel, 7, sizeof(paramOffset), &paramOffset);
+		error |= clSetKernelArg(forwardTrainingKernel, 8, sizeof(batchSize), &batchSize);
+		error |= clSetKernelArg(forwardTrainingKernel, 9, sizeof(epsilon), &epsilon);
+		error |= clSetKernelArg(forwardTrainingKernel, 10, sizeof(momentum), &momentum);
+		error |= cl::enqueueGroups(queue, forwardTrainingKernel, channels, batchSize * spatialSize, { output, runningStatistics, state });
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::batchNorm::cl_forwardTraining()");
+		}
+	}
+
+	void cl_backPropagate(cl_command_queue queue, const ClBackPropData& data, cl_mem inputError, uint32_t paramOffset, uint32_t batchSize) const final
+	{
+		cl_perChannel(backPropagateKernel, queue, data, inputError, paramOffset, batchSize);
+	}
+
+	void cl_calculateDerivatives(cl_command_queue queue, const ClBackPropData& data, cl_mem derivatives, uint32_t paramOffset, uint32_t batchSize) const final
+	{
+		cl_perChannel(calculateDerivativesKernel, queue, data, derivatives, paramOffset, batchSize);
+	}
+
+	// gamma = 1 and beta = 0, running mean 0 and variance 1
+	void cl_initializeParameters(cl_command_queue queue, cl_mem params, uint32_t offset) const final
+	{
+		std::vector<float> values(2 * channels);
+		initializeParameters(values.data());
+
+		int error;
+		error = clEnqueueWriteBuffer(queue, params, CL_TRUE, offset * sizeof(float), values.size() * sizeof(float), values.data(), 0, NULL, NULL);
+
+		std::copy(runningMean.begin(), runningMean.end(), values.begin());
+		std::copy(runningVariance.begin(), runningVariance.end(), values.begin() + channels);
+		error |= clEnqueueWriteBuffer(queue, runningStatistics, CL_TRUE, 0, values.size() * sizeof(float), values.data(), 0, NULL, NULL);
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::batchNorm::cl_initializeParameters()");
+		}
+	}
+
+	// Reads everything back, folds on the host and writes the Dense parameters back
+	bool cl_foldInto(cl_command_queue queue, const Layer& previous, cl_mem params, uint32_t previousOffset, uint32_t offset) final
+	{
+		if (folded)
+		{
+			return false;
+		}
+
+		std::vector<float> previousParams(previous.getParameterCount());
+		std::vector<float> values(2 * channels);
+		std::vector<float> statistics(2 * channels);
+
+		int error;
+		error = clEnqueueReadBuffer(queue, params, CL_TRUE, previousOffset * sizeof(float), previousParams.size() * sizeof(float), previousParams.data(), 0, NULL, NULL);
+		error |= clEnqueueReadBuffer(queue, params, CL_TRUE, offset * sizeof(float), values.size() * sizeof(float), values.data(), 0, NULL, NULL);
+		error |= clEnqueueReadBuffer(queue, runningStatistics, CL_TRUE, 0, statistics.size() * sizeof(float), statistics.data(), 0, NULL, NULL);
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::batchNorm::cl_foldInto()");
+		}
+
+		std::copy(statistics.begin(), statistics.begin() + channels, runningMean.begin());
+		std::copy(statistics.begin() + channels, statistics.end(), runningVariance.begin());
+
+		if (!foldInto(previous, previousParams.data(), values.data()))
+		{
+			return false;
+		}
+
+		error = clEnqueueWriteBuffer(queue, params, CL_TRUE, previousOffset * sizeof(float), previousParams.size() * sizeof(float), previousParams.data(), 0, NULL, NULL);
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::batchNorm::cl_foldInto()");
+		}
+
+		return true;
+	}
+
+	void cl_initKernels(cl_context context, cl_device_id device) final
+	{
+		auto options = cl::defines({ { "CHANNELS", channels }, { "SPATIAL_SIZE", spatialSize } });
+		auto program = cl::buildProgramFromFile(__FILE__, context, device, options);
+
+		int error;
+		forwardKernel = clCreateKernel(program, "forward", &error);
+		forwardTrainingKernel = clCreateKernel(program, "forwardTraining", &error);
+		backPropagateKernel = clCreateKernel(program, "backPropagate", &error);
+		calculateDerivativesKernel = clCreateKernel(program, "calculateDerivatives", &error);
+
+		if (!runningStatistics)
+		{
+			runningStatistics = clCreateBuffer(context, CL_MEM_READ_WRITE, 2 * channels * sizeof(float), NULL, &error);
+		}
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error while creating kernel(s) for layer::batchNorm.");
+		}
+	}
+
+	const std::vector<float>& getRunningMean() const { return runningMean; }
+	const std::vector<float>& getRunningVariance() const { return runningVariance; }
+
+	// channels gammas followed by channels betas
+	const float* getGamma(const float* parameters) const { return parameters; }
+	float* getGamma(float* parameters)       const { return parameters; }
+	const float* getBeta(const float* parameters) const { return parameters + channels; }
+	float* getBeta(float* parameters)       const { return parameters + channels; }
+
+private:
+	// Calls f with the index of every element of channel c in the batch
+	template<typename F>
+	void forEach(size_t c, size_t batchSize, F f) const
+	{
+		for (size_t n = 0; n < batchSize; ++n)
+		{
+			const size_t first = n * inputSize + c * spatialSize;
+
+			for (size_t i = first; i < first + spatialSize; ++i)
+			{
+				f(i);
+			}
+		}
+	}
+
+	// The running variance is the unbiased estimate
+	void updateRunningStatistics(size_t c, float mean, float variance, size_t count) const
+	{
+		const float unbiased = count > 1 ? variance * count / (count - 1) : variance;
+		runningMean[c] += momentum * (mean - runningMean[c]);
+		runningVariance[c] += momentum * (unbiased - runningVariance[c]);
+	}
+
+	void cl_perChannel(cl_kernel kernel, cl_command_queue queue, const ClBackPropData& data, cl_mem result, uint32_t paramOffset, uint32_t batchSize) const
+	{
+		int error;
+		error = clSetKernelArg(kernel, 0, sizeof(cl_mem), &data.outputError);
+		error |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &data.state);
+		error |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &result);
+		error |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &data.params);
+		error |= clSetKernelArg(kernel, 4, sizeof(paramOffset), &paramOffset);
+		error |= clSetKernelArg(kernel, 5, sizeof(batchSize), &batchSize);
+		error |= cl::enqueueGroups(queue, kernel, channels, batchSize * spatialSize, { result });
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::batchNorm::cl_backPropagate()");
+		}
+	}
+
+	const uint32_t channels;
+	const uint32_t spatialSize;
+
+	mutable std::vector<float> runningMean;
+	mutable std::vector<float> runningVariance;
+	mutable std::mutex runningMutex;
+
+	bool folded;
+
+	cl_kernel forwardKernel;
+
+	cl_kernel forwardTrainingKernel;
+
+	cl_kernel backPropagateKernel;
+
+	cl_kernel calculateDerivativesKernel;
+
+	// channels means followed by channels variances
+	cl_mem runningStatistics;
+};
+}
+}
@@ -0,0 +1,450 @@
+#define MAX_WORKGROUP_SIZE (256)
+
+// Set by layer::Conv2d when the program is built: INPUT_WIDTH, INPUT_HEIGHT, CHANNELS,
+// FILTER_WIDTH, FILTER_HEIGHT, FILTER_COUNT, STEP_X, STEP_Y, OUTPUT_WIDTH, OUTPUT_HEIGHT,
+// CONV_TILE and GEMM_TILE. The loops over the filter have constant bounds and the tiles a fixed size.
+#define PATCH_SIZE (CHANNELS * FILTER_HEIGHT * FILTER_WIDTH)
+#define POSITIONS (OUTPUT_WIDTH * OUTPUT_HEIGHT)
+#define INPUT_TILE_WIDTH ((CONV_TILE - 1) * STEP_X + FILTER_WIDTH)
+#define INPUT_TILE_HEIGHT ((CONV_TILE - 1) * STEP_Y + FILTER_HEIGHT)
+#define ERROR_TILE_WIDTH ((CONV_TILE + FILTER_WIDTH - 2) / STEP_X + 2)
+#define ERROR_TILE_HEIGHT ((CONV_TILE + FILTER_HEIGHT - 2) / STEP_Y + 2)
+
+inline uint updateSeed(uint seed)
+{
+	return seed = 0xa6718293 * seed + 0x638c571f;
+}
+
+inline float fastRand(float min, float max, uint* seed)
+{
+	*seed = updateSeed(*seed);
+	return ((float)((*seed >> 16) & 0x7FFF) / (float)(0x7FFF)) * (max - min) + min;
+}
+
+// One work group per filter
+__kernel void initParams(__global float* params,
+						 const uint paramOffset)
+{
+	params += paramOffset;
+	const uint patchSize = PATCH_SIZE;
+	const float sd = rsqrt((float)patchSize);
+	const size_t stride = get_local_size(0);
+	const size_t lid = get_local_id(0);
+	const size_t wid = get_group_id(0);
+	const size_t filterCount = get_num_groups(0);
+	__global float* weights = params + filterCount + wid * patchSize;
+	uint seed = get_global_id(0);
+
+	for (size_t i = lid; i < patchSize; i += stride)
+	{
+		weights[i] = fastRand(-sd, sd, &seed);
+	}
+
+	if (lid == 0)
+	{
+		params[wid] = 0;
+	}
+}
+
+// Each work group computes a CONV_TILE x CONV_TILE tile of output positions for one filter of
+// one sample. One channel at a time, the filter's weights for it and the patch of input under
+// the tile are staged in local memory so every input is read from global memory once per tile.
+__kernel void forward(__global const float* input,
+					  __global float* output,
+					  __global const float* params,
+					  const uint inputOffset,
+					  const uint outputOffset,
+					  const uint paramOffset)
+{
+	input += inputOffset;
+	output += outputOffset;
+	params += paramOffset;
+
+	__local float inputTile[INPUT_TILE_HEIGHT * INPUT_TILE_WIDTH];
+	__local float filterTile[FILTER_HEIGHT * FILTER_WIDTH];
+
+	const uint inputWidth = INPUT_WIDTH;
+	const uint inputHeight = INPUT_HEIGHT;
+	const uint channels = CHANNELS;
+	const uint filterWidth = FILTER_WIDTH;
+	const uint filterHeight = FILTER_HEIGHT;
+	const uint filterCount = FILTER_COUNT;
+	const uint filterSize = filterHeight * filterWidth;
+	const uint tileWidth = INPUT_TILE_WIDTH;
+	const uint tileHeight = INPUT_TILE_HEIGHT;
+
+	const uint lx = get_local_id(0);
+	const uint ly = get_local_id(1);
+	const uint lid = ly * CONV_TILE + lx;
+	const uint ox = get_global_id(0);
+	const uint oy = get_global_id(1);
+	const uint sample = get_global_id(2) / filterCount;
+	const uint f = get_global_id(2) - sample * filterCount;
+
+	// top left corner of the input under the tile
+	const uint x0 = get_group_id(0) * CONV_TILE * STEP_X;
+	const uint y0 = get_group_id(1) * CONV_TILE * STEP_Y;
+
+	input += sample * channels * inputHeight * inputWidth;
+	const __global float* filter = params + filterCount + f * channels * filterSize;
+
+	float sum = params[f];
+
+	for (uint c = 0; c < channels; ++c)
+	{
+		const __global float* channel = input + c * inputHeight * inputWidth;
+
+		// the previous channel's tiles must be finished with before they are overwritten
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for (uint i = lid; i < tileHeight * tileWidth; i += CONV_TILE * CONV_TILE)
+		{
+			const uint ty = i / tileWidth;
+			const uint tx = i - ty * tileWidth;
+			const uint y = y0 + ty;
+			const uint x = x0 + tx;
+			inputTile[i] = y < inputHeight && x < inputWidth ? channel[y * inputWidth + x] : 0.f;
+		}
+
+		for (uint i = lid; i < filterSize; i += CONV_TILE * CONV_TILE)
+		{
+			filterTile[i] = filter[c * filterSize + i];
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		const __local float* corner = inputTile + ly * STEP_Y * tileWidth + lx * STEP_X;
+
+		for (uint i = 0; i < filterHeight; ++i)
+		{
+			for (uint j = 0; j < filterWidth; ++j)
+			{
+				sum += filterTile[i * filterWidth + j] * corner[i * tileWidth + j];
+			}
+		}
+	}
+
+	if (ox < OUTPUT_WIDTH && oy < OUTPUT_HEIGHT)
+	{
+		output[(sample * filterCount + f) * OUTPUT_WIDTH * OUTPUT_HEIGHT + oy * OUTPUT_WIDTH + ox] = sum;
+	}
+}
+
+// Each work group computes a CONV_TILE x CONV_TILE tile of the input error for one channel of
+// one sample. For each filter in turn the output errors that reach the tile and the filter's
+// weights for the channel are staged in local memory.
+__kernel void backPropagate(__global const float* outputError,
+							__global float* inputError,
+							__global const float* params,
+							const uint paramOffset)
+{
+	params += paramOffset;
+
+	__local float errorTile[ERROR_TILE_HEIGHT * ERROR_TILE_WIDTH];
+	__local float filterTile[FILTER_HEIGHT * FILTER_WIDTH];
+
+	const uint inputWidth = INPUT_WIDTH;
+	const uint inputHeight = INPUT_HEIGHT;
+	const uint channels = CHANNELS;
+	const uint filterWidth = FILTER_WIDTH;
+	const uint filterHeight = FILTER_HEIGHT;
+	const uint filterCount = FILTER_COUNT;
+	const uint filterSize = filterHeight * filterWidth;
+	const uint outputWidth = OUTPUT_WIDTH;
+	const uint outputHeight = OUTPUT_HEIGHT;
+	const uint tileWidth = ERROR_TILE_WIDTH;
+	const uint tileHeight = ERROR_TILE_HEIGHT;
+
+	const uint lx = get_local_id(0);
+	const uint ly = get_local_id(1);
+	const uint lid = ly * CONV_TILE + lx;
+	const uint x = get_global_id(0);
+	const uint y = get_global_id(1);
+	const uint sample = get_global_id(2) / channels;
+	const uint c = get_global_id(2) - sample * channels;
+
+	// first output position whose patch reaches the tile
+	const uint x0 = get_group_id(0) * CONV_TILE;
+	const uint y0 = get_group_id(1) * CONV_TILE;
+	const uint ox0 = x0 + 1 > filterWidth ? (x0 + 1 - filterWidth + STEP_X - 1) / STEP_X : 0;
+	const uint oy0 = y0 + 1 > filterHeight ? (y0 + 1 - filterHeight + STEP_Y - 1) / STEP_Y : 0;
+
+	outputError += sample * filterCount * outputHeight * outputWidth;
+	const __global float* filters = params + filterCount + c * filterSize;
+
+	float sum = 0.f;
+
+	for (uint f = 0; f < filterCount; ++f)
+	{
+		const __global float* error = outputError + f * outputHeight * outputWidth;
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for (uint i = lid; i < tileHeight * tileWidth; i += CONV_TILE * CONV_TILE)
+		{
+			const uint ty = i / tileWidth;
+			const uint tx = i - ty * tileWidth;
+			const uint oy = oy0 + ty;
+			const uint ox = ox0 + tx;
+			errorTile[i] = oy < outputHeight && ox < outputWidth ? error[oy * outputWidth + ox] : 0.f;
+		}
+
+		for (uint i = lid; i < filterSize; i += CONV_TILE * CONV_TILE)
+		{
+			filterTile[i] = filters[f * channels * filterSize + i];
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		// every output position (ox, oy) with x = ox * STEP_X + j and y = oy * STEP_Y + i
+		for (uint i = 0; i < filterHeight && i <= y; ++i)
+		{
+			const uint dy = y - i;
+			const uint oy = dy / STEP_Y;
+
+			if (oy * STEP_Y != dy)
+			{
+				continue;
+			}
+
+			for (uint j = 0; j < filterWidth && j <= x; ++j)
+			{
+				const uint dx = x - j;
+				const uint ox = dx / STEP_X;
+
+				if (ox * STEP_X == dx)
+				{
+					sum += filterTile[i * filterWidth + j] * errorTile[(oy - oy0) * tileWidth + ox - ox0];
+				}
+			}
+		}
+	}
+
+	if (y < inputHeight && x < inputWidth)
+	{
+		inputError[(sample * channels + c) * inputHeight * inputWidth + y * inputWidth + x] = sum;
+	}
+}
+
+// One work group per parameter, summing over every sample and output position of the batch and
+// then reducing in local memory, so each derivative has a single writer and no atomics are needed.
+// Groups are ordered like the parameters of a filter: its bias then its weights.
+__kernel void calculateDerivatives(__global const float* input,
+								   __global const float* outputError,
+								   __global float* derivatives,
+								   const uint inputOffset,
+								   const uint paramOffset,
+								   const uint batchSize)
+{
+	input += inputOffset;
+	derivatives += paramOffset;
+
+	__local float temp[MAX_WORKGROUP_SIZE];
+
+	const uint inputWidth = INPUT_WIDTH;
+	const uint inputHeight = INPUT_HEIGHT;
+	const uint channels = CHANNELS;
+	const uint filterWidth = FILTER_WIDTH;
+	const uint filterHeight = FILTER_HEIGHT;
+	const uint filterCount = FILTER_COUNT;
+	const uint filterSize = filterHeight * filterWidth;
+	const uint patchSize = channels * filterSize;
+	const uint positions = OUTPUT_WIDTH * OUTPUT_HEIGHT;
+	const uint count = batchSize * positions;
+
+	const uint localSize = get_local_size(0);
+	const uint lid = get_local_id(0);
+	const uint wid = get_group_id(0);
+	const uint f = wid / (patchSize + 1);
+	const uint k = wid - f * (patchSize + 1);
+
+	float sum = 0.f;
+
+	if (k == 0)
+	{
+		for (uint i = lid; i < count; i += localSize)
+		{
+			const uint sample = i / positions;
+			const uint p = i - sample * positions;
+			sum += outputError[(sample * filterCount + f) * positions + p];
+		}
+	}
+	else
+	{
+		const uint c = (k - 1) / filterSize;
+		const uint fy = (k - 1 - c * filterSize) / filterWidth;
+		const uint fx = k - 1 - c * filterSize - fy * filterWidth;
+		const __global float* channel = input + (c * inputHeight + fy) * inputWidth + fx;
+
+		for (uint i = lid; i < count; i += localSize)
+		{
+			const uint sample = i / positions;
+			const uint p = i - sample * positions;
+			const uint oy = p / OUTPUT_WIDTH;
+			const uint ox = p - oy * OUTPUT_WIDTH;
+			const float x = channel[sample * channels * inputHeight * inputWidth + oy * STEP_Y * inputWidth + ox * STEP_X];
+			sum += outputError[(sample * filterCount + f) * positions + p] * x;
+		}
+	}
+
+	temp[lid] = sum;
+
+	for (uint i = localSize / 2; i > 0; i /= 2)
+	{
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lid < i)
+		{
+			temp[lid] += temp[lid + i];
+		}
+	}
+
+	if (lid == 0)
+	{
+		derivatives[k == 0 ? f : filterCount + f * patchSize + k - 1] += temp[0];
+	}
+}
+
+// Pointwise (1x1 filters, step 1) convolutions are plain matrix products with each sample's
+// CHANNELS x POSITIONS input, so the kernels below run them as tiled GEMMs instead. Each work
+// group computes a GEMM_TILE x GEMM_TILE tile of the result, staging both operands in local
+// memory one GEMM_TILE slice of the shared dimension at a time. They take the same arguments
+// as the general kernels.
+
+// output[FILTER_COUNT x POSITIONS] = bias + filters[FILTER_COUNT x CHANNELS] * input, one sample
+// per global z
+__kernel void pointwiseForward(__global const float* input,
+							   __global float* output,
+							   __global const float* params,
+							   const uint inputOffset,
+							   const uint outputOffset,
+							   const uint paramOffset)
+{
+	__local float filterTile[GEMM_TILE][GEMM_TILE];
+	__local float inputTile[GEMM_TILE][GEMM_TILE + 1];
+
+	const uint sample = get_global_id(2);
+	input += inputOffset + sample * CHANNELS * POSITIONS;
+	output += outputOffset + sample * FILTER_COUNT * POSITIONS;
+	params += paramOffset;
+	const __global float* filters = params + FILTER_COUNT;
+
+	const uint lx = get_local_id(0);
+	const uint ly = get_local_id(1);
+	const uint p = get_global_id(0);
+	const uint f = get_global_id(1);
+
+	float sum = 0.f;
+
+	for (uint c0 = 0; c0 < CHANNELS; c0 += GEMM_TILE)
+	{
+		filterTile[ly][lx] = f < FILTER_COUNT && c0 + lx < CHANNELS ? filters[f * CHANNELS + c0 + lx] : 0.f;
+		inputTile[ly][lx] = p < POSITIONS && c0 + ly < CHANNELS ? input[(c0 + ly) * POSITIONS + p] : 0.f;
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for (uint i = 0; i < GEMM_TILE; ++i)
+		{
+			sum += filterTile[ly][i] * inputTile[i][lx];
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (f < FILTER_COUNT && p < POSITIONS)
+	{
+		output[f * POSITIONS + p] = params[f] + sum;
+	}
+}
+
+// inputError[CHANNELS x POSITIONS] = filters^T * outputError, one sample per global z. The
+// filters are read a row at a time and used transposed from local memory.
+__kernel void pointwiseBackPropagate(__global const float* outputError,
+									 __global float* inputError,
+									 __global const float* params,
+									 const uint paramOffset)
+{
+	__local float filterTile[GEMM_TILE][GEMM_TILE + 1];
+	__local float errorTile[GEMM_TILE][GEMM_TILE + 1];
+
+	const uint sample = get_global_id(2);
+	outputError += sample * FILTER_COUNT * POSITIONS;
+	inputError += sample * CHANNELS * POSITIONS;
+	const __global float* filters = params + paramOffset + FILTER_COUNT;
+
+	const uint lx = get_local_id(0);
+	const uint ly = get_local_id(1);
+	const uint p = get_global_id(0);
+	const uint c = get_global_id(1);
+	const uint c0 = get_group_id(1) * GEMM_TILE;
+
+	float sum = 0.f;
+
+	for (uint f0 = 0; f0 < FILTER_COUNT; f0 += GEMM_TILE)
+	{
+		filterTile[ly][lx] = f0 + ly < FILTER_COUNT && c0 + lx < CHANNELS ? filters[(f0 + ly) * CHANNELS + c0 + lx] : 0.f;
+		errorTile[ly][lx] = p < POSITIONS && f0 + ly < FILTER_COUNT ? outputError[(f0 + ly) * POSITIONS + p] : 0.f;
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for (uint i = 0; i < GEMM_TILE; ++i)
+		{
+			sum += filterTile[i][ly] * errorTile[i][lx];
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (c < CHANNELS && p < POSITIONS)
+	{
+		inputError[c * POSITIONS + p] = sum;
+	}
+}
+
+// [bias | filters] derivatives += outputError * [1 | input^T] over every sample and position of
+// the batch. Column 0 of the result is the bias of each filter and column 1 + c its weight for
+// channel c, so every derivative has a single writer.
+__kernel void pointwiseCalculateDerivatives(__global const float* input,
+											__global const float* outputError,
+											__global float* derivatives,
+											const uint inputOffset,
+											const uint paramOffset,
+											const uint batchSize)
+{
+	__local float errorTile[GEMM_TILE][GEMM_TILE + 1];
+	__local float inputTile[GEMM_TILE][GEMM_TILE + 1];
+
+	input += inputOffset;
+	derivatives += paramOffset;
+
+	const uint lx = get_local_id(0);
+	const uint ly = get_local_id(1);
+	const uint j = get_global_id(0);
+	const uint f = get_global_id(1);
+	const uint j0 = get_group_id(0) * GEMM_TILE;
+	const uint count = batchSize * POSITIONS;
+
+	float sum = 0.f;
+
+	for (uint k0 = 0; k0 < count; k0 += GEMM_TILE)
+	{
+		// both operands are read along the positions, row ly of the input tile holds column j0 + ly
+		const uint k = k0 + lx;
+		const uint sample = k / POSITIONS;
+		const uint position = k - sample * POSITIONS;
+		const uint column = j0 + ly;
+		errorTile[ly][lx] = f < FILTER_COUNT && k < count ? outputError[(sample * FILTER_COUNT + f) * POSITIONS + position] : 0.f;
+		inputTile[ly][lx] = k >= count || column > CHANNELS ? 0.f
+			: column == 0 ? 1.f : input[(sample * CHANNELS + column - 1) * POSITIONS + position];
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for (uint i = 0; i < GEMM_TILE; ++i)
+		{
+			sum += errorTile[ly][i] * inputTile[lx][i];
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (f < FILTER_COUNT && j <= CHANNELS)
+	{
+		derivatives[j == 0 ? f : FILTER_COUNT + f * CHANNELS + j - 1] += sum;
+	}
+}
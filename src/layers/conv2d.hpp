@@ -0,0 +1,541 @@
+#pragma once
+#include "layer.hpp"
+#include "..\..\include\shape.hpp"
+#include "..\..\utils\utils.hpp"
+#include "..\math\gemm.hpp"
+#include "..\math\winograd.hpp"
+#include <vector>
+
+namespace nn
+{
+namespace layer
+{
+// 2D convolution without padding. The input is (channels, height, width) and the output is
+// (filterCount, outputHeight, outputWidth), both stored channel by channel.
+//
+// Each sample is unfolded (im2col) into a matrix with one row per output position holding the
+// patch of input under the filter, so every pass is a matrix product with the filters:
+//     output      = filters * patches^T
+//     patchError  = outputError^T * filters (then folded back onto the input)
+//     dFilters   += outputError * patches
+//
+// 1x1 filters with a step of 1 (pointwise convolution) need no unfolding: the input already is
+// the channels x positions matrix, so each pass is a single matrix product, as in Dense. On the
+// device they run as tiled GEMM kernels of their own.
+//
+// 3x3 filters with a step of 1 run forward with Winograd F(2x2, 3x3) instead, which needs 2.25x
+// fewer multiplications. The transformed filters are kept in the parameter cache so they are
+// only recalculated after each parameter update.
+class Conv2d : public Layer
+{
+public:
+	// filterSize and filterStep are { height, width }
+	Conv2d(Shape<3> inputShape, size_t filterCount, Shape<2> filterSize, Shape<2> filterStep = Shape<2>({ 1, 1 })) :
+		Layer(inputShape.size(),
+			filterCount * getOutputLength(inputShape.length(1), filterSize.length(0), filterStep.length(0)) * getOutputLength(inputShape.length(2), filterSize.length(1), filterStep.length(1)),
+			filterCount * (inputShape.length(0) * filterSize.size() + 1)),
+		channels(uint32_t(inputShape.length(0))),
+		inputHeight(uint32_t(inputShape.length(1))),
+		inputWidth(uint32_t(inputShape.length(2))),
+		filterCount(uint32_t(filterCount)),
+		filterHeight(uint32_t(filterSize.length(0))),
+		filterWidth(uint32_t(filterSize.length(1))),
+		stepY(uint32_t(filterStep.length(0))),
+		stepX(uint32_t(filterStep.length(1))),
+		outputHeight(uint32_t(getOutputLength(inputHeight, filterHeight, stepY))),
+		outputWidth(uint32_t(getOutputLength(inputWidth, filterWidth, stepX))),
+		forwardKernel(NULL),
+		backPropagateKernel(NULL),
+		calculateDerivativesKernel(NULL),
+		initKernel(NULL)
+	{
+	}
+
+	// Length of the output along one axis, 0 if the filter does not fit
+	static size_t getOutputLength(size_t inputLength, size_t filterLength, size_t step)
+	{
+		if (step == 0 || filterLength == 0 || filterLength > inputLength)
+		{
+			return 0;
+		}
+		return (inputLength - filterLength) / step + 1;
+	}
+
+	Shape<3> getOutputShape() const { return Shape<3>({ filterCount, outputHeight, outputWidth }); }
+
+	void forward(const float* input, const float* params, float* output) const final
+	{
+		forwardBatch(input, params, output, 1);
+	}
+
+	void backPropagate(const BackPropData& data, float* inputError) const final
+	{
+		backPropagateBatch(data, inputError, 1);
+	}
+
+	void calculateDerivatives(const BackPropData& data, float* derivatives) const final
+	{
+		calculateDerivativesBatch(data, derivatives, 1);
+	}
+
+	// True if every pass is a plain matrix product with the input (see above)
+	bool isPointwise() const { return filterHeight == 1 && filterWidth == 1 && stepY == 1 && stepX == 1; }
+
+	// True if forward passes take the Winograd path (given the parameter cache)
+	bool isWinograd() const { return filterHeight == 3 && filterWidth == 3 && stepY == 1 && stepX == 1; }
+
+	// Winograd transformed filters, 16 x filterCount x channels
+	size_t getParameterCacheSize() const final { return isWinograd() ? 16 * size_t(filterCount) * channels : 0; }
+
+	bool isParameterCacheUsedForward() const final { return true; }
+
+	void updateParameterCache(const float* params, float* cache) const final
+	{
+		const float* filter = getFilters(params);
+		const size_t stride = size_t(filterCount) * channels;
+
+		for (size_t i = 0; i < stride; ++i)
+		{
+			math::winogradFilter(filter + i * 9, cache + i, stride);
+		}
+	}
+
+	void forwardBatch(const float* input, const float* params, float* output, size_t batchSize, const float* cache = nullptr) const final
+	{
+		const float* bias = getBiases(params);
+
+		if (cache && isWinograd())
+		{
+			for (size_t n = 0; n < batchSize; ++n)
+			{
+				forwardWinograd(input, bias, cache, output);
+				input += inputSize;
+				output += outputSize;
+			}
+
+			return;
+		}
+
+		const float* filter = getFilters(params);
+		float* patches = isPointwise() ? nullptr : getPatchScratch();
+
+		for (size_t n = 0; n < batchSize; ++n)
+		{
+			for (size_t f = 0; f < filterCount; ++f)
+			{
+				std::fill_n(output + f * getPositionCount(), getPositionCount(), bias[f]);
+			}
+
+			if (isPointwise())
+			{
+				// output = filters * input
+				math::gemmNN(filter, input, output, filterCount, getPositionCount(), channels);
+			}
+			else
+			{
+				im2col(input, patches);
+				math::gemmNT(filter, patches, output, filterCount, getPositionCount(), getPatchSize());
+			}
+
+			input += inputSize;
+			output += outputSize;
+		}
+	}
+
+	void backPropagateBatch(const BackPropData& data, float* inputError, size_t batchSize) const final
+	{
+		const float* filter = getFilters(data.params);
+		const float* outputError = data.outputError;
+
+		memset(inputError, 0, batchSize * inputSize * sizeof(float));
+
+		if (isPointwise())
+		{
+			// inputError = filters^T * outputError
+			for (size_t n = 0; n < batchSize; ++n)
+			{
+				math::gemmTN(filter, outputError + n * outputSize, inputError + n * inputSize, channels, getPositionCount(), filterCount);
+			}
+
+			return;
+		}
+
+		float* patches = getPatchScratch();
+
+		for (size_t n = 0; n < batchSize; ++n)
+		{
+			memset(patches, 0, getPatchScratchSize() * sizeof(float));
+			math::gemmTN(outputError, filter, patches, getPositionCount(), getPatchSize(), filterCount);
+			col2im(patches, inputError);
+
+			outputError += outputSize;
+			inputError += inputSize;
+		}
+	}
+
+	void calculateDerivativesBatch(const BackPropData& data, float* derivatives, size_t batchSize) const final
+	{
+		float* db = getBiases(derivatives);
+		float* df = getFilters(derivatives);
+		const float* input = data.input;
+		const float* outputError = data.outputError;
+		float* patches = isPointwise() ? nullptr : getPatchScratch();
+
+		for (size_t n = 0; n < batchSize; ++n)
+		{
+			for (size_t f = 0; f < filterCount; ++f)
+			{
+				const float* error = outputError + f * getPositionCount();
+				float sum = 0.f;
+
+				for (size_t p = 0; p < getPositionCount(); ++p)
+				{
+					sum += error[p];
+				}
+
+				db[f] += sum;
+			}
+
+			if (isPointwise())
+			{
+				// dFilters += outputError * input^T
+				math::gemmNT(outputError, input, df, filterCount, channels, getPositionCount());
+			}
+			else
+			{
+				im2col(input, patches);
+				math::gemmNN(outputError, patches, df, filterCount, getPatchSize(), getPositionCount());
+			}
+
+			input += inputSize;
+			outputError += outputSize;
+		}
+	}
+
+	void initializeParameters(float* params) const final
+	{
+		const auto sd = 1.f / (float)sqrt(getPatchSize());
+		float* bias = getBiases(params);
+		float* filter = getFilters(params);
+
+		for (size_t i = 0; i < filterCount; ++i)
+		{
+			*bias++ = fastUniformRand(-1.f, 1.f);
+			for (size_t j = 0; j < getPatchSize(); ++j)
+			{
+				*filter++ = fastUniformRand(-sd, sd);
+			}
+		}
+	}
+
+	void cl_forward(cl_command_queue queue, cl_mem input, cl_mem params, cl_mem output, uint32_t inOffset, uint32_t outOffset, uint32_t paramOffset, uint32_t batchSize) const final
+	{
+		size_t groupSize[3] = { tile, tile, 1 };
+		size_t globalSize[3] = { roundUp(outputWidth, tile), roundUp(outputHeight, tile), size_t(batchSize) * filterCount };
+
+		if (isPointwise())
+		{
+			// filterCount x positions per sample
+			groupSize[0] = groupSize[1] = gemmTile;
+			globalSize[0] = roundUp(getPositionCount(), gemmTile);
+			globalSize[1] = roundUp(filterCount, gemmTile);
+			globalSize[2] = batchSize;
+		}
+
+		int error;
+		error = clSetKernelArg(forwardKernel, 0, sizeof(cl_mem), &input);
+		error |= clSetKernelArg(forwardKernel, 1, sizeof(cl_mem), &output);
+		error |= clSetKernelArg(forwardKernel, 2, sizeof(cl_mem), &params);
+		error |= clSetKernelArg(forwardKernel, 3, sizeof(inOffset), &inOffset);
+		error |= clSetKernelArg(forwardKernel, 4, sizeof(outOffset), &outOffset);
+		error |= clSetKernelArg(forwardKernel, 5, sizeof(paramOffset), &paramOffset);
+		error |= clEnqueueNDRangeKernel(queue, forwardKernel, 3, NULL, globalSize, groupSize, 0, NULL, NULL);
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::conv2d::cl_forward()");
+		}
+	}
+
+	void cl_backPropagate(cl_command_queue queue, const ClBackPropData& data, cl_mem inputError, uint32_t paramOffset, uint32_t batchSize) const final
+	{
+		size_t groupSize[3] = { tile, tile, 1 };
+		size_t globalSize[3] = { roundUp(inputWidth, tile), roundUp(inputHeight, tile), size_t(batchSize) * channels };
+
+		if (isPointwise())
+		{
+			// channels x positions per sample
+			groupSize[0] = groupSize[1] = gemmTile;
+			globalSize[0] = roundUp(getPositionCount(), gemmTile);
+			globalSize[1] = roundUp(channels, gemmTile);
+			globalSize[2] = batchSize;
+		}
+
+		int error;
+		error = clSetKernelArg(backPropagateKernel, 0, sizeof(cl_mem), &data.outputError);
+		error |= clSetKernelArg(backPropagateKernel, 1, sizeof(cl_mem), &inputError);
+		error |= clSetKernelArg(backPropagateKernel, 2, sizeof(cl_mem), &data.params);
+		error |= clSetKernelArg(backPropagateKernel, 3, sizeof(paramOffset), &paramOffset);
+		error |= clEnqueueNDRangeKernel(queue, backPropagateKernel, 3, NULL, globalSize, groupSize, 0, NULL, NULL);
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::conv2d::cl_backPropagate()");
+		}
+	}
+
+	void cl_calculateDerivatives(cl_command_queue queue, const ClBackPropData& data, cl_mem derivaitves, uint32_t paramOffset, uint32_t batchSize) const final
+	{
+		int error;
+		error = clSetKernelArg(calculateDerivativesKernel, 0, sizeof(cl_mem), &data.input);
+		error |= clSetKernelArg(calculateDerivativesKernel, 1, sizeof(cl_mem), &data.outputError);
+		error |= clSetKernelArg(calculateDerivativesKernel, 2, sizeof(cl_mem), &derivaitves);
+		error |= clSetKernelArg(calculateDerivativesKernel, 3, sizeof(data.inputOffset), &data.inputOffset);
+		error |= clSetKernelArg(calculateDerivativesKernel, 4, sizeof(paramOffset), &paramOffset);
+		error |= clSetKernelArg(calculateDerivativesKernel, 5, sizeof(batchSize), &batchSize);
+
+		if (isPointwise())
+		{
+			// filterCount x (1 + channels), the bias then the weights of each filter
+			size_t groupSize[2] = { gemmTile, gemmTile };
+			size_t globalSize[2] = { roundUp(channels + 1, gemmTile), roundUp(filterCount, gemmTile) };
+			error |= clEnqueueNDRangeKernel(queue, calculateDerivativesKernel, 2, NULL, globalSize, groupSize, 0, NULL, NULL);
+		}
+		else
+		{
+			// one work group per parameter
+			error |= cl::enqueueGroups(queue, calculateDerivativesKernel, parmeterCount, batchSize * (outputSize / filterCount), { derivaitves });
+		}
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::conv2d::cl_calculateDerivatives()");
+		}
+	}
+
+	void cl_initializeParameters(cl_command_queue queue, cl_mem params, uint32_t offset) const final
+	{
+		int error;
+		error = clSetKernelArg(initKernel, 0, sizeof(cl_mem), &params);
+		error |= clSetKernelArg(initKernel, 1, sizeof(offset), &offset);
+		error |= cl::enqueueGroups(queue, initKernel, filterCount, getPatchSize(), { params });
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::conv2d::cl_initializeParameters()");
+		}
+	}
+
+	void cl_initKernels(cl_context context, cl_device_id device) final
+	{
+		auto options = cl::defines({
+			{ "INPUT_WIDTH", inputWidth },
+			{ "INPUT_HEIGHT", inputHeight },
+			{ "CHANNELS", channels },
+			{ "FILTER_WIDTH", filterWidth },
+			{ "FILTER_HEIGHT", filterHeight },
+			{ "FILTER_COUNT", filterCount },
+			{ "STEP_X", stepX },
+			{ "STEP_Y", stepY },
+			{ "OUTPUT_WIDTH", outputWidth },
+			{ "OUTPUT_HEIGHT", outputHeight },
+			{ "CONV_TILE", tile },
+			{ "GEMM_TILE", gemmTile } });
+		auto program = cl::buildProgramFromFile(__FILE__, context, device, options);
+
+		// Pointwise convolutions run as matrix products, their kernels take the same arguments
+		const bool pointwise = isPointwise();
+
+		int error;
+		forwardKernel = clCreateKernel(program, pointwise ? "pointwiseForward" : "forward", &error);
+		backPropagateKernel = clCreateKernel(program, pointwise ? "pointwiseBackPropagate" : "backPropagate", &error);
+		calculateDerivativesKernel = clCreateKernel(program, pointwise ? "pointwiseCalculateDerivatives" : "calculateDerivatives", &error);
+		initKernel = clCreateKernel(program, "initParams", &error);
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error while creating kernel(s) for layer::conv2d.");
+		}
+	}
+
+	// filterCount biases followed by the filters, each channels x filterHeight x filterWidth
+	const float* getBiases(const float* parameters) const { return parameters; }
+	float* getBiases(float* parameters)       const { return parameters; }
+	const float* getFilters(const float* parameters) const { return parameters + filterCount; }
+	float* getFilters(float* parameters)       const { return parameters + filterCount; }
+
+private:
+	// Number of output positions per filter
+	size_t getPositionCount() const { return size_t(outputHeight) * outputWidth; }
+
+	// Number of inputs under the filter at one position
+	size_t getPatchSize() const { return size_t(channels) * filterHeight * filterWidth; }
+
+	size_t getPatchScratchSize() const { return getPositionCount() * getPatchSize(); }
+
+	// Unfolds one sample into positions x patch size. Filter rows are contiguous in the input
+	// so they are copied a row at a time.
+	void im2col(const float* input, float* patches) const
+	{
+		for (size_t y = 0; y < outputHeight; ++y)
+		{
+			for (size_t x = 0; x < outputWidth; ++x)
+			{
+				const float* corner = input + (y * stepY) * inputWidth + x * stepX;
+
+				for (size_t c = 0; c < channels; ++c)
+				{
+					const float* channel = corner + c * inputHeight * inputWidth;
+
+					for (size_t i = 0; i < filterHeight; ++i)
+					{
+						memcpy(patches, channel + i * inputWidth, filterWidth * sizeof(float));
+						patches += filterWidth;
+					}
+				}
+			}
+		}
+	}
+
+	// Inverse of im2col, summing where patches overlap
+	void col2im(const float* patches, float* input) const
+	{
+		for (size_t y = 0; y < outputHeight; ++y)
+		{
+			for (size_t x = 0; x < outputWidth; ++x)
+			{
+				float* corner = input + (y * stepY) * inputWidth + x * stepX;
+
+				for (size_t c = 0; c < channels; ++c)
+				{
+					float* channel = corner + c * inputHeight * inputWidth;
+
+					for (size_t i = 0; i < filterHeight; ++i)
+					{
+						math::axpy(1.f, patches, channel + i * inputWidth, filterWidth);
+						patches += filterWidth;
+					}
+				}
+			}
+		}
+	}
+
+	// One per thread, shared by all Conv2d layers and grown to the largest one
+	float* getPatchScratch() const
+	{
+		return getScratch(getPatchScratchSize());
+	}
+
+	float* getScratch(size_t size) const
+	{
+		static thread_local std::vector<float> scratch;
+
+		if (scratch.size() < size)
+		{
+			scratch.resize(size);
+		}
+
+		return scratch.data();
+	}
+
+	// One sample. The output is covered by 2x2 tiles, each computed from the 4x4 block of input
+	// under it. Tiles that hang over the bottom or right edge read zeros and drop their extra outputs.
+	void forwardWinograd(const float* input, const float* bias, const float* filters, float* output) const
+	{
+		const size_t tilesY = (outputHeight + 1) / 2;
+		const size_t tilesX = (outputWidth + 1) / 2;
+		const size_t tiles = tilesY * tilesX;
+		const size_t inputStride = size_t(channels) * tiles;
+		const size_t productStride = size_t(filterCount) * tiles;
+		const size_t filterStride = size_t(filterCount) * channels;
+
+		// 16 x tiles x channels transformed input, then 16 x filterCount x tiles products
+		float* transformed = getScratch(16 * (inputStride + productStride));
+		float* products = transformed + 16 * inputStride;
+
+		// Channels innermost so each of the 16 streams of transformed input is written sequentially
+		for (size_t ty = 0; ty < tilesY; ++ty)
+		{
+			for (size_t tx = 0; tx < tilesX; ++tx)
+			{
+				const bool inside = ty * 2 + 4 <= inputHeight && tx * 2 + 4 <= inputWidth;
+				const float* corner = input + ty * 2 * inputWidth + tx * 2;
+				float* v = transformed + (ty * tilesX + tx) * channels;
+
+				for (size_t c = 0; c < channels; ++c)
+				{
+					const float* channel = corner + c * inputHeight * inputWidth;
+					float block[16];
+
+					for (size_t i = 0; i < 4; ++i)
+					{
+						for (size_t j = 0; j < 4; ++j)
+						{
+							block[i * 4 + j] = inside || (ty * 2 + i < inputHeight && tx * 2 + j < inputWidth) ? channel[i * inputWidth + j] : 0.f;
+						}
+					}
+
+					math::winogradInput(block, v + c, inputStride);
+				}
+			}
+		}
+
+		memset(products, 0, 16 * productStride * sizeof(float));
+
+		for (size_t i = 0; i < 16; ++i)
+		{
+			math::gemmNT(filters + i * filterStride, transformed + i * inputStride, products + i * productStride, filterCount, tiles, channels);
+		}
+
+		for (size_t f = 0; f < filterCount; ++f)
+		{
+			float* map = output + f * getPositionCount();
+
+			for (size_t ty = 0; ty < tilesY; ++ty)
+			{
+				for (size_t tx = 0; tx < tilesX; ++tx)
+				{
+					float block[4];
+					math::winogradOutput(products + f * tiles + ty * tilesX + tx, productStride, block);
+
+					for (size_t i = 0; i < 2 && ty * 2 + i < outputHeight; ++i)
+					{
+						for (size_t j = 0; j < 2 && tx * 2 + j < outputWidth; ++j)
+						{
+							map[(ty * 2 + i) * outputWidth + tx * 2 + j] = block[i * 2 + j] + bias[f];
+						}
+					}
+				}
+			}
+		}
+	}
+
+	static size_t roundUp(size_t size, size_t multiple) { return (size + multiple - 1) / multiple * multiple; }
+
+	// passed to conv2d.cl as CONV_TILE
+	static const size_t tile = 8;
+
+	// passed to conv2d.cl as GEMM_TILE, the tile of the pointwise matrix products
+	static const size_t gemmTile = 16;
+
+	const uint32_t channels;
+	const uint32_t inputHeight;
+	const uint32_t inputWidth;
+	const uint32_t filterCount;
+	const uint32_t filterHeight;
+	const uint32_t filterWidth;
+	const uint32_t stepY;
+	const uint32_t stepX;
+	const uint32_t outputHeight;
+	const uint32_t outputWidth;
+
+	cl_kernel forwardKernel;
+
+	cl_kernel backPropagateKernel;
+
+	cl_kernel calculateDerivativesKernel;
+
+	cl_kernel initKernel;
+};
+}
+}
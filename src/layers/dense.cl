@@ -1,5 +1,44 @@
 #define MAX_WORKGROUP_SIZE (256)
 
+// Set by layer::Dense when the program is built: INPUT_WIDTH and OUTPUT_WIDTH, TRANSPOSE_TILE,
+// the tiling of the matrix products, GEMM_TILE = GEMM_GROUP * GEMM_BLOCK, and ACTIVATION.
+#define GEMM_TILE_K (16)
+
+// Activation applied to the output, see layer::Dense::cl_fuseActivation. Must match
+// layer::Dense::Activation. ACTIVATION_SLOPE is the bit pattern of the leaky ReLU slope.
+#define ACTIVATION_NONE (0)
+#define ACTIVATION_SIGMOID (1)
+#define ACTIVATION_RELU (2)
+#define ACTIVATION_TANH (3)
+
+inline float activate(const float x)
+{
+#if ACTIVATION == ACTIVATION_SIGMOID
+	return 1.f / (1.f + exp(-x));
+#elif ACTIVATION == ACTIVATION_RELU
+	return fmax(x, 0.f) + as_float((uint)ACTIVATION_SLOPE) * fmin(x, 0.f);
+#elif ACTIVATION == ACTIVATION_TANH
+	return tanh(x);
+#else
+	return x;
+#endif
+}
+
+// Error of the activation's input from the error of its output y. The derivative of each
+// activation follows from its output.
+inline float activationError(const float y, const float error)
+{
+#if ACTIVATION == ACTIVATION_SIGMOID
+	return y * (1.f - y) * error;
+#elif ACTIVATION == ACTIVATION_RELU
+	return y > 0.f ? error : as_float((uint)ACTIVATION_SLOPE) * error;
+#elif ACTIVATION == ACTIVATION_TANH
+	return (1.f - y * y) * error;
+#else
+	return error;
+#endif
+}
+
 inline uint updateSeed(uint seed)
 {
 	return seed = 0xa6718293 * seed + 0x638c571f;
@@ -12,141 +51,309 @@ inline float fastRand(float min, float max, uint* seed)
 }
 
 __kernel void initParams(__global float* params,
-						 const uint inputWidth,
 						 const uint paramOffset)
 {
 	params += paramOffset;
-	const float sd = rsqrt((double)inputWidth);
+	const float sd = rsqrt((double)INPUT_WIDTH);
 	const size_t stride = get_local_size(0);
 	const size_t lid = get_local_id(0);
 	const size_t wid = get_group_id(0);
 	const size_t outputSize = get_num_groups(0);
-	const size_t offset = outputSize + wid * inputWidth;
+	const size_t offset = outputSize + wid * INPUT_WIDTH;
 	__global float* weights = params + offset;
 	uint seed = get_global_id(0);
 
-	for (size_t i = lid; i < inputWidth; i += stride)
+	for (size_t i = lid; i < INPUT_WIDTH; i += stride)
 	{
 		weights[i] = fastRand(-sd, sd, &seed);
 	}
 
 	if (lid == 0)
 	{
-		__global float* bias = params + wid;
-		bias[wid] = 0;
+		params[wid] = 0;
+	}
+}
+
+// The tiled matrix products below compute C = A * B. Each work group computes a
+// GEMM_TILE x GEMM_TILE block of C, staging GEMM_TILE_K wide slices of A and B in local memory so
+// every value read from global memory is used GEMM_TILE times. Each work item keeps a
+// GEMM_BLOCK x GEMM_BLOCK block of C in registers, strided by the work group size so neighbouring
+// work items write neighbouring elements.
+
+// tile[i][k] = matrix(first + i, k0 + k), zero outside of count x depth. The matrix is stored with
+// k contiguous (rows of length depth) or, if not kContiguous, with i contiguous (rows of length
+// count). Consecutive work items read consecutive addresses either way. If output is given the
+// matrix is the output error, which is loaded as the error before the activation.
+inline void loadTile(__local float tile[GEMM_TILE][GEMM_TILE_K + 1], __global const float* matrix, __global const float* output,
+					 const uint first, const uint count, const uint k0, const uint depth, const bool kContiguous)
+{
+	const uint lid = get_local_id(1) * GEMM_GROUP + get_local_id(0);
+
+	for (uint e = lid; e < GEMM_TILE * GEMM_TILE_K; e += GEMM_GROUP * GEMM_GROUP)
+	{
+		const uint i = kContiguous ? e / GEMM_TILE_K : e % GEMM_TILE;
+		const uint k = kContiguous ? e % GEMM_TILE_K : e / GEMM_TILE;
+		const bool inside = first + i < count && k0 + k < depth;
+		const uint index = kContiguous ? (first + i) * depth + k0 + k : (k0 + k) * count + first + i;
+		tile[i][k] = inside ? (output ? activationError(output[index], matrix[index]) : matrix[index]) : 0.f;
 	}
 }
 
+// sums[r][c] += sum over k of aTile[ly + r * GEMM_GROUP][k] * bTile[lx + c * GEMM_GROUP][k]
+inline void multiplyTiles(__local float aTile[GEMM_TILE][GEMM_TILE_K + 1], __local float bTile[GEMM_TILE][GEMM_TILE_K + 1], float sums[GEMM_BLOCK][GEMM_BLOCK])
+{
+	const uint lx = get_local_id(0);
+	const uint ly = get_local_id(1);
+
+	for (uint k = 0; k < GEMM_TILE_K; ++k)
+	{
+		float a[GEMM_BLOCK];
+		float b[GEMM_BLOCK];
+
+		for (uint i = 0; i < GEMM_BLOCK; ++i)
+		{
+			a[i] = aTile[ly + i * GEMM_GROUP][k];
+			b[i] = bTile[lx + i * GEMM_GROUP][k];
+		}
+
+		for (uint r = 0; r < GEMM_BLOCK; ++r)
+		{
+			for (uint c = 0; c < GEMM_BLOCK; ++c)
+			{
+				sums[r][c] += a[r] * b[c];
+			}
+		}
+	}
+}
+
+// The work item's block of C = A * B, where A is m x depth and B is depth x n. See loadTile for
+// the layouts and aOutput. The tiles are the kernel's as local memory can only be declared there.
+inline void multiply(__global const float* a, __global const float* aOutput, __global const float* b, const uint m, const uint n, const uint depth,
+					 const bool aContiguous, const bool bContiguous, float sums[GEMM_BLOCK][GEMM_BLOCK],
+					 __local float aTile[GEMM_TILE][GEMM_TILE_K + 1], __local float bTile[GEMM_TILE][GEMM_TILE_K + 1])
+{
+	const uint row0 = get_group_id(1) * GEMM_TILE;
+	const uint col0 = get_group_id(0) * GEMM_TILE;
+
+	for (uint r = 0; r < GEMM_BLOCK; ++r)
+	{
+		for (uint c = 0; c < GEMM_BLOCK; ++c)
+		{
+			sums[r][c] = 0.f;
+		}
+	}
+
+	for (uint k0 = 0; k0 < depth; k0 += GEMM_TILE_K)
+	{
+		loadTile(aTile, a, aOutput, row0, m, k0, depth, aContiguous);
+		loadTile(bTile, b, 0, col0, n, k0, depth, bContiguous);
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		multiplyTiles(aTile, bTile, sums);
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+}
+
+// Row and column of C of element (r, c) of a work item's register block
+inline uint blockRow(const uint r) { return get_group_id(1) * GEMM_TILE + get_local_id(1) + r * GEMM_GROUP; }
+inline uint blockColumn(const uint c) { return get_group_id(0) * GEMM_TILE + get_local_id(0) + c * GEMM_GROUP; }
+
+// output = activate(input * weights^T + bias). Rows are samples, columns neurons.
 __kernel void forward(__global const float* input,
 					  __global float* output,
 					  __global const float* params,
 					  const uint inputOffset,
 					  const uint outputOffset,
 					  const uint paramOffset,
-					  const uint inputWidth,
-					  const uint outputWidth,
-					  const uint outputSize)
+					  const uint batchSize)
 {
 	input += inputOffset;
 	output += outputOffset;
 	params += paramOffset;
 
-	__local float temp[MAX_WORKGROUP_SIZE];
+	__local float aTile[GEMM_TILE][GEMM_TILE_K + 1];
+	__local float bTile[GEMM_TILE][GEMM_TILE_K + 1];
+	float sums[GEMM_BLOCK][GEMM_BLOCK];
+	multiply(input, 0, params + OUTPUT_WIDTH, batchSize, OUTPUT_WIDTH, INPUT_WIDTH, true, true, sums, aTile, bTile);
 
-	const size_t localSize = get_local_size(0);
-	const size_t lid = get_local_id(0);
-	const size_t wid = get_group_id(0);
-	//const size_t groupCount = get_num_groups(0);
-
-	// Todo: optimise group working on multiple rows if rows are small
-	//for (uint j = wid; j < outputSize; j += groupCount)
-	if (wid < outputSize)
+	for (uint r = 0; r < GEMM_BLOCK; ++r)
 	{
-		uint set = wid / outputWidth;
-		uint row = wid - set * outputWidth;;
-		const __global float* weights = params + outputWidth + row * inputWidth; // row of weight matrix
-		input += set * inputWidth;
-		temp[lid] = 0.f;
-
-		// sum
-		for (uint i = lid; i < inputWidth; i += localSize)
-		{
-			temp[lid] += weights[i] * input[i];
-		}
+		const uint sample = blockRow(r);
 
-		// accumulate
-		for (uint i = localSize / 2; i > 0; i /= 2)
+		for (uint c = 0; c < GEMM_BLOCK; ++c)
 		{
-			barrier(CLK_LOCAL_MEM_FENCE);
-			if (lid < i)
+			const uint neuron = blockColumn(c);
+
+			if (sample < batchSize && neuron < OUTPUT_WIDTH)
 			{
-				temp[lid] += temp[lid + i];
+				output[sample * OUTPUT_WIDTH + neuron] = activate(params[neuron] + sums[r][c]);
 			}
 		}
+	}
+}
+
+inline void storeInputError(__global float* inputError, const uint batchSize, float sums[GEMM_BLOCK][GEMM_BLOCK])
+{
+	for (uint r = 0; r < GEMM_BLOCK; ++r)
+	{
+		const uint sample = blockRow(r);
 
-		if (lid == 0)
+		for (uint c = 0; c < GEMM_BLOCK; ++c)
 		{
-			// bias + weight matrix row product
-			output[wid] = params[row] + temp[0];
+			const uint col = blockColumn(c);
+
+			if (sample < batchSize && col < INPUT_WIDTH)
+			{
+				inputError[sample * INPUT_WIDTH + col] = sums[r][c];
+			}
 		}
 	}
 }
 
+// inputError = outputError * weights. Rows are samples, columns inputs. With an activation
+// outputError is the error of its output, output the output itself.
 __kernel void backPropagate(__global const float* outputError,
+							__global const float* output,
 							__global float* inputError,
 							__global const float* params,
 							const uint paramOffset,
-							const uint inputWidth,
-							const uint outputWidth)
+							const uint batchSize)
 {
-	params += paramOffset;
+	__local float aTile[GEMM_TILE][GEMM_TILE_K + 1];
+	__local float bTile[GEMM_TILE][GEMM_TILE_K + 1];
+	float sums[GEMM_BLOCK][GEMM_BLOCK];
+	multiply(outputError, ACTIVATION ? output : 0, params + paramOffset + OUTPUT_WIDTH, batchSize, INPUT_WIDTH, OUTPUT_WIDTH, true, false, sums, aTile, bTile);
+	storeInputError(inputError, batchSize, sums);
+}
+
+// Same as backPropagate but reads the transposed weights (INPUT_WIDTH x OUTPUT_WIDTH) kept in the
+// parameter cache, which are laid out the same way as the weights in forward.
+__kernel void backPropagateTransposed(__global const float* outputError,
+									  __global const float* output,
+									  __global float* inputError,
+									  __global const float* cache,
+									  const uint cacheOffset,
+									  const uint batchSize)
+{
+	__local float aTile[GEMM_TILE][GEMM_TILE_K + 1];
+	__local float bTile[GEMM_TILE][GEMM_TILE_K + 1];
+	float sums[GEMM_BLOCK][GEMM_BLOCK];
+	multiply(outputError, ACTIVATION ? output : 0, cache + cacheOffset, batchSize, INPUT_WIDTH, OUTPUT_WIDTH, true, true, sums, aTile, bTile);
+	storeInputError(inputError, batchSize, sums);
+}
+
+// cache = transpose of the weight matrix. Tiles are staged through local memory so that both
+// the reads and the writes are contiguous.
+__kernel void transpose(__global const float* params,
+						__global float* cache,
+						const uint paramOffset,
+						const uint cacheOffset)
+{
+	__local float tile[TRANSPOSE_TILE][TRANSPOSE_TILE + 1];
 
-	__local float temp[MAX_WORKGROUP_SIZE];
+	const __global float* weights = params + paramOffset + OUTPUT_WIDTH;
+	cache += cacheOffset;
 
-	size_t col = get_global_id(0);
-	size_t row = get_global_id(1);
+	const uint lx = get_local_id(0);
+	const uint ly = get_local_id(1);
+	const uint x0 = get_group_id(0) * TRANSPOSE_TILE;
+	const uint y0 = get_group_id(1) * TRANSPOSE_TILE;
 
-	if (col < inputWidth)
+	// read weights[y0 + ly][x0 + lx]
+	if (x0 + lx < INPUT_WIDTH && y0 + ly < OUTPUT_WIDTH)
 	{
-		const __global float* weights = params + outputWidth;
-		const __global float* outputError_ = outputError + row * outputWidth;
-		__global float* inputError_ = inputError + row * inputWidth;
-		float sum = 0;
+		tile[ly][lx] = weights[(y0 + ly) * INPUT_WIDTH + x0 + lx];
+	}
 
-		for (size_t i = col, j = 0; j < outputWidth; i += inputWidth, j++)
-		{
-			sum += weights[i] * outputError_[j];
-		}
+	barrier(CLK_LOCAL_MEM_FENCE);
 
-		inputError_[col] = sum;
+	// write cache[x0 + ly][y0 + lx]
+	if (y0 + lx < OUTPUT_WIDTH && x0 + ly < INPUT_WIDTH)
+	{
+		cache[(x0 + ly) * OUTPUT_WIDTH + y0 + lx] = tile[lx][ly];
 	}
 }
 
+// weight derivatives += outputError^T * input, bias derivatives += column sums of outputError.
+// Rows are neurons, columns inputs and the inner dimension is the batch. The work groups of the
+// first column of tiles also sum the output errors of their rows as they pass through local memory.
+// See backPropagate for output.
 __kernel void calculateDerivatives(__global const float* input,
 								   __global const float* outputError,
+								   __global const float* output,
 								   __global float* derivatives,
 								   const uint inputOffset,
 								   const uint paramOffset,
-								   const uint inputWidth,
-								   const uint outputWidth,
-								   const uint outputSize)
+								   const uint batchSize)
 {
-	derivatives += paramOffset;
+	__local float aTile[GEMM_TILE][GEMM_TILE_K + 1];
+	__local float bTile[GEMM_TILE][GEMM_TILE_K + 1];
 
 	input += inputOffset;
-	size_t col = get_global_id(0);
-	size_t row = get_global_id(1);
+	derivatives += paramOffset;
+
+	const uint lx = get_local_id(0);
+	const uint ly = get_local_id(1);
+	const uint row0 = get_group_id(1) * GEMM_TILE;
+	const uint col0 = get_group_id(0) * GEMM_TILE;
+	const bool biases = col0 == 0 && lx == 0;
+
+	float sums[GEMM_BLOCK][GEMM_BLOCK];
+	float biasSums[GEMM_BLOCK];
 
-	if (col < inputWidth)
+	for (uint r = 0; r < GEMM_BLOCK; ++r)
 	{
-		__global float* dw = derivatives + outputWidth + row * inputWidth + col;
+		biasSums[r] = 0.f;
 
-		for (uint i = col, j = row; j < outputSize; j += outputWidth, i += inputWidth)
+		for (uint c = 0; c < GEMM_BLOCK; ++c)
 		{
-			*dw += outputError[j] * input[i];
-			if (col == 0)
+			sums[r][c] = 0.f;
+		}
+	}
+
+	for (uint k0 = 0; k0 < batchSize; k0 += GEMM_TILE_K)
+	{
+		loadTile(aTile, outputError, ACTIVATION ? output : 0, row0, OUTPUT_WIDTH, k0, batchSize, false);
+		loadTile(bTile, input, 0, col0, INPUT_WIDTH, k0, batchSize, false);
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		multiplyTiles(aTile, bTile, sums);
+
+		if (biases)
+		{
+			for (uint r = 0; r < GEMM_BLOCK; ++r)
+			{
+				for (uint k = 0; k < GEMM_TILE_K; ++k)
+				{
+					biasSums[r] += aTile[ly + r * GEMM_GROUP][k];
+				}
+			}
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	for (uint r = 0; r < GEMM_BLOCK; ++r)
+	{
+		const uint neuron = blockRow(r);
+
+		if (neuron >= OUTPUT_WIDTH)
+		{
+			continue;
+		}
+
+		if (biases)
+		{
+			derivatives[neuron] += biasSums[r];
+		}
+
+		for (uint c = 0; c < GEMM_BLOCK; ++c)
+		{
+			const uint col = blockColumn(c);
+
+			if (col < INPUT_WIDTH)
 			{
-				derivatives[row] += outputError[j];
+				derivatives[OUTPUT_WIDTH + neuron * INPUT_WIDTH + col] += sums[r][c];
 			}
 		}
 	}
@@ -1,6 +1,11 @@
 #pragma once
 #include "layer.hpp"
+#include "sigmoid.hpp"
+#include "relu.hpp"
+#include "tanh.hpp"
 #include "..\..\utils\utils.hpp"
+#include "..\math\gemm.hpp"
+#include "..\math\sparse.hpp"
 
 namespace nn
 {
@@ -9,56 +14,120 @@ namespace layer
 class Dense : public Layer
 {
 public:
-	Dense(size_t inputSize, size_t outputSize) :
+	// If transposedWeights is set a transposed copy of the weights (inputSize x outputSize) is kept
+	// in the parameter cache so backpropagation reads it row by row.
+	Dense(size_t inputSize, size_t outputSize, bool transposedWeights = true) :
 		Layer(inputSize, outputSize, (inputSize + 1) * outputSize),
+		transposedWeights(transposedWeights),
+		sparseThreshold(0.f),
+		activation(Activation::None),
+		activationSlope(0.f),
 		forwardKernel(NULL),
 		backPropagateKernel(NULL),
-		calculateDerivativesKernel(NULL)
+		backPropagateTransposedKernel(NULL),
+		calculateDerivativesKernel(NULL),
+		transposeKernel(NULL)
 	{
 	}
 
 	void forward(const float* input, const float* params, float* output) const final
+	{
+		forwardBatch(input, params, output, 1);
+	}
+
+	void backPropagate(const BackPropData& data, float* inputError) const final
+	{
+		backPropagateBatch(data, inputError, 1);
+	}
+
+	void calculateDerivatives(const BackPropData& data, float* derivatives) const final
+	{
+		calculateDerivativesBatch(data, derivatives, 1);
+	}
+
+	// Threshold used for the first layer of a network with sparse input enabled. Below it the
+	// skipped work outweighs the cost of compressing the input and of not using the blocked SIMD
+	// product.
+	static constexpr float defaultSparseInputThreshold = 0.25f;
+
+	// Inputs with a smaller fraction of non-zero elements than threshold skip the zero columns
+	// in forward and calculateDerivatives. 0 (the default) turns the sparse path off. The device
+	// kernels always run the tiled products.
+	void setSparseInputThreshold(float threshold)
+	{
+		sparseThreshold = threshold;
+	}
+
+	// output = input * weights^T + bias
+	void forwardBatch(const float* input, const float* params, float* output, size_t batchSize, const float* cache = nullptr) const final
 	{
 		const float* bias = getBiases(params);
 		const float* weight = getWeights(params);
-		
-		for (size_t i = 0; i < outputSize; ++i)
+
+		for (size_t i = 0; i < batchSize; ++i)
 		{
-			output[i] = *bias++;
-			for (size_t j = 0; j < inputSize; ++j)
-			{
-				output[i] += input[j] * *weight++;
-			}
+			memcpy(output + i * outputSize, bias, outputSize * sizeof(float));
+		}
+
+		// Each output gathers its weights at the non-zero inputs
+		if (isSparse(input, batchSize, std::min(sparseThreshold, maxSparseForwardDensity)))
+		{
+			SparseScratch& scratch = getSparseScratch();
+			math::compress(input, batchSize, inputSize, scratch.input);
+			math::spmmNT(scratch.input, weight, output, batchSize, outputSize, inputSize);
+		}
+		else
+		{
+			math::gemmNT(input, weight, output, batchSize, outputSize, inputSize);
 		}
 	}
 
-	void backPropagate(const BackPropData& data, float* inputError) const final
+	// inputError = outputError * weights
+	void backPropagateBatch(const BackPropData& data, float* inputError, size_t batchSize) const final
 	{
-		memset(inputError, 0, inputSize * sizeof(float));
+		memset(inputError, 0, batchSize * inputSize * sizeof(float));
 
-		const float* weight = getWeights(data.params);
-
-		for (size_t i = 0; i < outputSize; ++i)
+		if (data.cache)
 		{
-			for (size_t j = 0; j < inputSize; ++j)
-			{
-				inputError[j] += data.outputError[i] * *weight++;
-			}
+			math::gemmNT(data.outputError, data.cache, inputError, batchSize, inputSize, outputSize);
+		}
+		else
+		{
+			math::gemmNN(data.outputError, getWeights(data.params), inputError, batchSize, inputSize, outputSize);
 		}
 	}
 
-	void calculateDerivatives(const BackPropData& data, float* derivatives) const final
+	// dw += outputError^T * input, db += column sums of outputError
+	void calculateDerivativesBatch(const BackPropData& data, float* derivatives, size_t batchSize) const final
 	{
 		float* db = getBiases(derivatives);
 		float* dw = getWeights(derivatives);
 
-		for (size_t i = 0; i < outputSize; ++i)
+		for (size_t i = 0; i < batchSize; ++i)
 		{
-			*db++ += data.outputError[i];
-			for (size_t j = 0; j < inputSize; ++j)
+			math::axpy(1.f, data.outputError + i * outputSize, db, outputSize);
+		}
+
+		if (isSparse(data.input, batchSize, sparseThreshold))
+		{
+			SparseScratch& scratch = getSparseScratch();
+			math::compress(data.input, batchSize, inputSize, scratch.input);
+
+			if (scratch.sums.size() < getWeightCount())
+			{
+				scratch.sums.resize(getWeightCount(), 0.f);
+			}
+
+			if (scratch.used.size() < inputSize)
 			{
-				*dw++ += data.outputError[i] * data.input[j];
+				scratch.used.resize(inputSize, 0);
 			}
+
+			math::spmmTN(data.outputError, scratch.input, dw, outputSize, inputSize, batchSize, scratch.sums.data(), scratch.used.data());
+		}
+		else
+		{
+			math::gemmTN(data.outputError, data.input, dw, outputSize, inputSize, batchSize);
 		}
 	}
 
@@ -78,22 +147,53 @@ public:
 		}
 	}
 
+	size_t getParameterCacheSize() const final
+	{
+		return transposedWeights ? getWeightCount() : 0;
+	}
+
+	void updateParameterCache(const float* params, float* cache) const final
+	{
+		const float* weight = getWeights(params);
+		const size_t tile = 32;
+
+		// Tiled so both matrices are walked a cache line at a time
+		for (size_t i0 = 0; i0 < outputSize; i0 += tile)
+		{
+			const size_t iEnd = std::min(i0 + tile, size_t(outputSize));
+
+			for (size_t j0 = 0; j0 < inputSize; j0 += tile)
+			{
+				const size_t jEnd = std::min(j0 + tile, size_t(inputSize));
+
+				for (size_t i = i0; i < iEnd; ++i)
+				{
+					for (size_t j = j0; j < jEnd; ++j)
+					{
+						cache[j * outputSize + i] = weight[i * inputSize + j];
+					}
+				}
+			}
+		}
+	}
+
 	void cl_forward(cl_command_queue queue, cl_mem input, cl_mem params, cl_mem output, uint32_t inOffset, uint32_t outOffset, uint32_t paramOffset, uint32_t batchSize) const final
 	{
-		uint32_t size = batchSize * outputSize;
-		size_t globalSize = cl::workGroupSize * size;
-		
+		cl_kernel kernel = forwardKernel;
+
+		// One work group per gemmTile x gemmTile block of (sample, neuron) outputs
+		size_t groupSize[2] = { gemmGroup, gemmGroup };
+		size_t globalSize[2] = { getGemmSize(outputSize), getGemmSize(batchSize) };
+
 		int error;
-		error = clSetKernelArg(forwardKernel, 0, sizeof(cl_mem), &input);
-		error |= clSetKernelArg(forwardKernel, 1, sizeof(cl_mem), &output);
-		error |= clSetKernelArg(forwardKernel, 2, sizeof(cl_mem), &params);
-		error |= clSetKernelArg(forwardKernel, 3, sizeof(inOffset), &inOffset);
-		error |= clSetKernelArg(forwardKernel, 4, sizeof(outOffset), &outOffset);
-		error |= clSetKernelArg(forwardKernel, 5, sizeof(paramOffset), &paramOffset);
-		error |= clSetKernelArg(forwardKernel, 6, sizeof(inputSize), &inputSize);
-		error |= clSetKernelArg(forwardKernel, 7, sizeof(outputSize), &outputSize);
-		error |= clSetKernelArg(forwardKernel, 8, sizeof(size), &size);
-		error |= clEnqueueNDRangeKernel(queue, forwardKernel, 1, NULL, &globalSize, &cl::workGroupSize, 0, NULL, NULL);
+		error = clSetKernelArg(kernel, 0, sizeof(cl_mem), &input);
+		error |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &output);
+		error |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &params);
+		error |= clSetKernelArg(kernel, 3, sizeof(inOffset), &inOffset);
+		error |= clSetKernelArg(kernel, 4, sizeof(outOffset), &outOffset);
+		error |= clSetKernelArg(kernel, 5, sizeof(paramOffset), &paramOffset);
+		error |= clSetKernelArg(kernel, 6, sizeof(batchSize), &batchSize);
+		error |= clEnqueueNDRangeKernel(queue, kernel, 2, NULL, globalSize, groupSize, 0, NULL, NULL);
 
 		if (error != CL_SUCCESS)
 		{
@@ -103,40 +203,48 @@ public:
 
 	void cl_backPropagate(cl_command_queue queue, const ClBackPropData& data, cl_mem inputError, uint32_t paramOffset, uint32_t batchSize) const final
 	{
-		size_t groupSize[2] = { cl::workGroupSize, 1 };
-		size_t globalSize[2] = { cl::alignSize(inputSize), batchSize };
-		
+		// Both read the weights a tile at a time, the transposed ones with the same layout as forward
+		cl_kernel kernel = data.cache ? backPropagateTransposedKernel : backPropagateKernel;
+		const cl_mem weights = data.cache ? data.cache : data.params;
+		const uint32_t offset = data.cache ? data.cacheOffset : paramOffset;
+
+		// One work group per gemmTile x gemmTile block of (sample, input) errors
+		size_t groupSize[2] = { gemmGroup, gemmGroup };
+		size_t globalSize[2] = { getGemmSize(inputSize), getGemmSize(batchSize) };
+
 		int error;
-		error = clSetKernelArg(backPropagateKernel, 0, sizeof(cl_mem), &data.outputError);
-		error |= clSetKernelArg(backPropagateKernel, 1, sizeof(cl_mem), &inputError);
-		error |= clSetKernelArg(backPropagateKernel, 2, sizeof(cl_mem), &data.params);
-		error |= clSetKernelArg(backPropagateKernel, 3, sizeof(paramOffset), &paramOffset);
-		error |= clSetKernelArg(backPropagateKernel, 4, sizeof(inputSize), &inputSize);
-		error |= clSetKernelArg(backPropagateKernel, 5, sizeof(outputSize), &outputSize);
-		error |= clEnqueueNDRangeKernel(queue, backPropagateKernel, 2, NULL, globalSize, groupSize, 0, NULL, NULL);
+		error = clSetKernelArg(kernel, 0, sizeof(cl_mem), &data.outputError);
+		error |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &data.output);
+		error |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &inputError);
+		error |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &weights);
+		error |= clSetKernelArg(kernel, 4, sizeof(offset), &offset);
+		error |= clSetKernelArg(kernel, 5, sizeof(batchSize), &batchSize);
+		error |= clEnqueueNDRangeKernel(queue, kernel, 2, NULL, globalSize, groupSize, 0, NULL, NULL);
 
 		if (error != CL_SUCCESS)
 		{
-			throw std::exception("Unexpected error in layer::dense::cl_calculateDerivatives()");
+			throw std::exception("Unexpected error in layer::dense::cl_backPropagate()");
 		}
 	}
 
 	void cl_calculateDerivatives(cl_command_queue queue, const ClBackPropData& data, cl_mem derivaitves, uint32_t paramOffset, uint32_t batchSize) const final
 	{
-		uint32_t size = batchSize * outputSize;
-		size_t groupSize[2] = { cl::workGroupSize, 1 };
-		size_t globalSize[2] = { cl::alignSize(inputSize), outputSize };
+		cl_kernel kernel = calculateDerivativesKernel;
+
+		// One work group per gemmTile x gemmTile block of (neuron, input) weights. The first
+		// column of blocks also sums the bias derivatives.
+		size_t groupSize[2] = { gemmGroup, gemmGroup };
+		size_t globalSize[2] = { getGemmSize(inputSize), getGemmSize(outputSize) };
 
 		int error;
-		error = clSetKernelArg(calculateDerivativesKernel, 0, sizeof(cl_mem), &data.input);
-		error |= clSetKernelArg(calculateDerivativesKernel, 1, sizeof(cl_mem), &data.outputError);
-		error |= clSetKernelArg(calculateDerivativesKernel, 2, sizeof(cl_mem), &derivaitves);
-		error |= clSetKernelArg(calculateDerivativesKernel, 3, sizeof(data.inputOffset), &data.inputOffset);
-		error |= clSetKernelArg(calculateDerivativesKernel, 4, sizeof(paramOffset), &paramOffset);
-		error |= clSetKernelArg(calculateDerivativesKernel, 5, sizeof(inputSize), &inputSize);
-		error |= clSetKernelArg(calculateDerivativesKernel, 6, sizeof(outputSize), &outputSize);
-		error |= clSetKernelArg(calculateDerivativesKernel, 7, sizeof(size), &size);
-		error |= clEnqueueNDRangeKernel(queue, calculateDerivativesKernel, 2, NULL, globalSize, groupSize, 0, NULL, NULL);
+		error = clSetKernelArg(kernel, 0, sizeof(cl_mem), &data.input);
+		error |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &data.outputError);
+		error |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &data.output);
+		error |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &derivaitves);
+		error |= clSetKernelArg(kernel, 4, sizeof(data.inputOffset), &data.inputOffset);
+		error |= clSetKernelArg(kernel, 5, sizeof(paramOffset), &paramOffset);
+		error |= clSetKernelArg(kernel, 6, sizeof(batchSize), &batchSize);
+		error |= clEnqueueNDRangeKernel(queue, kernel, 2, NULL, globalSize, groupSize, 0, NULL, NULL);
 
 		if (error != CL_SUCCESS)
 		{
@@ -146,13 +254,11 @@ public:
 
 	void cl_initializeParameters(cl_command_queue queue, cl_mem params, uint32_t offset) const final
 	{
-		size_t globalSize = cl::workGroupSize * outputSize;
 
 		int error;
 		error = clSetKernelArg(initKernel, 0, sizeof(cl_mem), &params);
-		error |= clSetKernelArg(initKernel, 1, sizeof(inputSize), &inputSize);
-		error |= clSetKernelArg(initKernel, 2, sizeof(offset), &offset);
-		error |= clEnqueueNDRangeKernel(queue, initKernel, 1, NULL, &globalSize, &cl::workGroupSize, 0, NULL, NULL);
+		error |= clSetKernelArg(initKernel, 1, sizeof(offset), &offset);
+		error |= cl::enqueueGroups(queue, initKernel, outputSize, inputSize, { params });
 
 		if (error != CL_SUCCESS)
 		{
@@ -160,14 +266,76 @@ public:
 		}
 	}
 
+	size_t cl_getParameterCacheSize() const final { return getParameterCacheSize(); }
+
+	void cl_updateParameterCache(cl_command_queue queue, cl_mem params, cl_mem cache, uint32_t paramOffset, uint32_t cacheOffset) const final
+	{
+		size_t groupSize[2] = { transposeTile, transposeTile };
+		size_t globalSize[2] = { roundUp(inputSize, transposeTile), roundUp(outputSize, transposeTile) };
+
+		int error;
+		error = clSetKernelArg(transposeKernel, 0, sizeof(cl_mem), &params);
+		error |= clSetKernelArg(transposeKernel, 1, sizeof(cl_mem), &cache);
+		error |= clSetKernelArg(transposeKernel, 2, sizeof(paramOffset), &paramOffset);
+		error |= clSetKernelArg(transposeKernel, 3, sizeof(cacheOffset), &cacheOffset);
+		error |= clEnqueueNDRangeKernel(queue, transposeKernel, 2, NULL, globalSize, groupSize, 0, NULL, NULL);
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::dense::cl_updateParameterCache()");
+		}
+	}
+
+	// Applies next to the output in the epilogue of forward, and its derivative to the output
+	// error as it is loaded in backPropagate and calculateDerivatives, if next is an activation.
+	// Takes effect when the kernels are built.
+	bool cl_fuseActivation(const Layer& next) final
+	{
+		if (next.getInputSize() != outputSize)
+		{
+			return false;
+		}
+
+		if (dynamic_cast<const Sigmoid*>(&next))
+		{
+			activation = Activation::Sigmoid;
+		}
+		else if (const Relu* relu = dynamic_cast<const Relu*>(&next))
+		{
+			activation = Activation::Relu;
+			activationSlope = relu->getAlpha();
+		}
+		else if (dynamic_cast<const Tanh*>(&next))
+		{
+			activation = Activation::Tanh;
+		}
+
+		return activation != Activation::None;
+	}
+
 	void cl_initKernels(cl_context context, cl_device_id device) final
 	{
-		// TODO: calculate workgroup size
-		auto program = cl::buildProgramFromFile(__FILE__, context, device);
+		uint32_t slopeBits;
+		memcpy(&slopeBits, &activationSlope, sizeof(slopeBits));
+
+		// The widths and tile sizes are compiled in, so the products have constant loop bounds.
+		// The slope is passed as its bit pattern to keep it exact.
+		auto options = cl::defines({
+			{ "INPUT_WIDTH", inputSize },
+			{ "OUTPUT_WIDTH", outputSize },
+			{ "TRANSPOSE_TILE", transposeTile },
+			{ "GEMM_TILE", gemmTile },
+			{ "GEMM_GROUP", gemmGroup },
+			{ "GEMM_BLOCK", gemmBlock },
+			{ "ACTIVATION", size_t(activation) },
+			{ "ACTIVATION_SLOPE", slopeBits } });
+		auto program = cl::buildProgramFromFile(__FILE__, context, device, options);
 
 		int error;
 		forwardKernel = clCreateKernel(program, "forward", &error);
 		backPropagateKernel = clCreateKernel(program, "backPropagate", &error);
+		backPropagateTransposedKernel = clCreateKernel(program, "backPropagateTransposed", &error);
+		transposeKernel = clCreateKernel(program, "transpose", &error);
 		calculateDerivativesKernel = clCreateKernel(program, "calculateDerivatives", &error);
 		initKernel = clCreateKernel(program, "initParams", &error);
 
@@ -183,12 +351,79 @@ public:
 	float* getWeights(float* parameters)       const { return parameters + outputSize; }
 
 private:
+	bool isSparse(const float* input, size_t batchSize, float threshold) const
+	{
+		const size_t size = batchSize * inputSize;
+		return threshold > 0.f && float(math::countNonZero(input, size)) < threshold * float(size);
+	}
+
+	// Gathering the weights at the non-zeros stops paying off against the blocked product sooner
+	// than the scatter of calculateDerivatives does
+	static constexpr float maxSparseForwardDensity = 0.15f;
+
+	size_t getWeightCount() const { return size_t(inputSize) * outputSize; }
+
+	struct SparseScratch
+	{
+		// compressed input batch
+		math::SparseMatrix input;
+
+		// transposed weight derivatives, kept zeroed between uses
+		std::vector<float> sums;
+
+		// inputs that had a non-zero in the batch
+		std::vector<uint8_t> used;
+	};
+
+	// One per thread, shared by all Dense layers
+	static SparseScratch& getSparseScratch()
+	{
+		static thread_local SparseScratch scratch;
+		return scratch;
+	}
+
+	static size_t roundUp(size_t size, size_t multiple) { return (size + multiple - 1) / multiple * multiple; }
+
+	// passed to dense.cl as ACTIVATION, must match the ACTIVATION_ values there
+	enum class Activation
+	{
+		None,
+		Sigmoid,
+		Relu,
+		Tanh
+	};
+
+	// passed to dense.cl as TRANSPOSE_TILE
+	static const size_t transposeTile = 16;
+
+	// passed to dense.cl as GEMM_TILE, GEMM_GROUP and GEMM_BLOCK
+	static const size_t gemmTile = 32;
+	static const size_t gemmGroup = 8;
+	static const size_t gemmBlock = 4;
+
+	// Global size along a dimension of a tiled product, one work item per gemmBlock elements
+	static size_t getGemmSize(size_t size) { return roundUp(size, gemmTile) / gemmBlock; }
+
+	const bool transposedWeights;
+
+	float sparseThreshold;
+
+	// activation applied by the device kernels, see cl_fuseActivation
+	Activation activation;
+
+	// slope for negative inputs of a fused leaky ReLU
+	float activationSlope;
+
 	cl_kernel forwardKernel;
 
 	cl_kernel backPropagateKernel;
 
+	cl_kernel backPropagateTransposedKernel;
+
 	cl_kernel calculateDerivativesKernel;
 
+	cl_kernel transposeKernel;
+
 	cl_kernel initKernel;
 };
 }
@@ -0,0 +1,203 @@
+#define MAX_WORKGROUP_SIZE (256)
+
+// Set by layer::DepthwiseConv2d when the program is built: INPUT_WIDTH, INPUT_HEIGHT, CHANNELS,
+// FILTER_WIDTH, FILTER_HEIGHT, STEP_X, STEP_Y, OUTPUT_WIDTH and OUTPUT_HEIGHT.
+// Parameters are one bias per channel followed by one filterHeight x filterWidth filter per channel.
+
+inline uint updateSeed(uint seed)
+{
+	return seed = 0xa6718293 * seed + 0x638c571f;
+}
+
+inline float fastRand(float min, float max, uint* seed)
+{
+	*seed = updateSeed(*seed);
+	return ((float)((*seed >> 16) & 0x7FFF) / (float)(0x7FFF)) * (max - min) + min;
+}
+
+// One work group per channel
+__kernel void initParams(__global float* params,
+						 const uint paramOffset)
+{
+	params += paramOffset;
+	const uint filterSize = FILTER_WIDTH * FILTER_HEIGHT;
+	const float sd = rsqrt((float)filterSize);
+	const size_t stride = get_local_size(0);
+	const size_t lid = get_local_id(0);
+	const size_t wid = get_group_id(0);
+	const size_t channels = get_num_groups(0);
+	__global float* weights = params + channels + wid * filterSize;
+	uint seed = get_global_id(0);
+
+	for (size_t i = lid; i < filterSize; i += stride)
+	{
+		weights[i] = fastRand(-sd, sd, &seed);
+	}
+
+	if (lid == 0)
+	{
+		params[wid] = 0;
+	}
+}
+
+// One work item per output element. Neighbouring work items read neighbouring inputs, and the
+// filter of a channel is shared by a whole row, so both stay in cache.
+__kernel void forward(__global const float* input,
+					  __global float* output,
+					  __global const float* params,
+					  const uint inputOffset,
+					  const uint outputOffset,
+					  const uint paramOffset,
+					  const uint size)			// batch size * output size
+{
+	input += inputOffset;
+	output += outputOffset;
+	params += paramOffset;
+
+	const uint channels = CHANNELS;
+	const uint filterSize = FILTER_WIDTH * FILTER_HEIGHT;
+	const uint positions = OUTPUT_WIDTH * OUTPUT_HEIGHT;
+	uint gid = get_global_id(0);
+	uint stride = get_global_size(0);
+
+	for (uint i = gid; i < size; i += stride)
+	{
+		// i = (sample * channels + c) * positions + y * width + x
+		const uint map = i / positions;
+		const uint c = map % channels;
+		const uint p = i - map * positions;
+		const uint y = p / OUTPUT_WIDTH;
+		const uint x = p - y * OUTPUT_WIDTH;
+
+		__global const float* in = input + (map * INPUT_HEIGHT + y * STEP_Y) * INPUT_WIDTH + x * STEP_X;
+		__global const float* filter = params + channels + c * filterSize;
+		float sum = params[c];
+
+		for (uint fy = 0; fy < FILTER_HEIGHT; ++fy)
+		{
+			for (uint fx = 0; fx < FILTER_WIDTH; ++fx)
+			{
+				sum += filter[fy * FILTER_WIDTH + fx] * in[fy * INPUT_WIDTH + fx];
+			}
+		}
+
+		output[i] = sum;
+	}
+}
+
+// One work item per input element, so every element is written once and nothing needs clearing.
+// Only the outputs whose window covers the element contribute.
+__kernel void backPropagate(__global const float* outputError,
+							__global float* inputError,
+							__global const float* params,
+							const uint paramOffset,
+							const uint size)	// batch size * input size
+{
+	params += paramOffset;
+
+	const uint channels = CHANNELS;
+	const uint filterSize = FILTER_WIDTH * FILTER_HEIGHT;
+	const uint area = INPUT_WIDTH * INPUT_HEIGHT;
+	uint gid = get_global_id(0);
+	uint stride = get_global_size(0);
+
+	for (uint i = gid; i < size; i += stride)
+	{
+		const uint map = i / area;
+		const uint c = map % channels;
+		const uint p = i - map * area;
+		const uint y = p / INPUT_WIDTH;
+		const uint x = p - y * INPUT_WIDTH;
+
+		__global const float* error = outputError + map * OUTPUT_WIDTH * OUTPUT_HEIGHT;
+		__global const float* filter = params + channels + c * filterSize;
+		float sum = 0.f;
+
+		for (uint fy = 0; fy < FILTER_HEIGHT && fy <= y; ++fy)
+		{
+			const uint oy = (y - fy) / STEP_Y;
+
+			if (oy * STEP_Y != y - fy || oy >= OUTPUT_HEIGHT)
+			{
+				continue;
+			}
+
+			for (uint fx = 0; fx < FILTER_WIDTH && fx <= x; ++fx)
+			{
+				const uint ox = (x - fx) / STEP_X;
+
+				if (ox * STEP_X == x - fx && ox < OUTPUT_WIDTH)
+				{
+					sum += filter[fy * FILTER_WIDTH + fx] * error[oy * OUTPUT_WIDTH + ox];
+				}
+			}
+		}
+
+		inputError[i] = sum;
+	}
+}
+
+// One work group per parameter, each reducing over every output position of the batch
+__kernel void calculateDerivatives(__global const float* input,
+								   __global const float* outputError,
+								   __global float* derivatives,
+								   const uint inputOffset,
+								   const uint paramOffset,
+								   const uint batchSize)
+{
+	input += inputOffset;
+	derivatives += paramOffset;
+
+	__local float temp[MAX_WORKGROUP_SIZE];
+
+	const uint channels = CHANNELS;
+	const uint filterSize = FILTER_WIDTH * FILTER_HEIGHT;
+	const uint positions = OUTPUT_WIDTH * OUTPUT_HEIGHT;
+	const uint count = batchSize * positions;
+
+	const uint localSize = get_local_size(0);
+	const uint lid = get_local_id(0);
+	const uint wid = get_group_id(0);
+	const bool bias = wid < channels;
+	const uint c = bias ? wid : (wid - channels) / filterSize;
+	const uint k = bias ? 0 : wid - channels - c * filterSize;
+	const uint fy = k / FILTER_WIDTH;
+	const uint fx = k - fy * FILTER_WIDTH;
+
+	float sum = 0.f;
+
+	for (uint i = lid; i < count; i += localSize)
+	{
+		const uint sample = i / positions;
+		const uint p = i - sample * positions;
+		const uint map = sample * channels + c;
+		const float error = outputError[map * positions + p];
+
+		if (bias)
+		{
+			sum += error;
+		}
+		else
+		{
+			const uint oy = p / OUTPUT_WIDTH;
+			const uint ox = p - oy * OUTPUT_WIDTH;
+			sum += error * input[(map * INPUT_HEIGHT + oy * STEP_Y + fy) * INPUT_WIDTH + ox * STEP_X + fx];
+		}
+	}
+
+	temp[lid] = sum;
+
+	for (uint i = localSize / 2; i > 0; i /= 2)
+	{
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lid < i)
+		{
+			temp[lid] += temp[lid + i];
+		}
+	}
+
+	if (lid == 0)
+	{
+		derivatives[wid] += temp[0];
+	}
+}
@@ -0,0 +1,331 @@
+#pragma once
+#include "layer.hpp"
+#include "conv2d.hpp"
+#include "..\..\include\shape.hpp"
+#include "..\..\utils\utils.hpp"
+#include "..\math\kernels.hpp"
+
+namespace nn
+{
+namespace layer
+{
+// Depthwise 2D convolution without padding. Each channel of a (channels, height, width) input is
+// convolved with a filter of its own, so the output is (channels, outputHeight, outputWidth).
+// Followed by a 1x1 Conv2d (which runs as a plain matrix product) it makes a depthwise separable
+// convolution.
+//
+// With a step of 1 along x each filter element adds a scaled row of input to a row of output,
+// so every pass is made of the SIMD axpy and dot kernels over whole rows.
+class DepthwiseConv2d : public Layer
+{
+public:
+	// filterSize and filterStep are { height, width }
+	DepthwiseConv2d(Shape<3> inputShape, Shape<2> filterSize, Shape<2> filterStep = Shape<2>({ 1, 1 })) :
+		Layer(inputShape.size(),
+			inputShape.length(0) * Conv2d::getOutputLength(inputShape.length(1), filterSize.length(0), filterStep.length(0)) * Conv2d::getOutputLength(inputShape.length(2), filterSize.length(1), filterStep.length(1)),
+			inputShape.length(0) * (filterSize.size() + 1)),
+		channels(uint32_t(inputShape.length(0))),
+		inputHeight(uint32_t(inputShape.length(1))),
+		inputWidth(uint32_t(inputShape.length(2))),
+		filterHeight(uint32_t(filterSize.length(0))),
+		filterWidth(uint32_t(filterSize.length(1))),
+		stepY(uint32_t(filterStep.length(0))),
+		stepX(uint32_t(filterStep.length(1))),
+		outputHeight(uint32_t(Conv2d::getOutputLength(inputHeight, filterHeight, stepY))),
+		outputWidth(uint32_t(Conv2d::getOutputLength(inputWidth, filterWidth, stepX))),
+		forwardKernel(NULL),
+		backPropagateKernel(NULL),
+		calculateDerivativesKernel(NULL),
+		initKernel(NULL)
+	{
+	}
+
+	Shape<3> getOutputShape() const { return Shape<3>({ channels, outputHeight, outputWidth }); }
+
+	void forward(const float* input, const float* params, float* output) const final
+	{
+		forwardBatch(input, params, output, 1);
+	}
+
+	void backPropagate(const BackPropData& data, float* inputError) const final
+	{
+		backPropagateBatch(data, inputError, 1);
+	}
+
+	void calculateDerivatives(const BackPropData& data, float* derivatives) const final
+	{
+		calculateDerivativesBatch(data, derivatives, 1);
+	}
+
+	// output row += filter element * input row, for every filter element over each output row
+	void forwardBatch(const float* input, const float* params, float* output, size_t batchSize, const float* = nullptr) const final
+	{
+		const float* bias = getBiases(params);
+		const float* filter = getFilters(params);
+
+		for (size_t n = 0; n < batchSize; ++n)
+		{
+			for (size_t c = 0; c < channels; ++c)
+			{
+				std::fill_n(output + (n * channels + c) * getPositionCount(), getPositionCount(), bias[c]);
+			}
+		}
+
+		forEachRow(batchSize, [&](size_t k, size_t outputRow, size_t inputRow)
+		{
+			const float w = filter[k];
+			const float* in = input + inputRow;
+			float* out = output + outputRow;
+
+			if (stepX == 1)
+			{
+				math::axpy(w, in, out, outputWidth);
+			}
+			else
+			{
+				for (size_t x = 0; x < outputWidth; ++x)
+				{
+					out[x] += w * in[x * stepX];
+				}
+			}
+		});
+	}
+
+	void backPropagateBatch(const BackPropData& data, float* inputError, size_t batchSize) const final
+	{
+		const float* filter = getFilters(data.params);
+
+		memset(inputError, 0, batchSize * inputSize * sizeof(float));
+
+		forEachRow(batchSize, [&](size_t k, size_t outputRow, size_t inputRow)
+		{
+			const float w = filter[k];
+			const float* error = data.outputError + outputRow;
+			float* in = inputError + inputRow;
+
+			if (stepX == 1)
+			{
+				math::axpy(w, error, in, outputWidth);
+			}
+			else
+			{
+				for (size_t x = 0; x < outputWidth; ++x)
+				{
+					in[x * stepX] += w * error[x];
+				}
+			}
+		});
+	}
+
+	void calculateDerivativesBatch(const BackPropData& data, float* derivatives, size_t batchSize) const final
+	{
+		float* db = getBiases(derivatives);
+		float* df = getFilters(derivatives);
+
+		for (size_t n = 0; n < batchSize; ++n)
+		{
+			for (size_t c = 0; c < channels; ++c)
+			{
+				const float* error = data.outputError + (n * channels + c) * getPositionCount();
+				float sum = 0.f;
+
+				for (size_t p = 0; p < getPositionCount(); ++p)
+				{
+					sum += error[p];
+				}
+
+				db[c] += sum;
+			}
+		}
+
+		forEachRow(batchSize, [&](size_t k, size_t outputRow, size_t inputRow)
+		{
+			const float* error = data.outputError + outputRow;
+			const float* in = data.input + inputRow;
+
+			if (stepX == 1)
+			{
+				df[k] += math::dot(error, in, outputWidth);
+			}
+			else
+			{
+				for (size_t x = 0; x < outputWidth; ++x)
+				{
+					df[k] += error[x] * in[x * stepX];
+				}
+			}
+		});
+	}
+
+	void initializeParameters(float* params) const final
+	{
+		const auto sd = 1.f / (float)sqrt(getFilterSize());
+		float* bias = getBiases(params);
+		float* filter = getFilters(params);
+
+		for (size_t c = 0; c < channels; ++c)
+		{
+			*bias++ = fastUniformRand(-1.f, 1.f);
+			for (size_t i = 0; i < getFilterSize(); ++i)
+			{
+				*filter++ = fastUniformRand(-sd, sd);
+			}
+		}
+	}
+
+	// One work item per output element
+	void cl_forward(cl_command_queue queue, cl_mem input, cl_mem params, cl_mem output, uint32_t inOffset, uint32_t outOffset, uint32_t paramOffset, uint32_t batchSize) const final
+	{
+		uint32_t size = batchSize * outputSize;
+
+		int error;
+		error = clSetKernelArg(forwardKernel, 0, sizeof(cl_mem), &input);
+		error |= clSetKernelArg(forwardKernel, 1, sizeof(cl_mem), &output);
+		error |= clSetKernelArg(forwardKernel, 2, sizeof(cl_mem), &params);
+		error |= clSetKernelArg(forwardKernel, 3, sizeof(inOffset), &inOffset);
+		error |= clSetKernelArg(forwardKernel, 4, sizeof(outOffset), &outOffset);
+		error |= clSetKernelArg(forwardKernel, 5, sizeof(paramOffset), &paramOffset);
+		error |= clSetKernelArg(forwardKernel, 6, sizeof(size), &size);
+		error |= cl::enqueue(queue, forwardKernel, size, { output });
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::depthwiseConv2d::cl_forward()");
+		}
+	}
+
+	// One work item per input element, gathering from the outputs whose windows cover it
+	void cl_backPropagate(cl_command_queue queue, const ClBackPropData& data, cl_mem inputError, uint32_t paramOffset, uint32_t batchSize) const final
+	{
+		uint32_t size = batchSize * inputSize;
+
+		int error;
+		error = clSetKernelArg(backPropagateKernel, 0, sizeof(cl_mem), &data.outputError);
+		error |= clSetKernelArg(backPropagateKernel, 1, sizeof(cl_mem), &inputError);
+		error |= clSetKernelArg(backPropagateKernel, 2, sizeof(cl_mem), &data.params);
+		error |= clSetKernelArg(backPropagateKernel, 3, sizeof(paramOffset), &paramOffset);
+		error |= clSetKernelArg(backPropagateKernel, 4, sizeof(size), &size);
+		error |= cl::enqueue(queue, backPropagateKernel, size, { inputError });
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::depthwiseConv2d::cl_backPropagate()");
+		}
+	}
+
+	void cl_calculateDerivatives(cl_command_queue queue, const ClBackPropData& data, cl_mem derivaitves, uint32_t paramOffset, uint32_t batchSize) const final
+	{
+		// one work group per parameter
+		int error;
+		error = clSetKernelArg(calculateDerivativesKernel, 0, sizeof(cl_mem), &data.input);
+		error |= clSetKernelArg(calculateDerivativesKernel, 1, sizeof(cl_mem), &data.outputError);
+		error |= clSetKernelArg(calculateDerivativesKernel, 2, sizeof(cl_mem), &derivaitves);
+		error |= clSetKernelArg(calculateDerivativesKernel, 3, sizeof(data.inputOffset), &data.inputOffset);
+		error |= clSetKernelArg(calculateDerivativesKernel, 4, sizeof(paramOffset), &paramOffset);
+		error |= clSetKernelArg(calculateDerivativesKernel, 5, sizeof(batchSize), &batchSize);
+		error |= cl::enqueueGroups(queue, calculateDerivativesKernel, parmeterCount, batchSize * (outputSize / channels), { derivaitves });
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::depthwiseConv2d::cl_calculateDerivatives()");
+		}
+	}
+
+	void cl_initializeParameters(cl_command_queue queue, cl_mem params, uint32_t offset) const final
+	{
+		int error;
+		error = clSetKernelArg(initKernel, 0, sizeof(cl_mem), &params);
+		error |= clSetKernelArg(initKernel, 1, sizeof(offset), &offset);
+		error |= cl::enqueueGroups(queue, initKernel, channels, getFilterSize(), { params });
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::depthwiseConv2d::cl_initializeParameters()");
+		}
+	}
+
+	void cl_initKernels(cl_context context, cl_device_id device) final
+	{
+		auto options = cl::defines({
+			{ "INPUT_WIDTH", inputWidth },
+			{ "INPUT_HEIGHT", inputHeight },
+			{ "CHANNELS", channels },
+			{ "FILTER_WIDTH", filterWidth },
+			{ "FILTER_HEIGHT", filterHeight },
+			{ "STEP_X", stepX },
+			{ "STEP_Y", stepY },
+			{ "OUTPUT_WIDTH", outputWidth },
+			{ "OUTPUT_HEIGHT", outputHeight } });
+		auto program = cl::buildProgramFromFile(__FILE__, context, device, options);
+
+		int error;
+		forwardKernel = clCreateKernel(program, "forward", &error);
+		backPropagateKernel = clCreateKernel(program, "backPropagate", &error);
+		calculateDerivativesKernel = clCreateKernel(program, "calculateDerivatives", &error);
+		initKernel = clCreateKernel(program, "initParams", &error);
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error while creating kernel(s) for layer::depthwiseConv2d.");
+		}
+	}
+
+	// channels biases followed by the filters, each filterHeight x filterWidth
+	const float* getBiases(const float* parameters) const { return parameters; }
+	float* getBiases(float* parameters)       const { return parameters; }
+	const float* getFilters(const float* parameters) const { return parameters + channels; }
+	float* getFilters(float* parameters)       const { return parameters + channels; }
+
+private:
+	size_t getFilterSize() const { return size_t(filterHeight) * filterWidth; }
+
+	size_t getPositionCount() const { return size_t(outputHeight) * outputWidth; }
+
+	// Calls f(filter element, output row, first input under the row) for every filter element
+	// (indexed across all channels) and every output row of the batch. Rows are offsets from
+	// the start of the batch.
+	template<typename F>
+	void forEachRow(size_t batchSize, const F& f) const
+	{
+		for (size_t n = 0; n < batchSize; ++n)
+		{
+			for (size_t c = 0; c < channels; ++c)
+			{
+				for (size_t y = 0; y < outputHeight; ++y)
+				{
+					const size_t outputRow = n * outputSize + (c * outputHeight + y) * outputWidth;
+
+					for (size_t i = 0; i < filterHeight; ++i)
+					{
+						const size_t inputRow = n * inputSize + (c * inputHeight + y * stepY + i) * inputWidth;
+
+						for (size_t j = 0; j < filterWidth; ++j)
+						{
+							f((c * filterHeight + i) * filterWidth + j, outputRow, inputRow + j);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	const uint32_t channels;
+	const uint32_t inputHeight;
+	const uint32_t inputWidth;
+	const uint32_t filterHeight;
+	const uint32_t filterWidth;
+	const uint32_t stepY;
+	const uint32_t stepX;
+	const uint32_t outputHeight;
+	const uint32_t outputWidth;
+
+	cl_kernel forwardKernel;
+
+	cl_kernel backPropagateKernel;
+
+	cl_kernel calculateDerivativesKernel;
+
+	cl_kernel initKernel;
+};
+}
+}
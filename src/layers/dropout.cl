@@ -0,0 +1,78 @@
+// Philox4x32-10, the same as math::philox4x32 in math/philox.hpp
+inline uint4 philox4x32(uint4 counter, uint2 key)
+{
+	for (int round = 0; round < 10; ++round)
+	{
+		const uint hi0 = mul_hi(0xD2511F53u, counter.x);
+		const uint lo0 = 0xD2511F53u * counter.x;
+		const uint hi1 = mul_hi(0xCD9E8D57u, counter.z);
+		const uint lo1 = 0xCD9E8D57u * counter.z;
+
+		counter = (uint4)(hi1 ^ counter.y ^ key.x, lo1, hi0 ^ counter.w ^ key.y, lo0);
+		key += (uint2)(0x9E3779B9u, 0xBB67AE85u);
+	}
+
+	return counter;
+}
+
+// output = input * mask * scale for the 4 elements of block. scale = 1 / (1 - rate) comes from
+// the host so the results match it exactly.
+inline void applyMask(__global const float* input, __global float* output, const uint2 key, const uint step, const float rate, const float scale, const uint block, const uint size)
+{
+	const uint4 random = philox4x32((uint4)(block, step, 0, 0), key);
+	const uint bits[4] = { random.x, random.y, random.z, random.w };
+
+	for (uint j = 0; j < 4 && block * 4 + j < size; ++j)
+	{
+		const uint i = block * 4 + j;
+		const float uniform = (float)(bits[j] >> 8) * (1.f / 16777216.f);
+		output[i] = uniform < rate ? 0.f : input[i] * scale;
+	}
+}
+
+// One work item per block of 4 elements. input and output may be the same buffer.
+__kernel void forwardTraining(__global const float* input,
+							  __global float* output,
+							  __global uint* state,		// OUTPUT -> step of the batch
+							  const uint inputOffset,
+							  const uint outputOffset,
+							  const uint2 key,			// seed
+							  const uint step,
+							  const float rate,
+							  const float scale,
+							  const uint size)			// batch size * input size
+{
+	input += inputOffset;
+	output += outputOffset;
+	uint gid = get_global_id(0);
+	uint stride = get_global_size(0);
+
+	if (gid == 0)
+	{
+		state[0] = step;
+	}
+
+	for (uint block = gid; block * 4 < size; block += stride)
+	{
+		applyMask(input, output, key, step, rate, scale, block, size);
+	}
+}
+
+// The mask is generated again from the step saved by forwardTraining
+__kernel void backPropagate(__global const float* outputError,
+							__global float* inputError,
+							__global const uint* state,
+							const uint2 key,
+							const float rate,
+							const float scale,
+							const uint size)
+{
+	const uint step = state[0];
+	uint gid = get_global_id(0);
+	uint stride = get_global_size(0);
+
+	for (uint block = gid; block * 4 < size; block += stride)
+	{
+		applyMask(outputError, inputError, key, step, rate, scale, block, size);
+	}
+}
@@ -0,0 +1,196 @@
+#pragma once
+#include "layer.hpp"
+#include "../cl/cl_utils.hpp"
+#include "../math/philox.hpp"
+#include <algorithm>
+#include <atomic>
+
+namespace nn
+{
+namespace layer
+{
+// Inverted dropout. While training each input is zeroed with probability rate and the rest are
+// scaled by 1 / (1 - rate), so inference is the identity.
+//
+// Masks are never stored. Element i of a batch is kept if Philox keyed by (seed, step, i) says
+// so, where step counts the batches the layer has been trained on. Only the step is saved as
+// state and backpropagation generates the same mask again.
+//
+// A batch here is what one forwardTrainingBatch or cl_forwardTraining call sees: the networks
+// split mini-batches into chunks of at most 128 samples, and the host also splits them between
+// threads, with each chunk taking a step of its own. Given the same sequence of calls the host
+// and device generate identical masks, so a network gets the same masks on both only when it
+// trains on one thread with mini-batches of at most 128 samples. Otherwise the masks differ
+// but remain independent draws with the same rate.
+class Dropout : public Layer
+{
+public:
+	Dropout(size_t size, float rate, uint64_t seed = 0) :
+		Layer(size, size, 0),
+		rate(rate),
+		scale(1.f / (1.f - rate)),
+		seed(seed),
+		step(0),
+		forwardKernel(NULL),
+		backPropagateKernel(NULL)
+	{
+		if (size == 0)
+		{
+			throw std::invalid_argument("Cannot have a layer with size 0.");
+		}
+
+		if (!(rate >= 0.f && rate < 1.f))
+		{
+			throw std::invalid_argument("Dropout rate must be at least 0 and less than 1.");
+		}
+	}
+
+	float getRate() const { return rate; }
+
+	void forward(const float* input, const float* params, float* output) const final
+	{
+		forwardBatch(input, params, output, 1);
+	}
+
+	void backPropagate(const BackPropData& data, float* inputError) const final
+	{
+		backPropagateBatch(data, inputError, 1);
+	}
+
+	bool canRunInPlace() const final { return true; }
+
+	// The step of the batch. Only the first sample's slot is used.
+	size_t getTrainingStateSize() const final { return 1; }
+
+	void forwardBatch(const float* input, const float*, float* output, size_t batchSize, const float* = nullptr) const final
+	{
+		if (input != output)
+		{
+			std::copy(input, input + batchSize * inputSize, output);
+		}
+	}
+
+	void forwardTrainingBatch(const float* input, const float*, float* output, float* state, size_t batchSize, const float* = nullptr) const final
+	{
+		// Threads training on different chunks of a mini-batch each take a step of their own
+		const uint32_t batchStep = step++;
+		*reinterpret_cast<uint32_t*>(state) = batchStep;
+		applyMask(input, output, batchStep, batchSize * inputSize);
+	}
+
+	void backPropagateBatch(const BackPropData& data, float* inputError, size_t batchSize) const final
+	{
+		assert(data.state);
+		applyMask(data.outputError, inputError, *reinterpret_cast<const uint32_t*>(data.state), batchSize * inputSize);
+	}
+
+	// Copies unless the layer runs in place
+	void cl_forward(cl_command_queue queue, cl_mem input, cl_mem, cl_mem output, uint32_t inOffset, uint32_t outOffset, uint32_t, uint32_t batchSize) const final
+	{
+		if (input == output && inOffset == outOffset)
+		{
+			return;
+		}
+
+		int error = clEnqueueCopyBuffer(queue, input, output, inOffset * sizeof(float), outOffset * sizeof(float), batchSize * inputSize * sizeof(float), 0, NULL, NULL);
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::dropout::cl_forward()");
+		}
+	}
+
+	void cl_forwardTraining(cl_command_queue queue, cl_mem input, cl_mem, cl_mem output, cl_mem state, uint32_t inOffset, uint32_t outOffset, uint32_t, uint32_t batchSize) const final
+	{
+		uint32_t size = batchSize * inputSize;
+		const uint32_t batchStep = step++;
+		const cl_uint2 key = cl_getKey();
+
+		int error;
+		error = clSetKernelArg(forwardKernel, 0, sizeof(cl_mem), &input);
+		error |= clSetKernelArg(forwardKernel, 1, sizeof(cl_mem), &output);
+		error |= clSetKernelArg(forwardKernel, 2, sizeof(cl_mem), &state);
+		error |= clSetKernelArg(forwardKernel, 3, sizeof(inOffset), &inOffset);
+		error |= clSetKernelArg(forwardKernel, 4, sizeof(outOffset), &outOffset);
+		error |= clSetKernelArg(forwardKernel, 5, sizeof(key), &key);
+		error |= clSetKernelArg(forwardKernel, 6, sizeof(batchStep), &batchStep);
+		error |= clSetKernelArg(forwardKernel, 7, sizeof(rate), &rate);
+		error |= clSetKernelArg(forwardKernel, 8, sizeof(scale), &scale);
+		error |= clSetKernelArg(forwardKernel, 9, sizeof(size), &size);
+		error |= cl::enqueue(queue, forwardKernel, (size + 3) / 4, { output, state });
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::dropout::cl_forwardTraining()");
+		}
+	}
+
+	void cl_backPropagate(cl_command_queue queue, const ClBackPropData& data, cl_mem inputError, uint32_t, uint32_t batchSize) const final
+	{
+		uint32_t size = batchSize * inputSize;
+		const cl_uint2 key = cl_getKey();
+
+		int error;
+		error = clSetKernelArg(backPropagateKernel, 0, sizeof(cl_mem), &data.outputError);
+		error |= clSetKernelArg(backPropagateKernel, 1, sizeof(cl_mem), &inputError);
+		error |= clSetKernelArg(backPropagateKernel, 2, sizeof(cl_mem), &data.state);
+		error |= clSetKernelArg(backPropagateKernel, 3, sizeof(key), &key);
+		error |= clSetKernelArg(backPropagateKernel, 4, sizeof(rate), &rate);
+		error |= clSetKernelArg(backPropagateKernel, 5, sizeof(scale), &scale);
+		error |= clSetKernelArg(backPropagateKernel, 6, sizeof(size), &size);
+		error |= cl::enqueue(queue, backPropagateKernel, (size + 3) / 4, { inputError });
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::dropout::cl_backPropagate()");
+		}
+	}
+
+	void cl_initKernels(cl_context context, cl_device_id device) final
+	{
+		auto program = cl::buildProgramFromFile(__FILE__, context, device);
+
+		int error;
+		forwardKernel = clCreateKernel(program, "forwardTraining", &error);
+		backPropagateKernel = clCreateKernel(program, "backPropagate", &error);
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error while creating kernel(s) for layer::dropout.");
+		}
+	}
+
+private:
+	// output = input * mask * scale. One Philox call gives the mask of 4 consecutive elements.
+	void applyMask(const float* input, float* output, uint32_t batchStep, size_t size) const
+	{
+		for (size_t block = 0; block * 4 < size; ++block)
+		{
+			const auto random = math::philox4x32({ { uint32_t(block), batchStep, 0, 0 } }, uint32_t(seed), uint32_t(seed >> 32));
+			const size_t end = std::min(size, block * 4 + 4);
+
+			for (size_t i = block * 4; i < end; ++i)
+			{
+				output[i] = math::uniformFromBits(random.v[i - block * 4]) < rate ? 0.f : input[i] * scale;
+			}
+		}
+	}
+
+	cl_uint2 cl_getKey() const { return cl_uint2{ { uint32_t(seed), uint32_t(seed >> 32) } }; }
+
+	const float rate;
+
+	// 1 / (1 - rate)
+	const float scale;
+
+	const uint64_t seed;
+
+	// batches trained so far
+	mutable std::atomic<uint32_t> step;
+
+	cl_kernel forwardKernel;
+
+	cl_kernel backPropagateKernel;
+};
+}
+}
@@ -1,5 +1,5 @@
 #pragma once
-#include "../cl/cl_utils.hpp"
+#include "../cl/tuner.hpp"
 
 namespace nn
 {
@@ -16,6 +16,13 @@ public:
 		const float* output = nullptr;
 		const float* outputError = nullptr;
 		const float* params = nullptr;
+
+		// this layer's parameter cache (see getParameterCacheSize), or nullptr if not available
+		const float* cache = nullptr;
+
+		// what forwardTrainingBatch saved for this batch (see getTrainingStateSize). The layer may
+		// also use it as scratch space, it is not read again once the layer has backpropagated.
+		float* state = nullptr;
 	};
 
 	virtual void backPropagate(const BackPropData& data, float* inputError) const  = 0;
@@ -24,6 +31,81 @@ public:
 
 	virtual void initializeParameters(float* params) const {}
 
+	// Layers may keep a read-only copy of their parameters in a second layout (e.g. transposed
+	// weights) so that every pass reads memory sequentially. The parameters themselves keep the
+	// layout that initializeParameters and the optimizers expect. The copy is rebuilt after
+	// initialization and after every optimizer update. Returns the number of floats needed, 0 if none.
+	virtual size_t getParameterCacheSize() const { return 0; }
+
+	virtual void updateParameterCache(const float* params, float* cache) const {}
+
+	// True if forwardBatch uses the cache too, so it is still needed once the network is frozen
+	virtual bool isParameterCacheUsedForward() const { return false; }
+
+	// Floats per sample that the forward pass saves while training so backpropagation does not
+	// have to recompute them (e.g. which input won a pooling window). Inference never stores it.
+	virtual size_t getTrainingStateSize() const { return 0; }
+
+	// True if the output may be written over the input, and the input error over the output
+	// error, i.e. every output element only depends on the input element at the same position.
+	// backPropagate of such a layer must not read data.input, which may hold the output by then.
+	// Derivatives are calculated before backPropagate, which may overwrite data.outputError.
+	virtual bool canRunInPlace() const { return false; }
+
+	// True if backPropagate reads data.output. While training, an in-place layer is not allowed
+	// to overwrite the output of a layer that needs it.
+	virtual bool usesOutputInBackPropagation() const { return false; }
+
+	// Layers that are linear at inference time (e.g. batch norm) can be folded into the
+	// parameters of the previous layer when the network is frozen. Returns true if previousParams
+	// were updated, in which case the layer is skipped by inference from then on.
+	virtual bool foldInto(const Layer& previous, float* previousParams, const float* params) { return false; }
+
+	virtual bool isFolded() const { return false; }
+
+	// Batched variants of the above. Input, output and error pointers refer to batchSize
+	// consecutive rows of getInputSize() or getOutputSize() floats. The defaults process one row
+	// at a time; layers that can do better (e.g. with matrix-matrix products) override them.
+	// cache is the layer's parameter cache if it has one (see getParameterCacheSize).
+	virtual void forwardBatch(const float* input, const float* params, float* output, size_t batchSize, const float* cache = nullptr) const
+	{
+		for (size_t i = 0; i < batchSize; ++i)
+		{
+			forward(input, params, output);
+			input += inputSize;
+			output += outputSize;
+		}
+	}
+
+	// forwardBatch for training. state has room for batchSize * getTrainingStateSize() floats.
+	virtual void forwardTrainingBatch(const float* input, const float* params, float* output, float* state, size_t batchSize, const float* cache = nullptr) const
+	{
+		forwardBatch(input, params, output, batchSize, cache);
+	}
+
+	virtual void backPropagateBatch(const BackPropData& data, float* inputError, size_t batchSize) const
+	{
+		BackPropData row = data;
+
+		for (size_t i = 0; i < batchSize; ++i)
+		{
+			backPropagate(row, inputError);
+			nextRow(row);
+			inputError += inputSize;
+		}
+	}
+
+	virtual void calculateDerivativesBatch(const BackPropData& data, float* derivatives, size_t batchSize) const
+	{
+		BackPropData row = data;
+
+		for (size_t i = 0; i < batchSize; ++i)
+		{
+			calculateDerivatives(row, derivatives);
+			nextRow(row);
+		}
+	}
+
 	struct ClBackPropData
 	{
 		cl_mem input = NULL;
@@ -31,16 +113,38 @@ public:
 		cl_mem outputError = NULL;
 		cl_mem params = NULL;
 		uint32_t inputOffset  = 0;
+		cl_mem cache = NULL;
+		uint32_t cacheOffset = 0;
+		cl_mem state = NULL;
 	};
 
 	virtual void cl_forward(cl_command_queue queue, cl_mem input, cl_mem params, cl_mem output, uint32_t inOffset, uint32_t outOffset, uint32_t paramOffset, uint32_t batchSize) const = 0;
 
+	virtual void cl_forwardTraining(cl_command_queue queue, cl_mem input, cl_mem params, cl_mem output, cl_mem state, uint32_t inOffset, uint32_t outOffset, uint32_t paramOffset, uint32_t batchSize) const
+	{
+		cl_forward(queue, input, params, output, inOffset, outOffset, paramOffset, batchSize);
+	}
+
 	virtual void cl_backPropagate(cl_command_queue queue, const ClBackPropData& data, cl_mem inputError, uint32_t paramOffset, uint32_t batchSize) const = 0;
 
 	virtual void cl_calculateDerivatives(cl_command_queue queue, const ClBackPropData& data, cl_mem derivaitves, uint32_t paramOffset, uint32_t batchSize) const {}
 
 	virtual void cl_initializeParameters(cl_command_queue queue, cl_mem params, uint32_t offset) const {}
 
+	// Floats of parameter cache the device kernels use (see getParameterCacheSize). Only layers
+	// that rebuild it in cl_updateParameterCache have one, a host-only cache is not allocated.
+	virtual size_t cl_getParameterCacheSize() const { return 0; }
+
+	virtual void cl_updateParameterCache(cl_command_queue queue, cl_mem params, cl_mem cache, uint32_t paramOffset, uint32_t cacheOffset) const {}
+
+	virtual bool cl_foldInto(cl_command_queue queue, const Layer& previous, cl_mem params, uint32_t previousOffset, uint32_t offset) { return false; }
+
+	// Lets the layer apply next, an element-wise activation, to its output on the device so that
+	// next is skipped. Must be called before cl_initKernels. Returns true if the layer will, in which
+	// case it writes next's output and backpropagates from next's output error, which it is given
+	// as data.outputError along with next's output as data.output.
+	virtual bool cl_fuseActivation(const Layer& next) { return false; }
+
 	virtual void cl_initKernels(cl_context context, cl_device_id device) {};
 
 	const size_t getInputSize() const { return inputSize; }
@@ -60,6 +164,13 @@ protected:
 		}
 	}
 
+	void nextRow(BackPropData& data) const
+	{
+		if (data.input) data.input += inputSize;
+		if (data.output) data.output += outputSize;
+		if (data.outputError) data.outputError += outputSize;
+	}
+
 	const uint32_t inputSize;
 	const uint32_t outputSize;
 	const uint32_t parmeterCount;
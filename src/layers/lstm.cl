@@ -0,0 +1,325 @@
+#define MAX_WORKGROUP_SIZE (256)
+
+// Set by layer::Lstm when the program is built: FEATURES, HIDDEN, TIME_STEPS and GEMM_TILE.
+#define INPUT_SIZE (TIME_STEPS * FEATURES)
+#define ROW_WIDTH (FEATURES + HIDDEN)
+#define GATES (4 * HIDDEN)
+
+// Gemm flags
+#define TRANSPOSE_A (1)
+#define TRANSPOSE_B (2)
+#define ACCUMULATE (4)
+#define ADD_BIAS (8)
+
+// Step flags, must match layer::Lstm
+#define FIRST_STEP (1)
+#define LAST_STEP (2)
+
+// Offsets into the arena are passed as (gates, previous cell, cell, next step's [x, h] rows or
+// their errors). A row is [x(t), h(t-1)], so h starts at ROW_WIDTH - HIDDEN. Gates are ordered
+// input, forget, output, cell candidate.
+
+inline uint updateSeed(uint seed)
+{
+	return seed = 0xa6718293 * seed + 0x638c571f;
+}
+
+inline float fastRand(float min, float max, uint* seed)
+{
+	*seed = updateSeed(*seed);
+	return ((float)((*seed >> 16) & 0x7FFF) / (float)(0x7FFF)) * (max - min) + min;
+}
+
+inline float sigmoid(float x)
+{
+	return 1.f / (1.f + exp(-x));
+}
+
+// One work group per gate row. Forget gate biases start at 1.
+__kernel void initParams(__global float* params,
+						 const uint paramOffset)
+{
+	params += paramOffset;
+	const float sd = rsqrt((float)ROW_WIDTH);
+	const size_t stride = get_local_size(0);
+	const size_t lid = get_local_id(0);
+	const size_t wid = get_group_id(0);
+	__global float* weights = params + GATES + wid * ROW_WIDTH;
+	uint seed = get_global_id(0);
+
+	for (size_t i = lid; i < ROW_WIDTH; i += stride)
+	{
+		weights[i] = fastRand(-sd, sd, &seed);
+	}
+
+	if (lid == 0)
+	{
+		params[wid] = wid / HIDDEN == 1 ? 1.f : 0.f;
+	}
+}
+
+// Copies x(t) of every sample into the step's rows, and zeroes h on the first step
+__kernel void gatherInput(__global const float* input,
+						  __global float* arena,
+						  const uint inputOffset,	// of x(t) for the first sample
+						  const uint rowOffset,
+						  const uint flags,
+						  const uint batchSize)
+{
+	const uint size = batchSize * ROW_WIDTH;
+	uint gid = get_global_id(0);
+	uint stride = get_global_size(0);
+
+	for (uint i = gid; i < size; i += stride)
+	{
+		const uint n = i / ROW_WIDTH;
+		const uint j = i - n * ROW_WIDTH;
+
+		if (j < FEATURES)
+		{
+			arena[rowOffset + i] = input[inputOffset + n * INPUT_SIZE + j];
+		}
+		else if (flags & FIRST_STEP)
+		{
+			arena[rowOffset + i] = 0.f;
+		}
+	}
+}
+
+// C[m x n] = A[m x k] * B[k x n], plus C and/or a bias per column depending on the flags.
+// A and B may be stored transposed. One work item per element of C. The kernels below pass
+// constants for all but one dimension and the flags, so each is compiled with fixed loop bounds.
+inline void gemm(__global const float* a,
+				 __global const float* b,
+				 __global float* c,
+				 __global const float* bias,
+				 __local float aTile[GEMM_TILE][GEMM_TILE],
+				 __local float bTile[GEMM_TILE][GEMM_TILE + 1],
+				 const uint m,
+				 const uint n,
+				 const uint k,
+				 const uint flags)
+{
+	const uint lx = get_local_id(0);
+	const uint ly = get_local_id(1);
+	const uint col = get_global_id(0);
+	const uint row = get_global_id(1);
+
+	float sum = 0.f;
+
+	for (uint k0 = 0; k0 < k; k0 += GEMM_TILE)
+	{
+		const uint ak = k0 + lx;
+		const uint bk = k0 + ly;
+		aTile[ly][lx] = row < m && ak < k ? ((flags & TRANSPOSE_A) ? a[ak * m + row] : a[row * k + ak]) : 0.f;
+		bTile[ly][lx] = col < n && bk < k ? ((flags & TRANSPOSE_B) ? b[col * k + bk] : b[bk * n + col]) : 0.f;
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for (uint i = 0; i < GEMM_TILE; ++i)
+		{
+			sum += aTile[ly][i] * bTile[i][lx];
+		}
+
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (row < m && col < n)
+	{
+		if (flags & ADD_BIAS)
+		{
+			sum += bias[col];
+		}
+
+		if (flags & ACCUMULATE)
+		{
+			sum += c[row * n + col];
+		}
+
+		c[row * n + col] = sum;
+	}
+}
+
+// gates = bias + [x, h] * weights^T for batchSize rows
+__kernel void gemmGates(__global const float* rows,
+						__global const float* weights,
+						__global float* gates,
+						__global const float* bias,
+						const uint rowsOffset,
+						const uint weightOffset,
+						const uint gatesOffset,
+						const uint biasOffset,
+						const uint batchSize)
+{
+	__local float aTile[GEMM_TILE][GEMM_TILE];
+	__local float bTile[GEMM_TILE][GEMM_TILE + 1];
+	gemm(rows + rowsOffset, weights + weightOffset, gates + gatesOffset, bias + biasOffset, aTile, bTile,
+		 batchSize, GATES, ROW_WIDTH, TRANSPOSE_B | ADD_BIAS);
+}
+
+// [x, h] errors = gate errors * weights for batchSize rows
+__kernel void gemmRowError(__global const float* gateErrors,
+						   __global const float* weights,
+						   __global float* rowErrors,
+						   const uint gatesOffset,
+						   const uint weightOffset,
+						   const uint rowErrorOffset,
+						   const uint batchSize)
+{
+	__local float aTile[GEMM_TILE][GEMM_TILE];
+	__local float bTile[GEMM_TILE][GEMM_TILE + 1];
+	gemm(gateErrors + gatesOffset, weights + weightOffset, rowErrors + rowErrorOffset, 0, aTile, bTile,
+		 batchSize, ROW_WIDTH, GATES, 0);
+}
+
+// weight derivatives += gate errors^T * [x, h] over `count` rows
+__kernel void gemmWeightDerivatives(__global const float* gateErrors,
+									__global const float* rows,
+									__global float* derivatives,
+									const uint gatesOffset,
+									const uint rowsOffset,
+									const uint weightOffset,
+									const uint count)
+{
+	__local float aTile[GEMM_TILE][GEMM_TILE];
+	__local float bTile[GEMM_TILE][GEMM_TILE + 1];
+	gemm(gateErrors + gatesOffset, rows + rowsOffset, derivatives + weightOffset, 0, aTile, bTile,
+		 GATES, ROW_WIDTH, count, TRANSPOSE_A | ACCUMULATE);
+}
+
+// One work item per hidden unit of each sample. Activates the gates in place and updates the cell:
+//   c = f * cPrevious + i * g, h = o * tanh(c)
+// h goes to the next step's rows (unless this is the last step) and to the output if outputStride
+// is not 0.
+__kernel void cellForward(__global float* arena,
+						  __global float* output,
+						  const uint4 offsets,
+						  const uint outputOffset,
+						  const uint outputStride,
+						  const uint flags,
+						  const uint batchSize)
+{
+	const uint size = batchSize * HIDDEN;
+	uint gid = get_global_id(0);
+	uint stride = get_global_size(0);
+
+	for (uint k = gid; k < size; k += stride)
+	{
+		const uint n = k / HIDDEN;
+		const uint u = k - n * HIDDEN;
+		__global float* gate = arena + offsets.x + n * GATES + u;
+
+		const float i = sigmoid(gate[0]);
+		const float f = sigmoid(gate[HIDDEN]);
+		const float o = sigmoid(gate[2 * HIDDEN]);
+		const float g = tanh(gate[3 * HIDDEN]);
+		gate[0] = i;
+		gate[HIDDEN] = f;
+		gate[2 * HIDDEN] = o;
+		gate[3 * HIDDEN] = g;
+
+		const float cPrevious = (flags & FIRST_STEP) ? 0.f : arena[offsets.y + k];
+		const float c = f * cPrevious + i * g;
+		const float h = o * tanh(c);
+		arena[offsets.z + k] = c;
+
+		if (!(flags & LAST_STEP))
+		{
+			arena[offsets.w + n * ROW_WIDTH + ROW_WIDTH - HIDDEN + u] = h;
+		}
+
+		if (outputStride)
+		{
+			output[outputOffset + n * outputStride + u] = h;
+		}
+	}
+}
+
+// One work item per hidden unit of each sample. Replaces the gate activations with the errors of
+// the gate inputs. The error of h is the step's output error (if errorStride is not 0) plus the
+// h part of the next step's row error. The cell error carried from the next step is updated for
+// the previous one.
+__kernel void cellBackward(__global float* arena,
+						   __global const float* outputError,
+						   const uint4 offsets,
+						   const uint cellErrorOffset,
+						   const uint errorOffset,
+						   const uint errorStride,
+						   const uint flags,
+						   const uint batchSize)
+{
+	const uint size = batchSize * HIDDEN;
+	uint gid = get_global_id(0);
+	uint stride = get_global_size(0);
+
+	for (uint k = gid; k < size; k += stride)
+	{
+		const uint n = k / HIDDEN;
+		const uint u = k - n * HIDDEN;
+		__global float* gate = arena + offsets.x + n * GATES + u;
+
+		const float i = gate[0];
+		const float f = gate[HIDDEN];
+		const float o = gate[2 * HIDDEN];
+		const float g = gate[3 * HIDDEN];
+		const float tc = tanh(arena[offsets.z + k]);
+
+		float dh = errorStride ? outputError[errorOffset + n * errorStride + u] : 0.f;
+
+		if (!(flags & LAST_STEP))
+		{
+			dh += arena[offsets.w + n * ROW_WIDTH + ROW_WIDTH - HIDDEN + u];
+		}
+
+		const float carried = (flags & LAST_STEP) ? 0.f : arena[cellErrorOffset + k];
+		const float dc = carried + dh * o * (1.f - tc * tc);
+
+		gate[0] = dc * g * i * (1.f - i);
+		gate[HIDDEN] = (flags & FIRST_STEP) ? 0.f : dc * arena[offsets.y + k] * f * (1.f - f);
+		gate[2 * HIDDEN] = dh * tc * o * (1.f - o);
+		gate[3 * HIDDEN] = dc * i * (1.f - g * g);
+		arena[cellErrorOffset + k] = dc * f;
+	}
+}
+
+// One work item per gate, summing its errors over every step of every sample
+__kernel void biasDerivatives(__global const float* arena,
+							  __global float* derivatives,
+							  const uint gatesOffset,
+							  const uint paramOffset,
+							  const uint rows)
+{
+	const uint gid = get_global_id(0);
+
+	if (gid < GATES)
+	{
+		__global const float* errors = arena + gatesOffset + gid;
+		float sum = 0.f;
+
+		for (uint r = 0; r < rows; ++r)
+		{
+			sum += errors[r * GATES];
+		}
+
+		derivatives[paramOffset + gid] += sum;
+	}
+}
+
+// One work item per input element, copying the x part of its step's row error
+__kernel void scatterInputError(__global const float* arena,
+								__global float* inputError,
+								const uint rowErrorOffset,
+								const uint batchSize)
+{
+	const uint size = batchSize * INPUT_SIZE;
+	uint gid = get_global_id(0);
+	uint stride = get_global_size(0);
+
+	for (uint i = gid; i < size; i += stride)
+	{
+		const uint n = i / INPUT_SIZE;
+		const uint r = i - n * INPUT_SIZE;
+		const uint t = r / FEATURES;
+		const uint j = r - t * FEATURES;
+		inputError[i] = arena[rowErrorOffset + (t * batchSize + n) * ROW_WIDTH + j];
+	}
+}
@@ -0,0 +1,630 @@
+#pragma once
+#include "layer.hpp"
+#include "..\..\utils\utils.hpp"
+#include "..\math\gemm.hpp"
+#include <cmath>
+#include <vector>
+
+namespace nn
+{
+namespace layer
+{
+// Long short-term memory over a sequence of timeSteps inputs of inputFeatures each, i.e. one
+// sample is a (time, features) matrix. Outputs the hidden state of the last step, or of every
+// step if returnSequence is set.
+//
+// The four gates (input, forget, output and cell candidate, in that order) of every unit are
+// computed together. Each step builds rows of [x(t), h(t-1)] for the whole batch and multiplies
+// them by all gate weights in one product; the gate activations and the cell update are then one
+// pass over the result. Parameters are the 4 x hiddenSize biases followed by a
+// (4 x hiddenSize) x (inputFeatures + hiddenSize) weight matrix.
+//
+// While training every step is kept in the training state, which doubles as the arena for
+// backpropagation through time. calculateDerivativesBatch runs the whole backward recurrence and
+// leaves the error of each step's input there for backPropagateBatch, so it must come first
+// (as the network implementations do).
+class Lstm : public Layer
+{
+public:
+	Lstm(size_t timeSteps, size_t inputFeatures, size_t hiddenSize, bool returnSequence = false) :
+		Layer(timeSteps * inputFeatures, returnSequence ? timeSteps * hiddenSize : hiddenSize, 4 * hiddenSize * (inputFeatures + hiddenSize + 1)),
+		timeSteps(uint32_t(timeSteps)),
+		features(uint32_t(inputFeatures)),
+		hidden(uint32_t(hiddenSize)),
+		returnSequence(returnSequence),
+		gatherKernel(NULL),
+		gatesKernel(NULL),
+		rowErrorKernel(NULL),
+		weightDerivativesKernel(NULL),
+		cellForwardKernel(NULL),
+		cellBackwardKernel(NULL),
+		biasDerivativesKernel(NULL),
+		scatterKernel(NULL),
+		initKernel(NULL),
+		scratch(NULL),
+		scratchSize(0)
+	{
+		if (timeSteps == 0 || inputFeatures == 0 || hiddenSize == 0)
+		{
+			throw std::invalid_argument("LSTM layer must have at least one time step, input feature and hidden unit.");
+		}
+	}
+
+	~Lstm()
+	{
+		if (scratch)
+		{
+			clReleaseMemObject(scratch);
+		}
+	}
+
+	size_t getTimeSteps() const { return timeSteps; }
+	size_t getHiddenSize() const { return hidden; }
+
+	void forward(const float* input, const float* params, float* output) const final
+	{
+		forwardBatch(input, params, output, 1);
+	}
+
+	void backPropagate(const BackPropData& data, float* inputError) const final
+	{
+		backPropagateBatch(data, inputError, 1);
+	}
+
+	void calculateDerivatives(const BackPropData& data, float* derivatives) const final
+	{
+		calculateDerivativesBatch(data, derivatives, 1);
+	}
+
+	// Every step's [x, h] rows, gates and cell state, plus the backward pass's errors of [x, h]
+	// for every step and the cell state error carried between steps
+	size_t getTrainingStateSize() const final
+	{
+		return timeSteps * (2 * getRowWidth() + 5 * hidden) + hidden;
+	}
+
+	// Inference only keeps the current step, in a scratch buffer of the thread
+	void forwardBatch(const float* input, const float* params, float* output, size_t batchSize, const float* = nullptr) const final
+	{
+		std::vector<float>& arena = getScratch();
+		const size_t size = batchSize * (getRowWidth() + 5 * hidden);
+
+		if (arena.size() < size)
+		{
+			arena.resize(size);
+		}
+
+		run(input, params, output, getArena(arena.data(), batchSize, 1), batchSize);
+	}
+
+	void forwardTrainingBatch(const float* input, const float* params, float* output, float* state, size_t batchSize, const float* = nullptr) const final
+	{
+		run(input, params, output, getArena(state, batchSize, timeSteps), batchSize);
+	}
+
+	// Backpropagation through time. Gate activations are replaced by the errors of their inputs,
+	// which give the errors of [x, h] and, once every step is done, all derivatives in one product.
+	void calculateDerivativesBatch(const BackPropData& data, float* derivatives, size_t batchSize) const final
+	{
+		assert(data.state);
+		const Arena arena = getArena(data.state, batchSize, timeSteps);
+		const size_t width = getRowWidth();
+		const float* weight = getWeights(data.params);
+
+		memset(arena.cellError, 0, batchSize * hidden * sizeof(float));
+
+		for (size_t t = timeSteps; t-- > 0;)
+		{
+			const float* outputError = getStepOutput(data.outputError, t);
+			const float* nextError = t + 1 < timeSteps ? arena.rowError(t + 1, batchSize, width) + features : nullptr;
+
+			cellBackward(arena.gates(t, batchSize, hidden), t > 0 ? arena.cell(t - 1, batchSize, hidden) : nullptr, arena.cell(t, batchSize, hidden),
+				outputError, getOutputStride(), nextError, width, arena.cellError, batchSize);
+
+			float* rowError = arena.rowError(t, batchSize, width);
+			memset(rowError, 0, batchSize * width * sizeof(float));
+			math::gemmNN(arena.gates(t, batchSize, hidden), weight, rowError, batchSize, width, 4 * hidden);
+		}
+
+		const size_t rows = timeSteps * batchSize;
+		float* db = getBiases(derivatives);
+
+		for (size_t i = 0; i < rows; ++i)
+		{
+			math::axpy(1.f, arena.gates(0, batchSize, hidden) + i * 4 * hidden, db, 4 * hidden);
+		}
+
+		math::gemmTN(arena.gates(0, batchSize, hidden), arena.rows, getWeights(derivatives), 4 * hidden, width, rows);
+	}
+
+	// Copies the input part of every step's error left by calculateDerivativesBatch
+	void backPropagateBatch(const BackPropData& data, float* inputError, size_t batchSize) const final
+	{
+		assert(data.state);
+		const Arena arena = getArena(data.state, batchSize, timeSteps);
+		const size_t width = getRowWidth();
+
+		for (size_t t = 0; t < timeSteps; ++t)
+		{
+			const float* rowError = arena.rowError(t, batchSize, width);
+
+			for (size_t n = 0; n < batchSize; ++n)
+			{
+				memcpy(inputError + n * inputSize + t * features, rowError + n * width, features * sizeof(float));
+			}
+		}
+	}
+
+	// Weights are uniform in +/-1/sqrt(fan in). Forget gate biases start at 1 so the cell keeps its
+	// state until it learns otherwise.
+	void initializeParameters(float* params) const final
+	{
+		const size_t width = getRowWidth();
+		const auto sd = 1.f / (float)sqrt(width);
+		float* bias = getBiases(params);
+		float* weight = getWeights(params);
+
+		for (size_t i = 0; i < 4 * hidden; ++i)
+		{
+			*bias++ = i / hidden == forgetGate ? 1.f : 0.f;
+			for (size_t j = 0; j < width; ++j)
+			{
+				*weight++ = fastUniformRand(-sd, sd);
+			}
+		}
+	}
+
+	void cl_forward(cl_command_queue queue, cl_mem input, cl_mem params, cl_mem output, uint32_t inOffset, uint32_t outOffset, uint32_t paramOffset, uint32_t batchSize) const final
+	{
+		cl_run(queue, input, params, output, cl_getScratch(queue, batchSize), inOffset, outOffset, paramOffset, batchSize, 1);
+	}
+
+	void cl_forwardTraining(cl_command_queue queue, cl_mem input, cl_mem params, cl_mem output, cl_mem state, uint32_t inOffset, uint32_t outOffset, uint32_t paramOffset, uint32_t batchSize) const final
+	{
+		cl_run(queue, input, params, output, state, inOffset, outOffset, paramOffset, batchSize, timeSteps);
+	}
+
+	void cl_calculateDerivatives(cl_command_queue queue, const ClBackPropData& data, cl_mem derivatives, uint32_t paramOffset, uint32_t batchSize) const final
+	{
+		const Offsets arena = cl_getArena(batchSize, timeSteps);
+		const uint32_t width = getRowWidth();
+		const uint32_t weightOffset = paramOffset + 4 * hidden;
+
+		int error = CL_SUCCESS;
+
+		for (uint32_t t = timeSteps; t-- > 0;)
+		{
+			const uint32_t flags = (t == 0 ? firstStep : 0) | (t + 1 == timeSteps ? lastStep : 0);
+			const cl_uint4 offsets = { { arena.gates(t, batchSize, hidden), t > 0 ? arena.cell(t - 1, batchSize, hidden) : 0, arena.cell(t, batchSize, hidden),
+				t + 1 < timeSteps ? arena.rowError(t + 1, batchSize, width) : 0 } };
+			const uint32_t errorOffset = cl_getStepOutputOffset(0, t);
+			const uint32_t errorStride = hasStepOutput(t) ? getOutputStride() : 0;
+
+			error |= clSetKernelArg(cellBackwardKernel, 0, sizeof(cl_mem), &data.state);
+			error |= clSetKernelArg(cellBackwardKernel, 1, sizeof(cl_mem), &data.outputError);
+			error |= clSetKernelArg(cellBackwardKernel, 2, sizeof(offsets), &offsets);
+			error |= clSetKernelArg(cellBackwardKernel, 3, sizeof(arena.cellError), &arena.cellError);
+			error |= clSetKernelArg(cellBackwardKernel, 4, sizeof(errorOffset), &errorOffset);
+			error |= clSetKernelArg(cellBackwardKernel, 5, sizeof(errorStride), &errorStride);
+			error |= clSetKernelArg(cellBackwardKernel, 6, sizeof(flags), &flags);
+			error |= clSetKernelArg(cellBackwardKernel, 7, sizeof(batchSize), &batchSize);
+			error |= cl::enqueue(queue, cellBackwardKernel, batchSize * hidden, { data.state });
+
+			// [x, h] error = gate error * weights
+			const uint32_t gatesOffset = arena.gates(t, batchSize, hidden);
+			const uint32_t rowErrorOffset = arena.rowError(t, batchSize, width);
+			error |= clSetKernelArg(rowErrorKernel, 0, sizeof(cl_mem), &data.state);
+			error |= clSetKernelArg(rowErrorKernel, 1, sizeof(cl_mem), &data.params);
+			error |= clSetKernelArg(rowErrorKernel, 2, sizeof(cl_mem), &data.state);
+			error |= clSetKernelArg(rowErrorKernel, 3, sizeof(gatesOffset), &gatesOffset);
+			error |= clSetKernelArg(rowErrorKernel, 4, sizeof(weightOffset), &weightOffset);
+			error |= clSetKernelArg(rowErrorKernel, 5, sizeof(rowErrorOffset), &rowErrorOffset);
+			error |= clSetKernelArg(rowErrorKernel, 6, sizeof(batchSize), &batchSize);
+			error |= cl_gemm(queue, rowErrorKernel, batchSize, width);
+		}
+
+		const uint32_t rows = timeSteps * batchSize;
+		const uint32_t gatesOffset = arena.gates(0, batchSize, hidden);
+
+		error |= clSetKernelArg(biasDerivativesKernel, 0, sizeof(cl_mem), &data.state);
+		error |= clSetKernelArg(biasDerivativesKernel, 1, sizeof(cl_mem), &derivatives);
+		error |= clSetKernelArg(biasDerivativesKernel, 2, sizeof(gatesOffset), &gatesOffset);
+		error |= clSetKernelArg(biasDerivativesKernel, 3, sizeof(paramOffset), &paramOffset);
+		error |= clSetKernelArg(biasDerivativesKernel, 4, sizeof(rows), &rows);
+		error |= cl::enqueue(queue, biasDerivativesKernel, 4 * hidden, { derivatives });
+
+		// weight derivatives += gate errors^T * [x, h] over every step at once
+		error |= clSetKernelArg(weightDerivativesKernel, 0, sizeof(cl_mem), &data.state);
+		error |= clSetKernelArg(weightDerivativesKernel, 1, sizeof(cl_mem), &data.state);
+		error |= clSetKernelArg(weightDerivativesKernel, 2, sizeof(cl_mem), &derivatives);
+		error |= clSetKernelArg(weightDerivativesKernel, 3, sizeof(gatesOffset), &gatesOffset);
+		error |= clSetKernelArg(weightDerivativesKernel, 4, sizeof(arena.rows), &arena.rows);
+		error |= clSetKernelArg(weightDerivativesKernel, 5, sizeof(weightOffset), &weightOffset);
+		error |= clSetKernelArg(weightDerivativesKernel, 6, sizeof(rows), &rows);
+		error |= cl_gemm(queue, weightDerivativesKernel, 4 * hidden, width);
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::lstm::cl_calculateDerivatives()");
+		}
+	}
+
+	void cl_backPropagate(cl_command_queue queue, const ClBackPropData& data, cl_mem inputError, uint32_t, uint32_t batchSize) const final
+	{
+		const Offsets arena = cl_getArena(batchSize, timeSteps);
+		const uint32_t rowErrorOffset = arena.rowError(0, batchSize, getRowWidth());
+
+		int error;
+		error = clSetKernelArg(scatterKernel, 0, sizeof(cl_mem), &data.state);
+		error |= clSetKernelArg(scatterKernel, 1, sizeof(cl_mem), &inputError);
+		error |= clSetKernelArg(scatterKernel, 2, sizeof(rowErrorOffset), &rowErrorOffset);
+		error |= clSetKernelArg(scatterKernel, 3, sizeof(batchSize), &batchSize);
+		error |= cl::enqueue(queue, scatterKernel, batchSize * inputSize, { inputError });
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::lstm::cl_backPropagate()");
+		}
+	}
+
+	void cl_initializeParameters(cl_command_queue queue, cl_mem params, uint32_t offset) const final
+	{
+		const uint32_t width = getRowWidth();
+
+		int error;
+		error = clSetKernelArg(initKernel, 0, sizeof(cl_mem), &params);
+		error |= clSetKernelArg(initKernel, 1, sizeof(offset), &offset);
+		error |= cl::enqueueGroups(queue, initKernel, 4 * hidden, width, { params });
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::lstm::cl_initializeParameters()");
+		}
+	}
+
+	void cl_initKernels(cl_context context, cl_device_id device) final
+	{
+		// The sizes are compiled in, so only the batch size and step vary between launches
+		auto options = cl::defines({
+			{ "FEATURES", features },
+			{ "HIDDEN", hidden },
+			{ "TIME_STEPS", timeSteps },
+			{ "GEMM_TILE", gemmTile } });
+		auto program = cl::buildProgramFromFile(__FILE__, context, device, options);
+
+		int error;
+		gatherKernel = clCreateKernel(program, "gatherInput", &error);
+		gatesKernel = clCreateKernel(program, "gemmGates", &error);
+		rowErrorKernel = clCreateKernel(program, "gemmRowError", &error);
+		weightDerivativesKernel = clCreateKernel(program, "gemmWeightDerivatives", &error);
+		cellForwardKernel = clCreateKernel(program, "cellForward", &error);
+		cellBackwardKernel = clCreateKernel(program, "cellBackward", &error);
+		biasDerivativesKernel = clCreateKernel(program, "biasDerivatives", &error);
+		scatterKernel = clCreateKernel(program, "scatterInputError", &error);
+		initKernel = clCreateKernel(program, "initParams", &error);
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error while creating kernel(s) for layer::lstm.");
+		}
+	}
+
+	const float* getBiases(const float* parameters) const { return parameters; }
+	float* getBiases(float* parameters)       const { return parameters; }
+	const float* getWeights(const float* parameters) const { return parameters + 4 * hidden; }
+	float* getWeights(float* parameters)       const { return parameters + 4 * hidden; }
+
+private:
+	// Gate order within the 4 x hiddenSize gate values of a sample
+	static const size_t inputGate = 0, forgetGate = 1, outputGate = 2, cellGate = 3;
+
+	// Flags of a step, must match lstm.cl
+	static const uint32_t firstStep = 1, lastStep = 2;
+
+	static const size_t gemmTile = 16;
+
+	// Regions of the arena. Each holds one block of batchSize rows per step, oldest first, so
+	// the gate errors and [x, h] rows of the whole sequence are single matrices. Inference keeps
+	// one step, which every step overwrites.
+	template<typename T>
+	struct Regions
+	{
+		T rows;			// [x(t), h(t-1)]
+		T gateValues;	// activations, then the errors of the gate inputs
+		T cells;
+		T rowErrors;
+		T cellError;	// carried from step to step
+
+		T row(size_t t, size_t batchSize, size_t width) const { return T(rows + t * batchSize * width * slotUsed); }
+		T gates(size_t t, size_t batchSize, size_t hidden) const { return T(gateValues + t * batchSize * 4 * hidden * slotUsed); }
+		T cell(size_t t, size_t batchSize, size_t hidden) const { return T(cells + t * batchSize * hidden * slotUsed); }
+		T rowError(size_t t, size_t batchSize, size_t width) const { return T(rowErrors + t * batchSize * width * slotUsed); }
+
+		// 0 if every step shares the first block
+		size_t slotUsed;
+	};
+
+	using Arena = Regions<float*>;
+	using Offsets = Regions<uint32_t>;
+
+	template<typename T>
+	Regions<T> getRegions(T base, size_t batchSize, size_t steps) const
+	{
+		const size_t width = getRowWidth();
+		Regions<T> arena;
+		arena.rows = base;
+		arena.gateValues = T(arena.rows + steps * batchSize * width);
+		arena.cells = T(arena.gateValues + steps * batchSize * 4 * hidden);
+		arena.rowErrors = T(arena.cells + steps * batchSize * hidden);
+		arena.cellError = T(arena.rowErrors + steps * batchSize * width);
+		arena.slotUsed = steps > 1 ? 1 : 0;
+		return arena;
+	}
+
+	Arena getArena(float* base, size_t batchSize, size_t steps) const { return getRegions<float*>(base, batchSize, steps); }
+
+	Offsets cl_getArena(size_t batchSize, size_t steps) const { return getRegions<uint32_t>(0, batchSize, steps); }
+
+	size_t getRowWidth() const { return features + hidden; }
+
+	// Floats between the outputs of consecutive samples
+	size_t getOutputStride() const { return returnSequence ? timeSteps * hidden : hidden; }
+
+	bool hasStepOutput(size_t t) const { return returnSequence || t + 1 == timeSteps; }
+
+	// The output (or its error) of step t for the first sample, nullptr if the step has none
+	template<typename T>
+	T* getStepOutput(T* output, size_t t) const
+	{
+		return hasStepOutput(t) ? output + (returnSequence ? t * hidden : 0) : nullptr;
+	}
+
+	uint32_t cl_getStepOutputOffset(uint32_t outOffset, size_t t) const
+	{
+		return outOffset + uint32_t(returnSequence ? t * hidden : 0);
+	}
+
+	void run(const float* input, const float* params, float* output, const Arena& arena, size_t batchSize) const
+	{
+		const size_t width = getRowWidth();
+		const float* bias = getBiases(params);
+		const float* weight = getWeights(params);
+
+		for (size_t t = 0; t < timeSteps; ++t)
+		{
+			float* rows = arena.row(t, batchSize, width);
+			float* gates = arena.gates(t, batchSize, hidden);
+
+			for (size_t n = 0; n < batchSize; ++n)
+			{
+				memcpy(rows + n * width, input + n * inputSize + t * features, features * sizeof(float));
+
+				if (t == 0)
+				{
+					memset(rows + n * width + features, 0, hidden * sizeof(float));
+				}
+
+				memcpy(gates + n * 4 * hidden, bias, 4 * hidden * sizeof(float));
+			}
+
+			// All gates of the batch in one product
+			math::gemmNT(rows, weight, gates, batchSize, 4 * hidden, width);
+
+			float* next = t + 1 < timeSteps ? arena.row(t + 1, batchSize, width) + features : nullptr;
+
+			cellForward(gates, t > 0 ? arena.cell(t - 1, batchSize, hidden) : nullptr, arena.cell(t, batchSize, hidden),
+				next, width, getStepOutput(output, t), getOutputStride(), batchSize);
+		}
+	}
+
+	// Activates the gates in place and updates the cell state:
+	//   c = f * cPrevious + i * g, h = o * tanh(c)
+	// h is written to the next step's rows and/or the output, either of which may be nullptr.
+	void cellForward(float* gates, const float* previousCell, float* cell, float* next, size_t nextStride, float* output, size_t outputStride, size_t batchSize) const
+	{
+		const math::Kernels& k = math::kernels();
+
+		for (size_t n = 0; n < batchSize; ++n)
+		{
+			float* gate = gates + n * 4 * hidden;
+			const float* cPrevious = previousCell ? previousCell + n * hidden : nullptr;
+			float* c = cell + n * hidden;
+			float* h = next ? next + n * nextStride : output + n * outputStride;
+
+			// Input, forget and output gates are contiguous
+			k.sigmoid(gate, gate, 3 * hidden);
+			k.tanh(gate + cellGate * hidden, gate + cellGate * hidden, hidden);
+
+			const float* i = gate + inputGate * hidden;
+			const float* f = gate + forgetGate * hidden;
+			const float* o = gate + outputGate * hidden;
+			const float* g = gate + cellGate * hidden;
+
+			for (size_t u = 0; u < hidden; ++u)
+			{
+				c[u] = (cPrevious ? f[u] * cPrevious[u] : 0.f) + i[u] * g[u];
+			}
+
+			k.tanh(c, h, hidden);
+
+			for (size_t u = 0; u < hidden; ++u)
+			{
+				h[u] *= o[u];
+			}
+
+			if (next && output)
+			{
+				memcpy(output + n * outputStride, h, hidden * sizeof(float));
+			}
+		}
+	}
+
+	// Replaces the gate activations with the errors of the gate inputs. The error of h comes from
+	// the step's output error and the next step's row error (either may be nullptr). cellError
+	// holds the error carried from the next step and is left with the one for the previous step.
+	void cellBackward(float* gates, const float* previousCell, const float* cell, const float* outputError, size_t outputStride,
+		const float* nextError, size_t nextStride, float* cellError, size_t batchSize) const
+	{
+		for (size_t n = 0; n < batchSize; ++n)
+		{
+			float* gate = gates + n * 4 * hidden;
+			const float* cPrevious = previousCell ? previousCell + n * hidden : nullptr;
+			const float* c = cell + n * hidden;
+			float* dc = cellError + n * hidden;
+
+			for (size_t u = 0; u < hidden; ++u)
+			{
+				const float i = gate[inputGate * hidden + u];
+				const float f = gate[forgetGate * hidden + u];
+				const float o = gate[outputGate * hidden + u];
+				const float g = gate[cellGate * hidden + u];
+				const float tc = std::tanh(c[u]);
+
+				float dh = 0.f;
+				if (outputError) dh += outputError[n * outputStride + u];
+				if (nextError) dh += nextError[n * nextStride + u];
+
+				const float dcu = dc[u] + dh * o * (1.f - tc * tc);
+
+				gate[inputGate * hidden + u] = dcu * g * i * (1.f - i);
+				gate[forgetGate * hidden + u] = cPrevious ? dcu * cPrevious[u] * f * (1.f - f) : 0.f;
+				gate[outputGate * hidden + u] = dh * tc * o * (1.f - o);
+				gate[cellGate * hidden + u] = dcu * i * (1.f - g * g);
+				dc[u] = dcu * f;
+			}
+		}
+	}
+
+	void cl_run(cl_command_queue queue, cl_mem input, cl_mem params, cl_mem output, cl_mem state, uint32_t inOffset, uint32_t outOffset, uint32_t paramOffset, uint32_t batchSize, uint32_t steps) const
+	{
+		const Offsets arena = cl_getArena(batchSize, steps);
+		const uint32_t width = getRowWidth();
+		const uint32_t weightOffset = paramOffset + 4 * hidden;
+
+		int error = CL_SUCCESS;
+
+		for (uint32_t t = 0; t < timeSteps; ++t)
+		{
+			const uint32_t flags = (t == 0 ? firstStep : 0) | (t + 1 == timeSteps ? lastStep : 0);
+			const uint32_t rowOffset = arena.row(t, batchSize, width);
+			const uint32_t inputOffset = inOffset + t * features;
+
+			error |= clSetKernelArg(gatherKernel, 0, sizeof(cl_mem), &input);
+			error |= clSetKernelArg(gatherKernel, 1, sizeof(cl_mem), &state);
+			error |= clSetKernelArg(gatherKernel, 2, sizeof(inputOffset), &inputOffset);
+			error |= clSetKernelArg(gatherKernel, 3, sizeof(rowOffset), &rowOffset);
+			error |= clSetKernelArg(gatherKernel, 4, sizeof(flags), &flags);
+			error |= clSetKernelArg(gatherKernel, 5, sizeof(batchSize), &batchSize);
+			error |= cl::enqueue(queue, gatherKernel, batchSize * width, { state });
+
+			// gates = bias + [x, h] * weights^T
+			const uint32_t gatesOffset = arena.gates(t, batchSize, hidden);
+			error |= clSetKernelArg(gatesKernel, 0, sizeof(cl_mem), &state);
+			error |= clSetKernelArg(gatesKernel, 1, sizeof(cl_mem), &params);
+			error |= clSetKernelArg(gatesKernel, 2, sizeof(cl_mem), &state);
+			error |= clSetKernelArg(gatesKernel, 3, sizeof(cl_mem), &params);
+			error |= clSetKernelArg(gatesKernel, 4, sizeof(rowOffset), &rowOffset);
+			error |= clSetKernelArg(gatesKernel, 5, sizeof(weightOffset), &weightOffset);
+			error |= clSetKernelArg(gatesKernel, 6, sizeof(gatesOffset), &gatesOffset);
+			error |= clSetKernelArg(gatesKernel, 7, sizeof(paramOffset), &paramOffset);
+			error |= clSetKernelArg(gatesKernel, 8, sizeof(batchSize), &batchSize);
+			error |= cl_gemm(queue, gatesKernel, batchSize, 4 * hidden);
+
+			const cl_uint4 offsets = { { gatesOffset, t > 0 ? arena.cell(t - 1, batchSize, hidden) : 0, arena.cell(t, batchSize, hidden),
+				t + 1 < timeSteps ? arena.row(t + 1, batchSize, width) : 0 } };
+			const uint32_t outputOffset = cl_getStepOutputOffset(outOffset, t);
+			const uint32_t outputStride = hasStepOutput(t) ? getOutputStride() : 0;
+
+			error |= clSetKernelArg(cellForwardKernel, 0, sizeof(cl_mem), &state);
+			error |= clSetKernelArg(cellForwardKernel, 1, sizeof(cl_mem), &output);
+			error |= clSetKernelArg(cellForwardKernel, 2, sizeof(offsets), &offsets);
+			error |= clSetKernelArg(cellForwardKernel, 3, sizeof(outputOffset), &outputOffset);
+			error |= clSetKernelArg(cellForwardKernel, 4, sizeof(outputStride), &outputStride);
+			error |= clSetKernelArg(cellForwardKernel, 5, sizeof(flags), &flags);
+			error |= clSetKernelArg(cellForwardKernel, 6, sizeof(batchSize), &batchSize);
+			error |= cl::enqueue(queue, cellForwardKernel, batchSize * hidden, { state, output });
+		}
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::lstm::cl_forward()");
+		}
+	}
+
+	// Launches one of the gemm kernels, whose arguments are set already, over an m x n result.
+	// Returns the OpenCL error.
+	int cl_gemm(cl_command_queue queue, cl_kernel kernel, size_t m, size_t n) const
+	{
+		size_t groupSize[2] = { gemmTile, gemmTile };
+		size_t globalSize[2] = { roundUp(n, gemmTile), roundUp(m, gemmTile) };
+		return clEnqueueNDRangeKernel(queue, kernel, 2, NULL, globalSize, groupSize, 0, NULL, NULL);
+	}
+
+	// Arena for inference on the device, grown to the largest batch seen
+	cl_mem cl_getScratch(cl_command_queue queue, size_t batchSize) const
+	{
+		const size_t size = batchSize * (getRowWidth() + 5 * hidden) * sizeof(float);
+
+		if (scratchSize < size)
+		{
+			cl_context context;
+			int error = clGetCommandQueueInfo(queue, CL_QUEUE_CONTEXT, sizeof(context), &context, NULL);
+
+			if (scratch)
+			{
+				clReleaseMemObject(scratch);
+			}
+
+			scratch = clCreateBuffer(context, CL_MEM_READ_WRITE, size, NULL, &error);
+			scratchSize = size;
+
+			if (error != CL_SUCCESS)
+			{
+				throw std::exception("Unexpected error while allocating memory for layer::lstm.");
+			}
+		}
+
+		return scratch;
+	}
+
+	// One per thread, shared by all LSTM layers
+	static std::vector<float>& getScratch()
+	{
+		static thread_local std::vector<float> scratch;
+		return scratch;
+	}
+
+	static size_t roundUp(size_t size, size_t multiple) { return (size + multiple - 1) / multiple * multiple; }
+
+	const uint32_t timeSteps;
+
+	const uint32_t features;
+
+	const uint32_t hidden;
+
+	const bool returnSequence;
+
+	cl_kernel gatherKernel;
+
+	cl_kernel gatesKernel;
+
+	cl_kernel rowErrorKernel;
+
+	cl_kernel weightDerivativesKernel;
+
+	cl_kernel cellForwardKernel;
+
+	cl_kernel cellBackwardKernel;
+
+	cl_kernel biasDerivativesKernel;
+
+	cl_kernel scatterKernel;
+
+	cl_kernel initKernel;
+
+	mutable cl_mem scratch;
+
+	mutable size_t scratchSize;
+};
+}
+}
@@ -0,0 +1,120 @@
+// Set by layer::MaxPooling when the program is built: INPUT_WIDTH, INPUT_HEIGHT, CHANNELS,
+// POOL_WIDTH and POOL_HEIGHT. Each channel of the output is (INPUT_WIDTH / POOL_WIDTH) x
+// (INPUT_HEIGHT / POOL_HEIGHT).
+
+// Input index (within its sample) of the largest value in the window of output i (within its sample)
+inline uint findMax(__global const float* input, const uint i, float* max)
+{
+	const uint outputWidth = INPUT_WIDTH / POOL_WIDTH;
+	const uint outputHeight = INPUT_HEIGHT / POOL_HEIGHT;
+
+	const uint channel = i / (outputWidth * outputHeight);
+	const uint rest = i - channel * outputWidth * outputHeight;
+	const uint y = rest / outputWidth;
+	const uint x = rest - y * outputWidth;
+
+	const uint first = (channel * INPUT_HEIGHT + y * POOL_HEIGHT) * INPUT_WIDTH + x * POOL_WIDTH;
+	uint best = first;
+	*max = input[first];
+
+	for (uint j = 0; j < POOL_HEIGHT; ++j)
+	{
+		for (uint k = 0; k < POOL_WIDTH; ++k)
+		{
+			const uint index = first + j * INPUT_WIDTH + k;
+			const float value = input[index];
+
+			if (value > *max)
+			{
+				*max = value;
+				best = index;
+			}
+		}
+	}
+
+	return best;
+}
+
+__kernel void forward(__global const float* input,
+					  __global float* output,
+					  const uint inputOffset,
+					  const uint outputOffset,
+					  const uint size)			// batch size * output size
+{
+	input += inputOffset;
+	output += outputOffset;
+	const uint inputSize = INPUT_WIDTH * INPUT_HEIGHT * CHANNELS;
+	const uint outputSize = (INPUT_WIDTH / POOL_WIDTH) * (INPUT_HEIGHT / POOL_HEIGHT) * CHANNELS;
+	uint gid = get_global_id(0);
+	uint stride = get_global_size(0);
+
+	for (uint i = gid; i < size; i += stride)
+	{
+		const uint sample = i / outputSize;
+		float max;
+		findMax(input + sample * inputSize, i - sample * outputSize, &max);
+		output[i] = max;
+	}
+}
+
+// Same as forward but also saves the index of each window's winner for backPropagate
+__kernel void forwardTraining(__global const float* input,
+							  __global float* output,
+							  const uint inputOffset,
+							  const uint outputOffset,
+							  const uint size,
+							  __global uint* indices)
+{
+	input += inputOffset;
+	output += outputOffset;
+	const uint inputSize = INPUT_WIDTH * INPUT_HEIGHT * CHANNELS;
+	const uint outputSize = (INPUT_WIDTH / POOL_WIDTH) * (INPUT_HEIGHT / POOL_HEIGHT) * CHANNELS;
+	uint gid = get_global_id(0);
+	uint stride = get_global_size(0);
+
+	for (uint i = gid; i < size; i += stride)
+	{
+		const uint sample = i / outputSize;
+		float max;
+		indices[i] = findMax(input + sample * inputSize, i - sample * outputSize, &max);
+		output[i] = max;
+	}
+}
+
+// One work item per input element, so every element is written once and nothing needs clearing.
+// Windows do not overlap so each element only has to look at the winner of its own window.
+__kernel void backPropagate(__global const float* outputError,
+							__global const uint* indices,
+							__global float* inputError,
+							const uint size)	// batch size * input size
+{
+	const uint inputSize = INPUT_WIDTH * INPUT_HEIGHT * CHANNELS;
+	const uint outputWidth = INPUT_WIDTH / POOL_WIDTH;
+	const uint outputHeight = INPUT_HEIGHT / POOL_HEIGHT;
+	const uint outputSize = outputWidth * outputHeight * CHANNELS;
+	uint gid = get_global_id(0);
+	uint stride = get_global_size(0);
+
+	for (uint i = gid; i < size; i += stride)
+	{
+		const uint sample = i / inputSize;
+		const uint index = i - sample * inputSize;
+		const uint channel = index / (INPUT_WIDTH * INPUT_HEIGHT);
+		const uint rest = index - channel * INPUT_WIDTH * INPUT_HEIGHT;
+		const uint y = rest / INPUT_WIDTH / POOL_HEIGHT;
+		const uint x = (rest - rest / INPUT_WIDTH * INPUT_WIDTH) / POOL_WIDTH;
+		float error = 0.f;
+
+		if (y < outputHeight && x < outputWidth)
+		{
+			const uint o = sample * outputSize + (channel * outputHeight + y) * outputWidth + x;
+
+			if (indices[o] == index)
+			{
+				error = outputError[o];
+			}
+		}
+
+		inputError[i] = error;
+	}
+}
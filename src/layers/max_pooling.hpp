@@ -0,0 +1,212 @@
+#pragma once
+#include "layer.hpp"
+#include "..\..\include\shape.hpp"
+#include "..\..\include\dimension.hpp"
+#include <cstring>
+
+namespace nn
+{
+namespace layer
+{
+// Max over non-overlapping poolingSize windows of each channel of a (channels, height, width)
+// input. Rows and columns that do not fill a whole window are dropped.
+//
+// While training the forward pass saves the input index that won each window, so
+// backpropagation only has to copy each output error to its winner.
+class MaxPooling : public Layer
+{
+public:
+	MaxPooling(Shape<3> inputShape, Dim2 poolingSize) :
+		Layer(inputShape.size(), inputShape.length(0) * (inputShape.length(1) / poolingSize.y) * (inputShape.length(2) / poolingSize.x), 0),
+		channels(uint32_t(inputShape.length(0))),
+		inputHeight(uint32_t(inputShape.length(1))),
+		inputWidth(uint32_t(inputShape.length(2))),
+		poolHeight(poolingSize.y),
+		poolWidth(poolingSize.x),
+		outputHeight(inputHeight / poolHeight),
+		outputWidth(inputWidth / poolWidth),
+		forwardKernel(NULL),
+		forwardTrainingKernel(NULL),
+		backPropagateKernel(NULL)
+	{
+	}
+
+	Shape<3> getOutputShape() const { return Shape<3>({ channels, outputHeight, outputWidth }); }
+
+	void forward(const float* input, const float* params, float* output) const final
+	{
+		forwardBatch(input, params, output, 1);
+	}
+
+	void backPropagate(const BackPropData& data, float* inputError) const final
+	{
+		backPropagateBatch(data, inputError, 1);
+	}
+
+	void forwardBatch(const float* input, const float*, float* output, size_t batchSize, const float* = nullptr) const final
+	{
+		pool<false>(input, output, nullptr, batchSize);
+	}
+
+	// One index per output
+	size_t getTrainingStateSize() const final { return outputSize; }
+
+	void forwardTrainingBatch(const float* input, const float*, float* output, float* state, size_t batchSize, const float* = nullptr) const final
+	{
+		pool<true>(input, output, reinterpret_cast<uint32_t*>(state), batchSize);
+	}
+
+	// Needs the indices saved by forwardTrainingBatch
+	void backPropagateBatch(const BackPropData& data, float* inputError, size_t batchSize) const final
+	{
+		assert(data.state);
+		const uint32_t* indices = reinterpret_cast<const uint32_t*>(data.state);
+		const float* outputError = data.outputError;
+
+		memset(inputError, 0, batchSize * inputSize * sizeof(float));
+
+		for (size_t n = 0; n < batchSize; ++n)
+		{
+			for (size_t i = 0; i < outputSize; ++i)
+			{
+				inputError[indices[i]] = outputError[i];
+			}
+
+			indices += outputSize;
+			outputError += outputSize;
+			inputError += inputSize;
+		}
+	}
+
+	void cl_forward(cl_command_queue queue, cl_mem input, cl_mem, cl_mem output, uint32_t inOffset, uint32_t outOffset, uint32_t, uint32_t batchSize) const final
+	{
+		cl_pool(forwardKernel, queue, input, output, NULL, inOffset, outOffset, batchSize);
+	}
+
+	void cl_forwardTraining(cl_command_queue queue, cl_mem input, cl_mem, cl_mem output, cl_mem state, uint32_t inOffset, uint32_t outOffset, uint32_t, uint32_t batchSize) const final
+	{
+		cl_pool(forwardTrainingKernel, queue, input, output, state, inOffset, outOffset, batchSize);
+	}
+
+	void cl_backPropagate(cl_command_queue queue, const ClBackPropData& data, cl_mem inputError, uint32_t, uint32_t batchSize) const final
+	{
+		uint32_t size = batchSize * inputSize;
+
+		int error;
+		error = clSetKernelArg(backPropagateKernel, 0, sizeof(cl_mem), &data.outputError);
+		error |= clSetKernelArg(backPropagateKernel, 1, sizeof(cl_mem), &data.state);
+		error |= clSetKernelArg(backPropagateKernel, 2, sizeof(cl_mem), &inputError);
+		error |= clSetKernelArg(backPropagateKernel, 3, sizeof(size), &size);
+		error |= cl::enqueue(queue, backPropagateKernel, size, { inputError });
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::maxPooling::cl_backPropagate()");
+		}
+	}
+
+	void cl_initKernels(cl_context context, cl_device_id device) final
+	{
+		auto options = cl::defines({
+			{ "INPUT_WIDTH", inputWidth },
+			{ "INPUT_HEIGHT", inputHeight },
+			{ "CHANNELS", channels },
+			{ "POOL_WIDTH", poolWidth },
+			{ "POOL_HEIGHT", poolHeight } });
+		auto program = cl::buildProgramFromFile(__FILE__, context, device, options);
+
+		int error;
+		forwardKernel = clCreateKernel(program, "forward", &error);
+		forwardTrainingKernel = clCreateKernel(program, "forwardTraining", &error);
+		backPropagateKernel = clCreateKernel(program, "backPropagate", &error);
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error while creating kernel(s) for layer::maxPooling.");
+		}
+	}
+
+private:
+	template<bool StoreIndices>
+	void pool(const float* input, float* output, uint32_t* indices, size_t batchSize) const
+	{
+		for (size_t n = 0; n < batchSize; ++n)
+		{
+			for (size_t c = 0; c < channels; ++c)
+			{
+				for (size_t y = 0; y < outputHeight; ++y)
+				{
+					for (size_t x = 0; x < outputWidth; ++x)
+					{
+						const size_t first = (c * inputHeight + y * poolHeight) * inputWidth + x * poolWidth;
+						size_t best = first;
+						float max = input[first];
+
+						for (size_t i = 0; i < poolHeight; ++i)
+						{
+							for (size_t j = 0; j < poolWidth; ++j)
+							{
+								const size_t index = first + i * inputWidth + j;
+
+								if (input[index] > max)
+								{
+									max = input[index];
+									best = index;
+								}
+							}
+						}
+
+						*output++ = max;
+
+						if (StoreIndices)
+						{
+							*indices++ = uint32_t(best);
+						}
+					}
+				}
+			}
+
+			input += inputSize;
+		}
+	}
+
+	void cl_pool(cl_kernel kernel, cl_command_queue queue, cl_mem input, cl_mem output, cl_mem state, uint32_t inOffset, uint32_t outOffset, uint32_t batchSize) const
+	{
+		uint32_t size = batchSize * outputSize;
+
+		int error;
+		error = clSetKernelArg(kernel, 0, sizeof(cl_mem), &input);
+		error |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &output);
+		error |= clSetKernelArg(kernel, 2, sizeof(inOffset), &inOffset);
+		error |= clSetKernelArg(kernel, 3, sizeof(outOffset), &outOffset);
+		error |= clSetKernelArg(kernel, 4, sizeof(size), &size);
+
+		if (state)
+		{
+			error |= clSetKernelArg(kernel, 5, sizeof(cl_mem), &state);
+		}
+
+		error |= cl::enqueue(queue, kernel, size, { output, state });
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::maxPooling::cl_forward()");
+		}
+	}
+
+	const uint32_t channels;
+	const uint32_t inputHeight;
+	const uint32_t inputWidth;
+	const uint32_t poolHeight;
+	const uint32_t poolWidth;
+	const uint32_t outputHeight;
+	const uint32_t outputWidth;
+
+	cl_kernel forwardKernel;
+
+	cl_kernel forwardTrainingKernel;
+
+	cl_kernel backPropagateKernel;
+};
+}
+}
@@ -0,0 +1,36 @@
+// alpha is the slope for negative inputs, 0 for a plain ReLU. input and output may be the same buffer.
+__kernel void forward(__global const float* input, // layer input vector
+					  __global float* output,      // layer output vector
+					  const uint inputOffset,      // offset into input
+					  const uint outputOffset,     // offset into output
+					  const float alpha,           // slope for negative inputs
+					  const uint size)             // length of input (and output) vector
+{
+	input += inputOffset;
+	output += outputOffset;
+	uint gid = get_global_id(0);
+	uint stride = get_global_size(0);
+
+	for (uint i = gid; i < size; i += stride)
+	{
+		const float x = input[i];
+		output[i] = fmax(x, 0.f) + alpha * fmin(x, 0.f);
+	}
+}
+
+// The derivative is read from the output, the input may already have been overwritten
+__kernel void backPropagate(__global const float* output,      // layer output vector
+							__global const float* outputError, // layer output error vector
+							__global float* inputError,        // OUTPUT -> layer input error vector
+							const float alpha,                 // slope for negative inputs
+							const uint size)				   // length of input vector
+{
+	uint gid = get_global_id(0);
+	uint stride = get_global_size(0);
+
+	for (uint i = gid; i < size; i += stride)
+	{
+		const float error = outputError[i];
+		inputError[i] = output[i] > 0.f ? error : alpha * error;
+	}
+}
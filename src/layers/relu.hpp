@@ -0,0 +1,115 @@
+#pragma once
+#include "layer.hpp"
+#include "../cl/cl_utils.hpp"
+#include "../math/kernels.hpp"
+
+namespace nn
+{
+namespace layer
+{
+// Rectified linear unit, max(x, 0). With alpha > 0 it is the leaky variant, which lets
+// alpha * x through for negative x.
+//
+// Runs in place. The derivative (1 or alpha) follows from the sign of the output, so
+// backpropagation never needs the input that the output was written over.
+class Relu : public Layer
+{
+public:
+	Relu(size_t size, float alpha = 0.f) :
+		Layer(size, size, 0),
+		alpha(alpha),
+		forwardKernel(NULL),
+		backPropagateKernel(NULL)
+	{
+		if (!(alpha >= 0.f))
+		{
+			throw std::invalid_argument("Leaky ReLU slope cannot be negative.");
+		}
+	}
+
+	float getAlpha() const { return alpha; }
+
+	void forward(const float* input, const float* params, float* output) const final
+	{
+		forwardBatch(input, params, output, 1);
+	}
+
+	void backPropagate(const BackPropData& data, float* inputError) const final
+	{
+		backPropagateBatch(data, inputError, 1);
+	}
+
+	bool canRunInPlace() const final { return true; }
+
+	bool usesOutputInBackPropagation() const final { return true; }
+
+	void forwardBatch(const float* input, const float*, float* output, size_t batchSize, const float* = nullptr) const final
+	{
+		math::kernels().leakyRelu(input, output, alpha, inputSize * batchSize);
+	}
+
+	void backPropagateBatch(const BackPropData& data, float* inputError, size_t batchSize) const final
+	{
+		math::kernels().leakyReluBackward(data.output, data.outputError, inputError, alpha, inputSize * batchSize);
+	}
+
+	void cl_forward(cl_command_queue queue, cl_mem input, cl_mem, cl_mem output, uint32_t inOffset, uint32_t outOffset, uint32_t, uint32_t batchSize) const final
+	{
+		uint32_t size = batchSize * inputSize;
+
+		int error;
+		error = clSetKernelArg(forwardKernel, 0, sizeof(cl_mem), &input);
+		error |= clSetKernelArg(forwardKernel, 1, sizeof(cl_mem), &output);
+		error |= clSetKernelArg(forwardKernel, 2, sizeof(inOffset), &inOffset);
+		error |= clSetKernelArg(forwardKernel, 3, sizeof(outOffset), &outOffset);
+		error |= clSetKernelArg(forwardKernel, 4, sizeof(alpha), &alpha);
+		error |= clSetKernelArg(forwardKernel, 5, sizeof(size), &size);
+		error |= cl::enqueue(queue, forwardKernel, size, { output });
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::relu::cl_forward()");
+		}
+	}
+
+	void cl_backPropagate(cl_command_queue queue, const ClBackPropData& data, cl_mem inputError, uint32_t, uint32_t batchSize) const final
+	{
+		uint32_t size = batchSize * inputSize;
+
+		int error;
+		error = clSetKernelArg(backPropagateKernel, 0, sizeof(cl_mem), &data.output);
+		error |= clSetKernelArg(backPropagateKernel, 1, sizeof(cl_mem), &data.outputError);
+		error |= clSetKernelArg(backPropagateKernel, 2, sizeof(cl_mem), &inputError);
+		error |= clSetKernelArg(backPropagateKernel, 3, sizeof(alpha), &alpha);
+		error |= clSetKernelArg(backPropagateKernel, 4, sizeof(size), &size);
+		error |= cl::enqueue(queue, backPropagateKernel, size, { inputError });
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::relu::cl_backPropagate()");
+		}
+	}
+
+	void cl_initKernels(cl_context context, cl_device_id device) final
+	{
+		auto program = cl::buildProgramFromFile(__FILE__, context, device);
+
+		int error;
+		forwardKernel = clCreateKernel(program, "forward", &error);
+		backPropagateKernel = clCreateKernel(program, "backPropagate", &error);
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error while creating kernel(s) for layer::relu.");
+		}
+	}
+
+private:
+	const float alpha;
+
+	cl_kernel forwardKernel;
+
+	cl_kernel backPropagateKernel;
+};
+}
+}
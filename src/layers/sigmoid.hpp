@@ -1,6 +1,7 @@
 #pragma once
 #include "layer.hpp"
 #include "../cl/cl_utils.hpp"
+#include "../math/kernels.hpp"
 #include <math.h>
 #include <cstring>
 
@@ -16,26 +17,29 @@ public:
 	{
 	}
 
-	void forward(const float* input, const float*, float* output) const final
+	void forward(const float* input, const float* params, float* output) const final
 	{
-		for (size_t i = 0; i < inputSize; ++i)
-		{
-			output[i] = sigmoid(input[i]);
-		}
+		forwardBatch(input, params, output, 1);
 	}
 
 	void backPropagate(const BackPropData& data, float* inputError) const final
 	{
-		for (size_t i = 0; i < inputSize; ++i)
-		{
-			inputError[i] = sigmoidPrime(data.input[i]) * data.outputError[i];
-		}
+		backPropagateBatch(data, inputError, 1);
+	}
+
+	void forwardBatch(const float* input, const float*, float* output, size_t batchSize, const float* = nullptr) const final
+	{
+		math::kernels().sigmoid(input, output, inputSize * batchSize);
+	}
+
+	void backPropagateBatch(const BackPropData& data, float* inputError, size_t batchSize) const final
+	{
+		math::kernels().sigmoidBackward(data.input, data.outputError, inputError, inputSize * batchSize);
 	}
 
 	void cl_forward(cl_command_queue queue, cl_mem input, cl_mem, cl_mem output, uint32_t inOffset, uint32_t outOffset, uint32_t, uint32_t batchSize) const final
 	{
 		uint32_t size = batchSize * inputSize;
-		size_t globalSize = cl::alignSize(size);
 
 		int error;
 		error = clSetKernelArg(forwardKernel, 0, sizeof(cl_mem), &input);
@@ -43,7 +47,7 @@ public:
 		error |= clSetKernelArg(forwardKernel, 2, sizeof(inOffset), &inOffset);
 		error |= clSetKernelArg(forwardKernel, 3, sizeof(outOffset), &outOffset);
 		error |= clSetKernelArg(forwardKernel, 4, sizeof(size), &size);
-		error |= clEnqueueNDRangeKernel(queue, forwardKernel, 1, NULL, &globalSize, &cl::workGroupSize, 0, NULL, NULL);
+		error |= cl::enqueue(queue, forwardKernel, size, { output });
 
 		if (error != CL_SUCCESS)
 		{
@@ -54,7 +58,6 @@ public:
 	void cl_backPropagate(cl_command_queue queue, const ClBackPropData& data, cl_mem inputError, uint32_t, uint32_t batchSize) const final
 	{
 		uint32_t size = batchSize * inputSize;
-		size_t globalSize = cl::alignSize(size);
 
 		int error;
 		error = clSetKernelArg(backPropagateKernel, 0, sizeof(cl_mem), &data.input);
@@ -62,7 +65,7 @@ public:
 		error |= clSetKernelArg(backPropagateKernel, 2, sizeof(cl_mem), &inputError);
 		error |= clSetKernelArg(backPropagateKernel, 3, sizeof(data.inputOffset), &data.inputOffset);
 		error |= clSetKernelArg(backPropagateKernel, 4, sizeof(size), &size);
-		error |= clEnqueueNDRangeKernel(queue, backPropagateKernel, 1, NULL, &globalSize, &cl::workGroupSize, 0, NULL, NULL);
+		error |= cl::enqueue(queue, backPropagateKernel, size, { inputError });
 
 		if (error != CL_SUCCESS)
 		{
@@ -0,0 +1,33 @@
+// input and output may be the same buffer
+__kernel void forward(__global const float* input, // layer input vector
+					  __global float* output,      // layer output vector
+					  const uint inputOffset,      // offset into input
+					  const uint outputOffset,     // offset into output
+					  const uint size)             // length of input (and output) vector
+{
+	input += inputOffset;
+	output += outputOffset;
+	uint gid = get_global_id(0);
+	uint stride = get_global_size(0);
+
+	for (uint i = gid; i < size; i += stride)
+	{
+		output[i] = tanh(input[i]);
+	}
+}
+
+// The derivative is read from the output, the input may already have been overwritten
+__kernel void backPropagate(__global const float* output,      // layer output vector
+							__global const float* outputError, // layer output error vector
+							__global float* inputError,        // OUTPUT -> layer input error vector
+							const uint size)				   // length of input vector
+{
+	uint gid = get_global_id(0);
+	uint stride = get_global_size(0);
+
+	for (uint i = gid; i < size; i += stride)
+	{
+		const float y = output[i];
+		inputError[i] = (1.f - y * y) * outputError[i];
+	}
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include "layer.hpp"
+#include "../cl/cl_utils.hpp"
+#include "../math/kernels.hpp"
+
+namespace nn
+{
+namespace layer
+{
+// Hyperbolic tangent. Runs in place; the derivative is 1 - tanh(x)^2, which is calculated from
+// the output, so backpropagation never needs the input that the output was written over.
+class Tanh : public Layer
+{
+public:
+	Tanh(size_t size) :
+		Layer(size, size, 0),
+		forwardKernel(NULL),
+		backPropagateKernel(NULL)
+	{
+	}
+
+	void forward(const float* input, const float* params, float* output) const final
+	{
+		forwardBatch(input, params, output, 1);
+	}
+
+	void backPropagate(const BackPropData& data, float* inputError) const final
+	{
+		backPropagateBatch(data, inputError, 1);
+	}
+
+	bool canRunInPlace() const final { return true; }
+
+	bool usesOutputInBackPropagation() const final { return true; }
+
+	void forwardBatch(const float* input, const float*, float* output, size_t batchSize, const float* = nullptr) const final
+	{
+		math::kernels().tanh(input, output, inputSize * batchSize);
+	}
+
+	void backPropagateBatch(const BackPropData& data, float* inputError, size_t batchSize) const final
+	{
+		math::kernels().tanhBackward(data.output, data.outputError, inputError, inputSize * batchSize);
+	}
+
+	void cl_forward(cl_command_queue queue, cl_mem input, cl_mem, cl_mem output, uint32_t inOffset, uint32_t outOffset, uint32_t, uint32_t batchSize) const final
+	{
+		uint32_t size = batchSize * inputSize;
+
+		int error;
+		error = clSetKernelArg(forwardKernel, 0, sizeof(cl_mem), &input);
+		error |= clSetKernelArg(forwardKernel, 1, sizeof(cl_mem), &output);
+		error |= clSetKernelArg(forwardKernel, 2, sizeof(inOffset), &inOffset);
+		error |= clSetKernelArg(forwardKernel, 3, sizeof(outOffset), &outOffset);
+		error |= clSetKernelArg(forwardKernel, 4, sizeof(size), &size);
+		error |= cl::enqueue(queue, forwardKernel, size, { output });
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::tanh::cl_forward()");
+		}
+	}
+
+	void cl_backPropagate(cl_command_queue queue, const ClBackPropData& data, cl_mem inputError, uint32_t, uint32_t batchSize) const final
+	{
+		uint32_t size = batchSize * inputSize;
+
+		int error;
+		error = clSetKernelArg(backPropagateKernel, 0, sizeof(cl_mem), &data.output);
+		error |= clSetKernelArg(backPropagateKernel, 1, sizeof(cl_mem), &data.outputError);
+		error |= clSetKernelArg(backPropagateKernel, 2, sizeof(cl_mem), &inputError);
+		error |= clSetKernelArg(backPropagateKernel, 3, sizeof(size), &size);
+		error |= cl::enqueue(queue, backPropagateKernel, size, { inputError });
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in layer::tanh::cl_backPropagate()");
+		}
+	}
+
+	void cl_initKernels(cl_context context, cl_device_id device) final
+	{
+		auto program = cl::buildProgramFromFile(__FILE__, context, device);
+
+		int error;
+		forwardKernel = clCreateKernel(program, "forward", &error);
+		backPropagateKernel = clCreateKernel(program, "backPropagate", &error);
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error while creating kernel(s) for layer::tanh.");
+		}
+	}
+
+private:
+	cl_kernel forwardKernel;
+
+	cl_kernel backPropagateKernel;
+};
+}
+}
@@ -1,5 +1,5 @@
 #pragma once
-#include "../cl/cl_utils.hpp"
+#include "../cl/tuner.hpp"
 
 namespace nn
 {
@@ -20,6 +20,14 @@ public:
 
 	virtual void cl_calculateDerivatives(cl_command_queue queue, cl_mem output, cl_mem target, cl_mem derivatives, uint32_t targetOffset, uint32_t height, uint32_t width) const = 0;
 
+	// Classification losses can take one uint32_t label per row instead of a row of targets.
+	// Without one, training on labels subtracts 1 from the output at the label.
+	virtual bool supportsLabels() const { return false; }
+
+	virtual void calculateLabelDerivatives(const float* output, const uint32_t* labels, float* derivatives, size_t height, size_t width) const {}
+
+	virtual void cl_calculateLabelDerivatives(cl_command_queue queue, cl_mem output, cl_mem labels, cl_mem derivatives, uint32_t labelOffset, uint32_t height, uint32_t width) const {}
+
 	virtual void cl_initKernels(cl_context context, cl_device_id device) {};
 };
 }
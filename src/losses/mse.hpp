@@ -38,7 +38,6 @@ public:
 	void cl_calculateError(cl_command_queue queue, cl_mem output, cl_mem target, cl_mem ouputError, uint32_t targetOffset, uint32_t height, uint32_t width) const  final
 	{
 		uint32_t size = height * width;
-		size_t globalSize = cl::alignSize(size);
 
 		int error;
 		error = clSetKernelArg(calculateErrorKernel, 0, sizeof(cl_mem), &output);
@@ -46,7 +45,7 @@ public:
 		error |= clSetKernelArg(calculateErrorKernel, 2, sizeof(cl_mem), &ouputError);
 		error |= clSetKernelArg(calculateErrorKernel, 3, sizeof(targetOffset), &targetOffset);
 		error |= clSetKernelArg(calculateErrorKernel, 4, sizeof(size), &size);
-		error |= clEnqueueNDRangeKernel(queue, calculateErrorKernel, 1, NULL, &globalSize, &cl::workGroupSize, 0, NULL, NULL);
+		error |= cl::enqueue(queue, calculateErrorKernel, size, { ouputError });
 
 		if (error != CL_SUCCESS)
 		{
@@ -57,7 +56,6 @@ public:
 	void cl_calculateTotalError(cl_command_queue queue, cl_mem output, cl_mem target, cl_mem ouputError, uint32_t height, uint32_t width) const  final
 	{
 		uint32_t size = height * width;
-		size_t globalSize = cl::workGroupSize * height;
 
 		int error;
 		error = clSetKernelArg(calculateTotalErrorKernel, 0, sizeof(cl_mem), &output);
@@ -65,7 +63,7 @@ public:
 		error |= clSetKernelArg(calculateTotalErrorKernel, 2, sizeof(cl_mem), &ouputError);
 		error |= clSetKernelArg(calculateTotalErrorKernel, 3, sizeof(width), &width);
 		error |= clSetKernelArg(calculateTotalErrorKernel, 4, sizeof(size), &size);
-		error |= clEnqueueNDRangeKernel(queue, calculateTotalErrorKernel, 1, NULL, &globalSize, &cl::workGroupSize, 0, NULL, NULL);
+		error |= cl::enqueueGroups(queue, calculateTotalErrorKernel, height, width, { ouputError });
 
 		if (error != CL_SUCCESS)
 		{
@@ -76,7 +74,6 @@ public:
 	void cl_calculateDerivatives(cl_command_queue queue, cl_mem output, cl_mem target, cl_mem derivatives, uint32_t targetOffset, uint32_t height, uint32_t width) const final
 	{
 		uint32_t size = height * width;
-		size_t globalSize = cl::alignSize(size);
 
 		int error;
 		error = clSetKernelArg(calculateDerivativesKernel, 0, sizeof(cl_mem), &output);
@@ -84,7 +81,7 @@ public:
 		error |= clSetKernelArg(calculateDerivativesKernel, 2, sizeof(cl_mem), &derivatives);
 		error |= clSetKernelArg(calculateDerivativesKernel, 3, sizeof(targetOffset), &targetOffset);
 		error |= clSetKernelArg(calculateDerivativesKernel, 4, sizeof(size), &size);
-		error |= clEnqueueNDRangeKernel(queue, calculateDerivativesKernel, 1, NULL, &globalSize, &cl::workGroupSize, 0, NULL, NULL);
+		error |= cl::enqueue(queue, calculateDerivativesKernel, size, { derivatives });
 
 		//auto data = clEnqueueMapBuffer(queue, output, CL_TRUE, CL_MAP_READ, 0, 1 * sizeof(float), 0, NULL, NULL, &error);
 		//auto data1 = clEnqueueMapBuffer(queue, target, CL_TRUE, CL_MAP_READ, 0, 100 * sizeof(float), 0, NULL, NULL, &error);
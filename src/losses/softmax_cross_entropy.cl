@@ -0,0 +1,157 @@
+#define MAX_WORKGROUP_SIZE (256)
+
+// Every kernel runs one work group per row of width outputs. The row's log-sum-exp is found
+// with two reductions in local memory (maximum, then the sum of exp(x - maximum)) and is then
+// used straight away, so softmax probabilities are never stored.
+
+inline float reduceMax(__local float* temp, float value)
+{
+	const uint lid = get_local_id(0);
+	temp[lid] = value;
+
+	for (uint i = get_local_size(0) / 2; i > 0; i /= 2)
+	{
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lid < i)
+		{
+			temp[lid] = fmax(temp[lid], temp[lid + i]);
+		}
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+	const float result = temp[0];
+
+	// temp is reused by the next reduction
+	barrier(CLK_LOCAL_MEM_FENCE);
+	return result;
+}
+
+inline float reduceSum(__local float* temp, float value)
+{
+	const uint lid = get_local_id(0);
+	temp[lid] = value;
+
+	for (uint i = get_local_size(0) / 2; i > 0; i /= 2)
+	{
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lid < i)
+		{
+			temp[lid] += temp[lid + i];
+		}
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+	const float result = temp[0];
+	barrier(CLK_LOCAL_MEM_FENCE);
+	return result;
+}
+
+inline float logSumExp(__global const float* row, uint width, __local float* temp)
+{
+	const uint lid = get_local_id(0);
+	const uint stride = get_local_size(0);
+	float max = -MAXFLOAT;
+
+	for (uint i = lid; i < width; i += stride)
+	{
+		max = fmax(max, row[i]);
+	}
+
+	max = reduceMax(temp, max);
+	float sum = 0.f;
+
+	for (uint i = lid; i < width; i += stride)
+	{
+		sum += exp(row[i] - max);
+	}
+
+	return max + log(reduceSum(temp, sum));
+}
+
+__kernel void calculateError(__global const float* output,
+							 __global const float* target,
+							 __global float* error,
+							 uint targetOffset,
+							 uint width)
+{
+	__local float temp[MAX_WORKGROUP_SIZE];
+	const uint row = get_group_id(0) * width;
+	output += row;
+	target += targetOffset + row;
+	error += row;
+
+	const float lse = logSumExp(output, width, temp);
+
+	for (uint i = get_local_id(0); i < width; i += get_local_size(0))
+	{
+		error[i] = target[i] * (lse - output[i]);
+	}
+}
+
+__kernel void calculateTotalError(__global const float* output,
+								  __global const float* target,
+								  __global float* error,
+								  uint targetOffset,
+								  uint width)
+{
+	__local float temp[MAX_WORKGROUP_SIZE];
+	const uint wid = get_group_id(0);
+	output += wid * width;
+	target += targetOffset + wid * width;
+
+	const float lse = logSumExp(output, width, temp);
+	float sum = 0.f;
+
+	for (uint i = get_local_id(0); i < width; i += get_local_size(0))
+	{
+		sum += target[i] * (lse - output[i]);
+	}
+
+	sum = reduceSum(temp, sum);
+
+	if (get_local_id(0) == 0)
+	{
+		error[wid] = sum;
+	}
+}
+
+__kernel void calculateDerivatives(__global const float* output,
+								   __global const float* target,
+								   __global float* derivatives,
+								   uint targetOffset,
+								   uint width)
+{
+	__local float temp[MAX_WORKGROUP_SIZE];
+	const uint row = get_group_id(0) * width;
+	output += row;
+	target += targetOffset + row;
+	derivatives += row;
+
+	const float lse = logSumExp(output, width, temp);
+
+	for (uint i = get_local_id(0); i < width; i += get_local_size(0))
+	{
+		derivatives[i] = exp(output[i] - lse) - target[i];
+	}
+}
+
+// labelOffset is the index of the first row's label
+__kernel void calculateLabelDerivatives(__global const float* output,
+										__global const uint* labels,
+										__global float* derivatives,
+										uint labelOffset,
+										uint width)
+{
+	__local float temp[MAX_WORKGROUP_SIZE];
+	const uint wid = get_group_id(0);
+	output += wid * width;
+	derivatives += wid * width;
+	const uint label = labels[labelOffset + wid];
+
+	const float lse = logSumExp(output, width, temp);
+
+	for (uint i = get_local_id(0); i < width; i += get_local_size(0))
+	{
+		derivatives[i] = exp(output[i] - lse) - (i == label ? 1.f : 0.f);
+	}
+}
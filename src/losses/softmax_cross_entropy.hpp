@@ -0,0 +1,163 @@
+#pragma once
+#include "loss.hpp"
+#include <math.h>
+
+namespace nn
+{
+namespace loss
+{
+// Cross entropy of softmax(output), where output is a row of logits. The softmax only exists
+// inside the loss: each row's log-sum-exp and gradient, softmax(output) - target, are found
+// together in one pass so the probabilities are never stored. Subtracting the row maximum
+// before exponentiating keeps large logits from overflowing.
+//
+// Targets are rows of probabilities, or one uint32_t label per row for classification.
+class SoftmaxCrossEntropy : public Loss
+{
+public:
+	SoftmaxCrossEntropy() :
+		calculateErrorKernel(NULL),
+		calculateTotalErrorKernel(NULL),
+		calculateDerivativesKernel(NULL),
+		calculateLabelDerivativesKernel(NULL)
+	{
+	}
+
+	void calculateError(const float* output, const float* target, float* error, size_t size) const final
+	{
+		const float lse = logSumExp(output, size);
+
+		for (size_t i = 0; i < size; ++i)
+		{
+			error[i] = target[i] * (lse - output[i]);
+		}
+	}
+
+	float calculateError(const float* output, const float* target, size_t size) const final
+	{
+		const float lse = logSumExp(output, size);
+		float error = 0;
+
+		for (size_t i = 0; i < size; ++i)
+		{
+			error += target[i] * (lse - output[i]);
+		}
+		return error;
+	}
+
+	void calculateDerivatives(const float* output, const float* target, float* derivatives, size_t size) const final
+	{
+		const float lse = logSumExp(output, size);
+
+		for (size_t i = 0; i < size; ++i)
+		{
+			derivatives[i] = expf(output[i] - lse) - target[i];
+		}
+	}
+
+	bool supportsLabels() const final { return true; }
+
+	void calculateLabelDerivatives(const float* output, const uint32_t* labels, float* derivatives, size_t height, size_t width) const final
+	{
+		for (size_t n = 0; n < height; ++n)
+		{
+			const float lse = logSumExp(output, width);
+
+			for (size_t i = 0; i < width; ++i)
+			{
+				derivatives[i] = expf(output[i] - lse);
+			}
+
+			derivatives[labels[n]] -= 1.f;
+			output += width;
+			derivatives += width;
+		}
+	}
+
+	void cl_calculateError(cl_command_queue queue, cl_mem output, cl_mem target, cl_mem ouputError, uint32_t targetOffset, uint32_t height, uint32_t width) const final
+	{
+		cl_runRows(calculateErrorKernel, queue, output, target, ouputError, targetOffset, height, width);
+	}
+
+	void cl_calculateTotalError(cl_command_queue queue, cl_mem output, cl_mem target, cl_mem ouputError, uint32_t height, uint32_t width) const final
+	{
+		cl_runRows(calculateTotalErrorKernel, queue, output, target, ouputError, 0, height, width);
+	}
+
+	void cl_calculateDerivatives(cl_command_queue queue, cl_mem output, cl_mem target, cl_mem derivatives, uint32_t targetOffset, uint32_t height, uint32_t width) const final
+	{
+		cl_runRows(calculateDerivativesKernel, queue, output, target, derivatives, targetOffset, height, width);
+	}
+
+	void cl_calculateLabelDerivatives(cl_command_queue queue, cl_mem output, cl_mem labels, cl_mem derivatives, uint32_t labelOffset, uint32_t height, uint32_t width) const final
+	{
+		cl_runRows(calculateLabelDerivativesKernel, queue, output, labels, derivatives, labelOffset, height, width);
+	}
+
+	void cl_initKernels(cl_context context, cl_device_id device) final
+	{
+		auto program = cl::buildProgramFromFile(__FILE__, context, device);
+
+		int error;
+		calculateErrorKernel = clCreateKernel(program, "calculateError", &error);
+		calculateTotalErrorKernel = clCreateKernel(program, "calculateTotalError", &error);
+		calculateDerivativesKernel = clCreateKernel(program, "calculateDerivatives", &error);
+		calculateLabelDerivativesKernel = clCreateKernel(program, "calculateLabelDerivatives", &error);
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error while creating kernel(s) for softmaxCrossEntropy::cl_initKernels().");
+		}
+	}
+
+	// log(sum(exp(x))) in one pass, rescaling the running sum whenever a new maximum is found
+	static float logSumExp(const float* x, size_t size)
+	{
+		float max = -INFINITY;
+		float sum = 0.f;
+
+		for (size_t i = 0; i < size; ++i)
+		{
+			if (x[i] > max)
+			{
+				sum = sum * expf(max - x[i]) + 1.f;
+				max = x[i];
+			}
+			else
+			{
+				sum += expf(x[i] - max);
+			}
+		}
+
+		return max + logf(sum);
+	}
+
+private:
+	// Every kernel takes one work group per row
+	void cl_runRows(cl_kernel kernel, cl_command_queue queue, cl_mem output, cl_mem target, cl_mem result, uint32_t targetOffset, uint32_t height, uint32_t width) const
+	{
+
+		int error;
+		error = clSetKernelArg(kernel, 0, sizeof(cl_mem), &output);
+		error |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &target);
+		error |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &result);
+		error |= clSetKernelArg(kernel, 3, sizeof(targetOffset), &targetOffset);
+		error |= clSetKernelArg(kernel, 4, sizeof(width), &width);
+		error |= cl::enqueueGroups(queue, kernel, height, width, { result });
+
+		if (error != CL_SUCCESS)
+		{
+			throw std::exception("Unexpected error in loss::softmaxCrossEntropy");
+		}
+	}
+
+	cl_kernel calculateErrorKernel;
+
+	cl_kernel calculateTotalErrorKernel;
+
+	cl_kernel calculateDerivativesKernel;
+
+	cl_kernel calculateLabelDerivativesKernel;
+};
+}
+}
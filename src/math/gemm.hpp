@@ -0,0 +1,110 @@
+#pragma once
+#include <stdint.h>
+#include <algorithm>
+#include "kernels.hpp"
+
+namespace nn
+{
+namespace math
+{
+// Cache blocking parameters (in elements). A blockK x blockN tile of floats is 64KB which
+// fits comfortably in L2 and is re-used for every row of the left hand matrix.
+static const size_t blockM = 64;
+static const size_t blockN = 64;
+static const size_t blockK = 256;
+
+// C[m x n] += A[m x k] * B[n x k]^T
+inline void gemmNT(const float* a, const float* b, float* c, size_t m, size_t n, size_t k)
+{
+	for (size_t k0 = 0; k0 < k; k0 += blockK)
+	{
+		const size_t kLen = std::min(blockK, k - k0);
+
+		for (size_t n0 = 0; n0 < n; n0 += blockN)
+		{
+			const size_t nEnd = std::min(n0 + blockN, n);
+
+			size_t i = 0;
+
+			// 4 rows of A at a time so each row of B is read once per 4 rows of C
+			for (; i + 4 <= m; i += 4)
+			{
+				const float* aRow = a + i * k + k0;
+				float* cRow = c + i * n;
+				float sums[4];
+
+				for (size_t j = n0; j < nEnd; ++j)
+				{
+					dot4(aRow, k, b + j * k + k0, kLen, sums);
+					cRow[j] += sums[0];
+					cRow[j + n] += sums[1];
+					cRow[j + 2 * n] += sums[2];
+					cRow[j + 3 * n] += sums[3];
+				}
+			}
+
+			for (; i < m; ++i)
+			{
+				const float* aRow = a + i * k + k0;
+				float* cRow = c + i * n;
+
+				for (size_t j = n0; j < nEnd; ++j)
+				{
+					cRow[j] += dot(aRow, b + j * k + k0, kLen);
+				}
+			}
+		}
+	}
+}
+
+// C[m x n] += A[m x k] * B[k x n]
+inline void gemmNN(const float* a, const float* b, float* c, size_t m, size_t n, size_t k)
+{
+	for (size_t n0 = 0; n0 < n; n0 += blockK)
+	{
+		const size_t nLen = std::min(blockK, n - n0);
+
+		for (size_t p0 = 0; p0 < k; p0 += blockN)
+		{
+			const size_t pEnd = std::min(p0 + blockN, k);
+
+			for (size_t i = 0; i < m; ++i)
+			{
+				const float* aRow = a + i * k;
+				float* cRow = c + i * n + n0;
+
+				for (size_t p = p0; p < pEnd; ++p)
+				{
+					axpy(aRow[p], b + p * n + n0, cRow, nLen);
+				}
+			}
+		}
+	}
+}
+
+// C[m x n] += A[k x m]^T * B[k x n]
+inline void gemmTN(const float* a, const float* b, float* c, size_t m, size_t n, size_t k)
+{
+	for (size_t i0 = 0; i0 < m; i0 += blockM)
+	{
+		const size_t iEnd = std::min(i0 + blockM, m);
+
+		for (size_t n0 = 0; n0 < n; n0 += blockK)
+		{
+			const size_t nLen = std::min(blockK, n - n0);
+
+			for (size_t p = 0; p < k; ++p)
+			{
+				const float* aRow = a + p * m;
+				const float* bRow = b + p * n + n0;
+
+				for (size_t i = i0; i < iEnd; ++i)
+				{
+					axpy(aRow[i], bRow, c + i * n + n0, nLen);
+				}
+			}
+		}
+	}
+}
+}
+}
@@ -0,0 +1,825 @@
+#include "kernels.hpp"
+#include <math.h>
+#include <algorithm>
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define NN_TARGET(isa)
+#else
+#include <cpuid.h>
+#define NN_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace nn
+{
+namespace math
+{
+namespace
+{
+/// CPU feature detection
+
+struct CpuFeatures
+{
+	bool sse4 = false;
+	bool avx2 = false;
+	bool avx512 = false;
+};
+
+void cpuid(int leaf, int subLeaf, int info[4])
+{
+#ifdef _MSC_VER
+	__cpuidex(info, leaf, subLeaf);
+#else
+	unsigned int a, b, c, d;
+	__cpuid_count(leaf, subLeaf, a, b, c, d);
+	info[0] = a; info[1] = b; info[2] = c; info[3] = d;
+#endif
+}
+
+uint64_t xgetbv()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t lo, hi;
+	__asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((uint64_t)hi << 32) | lo;
+#endif
+}
+
+CpuFeatures detectCpuFeatures()
+{
+	CpuFeatures features;
+	int info[4];
+
+	cpuid(0, 0, info);
+	const int maxLeaf = info[0];
+
+	if (maxLeaf < 1)
+	{
+		return features;
+	}
+
+	cpuid(1, 0, info);
+	const bool sse41 = (info[2] & (1 << 19)) != 0;
+	const bool fma = (info[2] & (1 << 12)) != 0;
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+
+	features.sse4 = sse41;
+
+	// The OS must save the YMM (and for AVX-512 the ZMM/opmask) registers on context switches
+	const uint64_t xcr0 = osxsave ? xgetbv() : 0;
+	const bool ymmEnabled = (xcr0 & 0x6) == 0x6;
+	const bool zmmEnabled = (xcr0 & 0xE6) == 0xE6;
+
+	if (maxLeaf >= 7)
+	{
+		cpuid(7, 0, info);
+		const bool avx2 = (info[1] & (1 << 5)) != 0;
+		const bool avx512f = (info[1] & (1 << 16)) != 0;
+
+		features.avx2 = avx && avx2 && fma && ymmEnabled;
+		features.avx512 = features.avx2 && avx512f && zmmEnabled;
+	}
+
+	return features;
+}
+
+const CpuFeatures& cpuFeatures()
+{
+	static const CpuFeatures features = detectCpuFeatures();
+	return features;
+}
+
+/// Scalar
+
+float sigmoid(float x)
+{
+	return 1.f / (1.f + expf(-x));
+}
+
+float dotScalar(const float* a, const float* b, size_t size)
+{
+	float sum = 0.f;
+	for (size_t i = 0; i < size; ++i)
+	{
+		sum += a[i] * b[i];
+	}
+	return sum;
+}
+
+void dot4Scalar(const float* a, size_t stride, const float* b, size_t size, float* result)
+{
+	float sum0 = 0.f, sum1 = 0.f, sum2 = 0.f, sum3 = 0.f;
+	const float* a0 = a;
+	const float* a1 = a0 + stride;
+	const float* a2 = a1 + stride;
+	const float* a3 = a2 + stride;
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		sum0 += a0[i] * b[i];
+		sum1 += a1[i] * b[i];
+		sum2 += a2[i] * b[i];
+		sum3 += a3[i] * b[i];
+	}
+
+	result[0] = sum0;
+	result[1] = sum1;
+	result[2] = sum2;
+	result[3] = sum3;
+}
+
+void axpyScalar(float alpha, const float* x, float* y, size_t size)
+{
+	for (size_t i = 0; i < size; ++i)
+	{
+		y[i] += alpha * x[i];
+	}
+}
+
+void sigmoidScalar(const float* input, float* output, size_t size)
+{
+	for (size_t i = 0; i < size; ++i)
+	{
+		output[i] = sigmoid(input[i]);
+	}
+}
+
+void sigmoidBackwardScalar(const float* input, const float* outputError, float* inputError, size_t size)
+{
+	for (size_t i = 0; i < size; ++i)
+	{
+		const float s = sigmoid(input[i]);
+		inputError[i] = s * (1.f - s) * outputError[i];
+	}
+}
+
+void leakyReluScalar(const float* input, float* output, float alpha, size_t size)
+{
+	for (size_t i = 0; i < size; ++i)
+	{
+		// same form as the SIMD versions so negative inputs give +0, not -0, for a plain ReLU
+		output[i] = std::max(input[i], 0.f) + alpha * std::min(input[i], 0.f);
+	}
+}
+
+void leakyReluBackwardScalar(const float* output, const float* outputError, float* inputError, float alpha, size_t size)
+{
+	for (size_t i = 0; i < size; ++i)
+	{
+		inputError[i] = output[i] > 0.f ? outputError[i] : alpha * outputError[i];
+	}
+}
+
+void tanhScalar(const float* input, float* output, size_t size)
+{
+	for (size_t i = 0; i < size; ++i)
+	{
+		output[i] = tanhf(input[i]);
+	}
+}
+
+void tanhBackwardScalar(const float* output, const float* outputError, float* inputError, size_t size)
+{
+	for (size_t i = 0; i < size; ++i)
+	{
+		inputError[i] = (1.f - output[i] * output[i]) * outputError[i];
+	}
+}
+
+// Constants for the Cephes style expf approximation used by the SIMD kernels. The argument is
+// split into n * ln(2) + r, exp(r) is evaluated with a degree 6 polynomial and 2^n is built
+// directly in the exponent bits. Relative error is around 2 ulp over the clamped range.
+const float expHi = 88.3762626647949f;
+const float expLo = -88.3762626647949f;
+const float log2e = 1.44269504088896341f;
+const float ln2Hi = 0.693359375f;
+const float ln2Lo = -2.12194440e-4f;
+const float expP0 = 1.9875691500E-4f;
+const float expP1 = 1.3981999507E-3f;
+const float expP2 = 8.3334519073E-3f;
+const float expP3 = 4.1665795894E-2f;
+const float expP4 = 1.6666665459E-1f;
+const float expP5 = 5.0000001201E-1f;
+
+/// SSE4.1
+
+NN_TARGET("sse4.1") inline float hsum(__m128 v)
+{
+	__m128 shuf = _mm_movehdup_ps(v);
+	__m128 sums = _mm_add_ps(v, shuf);
+	shuf = _mm_movehl_ps(shuf, sums);
+	sums = _mm_add_ss(sums, shuf);
+	return _mm_cvtss_f32(sums);
+}
+
+NN_TARGET("sse4.1") float dotSse4(const float* a, const float* b, size_t size)
+{
+	__m128 sum0 = _mm_setzero_ps();
+	__m128 sum1 = _mm_setzero_ps();
+	size_t i = 0;
+
+	for (; i + 8 <= size; i += 8)
+	{
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+	}
+
+	for (; i + 4 <= size; i += 4)
+	{
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+	}
+
+	return hsum(_mm_add_ps(sum0, sum1)) + dotScalar(a + i, b + i, size - i);
+}
+
+NN_TARGET("sse4.1") void dot4Sse4(const float* a, size_t stride, const float* b, size_t size, float* result)
+{
+	__m128 sum0 = _mm_setzero_ps();
+	__m128 sum1 = _mm_setzero_ps();
+	__m128 sum2 = _mm_setzero_ps();
+	__m128 sum3 = _mm_setzero_ps();
+	const float* a0 = a;
+	const float* a1 = a0 + stride;
+	const float* a2 = a1 + stride;
+	const float* a3 = a2 + stride;
+	size_t i = 0;
+
+	for (; i + 4 <= size; i += 4)
+	{
+		const __m128 bv = _mm_loadu_ps(b + i);
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a0 + i), bv));
+		sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a1 + i), bv));
+		sum2 = _mm_add_ps(sum2, _mm_mul_ps(_mm_loadu_ps(a2 + i), bv));
+		sum3 = _mm_add_ps(sum3, _mm_mul_ps(_mm_loadu_ps(a3 + i), bv));
+	}
+
+	// Transpose-and-add so lane j holds the total of row j
+	_MM_TRANSPOSE4_PS(sum0, sum1, sum2, sum3);
+	__m128 sums = _mm_add_ps(_mm_add_ps(sum0, sum1), _mm_add_ps(sum2, sum3));
+	_mm_storeu_ps(result, sums);
+
+	for (; i < size; ++i)
+	{
+		result[0] += a0[i] * b[i];
+		result[1] += a1[i] * b[i];
+		result[2] += a2[i] * b[i];
+		result[3] += a3[i] * b[i];
+	}
+}
+
+NN_TARGET("sse4.1") void axpySse4(float alpha, const float* x, float* y, size_t size)
+{
+	const __m128 a = _mm_set1_ps(alpha);
+	size_t i = 0;
+
+	for (; i + 4 <= size; i += 4)
+	{
+		_mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(a, _mm_loadu_ps(x + i))));
+	}
+
+	axpyScalar(alpha, x + i, y + i, size - i);
+}
+
+NN_TARGET("sse4.1") inline __m128 expPs(__m128 x)
+{
+	x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(expLo)), _mm_set1_ps(expHi));
+	const __m128 fx = _mm_floor_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(log2e)), _mm_set1_ps(0.5f)));
+	x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(ln2Hi)));
+	x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(ln2Lo)));
+
+	__m128 y = _mm_set1_ps(expP0);
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(expP1));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(expP2));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(expP3));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(expP4));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(expP5));
+	y = _mm_add_ps(_mm_mul_ps(y, _mm_mul_ps(x, x)), x);
+	y = _mm_add_ps(y, _mm_set1_ps(1.f));
+
+	__m128i n = _mm_cvtps_epi32(fx);
+	n = _mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23);
+	return _mm_mul_ps(y, _mm_castsi128_ps(n));
+}
+
+NN_TARGET("sse4.1") inline __m128 sigmoidPs(__m128 x)
+{
+	const __m128 one = _mm_set1_ps(1.f);
+	return _mm_div_ps(one, _mm_add_ps(one, expPs(_mm_sub_ps(_mm_setzero_ps(), x))));
+}
+
+NN_TARGET("sse4.1") void sigmoidSse4(const float* input, float* output, size_t size)
+{
+	size_t i = 0;
+
+	for (; i + 4 <= size; i += 4)
+	{
+		_mm_storeu_ps(output + i, sigmoidPs(_mm_loadu_ps(input + i)));
+	}
+
+	sigmoidScalar(input + i, output + i, size - i);
+}
+
+NN_TARGET("sse4.1") void sigmoidBackwardSse4(const float* input, const float* outputError, float* inputError, size_t size)
+{
+	const __m128 one = _mm_set1_ps(1.f);
+	size_t i = 0;
+
+	for (; i + 4 <= size; i += 4)
+	{
+		const __m128 s = sigmoidPs(_mm_loadu_ps(input + i));
+		const __m128 ds = _mm_mul_ps(s, _mm_sub_ps(one, s));
+		_mm_storeu_ps(inputError + i, _mm_mul_ps(ds, _mm_loadu_ps(outputError + i)));
+	}
+
+	sigmoidBackwardScalar(input + i, outputError + i, inputError + i, size - i);
+}
+
+NN_TARGET("sse4.1") void leakyReluSse4(const float* input, float* output, float alpha, size_t size)
+{
+	const __m128 a = _mm_set1_ps(alpha);
+	const __m128 zero = _mm_setzero_ps();
+	size_t i = 0;
+
+	for (; i + 4 <= size; i += 4)
+	{
+		const __m128 x = _mm_loadu_ps(input + i);
+		_mm_storeu_ps(output + i, _mm_add_ps(_mm_max_ps(x, zero), _mm_mul_ps(a, _mm_min_ps(x, zero))));
+	}
+
+	leakyReluScalar(input + i, output + i, alpha, size - i);
+}
+
+NN_TARGET("sse4.1") void leakyReluBackwardSse4(const float* output, const float* outputError, float* inputError, float alpha, size_t size)
+{
+	const __m128 a = _mm_set1_ps(alpha);
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 zero = _mm_setzero_ps();
+	size_t i = 0;
+
+	for (; i + 4 <= size; i += 4)
+	{
+		const __m128 slope = _mm_blendv_ps(a, one, _mm_cmpgt_ps(_mm_loadu_ps(output + i), zero));
+		_mm_storeu_ps(inputError + i, _mm_mul_ps(slope, _mm_loadu_ps(outputError + i)));
+	}
+
+	leakyReluBackwardScalar(output + i, outputError + i, inputError + i, alpha, size - i);
+}
+
+// tanh(x) = 1 - 2 / (exp(2x) + 1)
+NN_TARGET("sse4.1") void tanhSse4(const float* input, float* output, size_t size)
+{
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 two = _mm_set1_ps(2.f);
+	size_t i = 0;
+
+	for (; i + 4 <= size; i += 4)
+	{
+		const __m128 e = expPs(_mm_mul_ps(two, _mm_loadu_ps(input + i)));
+		_mm_storeu_ps(output + i, _mm_sub_ps(one, _mm_div_ps(two, _mm_add_ps(e, one))));
+	}
+
+	tanhScalar(input + i, output + i, size - i);
+}
+
+NN_TARGET("sse4.1") void tanhBackwardSse4(const float* output, const float* outputError, float* inputError, size_t size)
+{
+	const __m128 one = _mm_set1_ps(1.f);
+	size_t i = 0;
+
+	for (; i + 4 <= size; i += 4)
+	{
+		const __m128 y = _mm_loadu_ps(output + i);
+		_mm_storeu_ps(inputError + i, _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(y, y)), _mm_loadu_ps(outputError + i)));
+	}
+
+	tanhBackwardScalar(output + i, outputError + i, inputError + i, size - i);
+}
+
+/// AVX2 + FMA
+
+NN_TARGET("avx2,fma") inline float hsum(__m256 v)
+{
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	__m128 shuf = _mm_movehdup_ps(sum);
+	sum = _mm_add_ps(sum, shuf);
+	shuf = _mm_movehl_ps(shuf, sum);
+	sum = _mm_add_ss(sum, shuf);
+	return _mm_cvtss_f32(sum);
+}
+
+NN_TARGET("avx2,fma") float dotAvx2(const float* a, const float* b, size_t size)
+{
+	__m256 sum0 = _mm256_setzero_ps();
+	__m256 sum1 = _mm256_setzero_ps();
+	size_t i = 0;
+
+	for (; i + 16 <= size; i += 16)
+	{
+		sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+		sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), sum1);
+	}
+
+	for (; i + 8 <= size; i += 8)
+	{
+		sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+	}
+
+	return hsum(_mm256_add_ps(sum0, sum1)) + dotScalar(a + i, b + i, size - i);
+}
+
+NN_TARGET("avx2,fma") void dot4Avx2(const float* a, size_t stride, const float* b, size_t size, float* result)
+{
+	__m256 sum0 = _mm256_setzero_ps();
+	__m256 sum1 = _mm256_setzero_ps();
+	__m256 sum2 = _mm256_setzero_ps();
+	__m256 sum3 = _mm256_setzero_ps();
+	const float* a0 = a;
+	const float* a1 = a0 + stride;
+	const float* a2 = a1 + stride;
+	const float* a3 = a2 + stride;
+	size_t i = 0;
+
+	for (; i + 8 <= size; i += 8)
+	{
+		const __m256 bv = _mm256_loadu_ps(b + i);
+		sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a0 + i), bv, sum0);
+		sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a1 + i), bv, sum1);
+		sum2 = _mm256_fmadd_ps(_mm256_loadu_ps(a2 + i), bv, sum2);
+		sum3 = _mm256_fmadd_ps(_mm256_loadu_ps(a3 + i), bv, sum3);
+	}
+
+	result[0] = hsum(sum0);
+	result[1] = hsum(sum1);
+	result[2] = hsum(sum2);
+	result[3] = hsum(sum3);
+
+	for (; i < size; ++i)
+	{
+		result[0] += a0[i] * b[i];
+		result[1] += a1[i] * b[i];
+		result[2] += a2[i] * b[i];
+		result[3] += a3[i] * b[i];
+	}
+}
+
+NN_TARGET("avx2,fma") void axpyAvx2(float alpha, const float* x, float* y, size_t size)
+{
+	const __m256 a = _mm256_set1_ps(alpha);
+	size_t i = 0;
+
+	for (; i + 8 <= size; i += 8)
+	{
+		_mm256_storeu_ps(y + i, _mm256_fmadd_ps(a, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+	}
+
+	axpyScalar(alpha, x + i, y + i, size - i);
+}
+
+NN_TARGET("avx2,fma") inline __m256 expPs(__m256 x)
+{
+	x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(expLo)), _mm256_set1_ps(expHi));
+	const __m256 fx = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(log2e), _mm256_set1_ps(0.5f)));
+	x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(ln2Hi), x);
+	x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(ln2Lo), x);
+
+	__m256 y = _mm256_set1_ps(expP0);
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(expP1));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(expP2));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(expP3));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(expP4));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(expP5));
+	y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x), x);
+	y = _mm256_add_ps(y, _mm256_set1_ps(1.f));
+
+	__m256i n = _mm256_cvtps_epi32(fx);
+	n = _mm256_slli_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(127)), 23);
+	return _mm256_mul_ps(y, _mm256_castsi256_ps(n));
+}
+
+NN_TARGET("avx2,fma") inline __m256 sigmoidPs(__m256 x)
+{
+	const __m256 one = _mm256_set1_ps(1.f);
+	return _mm256_div_ps(one, _mm256_add_ps(one, expPs(_mm256_sub_ps(_mm256_setzero_ps(), x))));
+}
+
+NN_TARGET("avx2,fma") void sigmoidAvx2(const float* input, float* output, size_t size)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= size; i += 8)
+	{
+		_mm256_storeu_ps(output + i, sigmoidPs(_mm256_loadu_ps(input + i)));
+	}
+
+	sigmoidScalar(input + i, output + i, size - i);
+}
+
+NN_TARGET("avx2,fma") void sigmoidBackwardAvx2(const float* input, const float* outputError, float* inputError, size_t size)
+{
+	const __m256 one = _mm256_set1_ps(1.f);
+	size_t i = 0;
+
+	for (; i + 8 <= size; i += 8)
+	{
+		const __m256 s = sigmoidPs(_mm256_loadu_ps(input + i));
+		const __m256 ds = _mm256_mul_ps(s, _mm256_sub_ps(one, s));
+		_mm256_storeu_ps(inputError + i, _mm256_mul_ps(ds, _mm256_loadu_ps(outputError + i)));
+	}
+
+	sigmoidBackwardScalar(input + i, outputError + i, inputError + i, size - i);
+}
+
+NN_TARGET("avx2,fma") void leakyReluAvx2(const float* input, float* output, float alpha, size_t size)
+{
+	const __m256 a = _mm256_set1_ps(alpha);
+	const __m256 zero = _mm256_setzero_ps();
+	size_t i = 0;
+
+	for (; i + 8 <= size; i += 8)
+	{
+		const __m256 x = _mm256_loadu_ps(input + i);
+		_mm256_storeu_ps(output + i, _mm256_fmadd_ps(a, _mm256_min_ps(x, zero), _mm256_max_ps(x, zero)));
+	}
+
+	leakyReluScalar(input + i, output + i, alpha, size - i);
+}
+
+NN_TARGET("avx2,fma") void leakyReluBackwardAvx2(const float* output, const float* outputError, float* inputError, float alpha, size_t size)
+{
+	const __m256 a = _mm256_set1_ps(alpha);
+	const __m256 one = _mm256_set1_ps(1.f);
+	const __m256 zero = _mm256_setzero_ps();
+	size_t i = 0;
+
+	for (; i + 8 <= size; i += 8)
+	{
+		const __m256 slope = _mm256_blendv_ps(a, one, _mm256_cmp_ps(_mm256_loadu_ps(output + i), zero, _CMP_GT_OQ));
+		_mm256_storeu_ps(inputError + i, _mm256_mul_ps(slope, _mm256_loadu_ps(outputError + i)));
+	}
+
+	leakyReluBackwardScalar(output + i, outputError + i, inputError + i, alpha, size - i);
+}
+
+NN_TARGET("avx2,fma") void tanhAvx2(const float* input, float* output, size_t size)
+{
+	const __m256 one = _mm256_set1_ps(1.f);
+	const __m256 two = _mm256_set1_ps(2.f);
+	size_t i = 0;
+
+	for (; i + 8 <= size; i += 8)
+	{
+		const __m256 e = expPs(_mm256_mul_ps(two, _mm256_loadu_ps(input + i)));
+		_mm256_storeu_ps(output + i, _mm256_sub_ps(one, _mm256_div_ps(two, _mm256_add_ps(e, one))));
+	}
+
+	tanhScalar(input + i, output + i, size - i);
+}
+
+NN_TARGET("avx2,fma") void tanhBackwardAvx2(const float* output, const float* outputError, float* inputError, size_t size)
+{
+	const __m256 one = _mm256_set1_ps(1.f);
+	size_t i = 0;
+
+	for (; i + 8 <= size; i += 8)
+	{
+		const __m256 y = _mm256_loadu_ps(output + i);
+		_mm256_storeu_ps(inputError + i, _mm256_mul_ps(_mm256_fnmadd_ps(y, y, one), _mm256_loadu_ps(outputError + i)));
+	}
+
+	tanhBackwardScalar(output + i, outputError + i, inputError + i, size - i);
+}
+
+/// AVX-512F
+
+NN_TARGET("avx512f") float dotAvx512(const float* a, const float* b, size_t size)
+{
+	__m512 sum0 = _mm512_setzero_ps();
+	__m512 sum1 = _mm512_setzero_ps();
+	size_t i = 0;
+
+	for (; i + 32 <= size; i += 32)
+	{
+		sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), sum0);
+		sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), sum1);
+	}
+
+	for (; i + 16 <= size; i += 16)
+	{
+		sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), sum0);
+	}
+
+	return _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1)) + dotScalar(a + i, b + i, size - i);
+}
+
+NN_TARGET("avx512f") void dot4Avx512(const float* a, size_t stride, const float* b, size_t size, float* result)
+{
+	__m512 sum0 = _mm512_setzero_ps();
+	__m512 sum1 = _mm512_setzero_ps();
+	__m512 sum2 = _mm512_setzero_ps();
+	__m512 sum3 = _mm512_setzero_ps();
+	const float* a0 = a;
+	const float* a1 = a0 + stride;
+	const float* a2 = a1 + stride;
+	const float* a3 = a2 + stride;
+	size_t i = 0;
+
+	for (; i + 16 <= size; i += 16)
+	{
+		const __m512 bv = _mm512_loadu_ps(b + i);
+		sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(a0 + i), bv, sum0);
+		sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(a1 + i), bv, sum1);
+		sum2 = _mm512_fmadd_ps(_mm512_loadu_ps(a2 + i), bv, sum2);
+		sum3 = _mm512_fmadd_ps(_mm512_loadu_ps(a3 + i), bv, sum3);
+	}
+
+	result[0] = _mm512_reduce_add_ps(sum0);
+	result[1] = _mm512_reduce_add_ps(sum1);
+	result[2] = _mm512_reduce_add_ps(sum2);
+	result[3] = _mm512_reduce_add_ps(sum3);
+
+	for (; i < size; ++i)
+	{
+		result[0] += a0[i] * b[i];
+		result[1] += a1[i] * b[i];
+		result[2] += a2[i] * b[i];
+		result[3] += a3[i] * b[i];
+	}
+}
+
+NN_TARGET("avx512f") void axpyAvx512(float alpha, const float* x, float* y, size_t size)
+{
+	const __m512 a = _mm512_set1_ps(alpha);
+	size_t i = 0;
+
+	for (; i + 16 <= size; i += 16)
+	{
+		_mm512_storeu_ps(y + i, _mm512_fmadd_ps(a, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+	}
+
+	axpyScalar(alpha, x + i, y + i, size - i);
+}
+
+NN_TARGET("avx512f") inline __m512 expPs(__m512 x)
+{
+	x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(expLo)), _mm512_set1_ps(expHi));
+	__m512 fx = _mm512_fmadd_ps(x, _mm512_set1_ps(log2e), _mm512_set1_ps(0.5f));
+	fx = _mm512_roundscale_ps(fx, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+	x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(ln2Hi), x);
+	x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(ln2Lo), x);
+
+	__m512 y = _mm512_set1_ps(expP0);
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(expP1));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(expP2));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(expP3));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(expP4));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(expP5));
+	y = _mm512_fmadd_ps(y, _mm512_mul_ps(x, x), x);
+	y = _mm512_add_ps(y, _mm512_set1_ps(1.f));
+
+	__m512i n = _mm512_cvtps_epi32(fx);
+	n = _mm512_slli_epi32(_mm512_add_epi32(n, _mm512_set1_epi32(127)), 23);
+	return _mm512_mul_ps(y, _mm512_castsi512_ps(n));
+}
+
+NN_TARGET("avx512f") inline __m512 sigmoidPs(__m512 x)
+{
+	const __m512 one = _mm512_set1_ps(1.f);
+	return _mm512_div_ps(one, _mm512_add_ps(one, expPs(_mm512_sub_ps(_mm512_setzero_ps(), x))));
+}
+
+NN_TARGET("avx512f") void sigmoidAvx512(const float* input, float* output, size_t size)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= size; i += 16)
+	{
+		_mm512_storeu_ps(output + i, sigmoidPs(_mm512_loadu_ps(input + i)));
+	}
+
+	sigmoidScalar(input + i, output + i, size - i);
+}
+
+NN_TARGET("avx512f") void sigmoidBackwardAvx512(const float* input, const float* outputError, float* inputError, size_t size)
+{
+	const __m512 one = _mm512_set1_ps(1.f);
+	size_t i = 0;
+
+	for (; i + 16 <= size; i += 16)
+	{
+		const __m512 s = sigmoidPs(_mm512_loadu_ps(input + i));
+		const __m512 ds = _mm512_mul_ps(s, _mm512_sub_ps(one, s));
+		_mm512_storeu_ps(inputError + i, _mm512_mul_ps(ds, _mm512_loadu_ps(outputError + i)));
+	}
+
+	sigmoidBackwardScalar(input + i, outputError + i, inputError + i, size - i);
+}
+
+NN_TARGET("avx512f") void leakyReluAvx512(const float* input, float* output, float alpha, size_t size)
+{
+	const __m512 a = _mm512_set1_ps(alpha);
+	const __m512 zero = _mm512_setzero_ps();
+	size_t i = 0;
+
+	for (; i + 16 <= size; i += 16)
+	{
+		const __m512 x = _mm512_loadu_ps(input + i);
+		_mm512_storeu_ps(output + i, _mm512_fmadd_ps(a, _mm512_min_ps(x, zero), _mm512_max_ps(x, zero)));
+	}
+
+	leakyReluScalar(input + i, output + i, alpha, size - i);
+}
+
+NN_TARGET("avx512f") void leakyReluBackwardAvx512(const float* output, const float* outputError, float* inputError, float alpha, size_t size)
+{
+	const __m512 a = _mm512_set1_ps(alpha);
+	const __m512 one = _mm512_set1_ps(1.f);
+	const __m512 zero = _mm512_setzero_ps();
+	size_t i = 0;
+
+	for (; i + 16 <= size; i += 16)
+	{
+		const __m512 slope = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(_mm512_loadu_ps(output + i), zero, _CMP_GT_OQ), a, one);
+		_mm512_storeu_ps(inputError + i, _mm512_mul_ps(slope, _mm512_loadu_ps(outputError + i)));
+	}
+
+	leakyReluBackwardScalar(output + i, outputError + i, inputError + i, alpha, size - i);
+}
+
+NN_TARGET("avx512f") void tanhAvx512(const float* input, float* output, size_t size)
+{
+	const __m512 one = _mm512_set1_ps(1.f);
+	const __m512 two = _mm512_set1_ps(2.f);
+	size_t i = 0;
+
+	for (; i + 16 <= size; i += 16)
+	{
+		const __m512 e = expPs(_mm512_mul_ps(two, _mm512_loadu_ps(input + i)));
+		_mm512_storeu_ps(output + i, _mm512_sub_ps(one, _mm512_div_ps(two, _mm512_add_ps(e, one))));
+	}
+
+	tanhScalar(input + i, output + i, size - i);
+}
+
+NN_TARGET("avx512f") void tanhBackwardAvx512(const float* output, const float* outputError, float* inputError, size_t size)
+{
+	const __m512 one = _mm512_set1_ps(1.f);
+	size_t i = 0;
+
+	for (; i + 16 <= size; i += 16)
+	{
+		const __m512 y = _mm512_loadu_ps(output + i);
+		_mm512_storeu_ps(inputError + i, _mm512_mul_ps(_mm512_fnmadd_ps(y, y, one), _mm512_loadu_ps(outputError + i)));
+	}
+
+	tanhBackwardScalar(output + i, outputError + i, inputError + i, size - i);
+}
+
+/// Dispatch tables
+
+const Kernels scalarKernels = { Isa::Scalar, "scalar", dotScalar, dot4Scalar, axpyScalar, sigmoidScalar, sigmoidBackwardScalar,
+								 leakyReluScalar, leakyReluBackwardScalar, tanhScalar, tanhBackwardScalar };
+const Kernels sse4Kernels = { Isa::Sse4, "sse4.1", dotSse4, dot4Sse4, axpySse4, sigmoidSse4, sigmoidBackwardSse4,
+							  leakyReluSse4, leakyReluBackwardSse4, tanhSse4, tanhBackwardSse4 };
+const Kernels avx2Kernels = { Isa::Avx2, "avx2", dotAvx2, dot4Avx2, axpyAvx2, sigmoidAvx2, sigmoidBackwardAvx2,
+							  leakyReluAvx2, leakyReluBackwardAvx2, tanhAvx2, tanhBackwardAvx2 };
+const Kernels avx512Kernels = { Isa::Avx512, "avx512", dotAvx512, dot4Avx512, axpyAvx512, sigmoidAvx512, sigmoidBackwardAvx512,
+								leakyReluAvx512, leakyReluBackwardAvx512, tanhAvx512, tanhBackwardAvx512 };
+}
+
+const Kernels* getKernels(Isa isa)
+{
+	const auto& features = cpuFeatures();
+
+	switch (isa)
+	{
+	case Isa::Scalar: return &scalarKernels;
+	case Isa::Sse4: return features.sse4 ? &sse4Kernels : nullptr;
+	case Isa::Avx2: return features.avx2 ? &avx2Kernels : nullptr;
+	case Isa::Avx512: return features.avx512 ? &avx512Kernels : nullptr;
+	}
+
+	return nullptr;
+}
+
+const Kernels& kernels()
+{
+	static const Kernels& best = []() -> const Kernels&
+	{
+		for (auto isa : { Isa::Avx512, Isa::Avx2, Isa::Sse4 })
+		{
+			if (auto kernels = getKernels(isa))
+			{
+				return *kernels;
+			}
+		}
+		return scalarKernels;
+	}();
+
+	return best;
+}
+}
+}
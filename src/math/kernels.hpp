@@ -0,0 +1,74 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+namespace nn
+{
+namespace math
+{
+enum class Isa
+{
+	Scalar,
+	Sse4,
+	Avx2,
+	Avx512
+};
+
+// Table of vectorized primitives for one instruction set. The scalar table reproduces the
+// plain C++ loops exactly; the SIMD tables handle trailing elements with the scalar code.
+// Element-wise kernels may be given the same buffer for input and output.
+struct Kernels
+{
+	Isa isa;
+
+	const char* name;
+
+	float (*dot)(const float* a, const float* b, size_t size);
+
+	// Dot products of 4 rows of a (given stride apart) with b
+	void (*dot4)(const float* a, size_t stride, const float* b, size_t size, float* result);
+
+	// y += alpha * x
+	void (*axpy)(float alpha, const float* x, float* y, size_t size);
+
+	// output = 1 / (1 + exp(-input))
+	void (*sigmoid)(const float* input, float* output, size_t size);
+
+	// inputError = sigmoid'(input) * outputError
+	void (*sigmoidBackward)(const float* input, const float* outputError, float* inputError, size_t size);
+
+	// output = input > 0 ? input : alpha * input (alpha = 0 for ReLU)
+	void (*leakyRelu)(const float* input, float* output, float alpha, size_t size);
+
+	// inputError = (output > 0 ? 1 : alpha) * outputError. Uses the output so alpha must be >= 0.
+	void (*leakyReluBackward)(const float* output, const float* outputError, float* inputError, float alpha, size_t size);
+
+	// output = tanh(input)
+	void (*tanh)(const float* input, float* output, size_t size);
+
+	// inputError = (1 - output^2) * outputError
+	void (*tanhBackward)(const float* output, const float* outputError, float* inputError, size_t size);
+};
+
+// Kernels for the best instruction set supported by this CPU, chosen once on first use
+const Kernels& kernels();
+
+// Kernels for a specific instruction set, or nullptr if this CPU does not support it
+const Kernels* getKernels(Isa isa);
+
+inline float dot(const float* a, const float* b, size_t size)
+{
+	return kernels().dot(a, b, size);
+}
+
+inline void dot4(const float* a, size_t stride, const float* b, size_t size, float* result)
+{
+	kernels().dot4(a, stride, b, size, result);
+}
+
+inline void axpy(float alpha, const float* x, float* y, size_t size)
+{
+	kernels().axpy(alpha, x, y, size);
+}
+}
+}
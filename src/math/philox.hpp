@@ -0,0 +1,43 @@
+#pragma once
+#include <stdint.h>
+
+namespace nn
+{
+namespace math
+{
+// Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3"). A stateless
+// generator: the 4 outputs are a pure function of a 128 bit counter and a 64 bit key, so any
+// element of a stream can be produced on its own, in any order, by any thread or work-item.
+// layers/dropout.cl has the same function for the device and must give identical results.
+struct Philox4x32
+{
+	uint32_t v[4];
+};
+
+inline Philox4x32 philox4x32(Philox4x32 counter, uint32_t key0, uint32_t key1)
+{
+	for (int round = 0; round < 10; ++round)
+	{
+		const uint64_t product0 = uint64_t(0xD2511F53u) * counter.v[0];
+		const uint64_t product1 = uint64_t(0xCD9E8D57u) * counter.v[2];
+
+		counter = { {
+			uint32_t(product1 >> 32) ^ counter.v[1] ^ key0,
+			uint32_t(product1),
+			uint32_t(product0 >> 32) ^ counter.v[3] ^ key1,
+			uint32_t(product0) } };
+
+		key0 += 0x9E3779B9u;
+		key1 += 0xBB67AE85u;
+	}
+
+	return counter;
+}
+
+// Uniform in [0, 1) from the top 24 bits
+inline float uniformFromBits(uint32_t bits)
+{
+	return float(bits >> 8) * (1.f / 16777216.f);
+}
+}
+}
@@ -0,0 +1,160 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "kernels.hpp"
+
+namespace nn
+{
+namespace math
+{
+// Compressed sparse rows. The vectors only ever grow so re-using one matrix does not allocate
+// once it has seen the largest input.
+struct SparseMatrix
+{
+	std::vector<float> values;
+
+	std::vector<uint32_t> columns;
+
+	// values/columns of row i are [rowStart[i], rowStart[i + 1])
+	std::vector<size_t> rowStart;
+};
+
+inline size_t countNonZero(const float* a, size_t size)
+{
+	size_t count = 0;
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		count += a[i] != 0.f;
+	}
+
+	return count;
+}
+
+// Compresses the m x k dense matrix a
+inline void compress(const float* a, size_t m, size_t k, SparseMatrix& result)
+{
+	if (result.values.size() < m * k)
+	{
+		result.values.resize(m * k);
+		result.columns.resize(m * k);
+	}
+
+	if (result.rowStart.size() < m + 1)
+	{
+		result.rowStart.resize(m + 1);
+	}
+
+	size_t count = 0;
+
+	for (size_t i = 0; i < m; ++i)
+	{
+		result.rowStart[i] = count;
+
+		// Branch free: every element is written and the position only moves on for non-zeros
+		for (size_t j = 0; j < k; ++j)
+		{
+			const float value = a[i * k + j];
+			result.values[count] = value;
+			result.columns[count] = uint32_t(j);
+			count += value != 0.f;
+		}
+	}
+
+	result.rowStart[m] = count;
+}
+
+// C[m x n] += A[m x k] * B[n x k]^T with A sparse. Each element of C gathers the row of B at the
+// non-zeros of its row of A, so B is read in its own layout. The loop runs over B's rows, four
+// at a time, on the outside so they stay in cache while every row of A is gathered against them.
+inline void spmmNT(const SparseMatrix& a, const float* b, float* c, size_t m, size_t n, size_t k)
+{
+	const float* values = a.values.data();
+	const uint32_t* columns = a.columns.data();
+	size_t j = 0;
+
+	for (; j + 4 <= n; j += 4)
+	{
+		const float* b0 = b + j * k;
+		const float* b1 = b0 + k;
+		const float* b2 = b1 + k;
+		const float* b3 = b2 + k;
+
+		for (size_t i = 0; i < m; ++i)
+		{
+			float s0 = 0.f, s1 = 0.f, s2 = 0.f, s3 = 0.f;
+
+			for (size_t p = a.rowStart[i]; p < a.rowStart[i + 1]; ++p)
+			{
+				const float value = values[p];
+				const uint32_t column = columns[p];
+				s0 += value * b0[column];
+				s1 += value * b1[column];
+				s2 += value * b2[column];
+				s3 += value * b3[column];
+			}
+
+			float* cRow = c + i * n + j;
+			cRow[0] += s0;
+			cRow[1] += s1;
+			cRow[2] += s2;
+			cRow[3] += s3;
+		}
+	}
+
+	for (; j < n; ++j)
+	{
+		const float* bRow = b + j * k;
+
+		for (size_t i = 0; i < m; ++i)
+		{
+			float sum = 0.f;
+
+			for (size_t p = a.rowStart[i]; p < a.rowStart[i + 1]; ++p)
+			{
+				sum += values[p] * bRow[columns[p]];
+			}
+
+			c[i * n + j] += sum;
+		}
+	}
+}
+
+// C[m x n] += A[k x m]^T * B[k x n] with B sparse. The products are summed into the transpose
+// of C (so each non-zero adds a scaled row of A) and then added to the touched columns of C.
+// scratch must hold n * m zeros and is left zeroed; used must hold n zeros and is left zeroed.
+inline void spmmTN(const float* a, const SparseMatrix& b, float* c, size_t m, size_t n, size_t k, float* scratch, uint8_t* used)
+{
+	const float* values = b.values.data();
+	const uint32_t* columns = b.columns.data();
+
+	for (size_t p = 0; p < k; ++p)
+	{
+		const float* aRow = a + p * m;
+
+		for (size_t q = b.rowStart[p]; q < b.rowStart[p + 1]; ++q)
+		{
+			axpy(values[q], aRow, scratch + columns[q] * m, m);
+			used[columns[q]] = 1;
+		}
+	}
+
+	for (size_t j = 0; j < n; ++j)
+	{
+		if (used[j])
+		{
+			float* sum = scratch + j * m;
+
+			for (size_t i = 0; i < m; ++i)
+			{
+				c[i * n + j] += sum[i];
+				sum[i] = 0.f;
+			}
+
+			used[j] = 0;
+		}
+	}
+}
+}
+}
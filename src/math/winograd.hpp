@@ -0,0 +1,83 @@
+#pragma once
+#include <stddef.h>
+
+namespace nn
+{
+namespace math
+{
+// Winograd F(2x2, 3x3): a 2x2 block of a 3x3 correlation from a 4x4 block of input using 16
+// multiplications instead of 36 (Lavin & Gray, "Fast Algorithms for Convolutional Neural Networks").
+//     output = A^T [(G g G^T) .* (B^T d B)] A
+// The 16 elements of each transformed block are written (or read) stride floats apart so that
+// element i of every block forms its own matrix, and the .* summed over channels becomes 16 GEMMs.
+
+// u = G g G^T for the 3x3 filter g (row major)
+inline void winogradFilter(const float* g, float* u, size_t stride)
+{
+	// G = [1, 0, 0; 1/2, 1/2, 1/2; 1/2, -1/2, 1/2; 0, 0, 1]
+	float t[4][3];
+
+	for (size_t j = 0; j < 3; ++j)
+	{
+		t[0][j] = g[j];
+		t[1][j] = 0.5f * (g[j] + g[3 + j] + g[6 + j]);
+		t[2][j] = 0.5f * (g[j] - g[3 + j] + g[6 + j]);
+		t[3][j] = g[6 + j];
+	}
+
+	for (size_t i = 0; i < 4; ++i)
+	{
+		u[(i * 4 + 0) * stride] = t[i][0];
+		u[(i * 4 + 1) * stride] = 0.5f * (t[i][0] + t[i][1] + t[i][2]);
+		u[(i * 4 + 2) * stride] = 0.5f * (t[i][0] - t[i][1] + t[i][2]);
+		u[(i * 4 + 3) * stride] = t[i][2];
+	}
+}
+
+// v = B^T d B for the 4x4 input block d (row major)
+inline void winogradInput(const float* d, float* v, size_t stride)
+{
+	// B^T = [1, 0, -1, 0; 0, 1, 1, 0; 0, -1, 1, 0; 0, 1, 0, -1]
+	float t[4][4];
+
+	for (size_t j = 0; j < 4; ++j)
+	{
+		t[0][j] = d[j] - d[8 + j];
+		t[1][j] = d[4 + j] + d[8 + j];
+		t[2][j] = d[8 + j] - d[4 + j];
+		t[3][j] = d[4 + j] - d[12 + j];
+	}
+
+	for (size_t i = 0; i < 4; ++i)
+	{
+		v[(i * 4 + 0) * stride] = t[i][0] - t[i][2];
+		v[(i * 4 + 1) * stride] = t[i][1] + t[i][2];
+		v[(i * 4 + 2) * stride] = t[i][2] - t[i][1];
+		v[(i * 4 + 3) * stride] = t[i][1] - t[i][3];
+	}
+}
+
+// y = A^T m A, the 2x2 output block (row major) for the transformed product m
+inline void winogradOutput(const float* m, size_t stride, float* y)
+{
+	// A^T = [1, 1, 1, 0; 0, 1, -1, -1]
+	float t[2][4];
+
+	for (size_t j = 0; j < 4; ++j)
+	{
+		const float m0 = m[j * stride];
+		const float m1 = m[(4 + j) * stride];
+		const float m2 = m[(8 + j) * stride];
+		const float m3 = m[(12 + j) * stride];
+		t[0][j] = m0 + m1 + m2;
+		t[1][j] = m1 - m2 - m3;
+	}
+
+	for (size_t i = 0; i < 2; ++i)
+	{
+		y[i * 2 + 0] = t[i][0] + t[i][1] + t[i][2];
+		y[i * 2 + 1] = t[i][1] - t[i][2] - t[i][3];
+	}
+}
+}
+}
@@ -0,0 +1,206 @@
+#pragma once
+#include "layers/layer.hpp"
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace nn
+{
+// Places the per-layer activation and error buffers of a network in one arena so that
+// buffers whose lifetimes do not overlap share memory. All sizes and offsets are in floats
+// per sample; multiply by the batch size to get the position inside a batch's arena.
+//
+// Steps are numbered in execution order. In the forward pass layer i runs at step i and its
+// output is used by layer i + 1. During training the backward pass of layer i runs at step
+// 2L - 1 - i and reads its input (the output of layer i - 1), its output and its output error.
+// Any state layer i saves for backpropagation lives from step i to its backward step.
+//
+// Layers that can run in place (see Layer::canRunInPlace) reuse the output and error buffers
+// of the layer before them instead of getting their own.
+class MemoryPlan
+{
+public:
+	using Layers = std::vector<std::unique_ptr<layer::Layer>>;
+
+	MemoryPlan() : size(0), unplannedSize(0) {}
+
+	MemoryPlan(const Layers& layers, bool training) :
+		outputOffsets(layers.size()),
+		errorOffsets(layers.size()),
+		stateOffsets(layers.size()),
+		size(0),
+		unplannedSize(0)
+	{
+		const size_t layerCount = layers.size();
+		std::vector<Buffer> buffers;
+
+		// Index into buffers of each layer's output and error. In-place layers share the
+		// buffers of the layer before them, which then have to live as long as both.
+		std::vector<size_t> outputBuffers(layerCount);
+		std::vector<size_t> errorBuffers(layerCount);
+
+		for (size_t i = 0; i < layerCount; ++i)
+		{
+			const bool inPlace = runsInPlace(layers, i, training);
+
+			Buffer output;
+			output.size = layers[i]->getOutputSize();
+			output.first = i;
+			output.last = training ? getBackwardStep(i, layerCount) : i + 1;
+			output.offset = &outputOffsets[i];
+			unplannedSize += output.size;
+			outputBuffers[i] = inPlace ? outputBuffers[i - 1] : buffers.size();
+			merge(buffers, outputBuffers[i], output);
+
+			if (training)
+			{
+				// The network's output error is calculated straight after the forward pass
+				Buffer error;
+				error.size = layers[i]->getOutputSize();
+				error.first = i + 1 < layerCount ? getBackwardStep(i + 1, layerCount) : layerCount - 1;
+				error.last = getBackwardStep(i, layerCount);
+				error.offset = &errorOffsets[i];
+				unplannedSize += error.size;
+				errorBuffers[i] = inPlace ? errorBuffers[i - 1] : buffers.size();
+				merge(buffers, errorBuffers[i], error);
+
+				Buffer state;
+				state.size = layers[i]->getTrainingStateSize();
+				state.first = i;
+				state.last = getBackwardStep(i, layerCount);
+				state.offset = &stateOffsets[i];
+				unplannedSize += state.size;
+
+				if (state.size > 0)
+				{
+					buffers.push_back(state);
+				}
+			}
+		}
+
+		size = assign(buffers);
+
+		// Only the first layer of each in-place run was placed
+		for (size_t i = 1; i < layerCount; ++i)
+		{
+			if (runsInPlace(layers, i, training))
+			{
+				outputOffsets[i] = outputOffsets[i - 1];
+				errorOffsets[i] = errorOffsets[i - 1];
+			}
+		}
+	}
+
+	// True if layer i writes its output over the output of layer i - 1 (and while training,
+	// its input error over its output error). Never true for the first layer, whose input
+	// belongs to the caller.
+	static bool runsInPlace(const Layers& layers, size_t i, bool training)
+	{
+		return i > 0 && layers[i]->canRunInPlace() && !(training && layers[i - 1]->usesOutputInBackPropagation());
+	}
+
+	// Start of layer i's output
+	size_t getOutputOffset(size_t i) const { return outputOffsets[i]; }
+
+	// Start of the error of layer i's output (training plans only)
+	size_t getErrorOffset(size_t i) const { return errorOffsets[i]; }
+
+	// Start of the state layer i saves for backpropagation (training plans only)
+	size_t getStateOffset(size_t i) const { return stateOffsets[i]; }
+
+	// Size of the arena
+	size_t getSize() const { return size; }
+
+	// Size needed if every buffer had memory of its own
+	size_t getUnplannedSize() const { return unplannedSize; }
+
+private:
+	struct Buffer
+	{
+		size_t size;
+
+		// first and last step (inclusive) at which the buffer is live
+		size_t first;
+		size_t last;
+
+		size_t* offset;
+	};
+
+	static size_t getBackwardStep(size_t layer, size_t layerCount)
+	{
+		return 2 * layerCount - 1 - layer;
+	}
+
+	// Adds buffer as buffers[index], or widens the lifetime of the buffer already there
+	static void merge(std::vector<Buffer>& buffers, size_t index, const Buffer& buffer)
+	{
+		if (index == buffers.size())
+		{
+			buffers.push_back(buffer);
+			return;
+		}
+
+		Buffer& shared = buffers[index];
+		shared.first = std::min(shared.first, buffer.first);
+		shared.last = std::max(shared.last, buffer.last);
+	}
+
+	// Greedy first fit, largest buffers first. Each buffer goes at the lowest offset that
+	// does not overlap a buffer already placed with an overlapping lifetime.
+	static size_t assign(std::vector<Buffer>& buffers)
+	{
+		std::stable_sort(buffers.begin(), buffers.end(), [](const Buffer& a, const Buffer& b)
+		{
+			return a.size > b.size;
+		});
+
+		size_t arenaSize = 0;
+
+		for (size_t i = 0; i < buffers.size(); ++i)
+		{
+			Buffer& buffer = buffers[i];
+			std::vector<const Buffer*> live;
+
+			for (size_t j = 0; j < i; ++j)
+			{
+				if (buffers[j].first <= buffer.last && buffer.first <= buffers[j].last)
+				{
+					live.push_back(&buffers[j]);
+				}
+			}
+
+			std::sort(live.begin(), live.end(), [](const Buffer* a, const Buffer* b)
+			{
+				return *a->offset < *b->offset;
+			});
+
+			size_t offset = 0;
+
+			for (const Buffer* other : live)
+			{
+				if (offset + buffer.size <= *other->offset)
+				{
+					break;
+				}
+
+				offset = std::max(offset, *other->offset + other->size);
+			}
+
+			*buffer.offset = offset;
+			arenaSize = std::max(arenaSize, offset + buffer.size);
+		}
+
+		return arenaSize;
+	}
+
+	std::vector<size_t> outputOffsets;
+
+	std::vector<size_t> errorOffsets;
+
+	std::vector<size_t> stateOffsets;
+
+	size_t size;
+
+	size_t unplannedSize;
+};
+}
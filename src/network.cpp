@@ -4,12 +4,21 @@
 #include "device_impl.hpp"
 
 #include "layers\dense.hpp"
+#include "layers\conv2d.hpp"
+#include "layers\depthwise_conv2d.hpp"
+#include "layers\max_pooling.hpp"
+#include "layers\lstm.hpp"
+#include "layers\batch_norm.hpp"
+#include "layers\dropout.hpp"
 #include "layers\sigmoid.hpp"
+#include "layers\tanh.hpp"
+#include "layers\relu.hpp"
 
 #include "optimizers\sgd.hpp"
 #include "optimizers\adam.hpp"
 
 #include "losses\mse.hpp"
+#include "losses\softmax_cross_entropy.hpp"
 #include <iostream>
 
 using namespace std;
@@ -24,6 +33,40 @@ Network::Network(NetworkArgs&& args)
 		throw invalid_argument("Cannot create a network with 0 layers.");
 	}
 
+	if (args.data->asyncTraining)
+	{
+		if (args.data->cl)
+		{
+			throw invalid_argument("Asynchronous training is not supported with OpenCL acceleration.");
+		}
+
+		if (args.data->optimizer && !args.data->optimizer->supportsAsyncUpdate())
+		{
+			throw invalid_argument("Asynchronous training requires the gradient descent optimizer.");
+		}
+	}
+
+	// Batch statistics are computed per mini-batch chunk, splitting one across threads would
+	// normalize each thread's share by different statistics
+	if (args.data->threadCount > 1 && !args.data->inferenceOnly)
+	{
+		for (const auto& layer : args.data->layers)
+		{
+			if (dynamic_cast<const layer::BatchNorm*>(layer.get()))
+			{
+				throw invalid_argument("Batch normalization cannot be trained with more than one thread.");
+			}
+		}
+	}
+
+	if (args.data->sparseInput)
+	{
+		if (auto dense = dynamic_cast<layer::Dense*>(args.data->layers.front().get()))
+		{
+			dense->setSparseInputThreshold(layer::Dense::defaultSparseInputThreshold);
+		}
+	}
+
 	if (args.data->cl)
 	{
 		if (cl::Wrapper::instance().init())
@@ -51,6 +94,11 @@ Network::~Network()
 {
 }
 
+void Network::freeze()
+{
+	impl->freeze();
+}
+
 Tensor<> Network::forward(ConstTensor<> inputs, size_t inputCount)
 {
 	return ((Impl*)impl.get())->forward(inputs, inputCount);
@@ -61,8 +109,32 @@ Tensor<1, uint32_t> Network::clasify(ConstTensor<> inputs, size_t inputCount)
 	return impl->clasify(inputs, inputCount);
 }
 
+void Network::forward(ConstTensor<> inputs, size_t inputCount, Tensor<>& outputs)
+{
+	if (outputs.size() < inputCount * impl->getConfig().outputShape.size())
+	{
+		throw std::invalid_argument("Output tensor is too small.");
+	}
+	impl->forward(inputs, inputCount, outputs.data());
+}
+
+void Network::clasify(ConstTensor<> inputs, size_t inputCount, Tensor<1, uint32_t>& classes)
+{
+	if (classes.size() < inputCount)
+	{
+		throw std::invalid_argument("Output tensor is too small.");
+	}
+	impl->clasify(inputs, inputCount, classes.data());
+}
+
+void Network::reserve(size_t inputCount)
+{
+	impl->reserve(inputCount);
+}
+
 void Network::train(ConstTensor<> inputs, ConstTensor<> targets, size_t inputCount, uint32_t epochs, size_t batchSize)
 {
+	checkNotFrozen();
 	checkLossFunction();
 	checkOptimizer();
 	impl->train(inputs, targets, inputCount, batchSize, epochs);
@@ -70,6 +142,7 @@ void Network::train(ConstTensor<> inputs, ConstTensor<> targets, size_t inputCou
 
 void Network::train(ConstTensor<> inputs, Tensor<1, const uint32_t> targets, size_t inputCount, uint32_t epochs, size_t batchSize)
 {
+	checkNotFrozen();
 	checkOptimizer();
 	impl->train(inputs, targets, inputCount, batchSize, epochs);
 }
@@ -130,6 +203,14 @@ void Network::checkOptimizer() const
 	}
 }
 
+void Network::checkNotFrozen() const
+{
+	if (impl->isFrozen())
+	{
+		throw std::exception("Network is frozen for inference and cannot be trained.");
+	}
+}
+
 NetworkArgs::NetworkArgs() :
 	data(make_unique<NetworkConfig>())
 {
@@ -163,11 +244,152 @@ void NetworkArgs::addLayerDense(uint32_t outputSize)
 	}
 
 	const uint32_t inputSize = data->outputShape.size();
-	auto layer = std::make_unique<layer::Dense>(inputSize, outputSize);
-	data->layers.push_back(move(layer));
+
+	// The first layer never backpropagates so has no use for transposed weights
+	const bool first = data->layers.empty();
+	data->layers.push_back(std::make_unique<layer::Dense>(inputSize, outputSize, !first));
 	data->outputShape = { outputSize };
 }
 
+void NetworkArgs::addLayerConv2d(uint32_t fileterCount, Shape<2> filterSize, Shape<2> filterStep)
+{
+	checkAddLayer();
+
+	if (fileterCount == 0)
+	{
+		throw std::invalid_argument("Cannot have a convolution layer with 0 filters.");
+	}
+
+	Shape<3> inputShape;
+
+	if (!getImageShape(inputShape))
+	{
+		throw std::invalid_argument("Convolution layer input must have shape (height, width) or (channels, height, width).");
+	}
+
+	if (layer::Conv2d::getOutputLength(inputShape.length(1), filterSize.length(0), filterStep.length(0)) == 0 ||
+		layer::Conv2d::getOutputLength(inputShape.length(2), filterSize.length(1), filterStep.length(1)) == 0)
+	{
+		throw std::invalid_argument("Convolution filter is larger than its input or has a step of 0.");
+	}
+
+	auto layer = std::make_unique<layer::Conv2d>(inputShape, fileterCount, filterSize, filterStep);
+	const auto outputShape = layer->getOutputShape();
+	data->layers.push_back(move(layer));
+	data->outputShape = outputShape;
+}
+
+void NetworkArgs::addLayerDepthwiseConv2d(Shape<2> filterSize, Shape<2> filterStep)
+{
+	checkAddLayer();
+
+	Shape<3> inputShape;
+
+	if (!getImageShape(inputShape))
+	{
+		throw std::invalid_argument("Depthwise convolution layer input must have shape (height, width) or (channels, height, width).");
+	}
+
+	if (layer::Conv2d::getOutputLength(inputShape.length(1), filterSize.length(0), filterStep.length(0)) == 0 ||
+		layer::Conv2d::getOutputLength(inputShape.length(2), filterSize.length(1), filterStep.length(1)) == 0)
+	{
+		throw std::invalid_argument("Convolution filter is larger than its input or has a step of 0.");
+	}
+
+	auto layer = std::make_unique<layer::DepthwiseConv2d>(inputShape, filterSize, filterStep);
+	const auto outputShape = layer->getOutputShape();
+	data->layers.push_back(move(layer));
+	data->outputShape = outputShape;
+}
+
+void NetworkArgs::addLayerSeparableConv2d(uint32_t filterCount, Shape<2> filterSize, Shape<2> filterStep)
+{
+	addLayerDepthwiseConv2d(filterSize, filterStep);
+	addLayerConv2d(filterCount, Shape<2>({ 1, 1 }));
+}
+
+void NetworkArgs::addLayerMaxPooling(Dim2 poolingSize)
+{
+	checkAddLayer();
+
+	Shape<3> inputShape;
+
+	if (!getImageShape(inputShape))
+	{
+		throw std::invalid_argument("Max pooling layer input must have shape (height, width) or (channels, height, width).");
+	}
+
+	if (poolingSize.x == 0 || poolingSize.y == 0 || poolingSize.x > inputShape.length(2) || poolingSize.y > inputShape.length(1))
+	{
+		throw std::invalid_argument("Pooling size must be at least 1 and no larger than its input.");
+	}
+
+	auto layer = std::make_unique<layer::MaxPooling>(inputShape, poolingSize);
+	const auto outputShape = layer->getOutputShape();
+	data->layers.push_back(move(layer));
+
+	// Keep the rank of the input
+	if (data->outputShape.dimensions().size() == 2)
+	{
+		data->outputShape = { uint32_t(outputShape.length(1)), uint32_t(outputShape.length(2)) };
+	}
+	else
+	{
+		data->outputShape = outputShape;
+	}
+}
+
+void NetworkArgs::addLayerLstm(uint32_t hiddenSize, bool returnSequence)
+{
+	checkAddLayer();
+
+	const auto& inputShape = data->outputShape;
+
+	if (inputShape.dimensions().size() != 2)
+	{
+		throw std::invalid_argument("LSTM layer input must have shape (time, features).");
+	}
+
+	if (hiddenSize == 0)
+	{
+		throw std::invalid_argument("Cannot have a layer with output size 0.");
+	}
+
+	const uint32_t timeSteps = uint32_t(inputShape.length(0));
+	data->layers.push_back(std::make_unique<layer::Lstm>(timeSteps, inputShape.length(1), hiddenSize, returnSequence));
+
+	if (returnSequence)
+	{
+		data->outputShape = { timeSteps, hiddenSize };
+	}
+	else
+	{
+		data->outputShape = { hiddenSize };
+	}
+}
+
+void NetworkArgs::addLayerBatchNorm()
+{
+	checkAddLayer();
+
+	// (channels, height, width) outputs are normalized per channel, anything else per element
+	const auto& shape = data->outputShape;
+	const bool image = shape.dimensions().size() == 3;
+	const uint32_t channels = image ? uint32_t(shape.length(0)) : uint32_t(shape.size());
+	const uint32_t spatialSize = uint32_t(shape.size()) / channels;
+
+	data->layers.push_back(std::make_unique<layer::BatchNorm>(channels, spatialSize));
+}
+
+void NetworkArgs::addLayerDropout(float rate)
+{
+	checkAddLayer();
+	const uint32_t inputSize = data->outputShape.size();
+
+	// Each dropout layer draws its own masks
+	data->layers.push_back(std::make_unique<layer::Dropout>(inputSize, rate, data->layers.size()));
+}
+
 void NetworkArgs::addLayerSigmoid()
 {
 	checkAddLayer();
@@ -176,6 +398,36 @@ void NetworkArgs::addLayerSigmoid()
 	data->layers.push_back(move(layer));
 }
 
+void NetworkArgs::addLayerTanh()
+{
+	checkAddLayer();
+	const uint32_t inputSize = data->outputShape.size();
+	auto layer = std::make_unique<layer::Tanh>(inputSize);
+	data->layers.push_back(move(layer));
+}
+
+void NetworkArgs::addLayerRelu()
+{
+	checkAddLayer();
+	const uint32_t inputSize = data->outputShape.size();
+	auto layer = std::make_unique<layer::Relu>(inputSize);
+	data->layers.push_back(move(layer));
+}
+
+void NetworkArgs::addLayerLrelu(float alpha)
+{
+	checkAddLayer();
+
+	if (!(alpha >= 0.f))
+	{
+		throw std::invalid_argument("Leaky ReLU slope cannot be negative.");
+	}
+
+	const uint32_t inputSize = data->outputShape.size();
+	auto layer = std::make_unique<layer::Relu>(inputSize, alpha);
+	data->layers.push_back(move(layer));
+}
+
 void NetworkArgs::setOptimizerGradientDescent(float learningRate)
 {
 	auto optimizer = std::make_unique<optimizer::Sgd>(learningRate);
@@ -194,16 +446,66 @@ void NetworkArgs::setLossMse()
 	data->lossFunc = move(loss);
 }
 
+void NetworkArgs::setLossSoftmaxCrossEntropy()
+{
+	auto loss = std::make_unique<loss::SoftmaxCrossEntropy>();
+	data->lossFunc = move(loss);
+}
+
 void NetworkArgs::enableOpenCLAcceleration(bool enable)
 {
 	data->cl = enable;
 }
 
+void NetworkArgs::setThreadCount(uint32_t threadCount)
+{
+	if (threadCount == 0)
+	{
+		throw std::invalid_argument("Thread count cannot be 0.");
+	}
+	data->threadCount = threadCount;
+}
+
+void NetworkArgs::enableAsyncTraining(bool enable)
+{
+	data->asyncTraining = enable;
+}
+
+void NetworkArgs::enableSparseInput(bool enable)
+{
+	data->sparseInput = enable;
+}
+
+void NetworkArgs::setInferenceOnly(bool enable)
+{
+	data->inferenceOnly = enable;
+}
+
 Shape<>& NetworkArgs::getOutputShape() const
 {
 	return data->outputShape;
 }
 
+bool NetworkArgs::getImageShape(Shape<3>& shape) const
+{
+	// Images with a single channel can be given as (height, width)
+	const auto& dimensions = data->outputShape.dimensions();
+
+	if (dimensions.size() == 2)
+	{
+		shape = Shape<3>({ 1, dimensions[0], dimensions[1] });
+		return true;
+	}
+
+	if (dimensions.size() == 3)
+	{
+		shape = Shape<3>({ dimensions[0], dimensions[1], dimensions[2] });
+		return true;
+	}
+
+	return false;
+}
+
 void NetworkArgs::checkAddLayer()
 {
 	if (data->inputShape.size() == 0)
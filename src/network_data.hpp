@@ -17,6 +17,18 @@ struct NetworkConfig
 {
     bool cl = false;
 
+    // number of host threads used for training and inference
+    uint32_t threadCount = 1;
+
+    // threads apply their updates to the shared parameters without synchronising
+    bool asyncTraining = false;
+
+    // the first layer skips the zeros of mostly empty input on the host
+    bool sparseInput = false;
+
+    // never allocate training state (same as calling Network::freeze() straight away)
+    bool inferenceOnly = false;
+
     Shape<> inputShape;
 
     Shape<> outputShape;
@@ -23,19 +23,30 @@ public:
 	}
 
 	~Adam()
+	{
+		release();
+	}
+
+	void release() final
 	{
 		if (mBuffer)
 		{
 			clReleaseMemObject(mBuffer);
+			mBuffer = NULL;
 		}
 		if (vBuffer)
 		{
 			clReleaseMemObject(vBuffer);
+			vBuffer = NULL;
 		}
 		if (betaPowBuffer)
 		{
 			clReleaseMemObject(betaPowBuffer);
+			betaPowBuffer = NULL;
 		}
+
+		std::vector<float>().swap(m);
+		std::vector<float>().swap(v);
 	}
 
 	void init(float* data, size_t paramCount) final
@@ -116,7 +127,6 @@ public:
 	{
 		const float scale = learningRate / batchSize;
 		uint32_t size = parameterCount;
-		size_t globalSize = cl::alignSize(size);
 		int error;
 
 		error = clSetKernelArg(updateKernel, 0, sizeof(cl_mem), &parameters);
@@ -126,7 +136,7 @@ public:
 		error |= clSetKernelArg(updateKernel, 4, sizeof(cl_mem), &betaPowBuffer);
 		error |= clSetKernelArg(updateKernel, 5, sizeof(scale), &scale);
 		error |= clSetKernelArg(updateKernel, 6, sizeof(size), &size);
-		error |= clEnqueueNDRangeKernel(queue, updateKernel, 1, NULL, &globalSize, &cl::workGroupSize, 0, NULL, NULL);
+		error |= cl::enqueue(queue, updateKernel, size, { parameters, derivatives, mBuffer, vBuffer });
 
 		if (error != CL_SUCCESS)
 		{
@@ -134,8 +144,9 @@ public:
 		}
 
 		error = clSetKernelArg(updateBetasKernel, 0, sizeof(cl_mem), &betaPowBuffer);
-		globalSize = 1;
-		error |= clEnqueueNDRangeKernel(queue, updateBetasKernel, 1, NULL, &globalSize, &globalSize, 0, NULL, NULL);
+		// A single work item, there is nothing to tune
+		const size_t one = 1;
+		error |= clEnqueueNDRangeKernel(queue, updateBetasKernel, 1, NULL, &one, &one, 0, NULL, NULL);
 
 		if (error != CL_SUCCESS)
 		{
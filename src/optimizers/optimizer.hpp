@@ -1,6 +1,7 @@
 #pragma once
 #include "tensor.hpp"
 #include "CL/opencl.h"
+#include "../cl/tuner.hpp"
 
 namespace nn
 {
@@ -18,6 +19,12 @@ public:
 	// Update parameters after backpropagation pass (end of batch)
 	virtual void update(float* parameters, const float* derivatives, size_t batchSize) = 0;
 
+	// Free all state kept between updates. The optimizer is not used again afterwards.
+	virtual void release() {}
+
+	// True if update() does not modify optimizer state, so several threads can update the same parameters at once
+	virtual bool supportsAsyncUpdate() const { return false; }
+
 	// Perform any necessary data initialization
 	virtual void cl_init(cl_context context, cl_device_id device, cl_command_queue queue, cl_mem derivatives, size_t paramCount) = 0;
 
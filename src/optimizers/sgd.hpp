@@ -35,6 +35,11 @@ public:
 		}
 	}
 
+	bool supportsAsyncUpdate() const final
+	{
+		return true;
+	}
+
 	void cl_init(cl_context context, cl_device_id device, cl_command_queue, cl_mem, size_t paramCount) final
 	{
 		auto program = cl::buildProgramFromFile(__FILE__, context, device);
@@ -65,14 +70,13 @@ public:
 	{
 		const float scale = learningRate / batchSize;
 		uint32_t size = parameterCount;
-		size_t globalSize = cl::alignSize(size / 4);
 		int error;
 		
 		error = clSetKernelArg(updateKernel, 0, sizeof(cl_mem), &parameters);
 		error |= clSetKernelArg(updateKernel, 1, sizeof(cl_mem), &derivatives);
 		error |= clSetKernelArg(updateKernel, 2, sizeof(scale), &scale);
 		error |= clSetKernelArg(updateKernel, 3, sizeof(size), &size);
-		error |= clEnqueueNDRangeKernel(queue, updateKernel, 1, NULL, &globalSize, &cl::workGroupSize, 0, NULL, NULL);
+		error |= cl::enqueue(queue, updateKernel, (size + 3) / 4, { parameters, derivatives });
 
 		
 		if (error != CL_SUCCESS)
@@ -0,0 +1,168 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <vector>
+
+namespace nn
+{
+// Fixed size fork-join pool. run() executes a task on every thread (the calling thread
+// takes index 0) and returns once all of them have finished. Tasks are passed by reference
+// rather than wrapped in std::function so running one never allocates.
+class ThreadPool
+{
+public:
+	ThreadPool(size_t threadCount) :
+		threadCount(threadCount),
+		task(nullptr),
+		invoke(nullptr),
+		generation(0),
+		pending(0),
+		stopping(false)
+	{
+		for (size_t i = 1; i < threadCount; ++i)
+		{
+			workers.emplace_back([this, i] { workerLoop(i); });
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	size_t size() const { return threadCount; }
+
+	template<typename F>
+	void run(const F& function)
+	{
+		if (threadCount == 1)
+		{
+			function(0);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			task = &function;
+			invoke = [](const void* task, size_t index) { (*static_cast<const F*>(task))(index); };
+			pending = threadCount - 1;
+			error = nullptr;
+			++generation;
+		}
+		wake.notify_all();
+
+		std::exception_ptr callerError;
+		try
+		{
+			function(0);
+		}
+		catch (...)
+		{
+			callerError = std::current_exception();
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] { return pending == 0; });
+		task = nullptr;
+
+		if (callerError)
+		{
+			std::rethrow_exception(callerError);
+		}
+
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
+	}
+
+	// Splits [0, count) into one contiguous range per thread
+	static void getRange(size_t count, size_t threadIndex, size_t threadCount, size_t& first, size_t& last)
+	{
+		first = count * threadIndex / threadCount;
+		last = count * (threadIndex + 1) / threadCount;
+	}
+
+private:
+	void workerLoop(size_t index)
+	{
+		size_t seenGeneration = 0;
+
+		for (;;)
+		{
+			const void* function;
+			void (*invokeFunction)(const void*, size_t);
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+
+				if (stopping)
+				{
+					return;
+				}
+
+				seenGeneration = generation;
+				function = task;
+				invokeFunction = invoke;
+			}
+
+			std::exception_ptr taskError;
+			try
+			{
+				invokeFunction(function, index);
+			}
+			catch (...)
+			{
+				taskError = std::current_exception();
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (taskError && !error)
+				{
+					error = taskError;
+				}
+
+				if (--pending == 0)
+				{
+					done.notify_one();
+				}
+			}
+		}
+	}
+
+	const size_t threadCount;
+
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+
+	std::condition_variable wake;
+
+	std::condition_variable done;
+
+	// current task and a function that calls it
+	const void* task;
+
+	void (*invoke)(const void* task, size_t index);
+
+	std::exception_ptr error;
+
+	size_t generation;
+
+	size_t pending;
+
+	bool stopping;
+};
+}
@@ -4,6 +4,13 @@
 namespace cl
 {
 
+// Buffers are padded to whole work groups of the smallest tuned size
+static size_t alignSize(size_t s)
+{
+	const size_t multiple = nn::cl::Tuner::defaultSize;
+	return (s + multiple - 1) / multiple * multiple;
+}
+
 Helper::Helper()
 {
 	if (!nn::cl::Wrapper::instance().init())
@@ -38,7 +45,7 @@ Helper::~Helper()
 cl_mem Helper::makeBuffer(nn::Tensor<> data)
 {
 	int error;
-	auto buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, nn::cl::alignSize(data.size()) * sizeof(float), NULL,  &error);	
+	auto buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, alignSize(data.size()) * sizeof(float), NULL,  &error);	
 	error |= clEnqueueWriteBuffer(queue, buffer, true, 0, data.size() * sizeof(float), data.data(), 0, NULL, NULL);
 
 	if (error != CL_SUCCESS)
@@ -53,7 +60,7 @@ cl_mem Helper::makeBuffer(nn::Tensor<> data)
 cl_mem Helper::makeBuffer(size_t size)
 {
 	int error;
-	auto buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, nn::cl::alignSize(size) * sizeof(float), NULL, &error);
+	auto buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, alignSize(size) * sizeof(float), NULL, &error);
 
 	if (error != CL_SUCCESS)
 	{
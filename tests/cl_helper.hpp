@@ -1,5 +1,5 @@
 #pragma once
-#include "..\src\cl\cl_utils.hpp"
+#include "..\src\cl\tuner.hpp"
 #include "..\include\tensor.hpp"
 #include <unordered_map>
 namespace cl
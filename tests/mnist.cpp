@@ -20,30 +20,41 @@ public:
 		Adam
 	};
 
-	auto makeNetwork(Shape<> inputShape, size_t outputSize, bool cl, Optimizer opt)
+	// With softmax the final layer's logits go straight into a softmax cross entropy loss
+	auto makeNetwork(Shape<> inputShape, size_t outputSize, bool cl, Optimizer opt, bool softmax)
 	{
 		NetworkArgs args;
 		args.setInputShape(inputShape);
 		args.addLayerDense(64);
 		args.addLayerSigmoid();
 		args.addLayerDense(outputSize);
-		args.addLayerSigmoid();
-		args.setLossMse();
+
+		if (softmax)
+		{
+			args.setLossSoftmaxCrossEntropy();
+		}
+		else
+		{
+			args.addLayerSigmoid();
+			args.setLossMse();
+		}
+
 		args.enableOpenCLAcceleration(cl);
 
 		switch (opt)
 		{
-		case Optimizer::Sgd: args.setOptimizerGradientDescent(1.0f); break;
+		// The softmax gradient has no sigmoid derivative to damp it
+		case Optimizer::Sgd: args.setOptimizerGradientDescent(softmax ? 0.1f : 1.0f); break;
 		case Optimizer::Adam: args.setOptimizerAdam(0.3f); break;
 		}
 
 		return Network(move(args));
 	}
 
-	void TrainAndTest(bool cl, Optimizer opt)
+	void TrainAndTest(bool cl, Optimizer opt, bool softmax = false)
 	{
 		auto data = LoadFormattedMnist();
-		auto network = makeNetwork(data.trainingData.shape().slice(), 10, cl, opt);
+		auto network = makeNetwork(data.trainingData.shape().slice(), 10, cl, opt, softmax);
 		network.train(data.trainingData, data.trainingLabels, 16, 1);
 		auto accuracy = (float)network.test(data.testData.section(0, 1000), data.testLabels.section(0, 1000));
 		Assert::IsTrue(accuracy >= 0.9);
@@ -66,6 +77,15 @@ public:
 	{
 		TrainAndTest(true, Optimizer::Adam);
 	}
+
+	TEST_METHOD(SoftmaxCrossEntropy)
+	{
+		TrainAndTest(false, Optimizer::Sgd, true);
+	}
+	TEST_METHOD(cl_SoftmaxCrossEntropy)
+	{
+		TrainAndTest(true, Optimizer::Sgd, true);
+	}
 };
 }
 }
\ No newline at end of file
@@ -0,0 +1,86 @@
+#include "pch.h"
+#include "..\src\cl\tuner.hpp"
+#include "..\src\optimizers\sgd.hpp"
+#include "..\utils\utils.hpp"
+#include <cstdio>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace nn;
+using namespace std;
+
+namespace test
+{
+TEST_CLASS(Tuner)
+{
+public:
+
+	TEST_METHOD(CacheTest)
+	{
+		const char* fileName = "tuning_cache_test.txt";
+		remove(fileName);
+
+		{
+			nn::cl::TuningCache cache(fileName, "device", "1.0");
+			size_t value;
+			Assert::IsFalse(cache.find("dense.forward i1x64", value));
+			cache.insert("dense.forward i1x64", 128);
+			cache.insert("sgd.update i1x1024", 64);
+			Assert::IsTrue(cache.find("dense.forward i1x64", value));
+			Assert::AreEqual(size_t(128), value);
+		}
+
+		{
+			nn::cl::TuningCache sameDriver(fileName, "device", "1.0");
+			nn::cl::TuningCache newDriver(fileName, "device", "1.1");
+			nn::cl::TuningCache otherDevice(fileName, "other\tdevice", "1.0");
+			size_t value = 0;
+			Assert::IsTrue(sameDriver.find("sgd.update i1x1024", value));
+			Assert::AreEqual(size_t(64), value);
+			Assert::IsFalse(newDriver.find("sgd.update i1x1024", value));
+			Assert::IsFalse(otherDevice.find("sgd.update i1x1024", value));
+		}
+
+		remove(fileName);
+	}
+
+	// The first launch is timed with every candidate size, which must leave the update applied once
+	TEST_METHOD(cl_FirstLaunchTest)
+	{
+		const size_t count = 1000;
+		const size_t batchSize = 4;
+		auto params = nn::uniformRandomTensor(count, -1.f, 1.f);
+		auto derivatives = nn::uniformRandomTensor(count, -1.f, 1.f);
+		auto clParams = clHelper.makeBuffer(params);
+		auto clDerivatives = clHelper.makeBuffer(derivatives);
+
+		CacheFileGuard guard("");
+		auto sgd = nn::optimizer::Sgd(0.1f);
+		sgd.init(params.data(), count);
+		sgd.cl_init(clHelper.getContext(), clHelper.getDevice(), clHelper.getQueue(), clParams, count);
+		sgd.update(params.data(), derivatives.data(), batchSize);
+		sgd.cl_update(clHelper.getQueue(), clParams, clDerivatives, batchSize);
+
+		Assert::IsTrue(areWithinTolerance(params.data(), clHelper.getData(clParams).data(), count, 0.0001));
+	}
+
+private:
+	// Switches the tuning cache file and restores the previous one, also when an assertion fails
+	struct CacheFileGuard
+	{
+		CacheFileGuard(const std::string& fileName) :
+			previous(nn::cl::Tuner::getCacheFile())
+		{
+			nn::cl::Tuner::setCacheFile(fileName);
+		}
+
+		~CacheFileGuard()
+		{
+			nn::cl::Tuner::setCacheFile(previous);
+		}
+
+		std::string previous;
+	};
+
+	::cl::Helper clHelper;
+};
+}
@@ -0,0 +1,228 @@
+#include "pch.h"
+#include "..\src\layers\batch_norm.hpp"
+#include "..\src\layers\dense.hpp"
+#include "..\utils\utils.hpp"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace nn;
+using namespace std;
+
+namespace test
+{
+namespace layer
+{
+TEST_CLASS(BatchNorm)
+{
+public:
+	TEST_METHOD(ConstructTest)
+	{
+		auto layer = nn::layer::BatchNorm(3, 5);
+		Assert::AreEqual(size_t(15), layer.getInputSize());
+		Assert::AreEqual(size_t(15), layer.getOutputSize());
+		Assert::AreEqual(size_t(6), layer.getParameterCount());
+		Assert::AreEqual(size_t(15 + 3), layer.getTrainingStateSize());
+		Assert::IsTrue(layer.canRunInPlace());
+	}
+
+	TEST_METHOD(ForwardTrainingTest)
+	{
+		auto layer = nn::layer::BatchNorm(2, 3);
+		const size_t batchSize = 4;
+		auto input = nn::uniformRandomTensor(batchSize * layer.getInputSize(), -3.f, 5.f);
+		auto output = Tensor<>(input.size());
+		auto state = Tensor<>(batchSize * layer.getTrainingStateSize());
+		auto params = Tensor<>(layer.getParameterCount());
+		layer.initializeParameters(params.data());
+
+		layer.forwardTrainingBatch(input.data(), params.data(), output.data(), state.data(), batchSize);
+
+		// Every channel has mean 0 and variance 1 over the batch
+		for (size_t c = 0; c < 2; ++c)
+		{
+			double sum = 0.0, sumSquares = 0.0;
+
+			for (size_t n = 0; n < batchSize; ++n)
+			{
+				for (size_t i = 0; i < 3; ++i)
+				{
+					const float y = output[n * 6 + c * 3 + i];
+					sum += y;
+					sumSquares += y * y;
+				}
+			}
+
+			Assert::AreEqual(0.0, sum / 12, 1e-5);
+			Assert::AreEqual(1.0, sumSquares / 12, 1e-3);
+		}
+	}
+
+	TEST_METHOD(RunningStatisticsTest)
+	{
+		auto layer = nn::layer::BatchNorm(1, 4);
+		Tensor<> input = { 1.f, 2.f, 3.f, 6.f };
+		auto output = Tensor<>(input.size());
+		auto state = Tensor<>(layer.getTrainingStateSize());
+		auto params = Tensor<>(layer.getParameterCount());
+		layer.initializeParameters(params.data());
+
+		layer.forwardTrainingBatch(input.data(), params.data(), output.data(), state.data(), 1);
+
+		// Mean 3 and unbiased variance 14 / 3, moved from 0 and 1 by the momentum
+		const float m = nn::layer::BatchNorm::momentum;
+		Assert::AreEqual(m * 3.f, layer.getRunningMean()[0], 1e-6f);
+		Assert::AreEqual(1.f + m * (14.f / 3.f - 1.f), layer.getRunningVariance()[0], 1e-5f);
+
+		// Inference uses the running statistics
+		layer.forwardBatch(input.data(), params.data(), output.data(), 1);
+		const float expected = (1.f - layer.getRunningMean()[0]) / sqrtf(layer.getRunningVariance()[0] + nn::layer::BatchNorm::epsilon);
+		Assert::AreEqual(expected, output[0], 1e-5f);
+	}
+
+	// Compares backPropagateBatch and calculateDerivativesBatch with finite differences of
+	// sum(outputError * output)
+	TEST_METHOD(BackpropTest)
+	{
+		auto layer = nn::layer::BatchNorm(2, 3);
+		const size_t batchSize = 4;
+		auto input = nn::uniformRandomTensor(batchSize * layer.getInputSize(), -1.f, 1.f);
+		auto outputError = nn::uniformRandomTensor(input.size(), -1.f, 1.f);
+		auto params = nn::uniformRandomTensor(layer.getParameterCount(), 0.5f, 1.5f);
+		auto output = Tensor<>(input.size());
+		auto state = Tensor<>(batchSize * layer.getTrainingStateSize());
+		auto inputError = Tensor<>(input.size());
+		auto derivatives = Tensor<>(params.size());
+		std::fill(derivatives.data(), derivatives.end(), 0.f);
+
+		auto loss = [&]()
+		{
+			double sum = 0.0;
+			layer.forwardTrainingBatch(input.data(), params.data(), output.data(), state.data(), batchSize);
+
+			for (size_t i = 0; i < output.size(); ++i)
+			{
+				sum += output[i] * outputError[i];
+			}
+
+			return sum;
+		};
+
+		auto gradient = [&](float& x)
+		{
+			const float h = 1e-2f;
+			const float original = x;
+			x = original + h;
+			const double plus = loss();
+			x = original - h;
+			const double minus = loss();
+			x = original;
+			return float((plus - minus) / (2 * h));
+		};
+
+		loss();
+		nn::layer::Layer::BackPropData backProp;
+		backProp.params = params.data();
+		backProp.outputError = outputError.data();
+		backProp.state = state.data();
+		layer.calculateDerivativesBatch(backProp, derivatives.data(), batchSize);
+		layer.backPropagateBatch(backProp, inputError.data(), batchSize);
+
+		for (size_t i = 0; i < input.size(); ++i)
+		{
+			Assert::AreEqual(gradient(input[i]), inputError[i], 1e-2f);
+		}
+
+		for (size_t i = 0; i < params.size(); ++i)
+		{
+			Assert::AreEqual(gradient(params[i]), derivatives[i], 1e-2f);
+		}
+	}
+
+	TEST_METHOD(FoldTest)
+	{
+		auto dense = nn::layer::Dense(5, 3);
+		auto layer = nn::layer::BatchNorm(3);
+		const size_t batchSize = 8;
+		auto input = nn::uniformRandomTensor(batchSize * 5, -1.f, 1.f);
+		auto denseParams = Tensor<>(dense.getParameterCount());
+		auto params = nn::uniformRandomTensor(layer.getParameterCount(), 0.5f, 1.5f);
+		auto denseOutput = Tensor<>(batchSize * 3);
+		auto output = Tensor<>(batchSize * 3);
+		auto foldedOutput = Tensor<>(batchSize * 3);
+		auto state = Tensor<>(batchSize * layer.getTrainingStateSize());
+		dense.initializeParameters(denseParams.data());
+
+		// Move the running statistics away from their initial values
+		dense.forwardBatch(input.data(), denseParams.data(), denseOutput.data(), batchSize);
+
+		for (size_t i = 0; i < 10; ++i)
+		{
+			layer.forwardTrainingBatch(denseOutput.data(), params.data(), output.data(), state.data(), batchSize);
+		}
+
+		layer.forwardBatch(denseOutput.data(), params.data(), output.data(), batchSize);
+
+		Assert::IsFalse(layer.foldInto(nn::layer::BatchNorm(3), denseParams.data(), params.data()));
+		Assert::IsTrue(layer.foldInto(dense, denseParams.data(), params.data()));
+		Assert::IsTrue(layer.isFolded());
+		dense.forwardBatch(input.data(), denseParams.data(), foldedOutput.data(), batchSize);
+
+		Assert::IsTrue(areWithinTolerance(output.data(), foldedOutput.data(), output.size(), 0.0001f));
+	}
+
+	TEST_METHOD(cl_PassesTest)
+	{
+		auto layer = nn::layer::BatchNorm(3, 5);
+		const uint32_t batchSize = 4;
+		auto input = nn::uniformRandomTensor(batchSize * layer.getInputSize(), -1.f, 1.f);
+		auto outputError = nn::uniformRandomTensor(input.size(), -1.f, 1.f);
+		auto params = Tensor<>(layer.getParameterCount());
+		auto output = Tensor<>(input.size());
+		auto trainingOutput = Tensor<>(input.size());
+		auto state = Tensor<>(batchSize * layer.getTrainingStateSize());
+		auto inputError = Tensor<>(input.size());
+		auto derivatives = Tensor<>(params.size());
+		std::fill(derivatives.data(), derivatives.end(), 0.f);
+
+		layer.cl_initKernels(clHelper.getContext(), clHelper.getDevice());
+		auto clInput = clHelper.makeBuffer(input);
+		auto clParams = clHelper.makeBuffer(params.size());
+		auto clOutput = clHelper.makeBuffer(output.size());
+		auto clTrainingOutput = clHelper.makeBuffer(output.size());
+		auto clState = clHelper.makeBuffer(state.size());
+		auto clOutputError = clHelper.makeBuffer(outputError);
+		auto clInputError = clHelper.makeBuffer(inputError.size());
+		auto clDerivatives = clHelper.makeBuffer(derivatives);
+		layer.cl_initializeParameters(clHelper.getQueue(), clParams, 0);
+		layer.initializeParameters(params.data());
+
+		// Inference before training so both use the initial running statistics
+		layer.forwardBatch(input.data(), params.data(), output.data(), batchSize);
+		layer.forwardTrainingBatch(input.data(), params.data(), trainingOutput.data(), state.data(), batchSize);
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.params = params.data();
+		backProp.outputError = outputError.data();
+		backProp.state = state.data();
+		layer.calculateDerivativesBatch(backProp, derivatives.data(), batchSize);
+		layer.backPropagateBatch(backProp, inputError.data(), batchSize);
+
+		nn::layer::Layer::ClBackPropData clBackProp;
+		clBackProp.params = clParams;
+		clBackProp.outputError = clOutputError;
+		clBackProp.state = clState;
+		layer.cl_forward(clHelper.getQueue(), clInput, clParams, clOutput, 0, 0, 0, batchSize);
+		layer.cl_forwardTraining(clHelper.getQueue(), clInput, clParams, clTrainingOutput, clState, 0, 0, 0, batchSize);
+		layer.cl_calculateDerivatives(clHelper.getQueue(), clBackProp, clDerivatives, 0, batchSize);
+		layer.cl_backPropagate(clHelper.getQueue(), clBackProp, clInputError, 0, batchSize);
+
+		Assert::IsTrue(areWithinTolerance(output.data(), clHelper.getData(clOutput).data(), output.size(), 0.0001));
+		Assert::IsTrue(areWithinTolerance(trainingOutput.data(), clHelper.getData(clTrainingOutput).data(), output.size(), 0.0001));
+		Assert::IsTrue(areWithinTolerance(derivatives.data(), clHelper.getData(clDerivatives).data(), derivatives.size(), 0.0001));
+		Assert::IsTrue(areWithinTolerance(inputError.data(), clHelper.getData(clInputError).data(), inputError.size(), 0.0001));
+	}
+
+private:
+	::cl::Helper clHelper;
+};
+}
+}
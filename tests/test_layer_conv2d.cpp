@@ -0,0 +1,256 @@
+#include "pch.h"
+#include "..\src\layers\conv2d.hpp"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace nn;
+using namespace std;
+
+namespace test
+{
+namespace layer
+{
+TEST_CLASS(Conv2d)
+{
+public:
+
+	// Direct convolution of one sample with 2 channels, 3 filters of 3x2 and step (2, 1)
+	struct Reference
+	{
+		static const size_t channels = 2, height = 7, width = 6, filters = 3, fh = 3, fw = 2, sy = 2, sx = 1;
+		static const size_t outHeight = (height - fh) / sy + 1, outWidth = (width - fw) / sx + 1;
+
+		static float& at(float* x, size_t c, size_t y, size_t xx, size_t h, size_t w) { return x[(c * h + y) * w + xx]; }
+
+		static float filter(const float* params, size_t f, size_t c, size_t y, size_t x)
+		{
+			return params[filters + ((f * channels + c) * fh + y) * fw + x];
+		}
+	};
+
+	static nn::layer::Conv2d makeLayer()
+	{
+		return nn::layer::Conv2d(Shape<3>({ Reference::channels, Reference::height, Reference::width }), Reference::filters,
+			Shape<2>({ Reference::fh, Reference::fw }), Shape<2>({ Reference::sy, Reference::sx }));
+	}
+
+	TEST_METHOD(ConstructTest)
+	{
+		auto layer = makeLayer();
+		Assert::AreEqual(size_t(2 * 7 * 6), layer.getInputSize());
+		Assert::AreEqual(size_t(3 * 3 * 5), layer.getOutputSize());
+		Assert::AreEqual(size_t(3 * (2 * 3 * 2 + 1)), layer.getParameterCount());
+		Assert::IsTrue(layer.getOutputShape() == Shape<3>({ 3, 3, 5 }));
+	}
+
+	TEST_METHOD(InvalidArgs)
+	{
+		auto filterTooBig = []
+		{
+			auto layer = nn::layer::Conv2d(Shape<3>({ 1, 4, 4 }), 2, Shape<2>({ 5, 1 }));
+		};
+		Assert::ExpectException<std::invalid_argument>(filterTooBig);
+	}
+
+	TEST_METHOD(PassesTest)
+	{
+		using R = Reference;
+		const size_t batchSize = 3;
+		auto layer = makeLayer();
+		auto input = nn::uniformRandomTensor(batchSize * layer.getInputSize(), -1.f, 1.f);
+		auto outputError = nn::uniformRandomTensor(batchSize * layer.getOutputSize(), -1.f, 1.f);
+		auto params = nn::uniformRandomTensor(layer.getParameterCount(), -1.f, 1.f);
+
+		auto expectedOutput = Tensor<>(outputError.size());
+		auto expectedInputError = Tensor<>(input.size());
+		auto expectedDvs = Tensor<>(layer.getParameterCount());
+		std::memset(expectedInputError.data(), 0, sizeof(float) * expectedInputError.size());
+		std::memset(expectedDvs.data(), 0, sizeof(float) * expectedDvs.size());
+
+		for (size_t n = 0; n < batchSize; ++n)
+		{
+			float* in = input.data() + n * layer.getInputSize();
+			float* out = expectedOutput.data() + n * layer.getOutputSize();
+			float* err = outputError.data() + n * layer.getOutputSize();
+			float* inErr = expectedInputError.data() + n * layer.getInputSize();
+
+			for (size_t f = 0; f < R::filters; ++f)
+			{
+				for (size_t y = 0; y < R::outHeight; ++y)
+				{
+					for (size_t x = 0; x < R::outWidth; ++x)
+					{
+						float sum = params[f];
+						const float e = R::at(err, f, y, x, R::outHeight, R::outWidth);
+						expectedDvs[f] += e;
+
+						for (size_t c = 0; c < R::channels; ++c)
+						{
+							for (size_t i = 0; i < R::fh; ++i)
+							{
+								for (size_t j = 0; j < R::fw; ++j)
+								{
+									const size_t iy = y * R::sy + i, ix = x * R::sx + j;
+									sum += R::filter(params.data(), f, c, i, j) * R::at(in, c, iy, ix, R::height, R::width);
+									R::at(inErr, c, iy, ix, R::height, R::width) += e * R::filter(params.data(), f, c, i, j);
+									expectedDvs[R::filters + ((f * R::channels + c) * R::fh + i) * R::fw + j] += e * R::at(in, c, iy, ix, R::height, R::width);
+								}
+							}
+						}
+
+						R::at(out, f, y, x, R::outHeight, R::outWidth) = sum;
+					}
+				}
+			}
+		}
+
+		auto output = Tensor<>(expectedOutput.size());
+		auto inputError = Tensor<>(input.size());
+		auto dvs = Tensor<>(layer.getParameterCount());
+		std::memset(dvs.data(), 0, sizeof(float) * dvs.size());
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.input = input.data();
+		backProp.outputError = outputError.data();
+		backProp.params = params.data();
+
+		layer.forwardBatch(input.data(), params.data(), output.data(), batchSize);
+		layer.backPropagateBatch(backProp, inputError.data(), batchSize);
+		layer.calculateDerivativesBatch(backProp, dvs.data(), batchSize);
+
+		Assert::IsTrue(areWithinTolerance(expectedOutput.data(), output.data(), output.size(), 0.001));
+		Assert::IsTrue(areWithinTolerance(expectedInputError.data(), inputError.data(), inputError.size(), 0.001));
+		Assert::IsTrue(areWithinTolerance(expectedDvs.data(), dvs.data(), dvs.size(), 0.001));
+	}
+
+	TEST_METHOD(WinogradTest)
+	{
+		// Odd output sizes so the last row and column of tiles hang over the edge
+		const size_t batchSize = 3;
+		auto layer = nn::layer::Conv2d(Shape<3>({ 5, 9, 8 }), 6, Shape<2>({ 3, 3 }));
+		Assert::IsTrue(layer.isWinograd());
+		Assert::IsTrue(layer.getOutputShape() == Shape<3>({ 6, 7, 6 }));
+		Assert::AreEqual(size_t(0), makeLayer().getParameterCacheSize());
+
+		// The device kernels do not use the transformed filters
+		Assert::AreEqual(size_t(0), layer.cl_getParameterCacheSize());
+
+		auto input = nn::uniformRandomTensor(batchSize * layer.getInputSize(), -1.f, 1.f);
+		auto params = nn::uniformRandomTensor(layer.getParameterCount(), -1.f, 1.f);
+		auto cache = Tensor<>(layer.getParameterCacheSize());
+		layer.updateParameterCache(params.data(), cache.data());
+
+		// Without the cache it takes the im2col path
+		auto expected = Tensor<>(batchSize * layer.getOutputSize());
+		auto output = Tensor<>(expected.size());
+		layer.forwardBatch(input.data(), params.data(), expected.data(), batchSize);
+		layer.forwardBatch(input.data(), params.data(), output.data(), batchSize, cache.data());
+
+		Assert::IsTrue(areWithinTolerance(expected.data(), output.data(), output.size(), 0.0001));
+	}
+
+	TEST_METHOD(PointwiseTest)
+	{
+		// A 1x1 convolution is a matrix product per sample
+		const size_t batchSize = 3, channels = 4, filters = 5, positions = 3 * 7;
+		auto layer = nn::layer::Conv2d(Shape<3>({ channels, 3, 7 }), filters, Shape<2>({ 1, 1 }));
+		Assert::IsTrue(layer.isPointwise());
+
+		auto input = nn::uniformRandomTensor(batchSize * layer.getInputSize(), -1.f, 1.f);
+		auto outputError = nn::uniformRandomTensor(batchSize * layer.getOutputSize(), -1.f, 1.f);
+		auto params = nn::uniformRandomTensor(layer.getParameterCount(), -1.f, 1.f);
+		const float* weights = params.data() + filters;
+
+		auto expectedOutput = Tensor<>(outputError.size());
+		auto expectedInputError = Tensor<>(input.size());
+		auto expectedDvs = Tensor<>(layer.getParameterCount());
+		std::memset(expectedInputError.data(), 0, sizeof(float) * expectedInputError.size());
+		std::memset(expectedDvs.data(), 0, sizeof(float) * expectedDvs.size());
+
+		for (size_t n = 0; n < batchSize; ++n)
+		{
+			for (size_t f = 0; f < filters; ++f)
+			{
+				for (size_t p = 0; p < positions; ++p)
+				{
+					const size_t o = (n * filters + f) * positions + p;
+					float sum = params[f];
+					expectedDvs[f] += outputError[o];
+
+					for (size_t c = 0; c < channels; ++c)
+					{
+						const size_t i = (n * channels + c) * positions + p;
+						sum += weights[f * channels + c] * input[i];
+						expectedInputError[i] += outputError[o] * weights[f * channels + c];
+						expectedDvs[filters + f * channels + c] += outputError[o] * input[i];
+					}
+
+					expectedOutput[o] = sum;
+				}
+			}
+		}
+
+		auto output = Tensor<>(expectedOutput.size());
+		auto inputError = Tensor<>(input.size());
+		auto dvs = Tensor<>(layer.getParameterCount());
+		std::memset(dvs.data(), 0, sizeof(float) * dvs.size());
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.input = input.data();
+		backProp.outputError = outputError.data();
+		backProp.params = params.data();
+
+		layer.forwardBatch(input.data(), params.data(), output.data(), batchSize);
+		layer.backPropagateBatch(backProp, inputError.data(), batchSize);
+		layer.calculateDerivativesBatch(backProp, dvs.data(), batchSize);
+
+		Assert::IsTrue(areWithinTolerance(expectedOutput.data(), output.data(), output.size(), 0.001));
+		Assert::IsTrue(areWithinTolerance(expectedInputError.data(), inputError.data(), inputError.size(), 0.001));
+		Assert::IsTrue(areWithinTolerance(expectedDvs.data(), dvs.data(), dvs.size(), 0.001));
+	}
+
+	TEST_METHOD(cl_PassesTest)
+	{
+		const size_t batchSize = 3;
+		auto layer = makeLayer();
+		auto input = nn::uniformRandomTensor(batchSize * layer.getInputSize(), -1.f, 1.f);
+		auto outputError = nn::uniformRandomTensor(batchSize * layer.getOutputSize(), -1.f, 1.f);
+		auto params = nn::uniformRandomTensor(layer.getParameterCount(), -1.f, 1.f);
+		auto output = Tensor<>(outputError.size());
+		auto inputError = Tensor<>(input.size());
+		auto dvs = Tensor<>(layer.getParameterCount());
+		std::memset(dvs.data(), 0, sizeof(float) * dvs.size());
+
+		auto clInput = clHelper.makeBuffer(input);
+		auto clOutput = clHelper.makeBuffer(output.size());
+		auto clOutputError = clHelper.makeBuffer(outputError);
+		auto clInputError = clHelper.makeBuffer(inputError.size());
+		auto clParams = clHelper.makeBuffer(params);
+		auto clDvs = clHelper.makeBuffer(dvs);
+		layer.cl_initKernels(clHelper.getContext(), clHelper.getDevice());
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.input = input.data();
+		backProp.outputError = outputError.data();
+		backProp.params = params.data();
+		layer.forwardBatch(input.data(), params.data(), output.data(), batchSize);
+		layer.backPropagateBatch(backProp, inputError.data(), batchSize);
+		layer.calculateDerivativesBatch(backProp, dvs.data(), batchSize);
+
+		nn::layer::Layer::ClBackPropData clBackProp;
+		clBackProp.input = clInput;
+		clBackProp.outputError = clOutputError;
+		clBackProp.params = clParams;
+		layer.cl_forward(clHelper.getQueue(), clInput, clParams, clOutput, 0, 0, 0, batchSize);
+		layer.cl_backPropagate(clHelper.getQueue(), clBackProp, clInputError, 0, batchSize);
+		layer.cl_calculateDerivatives(clHelper.getQueue(), clBackProp, clDvs, 0, batchSize);
+
+		Assert::IsTrue(areWithinTolerance(output.data(), clHelper.getData(clOutput).data(), output.size(), 0.001));
+		Assert::IsTrue(areWithinTolerance(inputError.data(), clHelper.getData(clInputError).data(), inputError.size(), 0.001));
+		Assert::IsTrue(areWithinTolerance(dvs.data(), clHelper.getData(clDvs).data(), dvs.size(), 0.001));
+	}
+
+private:
+	::cl::Helper clHelper;
+};
+}
+}
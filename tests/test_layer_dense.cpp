@@ -105,6 +105,120 @@ public:
 		Assert::AreEqual(4.f, dw[3]);
 	}
 
+	TEST_METHOD(BatchTest)
+	{
+		auto input = nn::uniformRandomTensor(100, -5.f, 5.f).as<2>({ 5, 20 });
+		auto outputError = nn::uniformRandomTensor(50, -5.f, 5.f).as<2>({ 5, 10 });
+		auto layer = nn::layer::Dense(20, 10);
+		auto params = nn::uniformRandomTensor(layer.getParameterCount(), -5.f, 5.f);
+
+		// Reference results, one row at a time
+		auto output = Tensor<2>({ 5, 10 });
+		auto inputError = Tensor<2>({ 5, 20 });
+		auto dvs = Tensor<>(layer.getParameterCount());
+		std::memset(dvs.data(), 0, sizeof(float) * dvs.size());
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.params = params.data();
+
+		for (size_t i = 0; i < input.length(); i++)
+		{
+			layer.forward(input[i].data(), params.data(), output[i].data());
+			backProp.input = input[i].data();
+			backProp.outputError = outputError[i].data();
+			layer.backPropagate(backProp, inputError[i].data());
+			layer.calculateDerivatives(backProp, dvs.data());
+		}
+
+		auto batchOutput = Tensor<2>({ 5, 10 });
+		auto batchInputError = Tensor<2>({ 5, 20 });
+		auto batchDvs = Tensor<>(layer.getParameterCount());
+		std::memset(batchDvs.data(), 0, sizeof(float) * batchDvs.size());
+
+		backProp.input = input.data();
+		backProp.outputError = outputError.data();
+		layer.forwardBatch(input.data(), params.data(), batchOutput.data(), input.length());
+		layer.backPropagateBatch(backProp, batchInputError.data(), input.length());
+		layer.calculateDerivativesBatch(backProp, batchDvs.data(), input.length());
+
+		Assert::IsTrue(areWithinTolerance(output.data(), batchOutput.data(), output.size(), 0.0001));
+		Assert::IsTrue(areWithinTolerance(inputError.data(), batchInputError.data(), inputError.size(), 0.0001));
+		Assert::IsTrue(areWithinTolerance(dvs.data(), batchDvs.data(), dvs.size(), 0.0001));
+	}
+
+	TEST_METHOD(TransposedBackpropTest)
+	{
+		auto outputError = nn::uniformRandomTensor(70, -5.f, 5.f).as<2>({ 7, 10 });
+		auto layer = nn::layer::Dense(37, 10);
+		auto params = nn::uniformRandomTensor(layer.getParameterCount(), -5.f, 5.f);
+		auto cache = Tensor<>(layer.getParameterCacheSize());
+		Assert::AreEqual(size_t(37 * 10), cache.size());
+
+		layer.updateParameterCache(params.data(), cache.data());
+
+		for (size_t i = 0; i < 10; ++i)
+		{
+			for (size_t j = 0; j < 37; ++j)
+			{
+				Assert::AreEqual(layer.getWeights(params.data())[i * 37 + j], cache[j * 10 + i]);
+			}
+		}
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.params = params.data();
+		backProp.outputError = outputError.data();
+
+		auto expected = Tensor<2>({ 7, 37 });
+		layer.backPropagateBatch(backProp, expected.data(), 7);
+
+		auto result = Tensor<2>({ 7, 37 });
+		backProp.cache = cache.data();
+		layer.backPropagateBatch(backProp, result.data(), 7);
+
+		Assert::IsTrue(areWithinTolerance(expected.data(), result.data(), expected.size(), 0.0001));
+		Assert::AreEqual(size_t(0), nn::layer::Dense(37, 10, false).getParameterCacheSize());
+	}
+
+	TEST_METHOD(SparseInputTest)
+	{
+		// about 10% non-zero
+		auto input = nn::uniformRandomTensor(7 * 50, 0.f, 1.f).as<2>({ 7, 50 });
+		std::transform(input.data(), input.end(), input.data(), [](float x) { return x < 0.9f ? 0.f : x; });
+		auto outputError = nn::uniformRandomTensor(7 * 10, -5.f, 5.f).as<2>({ 7, 10 });
+
+		auto dense = nn::layer::Dense(50, 10, false);
+		auto sparse = nn::layer::Dense(50, 10, false);
+		sparse.setSparseInputThreshold(0.5f);
+		// The sparse path reads the weights in their own layout
+		Assert::AreEqual(size_t(0), sparse.getParameterCacheSize());
+
+		auto params = nn::uniformRandomTensor(dense.getParameterCount(), -5.f, 5.f);
+
+		auto expectedOutput = Tensor<2>({ 7, 10 });
+		auto output = Tensor<2>({ 7, 10 });
+		dense.forwardBatch(input.data(), params.data(), expectedOutput.data(), 7);
+		sparse.forwardBatch(input.data(), params.data(), output.data(), 7);
+		Assert::IsTrue(areWithinTolerance(expectedOutput.data(), output.data(), output.size(), 0.0001));
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.input = input.data();
+		backProp.outputError = outputError.data();
+
+		auto expectedDvs = Tensor<>(dense.getParameterCount());
+		auto dvs = Tensor<>(dense.getParameterCount());
+		std::memset(expectedDvs.data(), 0, sizeof(float) * expectedDvs.size());
+		std::memset(dvs.data(), 0, sizeof(float) * dvs.size());
+
+		// twice so the second pass relies on the scratch having been cleared
+		for (int i = 0; i < 2; ++i)
+		{
+			dense.calculateDerivativesBatch(backProp, expectedDvs.data(), 7);
+			sparse.calculateDerivativesBatch(backProp, dvs.data(), 7);
+		}
+
+		Assert::IsTrue(areWithinTolerance(expectedDvs.data(), dvs.data(), dvs.size(), 0.0001));
+	}
+
 	TEST_METHOD(cl_ForwardTest)
 	{
 		auto input = nn::uniformRandomTensor(100, -5.f, 5.f).as<2>({ 5, 20 });
@@ -125,6 +239,24 @@ public:
 		Assert::IsTrue(areWithinTolerance(target.data(), output.data(), target.size(), 0.0001));
 	}
 
+	// Several tiles in every direction, none of them full
+	TEST_METHOD(cl_TiledForwardTest)
+	{
+		const size_t batchSize = 70;
+		auto input = nn::uniformRandomTensor(batchSize * 37, -1.f, 1.f);
+		auto target = Tensor<>(batchSize * 45);
+		auto layer = nn::layer::Dense(37, 45);
+		auto params = nn::uniformRandomTensor(layer.getParameterCount(), -1.f, 1.f);
+		auto clInput = clHelper.makeBuffer(input);
+		auto clOutput = clHelper.makeBuffer(target.size());
+		auto clParams = clHelper.makeBuffer(params);
+		layer.cl_initKernels(clHelper.getContext(), clHelper.getDevice());
+
+		layer.forwardBatch(input.data(), params.data(), target.data(), batchSize);
+		layer.cl_forward(clHelper.getQueue(), clInput, clParams, clOutput, 0, 0, 0, batchSize);
+		Assert::IsTrue(areWithinTolerance(target.data(), clHelper.getData(clOutput).data(), target.size(), 0.001));
+	}
+
 	TEST_METHOD(cl_BackPropagateTest)
 	{
 		auto inputError = Tensor<2>({ 5, 20 });
@@ -157,6 +289,77 @@ public:
 		Assert::IsTrue(areWithinTolerance(result.data(), inputError.data(), result.size(), 0.0001));
 	}
 
+	TEST_METHOD(cl_TransposedBackPropagateTest)
+	{
+		auto inputError = Tensor<2>({ 5, 20 });
+		auto outputError = nn::uniformRandomTensor(50, -5.f, 5.f).as<2>({ 5, 10 });
+
+		auto layer = nn::layer::Dense(20, 10);
+		auto params = nn::uniformRandomTensor(layer.getParameterCount(), -5.f, 5.f);
+		auto cache = Tensor<>(layer.getParameterCacheSize());
+		layer.updateParameterCache(params.data(), cache.data());
+
+		auto clInputError = clHelper.makeBuffer(inputError.size());
+		auto clOutputError = clHelper.makeBuffer(outputError.flat());
+		auto clParams = clHelper.makeBuffer(params);
+		auto clCache = clHelper.makeBuffer(cache.size());
+		layer.cl_initKernels(clHelper.getContext(), clHelper.getDevice());
+		layer.cl_updateParameterCache(clHelper.getQueue(), clParams, clCache, 0, 0);
+
+		Assert::IsTrue(areWithinTolerance(cache.data(), clHelper.getData(clCache).data(), cache.size(), 0.0001));
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.params = params.data();
+		backProp.outputError = outputError.data();
+		layer.backPropagateBatch(backProp, inputError.data(), inputError.length());
+
+		nn::layer::Layer::ClBackPropData clBackProp;
+		clBackProp.outputError = clOutputError;
+		clBackProp.params = clParams;
+		clBackProp.cache = clCache;
+
+		layer.cl_backPropagate(clHelper.getQueue(), clBackProp, clInputError, 0, inputError.length());
+		auto result = clHelper.getData(clInputError);
+
+		Assert::IsTrue(areWithinTolerance(result.data(), inputError.data(), result.size(), 0.0001));
+	}
+
+	TEST_METHOD(cl_SparseInputTest)
+	{
+		auto input = nn::uniformRandomTensor(100, 0.f, 1.f).as<2>({ 5, 20 });
+		std::transform(input.data(), input.end(), input.data(), [](float x) { return x < 0.9f ? 0.f : x; });
+		auto outputError = nn::uniformRandomTensor(50, -5.f, 5.f).as<2>({ 5, 10 });
+		auto output = Tensor<2>({ 5, 10 });
+
+		auto layer = nn::layer::Dense(20, 10, false);
+		layer.setSparseInputThreshold(0.5f);
+		auto params = nn::uniformRandomTensor(layer.getParameterCount(), -5.f, 5.f);
+		auto dvs = Tensor<>(layer.getParameterCount());
+		std::memset(dvs.data(), 0, sizeof(float) * dvs.size());
+
+		auto clInput = clHelper.makeBuffer(input.flat());
+		auto clOutput = clHelper.makeBuffer(output.size());
+		auto clOutputError = clHelper.makeBuffer(outputError.flat());
+		auto clParams = clHelper.makeBuffer(params);
+		auto clDvs = clHelper.makeBuffer(dvs);
+		layer.cl_initKernels(clHelper.getContext(), clHelper.getDevice());
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.input = input.data();
+		backProp.outputError = outputError.data();
+		layer.forwardBatch(input.data(), params.data(), output.data(), input.length());
+		layer.calculateDerivativesBatch(backProp, dvs.data(), input.length());
+
+		nn::layer::Layer::ClBackPropData clBackProp;
+		clBackProp.input = clInput;
+		clBackProp.outputError = clOutputError;
+		layer.cl_forward(clHelper.getQueue(), clInput, clParams, clOutput, 0, 0, 0, input.length());
+		layer.cl_calculateDerivatives(clHelper.getQueue(), clBackProp, clDvs, 0, input.length());
+
+		Assert::IsTrue(areWithinTolerance(output.data(), clHelper.getData(clOutput).data(), output.size(), 0.0001));
+		Assert::IsTrue(areWithinTolerance(dvs.data(), clHelper.getData(clDvs).data(), dvs.size(), 0.0001));
+	}
+
 	TEST_METHOD(cl_DerivativesTest)
 	{
 		auto input = nn::uniformRandomTensor(100, -5.f, 5.f).as<2>({ 5, 20 });
@@ -188,6 +391,103 @@ public:
 		Assert::IsTrue(areWithinTolerance(result.data(), dvs.data(), result.size(), 0.0001));
 	}
 
+	// Several tiles in every direction, none of them full, with and without the transposed weights
+	TEST_METHOD(cl_TiledBackPropagateTest)
+	{
+		const size_t batchSize = 70;
+		auto input = nn::uniformRandomTensor(batchSize * 37, -1.f, 1.f);
+		auto outputError = nn::uniformRandomTensor(batchSize * 45, -1.f, 1.f);
+		auto layer = nn::layer::Dense(37, 45);
+		auto params = nn::uniformRandomTensor(layer.getParameterCount(), -1.f, 1.f);
+		auto cache = Tensor<>(layer.getParameterCacheSize());
+		auto inputError = Tensor<>(input.size());
+		auto dvs = Tensor<>(layer.getParameterCount());
+		std::memset(dvs.data(), 0, sizeof(float) * dvs.size());
+		layer.updateParameterCache(params.data(), cache.data());
+
+		auto clInput = clHelper.makeBuffer(input);
+		auto clOutputError = clHelper.makeBuffer(outputError);
+		auto clParams = clHelper.makeBuffer(params);
+		auto clCache = clHelper.makeBuffer(cache);
+		auto clInputError = clHelper.makeBuffer(inputError.size());
+		auto clTransposedInputError = clHelper.makeBuffer(inputError.size());
+		auto clDvs = clHelper.makeBuffer(dvs);
+		layer.cl_initKernels(clHelper.getContext(), clHelper.getDevice());
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.input = input.data();
+		backProp.outputError = outputError.data();
+		backProp.params = params.data();
+		layer.backPropagateBatch(backProp, inputError.data(), batchSize);
+		layer.calculateDerivativesBatch(backProp, dvs.data(), batchSize);
+
+		nn::layer::Layer::ClBackPropData clBackProp;
+		clBackProp.input = clInput;
+		clBackProp.outputError = clOutputError;
+		clBackProp.params = clParams;
+		layer.cl_calculateDerivatives(clHelper.getQueue(), clBackProp, clDvs, 0, batchSize);
+		layer.cl_backPropagate(clHelper.getQueue(), clBackProp, clInputError, 0, batchSize);
+		clBackProp.cache = clCache;
+		layer.cl_backPropagate(clHelper.getQueue(), clBackProp, clTransposedInputError, 0, batchSize);
+
+		Assert::IsTrue(areWithinTolerance(inputError.data(), clHelper.getData(clInputError).data(), inputError.size(), 0.001));
+		Assert::IsTrue(areWithinTolerance(inputError.data(), clHelper.getData(clTransposedInputError).data(), inputError.size(), 0.001));
+		Assert::IsTrue(areWithinTolerance(dvs.data(), clHelper.getData(clDvs).data(), dvs.size(), 0.001));
+	}
+
+	// The fused kernels must match a Dense layer followed by a Sigmoid layer
+	TEST_METHOD(cl_FusedActivationTest)
+	{
+		const size_t batchSize = 70;
+		auto input = nn::uniformRandomTensor(batchSize * 37, -1.f, 1.f);
+		auto outputError = nn::uniformRandomTensor(batchSize * 45, -1.f, 1.f);
+		auto layer = nn::layer::Dense(37, 45);
+		auto sigmoid = nn::layer::Sigmoid(45);
+		auto params = nn::uniformRandomTensor(layer.getParameterCount(), -1.f, 1.f);
+		auto preActivation = Tensor<>(outputError.size());
+		auto output = Tensor<>(outputError.size());
+		auto preActivationError = Tensor<>(outputError.size());
+		auto inputError = Tensor<>(input.size());
+		auto dvs = Tensor<>(layer.getParameterCount());
+		std::memset(dvs.data(), 0, sizeof(float) * dvs.size());
+
+		auto clInput = clHelper.makeBuffer(input);
+		auto clOutput = clHelper.makeBuffer(output.size());
+		auto clOutputError = clHelper.makeBuffer(outputError);
+		auto clParams = clHelper.makeBuffer(params);
+		auto clInputError = clHelper.makeBuffer(inputError.size());
+		auto clDvs = clHelper.makeBuffer(dvs);
+		Assert::IsTrue(layer.cl_fuseActivation(sigmoid));
+		layer.cl_initKernels(clHelper.getContext(), clHelper.getDevice());
+
+		layer.forwardBatch(input.data(), params.data(), preActivation.data(), batchSize);
+		sigmoid.forwardBatch(preActivation.data(), nullptr, output.data(), batchSize);
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.input = preActivation.data();
+		backProp.outputError = outputError.data();
+		sigmoid.backPropagateBatch(backProp, preActivationError.data(), batchSize);
+		backProp.input = input.data();
+		backProp.outputError = preActivationError.data();
+		backProp.params = params.data();
+		layer.backPropagateBatch(backProp, inputError.data(), batchSize);
+		layer.calculateDerivativesBatch(backProp, dvs.data(), batchSize);
+
+		layer.cl_forward(clHelper.getQueue(), clInput, clParams, clOutput, 0, 0, 0, batchSize);
+
+		nn::layer::Layer::ClBackPropData clBackProp;
+		clBackProp.input = clInput;
+		clBackProp.output = clOutput;
+		clBackProp.outputError = clOutputError;
+		clBackProp.params = clParams;
+		layer.cl_calculateDerivatives(clHelper.getQueue(), clBackProp, clDvs, 0, batchSize);
+		layer.cl_backPropagate(clHelper.getQueue(), clBackProp, clInputError, 0, batchSize);
+
+		Assert::IsTrue(areWithinTolerance(output.data(), clHelper.getData(clOutput).data(), output.size(), 0.001));
+		Assert::IsTrue(areWithinTolerance(inputError.data(), clHelper.getData(clInputError).data(), inputError.size(), 0.001));
+		Assert::IsTrue(areWithinTolerance(dvs.data(), clHelper.getData(clDvs).data(), dvs.size(), 0.001));
+	}
+
 	TEST_METHOD(cl_InitTest)
 	{
 		auto layer = nn::layer::Dense(5, 8);
@@ -0,0 +1,155 @@
+#include "pch.h"
+#include "..\src\layers\depthwise_conv2d.hpp"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace nn;
+using namespace std;
+
+namespace test
+{
+namespace layer
+{
+TEST_CLASS(DepthwiseConv2d)
+{
+public:
+
+	// 3 channels of 7x6 with 3x2 filters
+	static const size_t channels = 3, height = 7, width = 6, fh = 3, fw = 2;
+
+	static nn::layer::DepthwiseConv2d makeLayer(size_t sy, size_t sx)
+	{
+		return nn::layer::DepthwiseConv2d(Shape<3>({ channels, height, width }), Shape<2>({ fh, fw }), Shape<2>({ sy, sx }));
+	}
+
+	TEST_METHOD(ConstructTest)
+	{
+		auto layer = makeLayer(2, 1);
+		Assert::AreEqual(size_t(3 * 7 * 6), layer.getInputSize());
+		Assert::AreEqual(size_t(3 * 3 * 5), layer.getOutputSize());
+		Assert::AreEqual(size_t(3 * (3 * 2 + 1)), layer.getParameterCount());
+		Assert::IsTrue(layer.getOutputShape() == Shape<3>({ 3, 3, 5 }));
+	}
+
+	// Direct convolution, with the SIMD row path (step x of 1) and without it
+	void PassesTest(size_t sy, size_t sx)
+	{
+		const size_t batchSize = 3;
+		auto layer = makeLayer(sy, sx);
+		const size_t outHeight = layer.getOutputShape().length(1), outWidth = layer.getOutputShape().length(2);
+		auto input = nn::uniformRandomTensor(batchSize * layer.getInputSize(), -1.f, 1.f);
+		auto outputError = nn::uniformRandomTensor(batchSize * layer.getOutputSize(), -1.f, 1.f);
+		auto params = nn::uniformRandomTensor(layer.getParameterCount(), -1.f, 1.f);
+
+		auto expectedOutput = Tensor<>(outputError.size());
+		auto expectedInputError = Tensor<>(input.size());
+		auto expectedDvs = Tensor<>(layer.getParameterCount());
+		std::memset(expectedInputError.data(), 0, sizeof(float) * expectedInputError.size());
+		std::memset(expectedDvs.data(), 0, sizeof(float) * expectedDvs.size());
+
+		for (size_t n = 0; n < batchSize; ++n)
+		{
+			for (size_t c = 0; c < channels; ++c)
+			{
+				const size_t map = n * channels + c;
+				const float* filter = params.data() + channels + c * fh * fw;
+
+				for (size_t y = 0; y < outHeight; ++y)
+				{
+					for (size_t x = 0; x < outWidth; ++x)
+					{
+						const size_t o = (map * outHeight + y) * outWidth + x;
+						float sum = params[c];
+						expectedDvs[c] += outputError[o];
+
+						for (size_t i = 0; i < fh; ++i)
+						{
+							for (size_t j = 0; j < fw; ++j)
+							{
+								const size_t in = (map * height + y * sy + i) * width + x * sx + j;
+								sum += filter[i * fw + j] * input[in];
+								expectedInputError[in] += outputError[o] * filter[i * fw + j];
+								expectedDvs[channels + (c * fh + i) * fw + j] += outputError[o] * input[in];
+							}
+						}
+
+						expectedOutput[o] = sum;
+					}
+				}
+			}
+		}
+
+		auto output = Tensor<>(expectedOutput.size());
+		auto inputError = Tensor<>(input.size());
+		auto dvs = Tensor<>(layer.getParameterCount());
+		std::memset(dvs.data(), 0, sizeof(float) * dvs.size());
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.input = input.data();
+		backProp.outputError = outputError.data();
+		backProp.params = params.data();
+
+		layer.forwardBatch(input.data(), params.data(), output.data(), batchSize);
+		layer.backPropagateBatch(backProp, inputError.data(), batchSize);
+		layer.calculateDerivativesBatch(backProp, dvs.data(), batchSize);
+
+		Assert::IsTrue(areWithinTolerance(expectedOutput.data(), output.data(), output.size(), 0.001));
+		Assert::IsTrue(areWithinTolerance(expectedInputError.data(), inputError.data(), inputError.size(), 0.001));
+		Assert::IsTrue(areWithinTolerance(expectedDvs.data(), dvs.data(), dvs.size(), 0.001));
+	}
+
+	TEST_METHOD(PassesTest)
+	{
+		PassesTest(2, 1);
+	}
+
+	TEST_METHOD(StepTest)
+	{
+		PassesTest(1, 2);
+	}
+
+	TEST_METHOD(cl_PassesTest)
+	{
+		const size_t batchSize = 3;
+		auto layer = makeLayer(2, 2);
+		auto input = nn::uniformRandomTensor(batchSize * layer.getInputSize(), -1.f, 1.f);
+		auto outputError = nn::uniformRandomTensor(batchSize * layer.getOutputSize(), -1.f, 1.f);
+		auto params = nn::uniformRandomTensor(layer.getParameterCount(), -1.f, 1.f);
+		auto output = Tensor<>(outputError.size());
+		auto inputError = Tensor<>(input.size());
+		auto dvs = Tensor<>(layer.getParameterCount());
+		std::memset(dvs.data(), 0, sizeof(float) * dvs.size());
+
+		auto clInput = clHelper.makeBuffer(input);
+		auto clOutput = clHelper.makeBuffer(output.size());
+		auto clOutputError = clHelper.makeBuffer(outputError);
+		auto clInputError = clHelper.makeBuffer(inputError.size());
+		auto clParams = clHelper.makeBuffer(params);
+		auto clDvs = clHelper.makeBuffer(dvs);
+		layer.cl_initKernels(clHelper.getContext(), clHelper.getDevice());
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.input = input.data();
+		backProp.outputError = outputError.data();
+		backProp.params = params.data();
+		layer.forwardBatch(input.data(), params.data(), output.data(), batchSize);
+		layer.backPropagateBatch(backProp, inputError.data(), batchSize);
+		layer.calculateDerivativesBatch(backProp, dvs.data(), batchSize);
+
+		nn::layer::Layer::ClBackPropData clBackProp;
+		clBackProp.input = clInput;
+		clBackProp.outputError = clOutputError;
+		clBackProp.params = clParams;
+		layer.cl_forward(clHelper.getQueue(), clInput, clParams, clOutput, 0, 0, 0, batchSize);
+		layer.cl_backPropagate(clHelper.getQueue(), clBackProp, clInputError, 0, batchSize);
+		layer.cl_calculateDerivatives(clHelper.getQueue(), clBackProp, clDvs, 0, batchSize);
+
+		Assert::IsTrue(areWithinTolerance(output.data(), clHelper.getData(clOutput).data(), output.size(), 0.001));
+		Assert::IsTrue(areWithinTolerance(inputError.data(), clHelper.getData(clInputError).data(), inputError.size(), 0.001));
+		Assert::IsTrue(areWithinTolerance(dvs.data(), clHelper.getData(clDvs).data(), dvs.size(), 0.001));
+	}
+
+private:
+	::cl::Helper clHelper;
+};
+}
+}
@@ -0,0 +1,157 @@
+#include "pch.h"
+#include "..\src\layers\dropout.hpp"
+#include "..\utils\utils.hpp"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace nn;
+using namespace std;
+
+namespace test
+{
+namespace layer
+{
+TEST_CLASS(Dropout)
+{
+public:
+	TEST_METHOD(InvalidArgs)
+	{
+		auto invalidSize = []
+		{
+			auto layer = nn::layer::Dropout(0, 0.5f);
+		};
+		auto invalidRate = []
+		{
+			auto layer = nn::layer::Dropout(10, 1.f);
+		};
+		Assert::ExpectException<std::invalid_argument>(invalidSize);
+		Assert::ExpectException<std::invalid_argument>(invalidRate);
+	}
+
+	// Known answers from the Random123 distribution
+	TEST_METHOD(PhiloxTest)
+	{
+		auto zeros = math::philox4x32({ { 0, 0, 0, 0 } }, 0, 0);
+		auto pi = math::philox4x32({ { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 } }, 0xa4093822, 0x299f31d0);
+
+		Assert::AreEqual(0x6627e8d5u, zeros.v[0]);
+		Assert::AreEqual(0xe169c58du, zeros.v[1]);
+		Assert::AreEqual(0xbc57ac4cu, zeros.v[2]);
+		Assert::AreEqual(0x9b00dbd8u, zeros.v[3]);
+		Assert::AreEqual(0xd16cfe09u, pi.v[0]);
+		Assert::AreEqual(0x94fdccebu, pi.v[1]);
+		Assert::AreEqual(0x5001e420u, pi.v[2]);
+		Assert::AreEqual(0x24126ea1u, pi.v[3]);
+	}
+
+	TEST_METHOD(ForwardTest)
+	{
+		auto layer = nn::layer::Dropout(1000, 0.25f);
+		const size_t batchSize = 3;
+		auto input = nn::uniformRandomTensor(batchSize * 1000, 1.f, 2.f);
+		auto output = Tensor<>(input.size());
+		auto nextOutput = Tensor<>(input.size());
+		uint32_t state[batchSize];
+
+		layer.forwardBatch(input.data(), nullptr, output.data(), batchSize);
+		Assert::IsTrue(input == output);
+
+		layer.forwardTrainingBatch(input.data(), nullptr, output.data(), reinterpret_cast<float*>(state), batchSize);
+		Assert::AreEqual(0u, state[0]);
+
+		// About rate of the inputs are dropped, the rest are scaled up
+		size_t dropped = 0;
+
+		for (size_t i = 0; i < input.size(); ++i)
+		{
+			if (output[i] == 0.f)
+			{
+				++dropped;
+			}
+			else
+			{
+				Assert::AreEqual(input[i] / 0.75f, output[i], 1e-6f);
+			}
+		}
+
+		Assert::AreEqual(0.25, double(dropped) / input.size(), 0.03);
+
+		// Each batch gets a new mask
+		layer.forwardTrainingBatch(input.data(), nullptr, nextOutput.data(), reinterpret_cast<float*>(state), batchSize);
+		Assert::AreEqual(1u, state[0]);
+		Assert::IsFalse(output == nextOutput);
+	}
+
+	TEST_METHOD(BackpropTest)
+	{
+		auto layer = nn::layer::Dropout(100, 0.5f, 7);
+		const size_t batchSize = 3;
+		auto input = nn::uniformRandomTensor(batchSize * 100, 1.f, 2.f);
+		auto outputError = nn::uniformRandomTensor(input.size(), 1.f, 2.f);
+		auto output = Tensor<>(input.size());
+		auto inputError = Tensor<>(input.size());
+		uint32_t state[batchSize];
+
+		layer.forwardTrainingBatch(input.data(), nullptr, output.data(), reinterpret_cast<float*>(state), batchSize);
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.outputError = outputError.data();
+		backProp.state = reinterpret_cast<float*>(state);
+		layer.backPropagateBatch(backProp, inputError.data(), batchSize);
+
+		// Errors only pass through the inputs that were kept, with the same scale
+		for (size_t i = 0; i < input.size(); ++i)
+		{
+			Assert::AreEqual(output[i] == 0.f, inputError[i] == 0.f);
+			Assert::AreEqual(output[i] / input[i], inputError[i] / outputError[i], 1e-6f);
+		}
+
+		// In place gives the same result
+		Assert::IsTrue(layer.canRunInPlace());
+		layer.backPropagateBatch(backProp, outputError.data(), batchSize);
+		Assert::IsTrue(inputError == outputError);
+	}
+
+	TEST_METHOD(cl_PassesTest)
+	{
+		// Two layers with the same seed are at the same step
+		auto layer = nn::layer::Dropout(300, 0.3f, 12345);
+		auto clLayer = nn::layer::Dropout(300, 0.3f, 12345);
+		const uint32_t batchSize = 5;
+		auto input = nn::uniformRandomTensor(batchSize * layer.getInputSize(), -1.f, 1.f);
+		auto outputError = nn::uniformRandomTensor(input.size(), -1.f, 1.f);
+		auto output = Tensor<>(input.size());
+		auto inputError = Tensor<>(input.size());
+		auto state = Tensor<>(batchSize * layer.getTrainingStateSize());
+
+		auto clInput = clHelper.makeBuffer(input);
+		auto clOutput = clHelper.makeBuffer(output.size());
+		auto clTrainingOutput = clHelper.makeBuffer(output.size());
+		auto clState = clHelper.makeBuffer(state.size());
+		auto clOutputError = clHelper.makeBuffer(outputError);
+		auto clInputError = clHelper.makeBuffer(inputError.size());
+		clLayer.cl_initKernels(clHelper.getContext(), clHelper.getDevice());
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.outputError = outputError.data();
+		backProp.state = state.data();
+		layer.forwardTrainingBatch(input.data(), nullptr, output.data(), state.data(), batchSize);
+		layer.backPropagateBatch(backProp, inputError.data(), batchSize);
+
+		nn::layer::Layer::ClBackPropData clBackProp;
+		clBackProp.outputError = clOutputError;
+		clBackProp.state = clState;
+		clLayer.cl_forward(clHelper.getQueue(), clInput, NULL, clOutput, 0, 0, 0, batchSize);
+		clLayer.cl_forwardTraining(clHelper.getQueue(), clInput, NULL, clTrainingOutput, clState, 0, 0, 0, batchSize);
+		clLayer.cl_backPropagate(clHelper.getQueue(), clBackProp, clInputError, 0, batchSize);
+
+		// Identical masks, so the outputs match exactly
+		Assert::IsTrue(input == clHelper.getData(clOutput));
+		Assert::IsTrue(output == clHelper.getData(clTrainingOutput));
+		Assert::IsTrue(inputError == clHelper.getData(clInputError));
+	}
+
+private:
+	::cl::Helper clHelper;
+};
+}
+}
@@ -0,0 +1,230 @@
+#include "pch.h"
+#include "..\src\layers\lstm.hpp"
+#include <cmath>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace nn;
+using namespace std;
+
+namespace test
+{
+namespace layer
+{
+TEST_CLASS(Lstm)
+{
+public:
+
+	static const size_t timeSteps = 4, features = 3, hidden = 5;
+
+	// One sample, one step at a time with the gates written out
+	static void reference(const float* input, const float* params, float* output, bool returnSequence)
+	{
+		const size_t width = features + hidden;
+		const float* bias = params;
+		const float* weight = params + 4 * hidden;
+		float h[hidden] = {}, c[hidden] = {}, gate[4 * hidden];
+		auto sigmoid = [](float x) { return 1.f / (1.f + exp(-x)); };
+
+		for (size_t t = 0; t < timeSteps; ++t)
+		{
+			for (size_t j = 0; j < 4 * hidden; ++j)
+			{
+				float sum = bias[j];
+
+				for (size_t k = 0; k < features; ++k)
+				{
+					sum += weight[j * width + k] * input[t * features + k];
+				}
+
+				for (size_t k = 0; k < hidden; ++k)
+				{
+					sum += weight[j * width + features + k] * h[k];
+				}
+
+				gate[j] = sum;
+			}
+
+			for (size_t u = 0; u < hidden; ++u)
+			{
+				c[u] = sigmoid(gate[hidden + u]) * c[u] + sigmoid(gate[u]) * tanh(gate[3 * hidden + u]);
+				h[u] = sigmoid(gate[2 * hidden + u]) * tanh(c[u]);
+			}
+
+			if (returnSequence || t + 1 == timeSteps)
+			{
+				std::copy(h, h + hidden, output + (returnSequence ? t * hidden : 0));
+			}
+		}
+	}
+
+	TEST_METHOD(ConstructTest)
+	{
+		auto layer = nn::layer::Lstm(timeSteps, features, hidden);
+		Assert::AreEqual(timeSteps * features, layer.getInputSize());
+		Assert::AreEqual(hidden, layer.getOutputSize());
+		Assert::AreEqual(4 * hidden * (features + hidden + 1), layer.getParameterCount());
+		Assert::AreEqual(timeSteps * hidden, nn::layer::Lstm(timeSteps, features, hidden, true).getOutputSize());
+	}
+
+	TEST_METHOD(InvalidArgs)
+	{
+		auto noSteps = []
+		{
+			auto layer = nn::layer::Lstm(0, features, hidden);
+		};
+		Assert::ExpectException<std::invalid_argument>(noSteps);
+	}
+
+	void ForwardTest(bool returnSequence)
+	{
+		const size_t batchSize = 3;
+		auto layer = nn::layer::Lstm(timeSteps, features, hidden, returnSequence);
+		auto input = nn::uniformRandomTensor(batchSize * layer.getInputSize(), -1.f, 1.f);
+		auto params = nn::uniformRandomTensor(layer.getParameterCount(), -1.f, 1.f);
+		auto expected = Tensor<>(batchSize * layer.getOutputSize());
+		auto output = Tensor<>(expected.size());
+		auto trainingOutput = Tensor<>(expected.size());
+		auto state = Tensor<>(batchSize * layer.getTrainingStateSize());
+
+		for (size_t n = 0; n < batchSize; ++n)
+		{
+			reference(input.data() + n * layer.getInputSize(), params.data(), expected.data() + n * layer.getOutputSize(), returnSequence);
+		}
+
+		layer.forwardBatch(input.data(), params.data(), output.data(), batchSize);
+		layer.forwardTrainingBatch(input.data(), params.data(), trainingOutput.data(), state.data(), batchSize);
+
+		Assert::IsTrue(areWithinTolerance(expected.data(), output.data(), output.size(), 0.0001));
+		Assert::IsTrue(areWithinTolerance(expected.data(), trainingOutput.data(), output.size(), 0.0001));
+	}
+
+	TEST_METHOD(ForwardTest)
+	{
+		ForwardTest(false);
+	}
+
+	TEST_METHOD(ForwardSequenceTest)
+	{
+		ForwardTest(true);
+	}
+
+	void BackpropTest(bool returnSequence)
+	{
+		auto layer = nn::layer::Lstm(timeSteps, features, hidden, returnSequence);
+		const size_t batchSize = 2;
+		auto input = nn::uniformRandomTensor(batchSize * layer.getInputSize(), -1.f, 1.f);
+		auto outputError = nn::uniformRandomTensor(batchSize * layer.getOutputSize(), -1.f, 1.f);
+		auto params = nn::uniformRandomTensor(layer.getParameterCount(), -1.f, 1.f);
+		auto output = Tensor<>(outputError.size());
+		auto state = Tensor<>(batchSize * layer.getTrainingStateSize());
+		auto inputError = Tensor<>(input.size());
+		auto derivatives = Tensor<>(params.size());
+		std::fill(derivatives.data(), derivatives.end(), 0.f);
+
+		auto loss = [&]()
+		{
+			double sum = 0.0;
+			layer.forwardTrainingBatch(input.data(), params.data(), output.data(), state.data(), batchSize);
+
+			for (size_t i = 0; i < output.size(); ++i)
+			{
+				sum += output[i] * outputError[i];
+			}
+
+			return sum;
+		};
+
+		auto gradient = [&](float& x)
+		{
+			const float h = 1e-2f;
+			const float original = x;
+			x = original + h;
+			const double plus = loss();
+			x = original - h;
+			const double minus = loss();
+			x = original;
+			return float((plus - minus) / (2 * h));
+		};
+
+		loss();
+		nn::layer::Layer::BackPropData backProp;
+		backProp.params = params.data();
+		backProp.outputError = outputError.data();
+		backProp.state = state.data();
+		layer.calculateDerivativesBatch(backProp, derivatives.data(), batchSize);
+		layer.backPropagateBatch(backProp, inputError.data(), batchSize);
+
+		for (size_t i = 0; i < input.size(); ++i)
+		{
+			Assert::AreEqual(gradient(input[i]), inputError[i], 1e-2f);
+		}
+
+		for (size_t i = 0; i < params.size(); ++i)
+		{
+			Assert::AreEqual(gradient(params[i]), derivatives[i], 1e-2f);
+		}
+	}
+
+	TEST_METHOD(BackpropTest)
+	{
+		BackpropTest(false);
+	}
+
+	TEST_METHOD(BackpropSequenceTest)
+	{
+		BackpropTest(true);
+	}
+
+	TEST_METHOD(cl_PassesTest)
+	{
+		const size_t batchSize = 3;
+		auto layer = nn::layer::Lstm(timeSteps, features, hidden, true);
+		auto input = nn::uniformRandomTensor(batchSize * layer.getInputSize(), -1.f, 1.f);
+		auto outputError = nn::uniformRandomTensor(batchSize * layer.getOutputSize(), -1.f, 1.f);
+		auto params = nn::uniformRandomTensor(layer.getParameterCount(), -1.f, 1.f);
+		auto output = Tensor<>(outputError.size());
+		auto state = Tensor<>(batchSize * layer.getTrainingStateSize());
+		auto inputError = Tensor<>(input.size());
+		auto dvs = Tensor<>(layer.getParameterCount());
+		std::memset(dvs.data(), 0, sizeof(float) * dvs.size());
+
+		auto clInput = clHelper.makeBuffer(input);
+		auto clOutput = clHelper.makeBuffer(output.size());
+		auto clInferenceOutput = clHelper.makeBuffer(output.size());
+		auto clState = clHelper.makeBuffer(state.size());
+		auto clOutputError = clHelper.makeBuffer(outputError);
+		auto clInputError = clHelper.makeBuffer(inputError.size());
+		auto clParams = clHelper.makeBuffer(params);
+		auto clDvs = clHelper.makeBuffer(dvs);
+		layer.cl_initKernels(clHelper.getContext(), clHelper.getDevice());
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.input = input.data();
+		backProp.outputError = outputError.data();
+		backProp.params = params.data();
+		backProp.state = state.data();
+		layer.forwardTrainingBatch(input.data(), params.data(), output.data(), state.data(), batchSize);
+		layer.calculateDerivativesBatch(backProp, dvs.data(), batchSize);
+		layer.backPropagateBatch(backProp, inputError.data(), batchSize);
+
+		nn::layer::Layer::ClBackPropData clBackProp;
+		clBackProp.input = clInput;
+		clBackProp.outputError = clOutputError;
+		clBackProp.params = clParams;
+		clBackProp.state = clState;
+		layer.cl_forward(clHelper.getQueue(), clInput, clParams, clInferenceOutput, 0, 0, 0, batchSize);
+		layer.cl_forwardTraining(clHelper.getQueue(), clInput, clParams, clOutput, clState, 0, 0, 0, batchSize);
+		layer.cl_calculateDerivatives(clHelper.getQueue(), clBackProp, clDvs, 0, batchSize);
+		layer.cl_backPropagate(clHelper.getQueue(), clBackProp, clInputError, 0, batchSize);
+
+		Assert::IsTrue(areWithinTolerance(output.data(), clHelper.getData(clInferenceOutput).data(), output.size(), 0.001));
+		Assert::IsTrue(areWithinTolerance(output.data(), clHelper.getData(clOutput).data(), output.size(), 0.001));
+		Assert::IsTrue(areWithinTolerance(inputError.data(), clHelper.getData(clInputError).data(), inputError.size(), 0.001));
+		Assert::IsTrue(areWithinTolerance(dvs.data(), clHelper.getData(clDvs).data(), dvs.size(), 0.001));
+	}
+
+private:
+	::cl::Helper clHelper;
+};
+}
+}
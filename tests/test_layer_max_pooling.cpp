@@ -0,0 +1,130 @@
+#include "pch.h"
+#include "..\src\layers\max_pooling.hpp"
+#include "..\utils\utils.hpp"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace nn;
+using namespace std;
+
+namespace test
+{
+namespace layer
+{
+TEST_CLASS(MaxPooling)
+{
+public:
+
+	TEST_METHOD(ConstructTest)
+	{
+		auto layer = nn::layer::MaxPooling(Shape<3>({ 2, 5, 7 }), Dim2{ 3, 2 });
+		Assert::AreEqual(size_t(2 * 5 * 7), layer.getInputSize());
+		Assert::AreEqual(size_t(2 * 2 * 2), layer.getOutputSize());
+		Assert::AreEqual(size_t(0), layer.getParameterCount());
+		Assert::AreEqual(layer.getOutputSize(), layer.getTrainingStateSize());
+		Assert::IsTrue(layer.getOutputShape() == Shape<3>({ 2, 2, 2 }));
+	}
+
+	TEST_METHOD(ForwardTest)
+	{
+		// 1 channel of 3 x 4, the last row is dropped
+		Tensor<> input = {
+			1.f, 5.f, -2.f, 0.f,
+			3.f, 2.f, -1.f, -3.f,
+			9.f, 9.f, 9.f, 9.f };
+		auto layer = nn::layer::MaxPooling(Shape<3>({ 1, 3, 4 }), Dim2{ 2, 2 });
+		Tensor<> output(2);
+		Tensor<> trainingOutput(2);
+		Tensor<1, uint32_t> indices(2);
+
+		layer.forward(input.data(), nullptr, output.data());
+		layer.forwardTrainingBatch(input.data(), nullptr, trainingOutput.data(), reinterpret_cast<float*>(indices.data()), 1);
+
+		Assert::AreEqual(5.f, output[0]);
+		Assert::AreEqual(0.f, output[1]);
+		Assert::IsTrue(output == trainingOutput);
+		Assert::AreEqual(1u, indices[0]);
+		Assert::AreEqual(3u, indices[1]);
+	}
+
+	TEST_METHOD(BackpropTest)
+	{
+		auto layer = nn::layer::MaxPooling(Shape<3>({ 3, 6, 5 }), Dim2{ 2, 3 });
+		const size_t batchSize = 4;
+		auto input = nn::uniformRandomTensor(batchSize * layer.getInputSize(), -1.f, 1.f);
+		auto outputError = nn::uniformRandomTensor(batchSize * layer.getOutputSize(), -1.f, 1.f);
+		auto output = Tensor<>(outputError.size());
+		auto state = Tensor<>(batchSize * layer.getTrainingStateSize());
+		auto inputError = Tensor<>(input.size());
+
+		layer.forwardTrainingBatch(input.data(), nullptr, output.data(), state.data(), batchSize);
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.input = input.data();
+		backProp.outputError = outputError.data();
+		backProp.state = state.data();
+		layer.backPropagateBatch(backProp, inputError.data(), batchSize);
+
+		// Each output error lands on the input equal to its output, everything else is 0
+		size_t nonZero = 0;
+
+		for (size_t n = 0; n < batchSize; ++n)
+		{
+			for (size_t i = 0; i < layer.getInputSize(); ++i)
+			{
+				const float error = inputError[n * layer.getInputSize() + i];
+
+				if (error != 0.f)
+				{
+					const float* errors = outputError.data() + n * layer.getOutputSize();
+					const float* outputs = output.data() + n * layer.getOutputSize();
+					const size_t o = std::find(errors, errors + layer.getOutputSize(), error) - errors;
+					Assert::AreEqual(outputs[o], input[n * layer.getInputSize() + i]);
+					++nonZero;
+				}
+			}
+		}
+
+		Assert::AreEqual(outputError.size(), nonZero);
+	}
+
+	TEST_METHOD(cl_PassesTest)
+	{
+		auto layer = nn::layer::MaxPooling(Shape<3>({ 3, 6, 5 }), Dim2{ 2, 3 });
+		const uint32_t batchSize = 4;
+		auto input = nn::uniformRandomTensor(batchSize * layer.getInputSize(), -1.f, 1.f);
+		auto outputError = nn::uniformRandomTensor(batchSize * layer.getOutputSize(), -1.f, 1.f);
+		auto output = Tensor<>(outputError.size());
+		auto state = Tensor<>(batchSize * layer.getTrainingStateSize());
+		auto inputError = Tensor<>(input.size());
+
+		auto clInput = clHelper.makeBuffer(input);
+		auto clOutput = clHelper.makeBuffer(output.size());
+		auto clTrainingOutput = clHelper.makeBuffer(output.size());
+		auto clState = clHelper.makeBuffer(state.size());
+		auto clOutputError = clHelper.makeBuffer(outputError);
+		auto clInputError = clHelper.makeBuffer(inputError.size());
+		layer.cl_initKernels(clHelper.getContext(), clHelper.getDevice());
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.outputError = outputError.data();
+		backProp.state = state.data();
+		layer.forwardTrainingBatch(input.data(), nullptr, output.data(), state.data(), batchSize);
+		layer.backPropagateBatch(backProp, inputError.data(), batchSize);
+
+		nn::layer::Layer::ClBackPropData clBackProp;
+		clBackProp.outputError = clOutputError;
+		clBackProp.state = clState;
+		layer.cl_forward(clHelper.getQueue(), clInput, NULL, clOutput, 0, 0, 0, batchSize);
+		layer.cl_forwardTraining(clHelper.getQueue(), clInput, NULL, clTrainingOutput, clState, 0, 0, 0, batchSize);
+		layer.cl_backPropagate(clHelper.getQueue(), clBackProp, clInputError, 0, batchSize);
+
+		Assert::IsTrue(areWithinTolerance(output.data(), clHelper.getData(clOutput).data(), output.size(), 0.0001));
+		Assert::IsTrue(areWithinTolerance(output.data(), clHelper.getData(clTrainingOutput).data(), output.size(), 0.0001));
+		Assert::IsTrue(areWithinTolerance(inputError.data(), clHelper.getData(clInputError).data(), inputError.size(), 0.0001));
+	}
+
+private:
+	::cl::Helper clHelper;
+};
+}
+}
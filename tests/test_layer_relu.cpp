@@ -0,0 +1,121 @@
+#include "pch.h"
+#include "..\src\layers\relu.hpp"
+#include "..\utils\utils.hpp"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace nn;
+using namespace std;
+
+namespace test
+{
+namespace layer
+{
+TEST_CLASS(Relu)
+{
+public:
+	TEST_METHOD(InvalidArgs)
+	{
+		auto invalidSize = []
+		{
+			auto layer = nn::layer::Relu(0);
+		};
+		auto invalidAlpha = []
+		{
+			auto layer = nn::layer::Relu(10, -0.1f);
+		};
+		Assert::ExpectException<std::invalid_argument>(invalidSize);
+		Assert::ExpectException<std::invalid_argument>(invalidAlpha);
+	}
+
+	TEST_METHOD(ForwardTest)
+	{
+		Tensor<> input = { 0.0f, -1.0f, 2.0f };
+		Tensor<> output(input.size());
+		Tensor<> leakyOutput(input.size());
+		nn::layer::Relu(input.size()).forward(input.data(), nullptr, output.data());
+		nn::layer::Relu(input.size(), 0.1f).forward(input.data(), nullptr, leakyOutput.data());
+
+		Assert::IsTrue(output == Tensor<>({ 0.0f, 0.0f, 2.0f }));
+		Assert::IsTrue(leakyOutput == Tensor<>({ 0.0f, -0.1f, 2.0f }));
+	}
+
+	TEST_METHOD(InPlaceTest)
+	{
+		auto layer = nn::layer::Relu(100, 0.1f);
+		const size_t batchSize = 3;
+		auto input = nn::uniformRandomTensor(batchSize * 100, -1.f, 1.f);
+		auto outputError = nn::uniformRandomTensor(input.size(), -1.f, 1.f);
+		auto output = Tensor<>(input.size());
+		auto inputError = Tensor<>(input.size());
+
+		layer.forwardBatch(input.data(), nullptr, output.data(), batchSize);
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.output = output.data();
+		backProp.outputError = outputError.data();
+		layer.backPropagateBatch(backProp, inputError.data(), batchSize);
+
+		// Same results with the output written over the input and the input error over the output error
+		Assert::IsTrue(layer.canRunInPlace());
+		layer.forwardBatch(input.data(), nullptr, input.data(), batchSize);
+		backProp.output = input.data();
+		layer.backPropagateBatch(backProp, outputError.data(), batchSize);
+
+		Assert::IsTrue(output == input);
+		Assert::IsTrue(inputError == outputError);
+	}
+
+	TEST_METHOD(BackpropTest)
+	{
+		Tensor<> input = { 0.5f, -1.0f, 2.0f };
+		Tensor<> output(input.size());
+		Tensor<> outputError = { 1.0f, 2.0f, 3.0f };
+		Tensor<> inputError(input.size());
+		auto layer = nn::layer::Relu(input.size(), 0.1f);
+		layer.forward(input.data(), nullptr, output.data());
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.output = output.data();
+		backProp.outputError = outputError.data();
+		layer.backPropagate(backProp, inputError.data());
+
+		Assert::AreEqual(1.0f, inputError[0]);
+		Assert::AreEqual(0.2f, inputError[1], 0.000001f);
+		Assert::AreEqual(3.0f, inputError[2]);
+	}
+
+	TEST_METHOD(cl_PassesTest)
+	{
+		auto layer = nn::layer::Relu(100, 0.1f);
+		const uint32_t batchSize = 5;
+		auto input = nn::uniformRandomTensor(batchSize * 100, -5.f, 5.f);
+		auto outputError = nn::uniformRandomTensor(input.size(), -5.f, 5.f);
+		auto output = Tensor<>(input.size());
+		auto inputError = Tensor<>(input.size());
+
+		layer.forwardBatch(input.data(), nullptr, output.data(), batchSize);
+		nn::layer::Layer::BackPropData backProp;
+		backProp.output = output.data();
+		backProp.outputError = outputError.data();
+		layer.backPropagateBatch(backProp, inputError.data(), batchSize);
+
+		// Run in place, as the network does
+		auto clData = clHelper.makeBuffer(input);
+		auto clError = clHelper.makeBuffer(outputError);
+		layer.cl_initKernels(clHelper.getContext(), clHelper.getDevice());
+		layer.cl_forward(clHelper.getQueue(), clData, NULL, clData, 0, 0, 0, batchSize);
+
+		nn::layer::Layer::ClBackPropData clBackProp;
+		clBackProp.output = clData;
+		clBackProp.outputError = clError;
+		layer.cl_backPropagate(clHelper.getQueue(), clBackProp, clError, 0, batchSize);
+
+		Assert::IsTrue(areWithinTolerance(output.data(), clHelper.getData(clData).data(), output.size(), 0.0001));
+		Assert::IsTrue(areWithinTolerance(inputError.data(), clHelper.getData(clError).data(), inputError.size(), 0.0001));
+	}
+
+private:
+	::cl::Helper clHelper;
+};
+}
+}
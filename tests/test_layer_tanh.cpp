@@ -0,0 +1,94 @@
+#include "pch.h"
+#include "..\src\layers\tanh.hpp"
+#include "..\utils\utils.hpp"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace nn;
+using namespace std;
+
+namespace test
+{
+namespace layer
+{
+TEST_CLASS(Tanh)
+{
+public:
+	TEST_METHOD(InvalidArgs)
+	{
+		auto invalidArgs = []
+		{
+			auto layer = nn::layer::Tanh(0);
+		};
+		Assert::ExpectException<std::invalid_argument>(invalidArgs);
+	}
+
+	TEST_METHOD(ForwardTest)
+	{
+		Tensor<> input = { 0.0f, -1.0f, 1.0f, 20.0f };
+		Tensor<> output(input.size());
+		auto layer = nn::layer::Tanh(input.size());
+		layer.forward(input.data(), nullptr, output.data());
+
+		for (size_t i = 0; i < input.size(); ++i)
+		{
+			Assert::AreEqual(tanhf(input[i]), output[i], 0.000001f);
+		}
+	}
+
+	TEST_METHOD(BackpropTest)
+	{
+		Tensor<> input = { 0.0f, -1.0f, 1.0f };
+		Tensor<> output(input.size());
+		Tensor<> outputError = { 1.0f, 2.0f, 3.0f };
+		Tensor<> inputError(input.size());
+		auto layer = nn::layer::Tanh(input.size());
+
+		// Written over the input, backpropagation only needs the output
+		layer.forward(input.data(), nullptr, output.data());
+		layer.forward(input.data(), nullptr, input.data());
+
+		nn::layer::Layer::BackPropData backProp;
+		backProp.output = input.data();
+		backProp.outputError = outputError.data();
+		layer.backPropagate(backProp, inputError.data());
+
+		for (size_t i = 0; i < input.size(); ++i)
+		{
+			Assert::AreEqual((1.f - output[i] * output[i]) * outputError[i], inputError[i], 0.000001f);
+		}
+	}
+
+	TEST_METHOD(cl_PassesTest)
+	{
+		auto layer = nn::layer::Tanh(100);
+		const uint32_t batchSize = 5;
+		auto input = nn::uniformRandomTensor(batchSize * 100, -5.f, 5.f);
+		auto outputError = nn::uniformRandomTensor(input.size(), -5.f, 5.f);
+		auto output = Tensor<>(input.size());
+		auto inputError = Tensor<>(input.size());
+
+		layer.forwardBatch(input.data(), nullptr, output.data(), batchSize);
+		nn::layer::Layer::BackPropData backProp;
+		backProp.output = output.data();
+		backProp.outputError = outputError.data();
+		layer.backPropagateBatch(backProp, inputError.data(), batchSize);
+
+		auto clData = clHelper.makeBuffer(input);
+		auto clError = clHelper.makeBuffer(outputError);
+		layer.cl_initKernels(clHelper.getContext(), clHelper.getDevice());
+		layer.cl_forward(clHelper.getQueue(), clData, NULL, clData, 0, 0, 0, batchSize);
+
+		nn::layer::Layer::ClBackPropData clBackProp;
+		clBackProp.output = clData;
+		clBackProp.outputError = clError;
+		layer.cl_backPropagate(clHelper.getQueue(), clBackProp, clError, 0, batchSize);
+
+		Assert::IsTrue(areWithinTolerance(output.data(), clHelper.getData(clData).data(), output.size(), 0.0001));
+		Assert::IsTrue(areWithinTolerance(inputError.data(), clHelper.getData(clError).data(), inputError.size(), 0.0001));
+	}
+
+private:
+	::cl::Helper clHelper;
+};
+}
+}
@@ -0,0 +1,100 @@
+#include "pch.h"
+#include "..\src\losses\softmax_cross_entropy.hpp"
+#include "..\utils\utils.hpp"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace std;
+using namespace nn;
+
+namespace test
+{
+namespace loss
+{
+TEST_CLASS(SoftmaxCrossEntropy)
+{
+public:
+
+	TEST_METHOD(Error)
+	{
+		// softmax = { 0.090, 0.245, 0.665 }
+		float output[] = { 0.f, 1.f, 2.f };
+		float target[] = { 0.f, 0.f, 1.f };
+		float otherTarget[] = { 1.f, 0.f, 0.f };
+
+		nn::loss::SoftmaxCrossEntropy lossFunc;
+		Assert::AreEqual(0.40761f, lossFunc.calculateError(output, target, 3), 0.00001f);
+		Assert::AreEqual(2.40761f, lossFunc.calculateError(output, otherTarget, 3), 0.00001f);
+	}
+
+	TEST_METHOD(Derivatives)
+	{
+		float output[] = { 0.f, 1.f, 2.f, 1000.f, 1001.f, 999.f };
+		float target[] = { 0.f, 0.f, 1.f, 1.f, 0.f, 0.f };
+		uint32_t labels[] = { 2, 0 };
+		float expected[] = { 0.09003f, 0.24473f, -0.33476f, -0.75527f, 0.66524f, 0.09003f };
+		float derivatives[6];
+		float labelDerivatives[6];
+
+		// Large logits must not overflow
+		nn::loss::SoftmaxCrossEntropy lossFunc;
+		lossFunc.calculateDerivatives(output, target, derivatives, 3);
+		lossFunc.calculateDerivatives(output + 3, target + 3, derivatives + 3, 3);
+		lossFunc.calculateLabelDerivatives(output, labels, labelDerivatives, 2, 3);
+
+		for (size_t i = 0; i < 6; ++i)
+		{
+			Assert::AreEqual(expected[i], derivatives[i], 0.00001f);
+			Assert::AreEqual(expected[i], labelDerivatives[i], 0.00001f);
+		}
+	}
+
+	TEST_METHOD(cl_Passes)
+	{
+		nn::loss::SoftmaxCrossEntropy lossFunc;
+		lossFunc.cl_initKernels(clHelper.getContext(), clHelper.getDevice());
+		const uint32_t height = 4, width = 50;
+		auto output = uniformRandomTensor(height * width, -20.f, 20.f);
+		auto target = Tensor<>(output.size());
+		auto labels = Tensor<>(height);
+		std::fill(target.data(), target.end(), 0.f);
+
+		auto error = Tensor<>(output.size());
+		auto totalError = Tensor<>(height);
+		auto derivatives = Tensor<>(output.size());
+
+		for (uint32_t i = 0; i < height; ++i)
+		{
+			const uint32_t label = (i * 7) % width;
+			reinterpret_cast<uint32_t*>(labels.data())[i] = label;
+			target[i * width + label] = 1.f;
+
+			const float* row = output.data() + i * width;
+			lossFunc.calculateError(row, target.data() + i * width, error.data() + i * width, width);
+			totalError[i] = lossFunc.calculateError(row, target.data() + i * width, width);
+			lossFunc.calculateDerivatives(row, target.data() + i * width, derivatives.data() + i * width, width);
+		}
+
+		auto clOutput = clHelper.makeBuffer(output);
+		auto clTarget = clHelper.makeBuffer(target);
+		auto clLabels = clHelper.makeBuffer(labels);
+		auto clError = clHelper.makeBuffer(error.size());
+		auto clTotalError = clHelper.makeBuffer(height);
+		auto clDerivatives = clHelper.makeBuffer(derivatives.size());
+		auto clLabelDerivatives = clHelper.makeBuffer(derivatives.size());
+
+		lossFunc.cl_calculateError(clHelper.getQueue(), clOutput, clTarget, clError, 0, height, width);
+		lossFunc.cl_calculateTotalError(clHelper.getQueue(), clOutput, clTarget, clTotalError, height, width);
+		lossFunc.cl_calculateDerivatives(clHelper.getQueue(), clOutput, clTarget, clDerivatives, 0, height, width);
+		lossFunc.cl_calculateLabelDerivatives(clHelper.getQueue(), clOutput, clLabels, clLabelDerivatives, 0, height, width);
+
+		Assert::IsTrue(areWithinTolerance(error.data(), clHelper.getData(clError).data(), error.size(), 0.0001));
+		Assert::IsTrue(areWithinTolerance(totalError.data(), clHelper.getData(clTotalError).data(), totalError.size(), 0.0001));
+		Assert::IsTrue(areWithinTolerance(derivatives.data(), clHelper.getData(clDerivatives).data(), derivatives.size(), 0.0001));
+		Assert::IsTrue(areWithinTolerance(derivatives.data(), clHelper.getData(clLabelDerivatives).data(), derivatives.size(), 0.0001));
+	}
+
+private:
+	::cl::Helper clHelper;
+};
+}
+}
@@ -0,0 +1,183 @@
+#include "pch.h"
+#include "..\src\math\kernels.hpp"
+#include "..\src\layers\sigmoid.hpp"
+#include "..\utils\utils.hpp"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace nn;
+using namespace std;
+
+namespace test
+{
+namespace math
+{
+TEST_CLASS(Kernels)
+{
+public:
+	// Runs f for every instruction set supported by this CPU
+	template<typename F> void forEachIsa(F f)
+	{
+		for (auto isa : { nn::math::Isa::Sse4, nn::math::Isa::Avx2, nn::math::Isa::Avx512 })
+		{
+			if (auto kernels = nn::math::getKernels(isa))
+			{
+				f(*kernels);
+			}
+		}
+	}
+
+	TEST_METHOD(Scalar)
+	{
+		Assert::IsTrue(nn::math::getKernels(nn::math::Isa::Scalar) != nullptr);
+	}
+
+	TEST_METHOD(Dot)
+	{
+		auto a = uniformRandomTensor(size, -5.f, 5.f);
+		auto b = uniformRandomTensor(size, -5.f, 5.f);
+		const float expected = scalar().dot(a.data(), b.data(), size);
+
+		forEachIsa([&](const nn::math::Kernels& kernels)
+		{
+			Assert::AreEqual(expected, kernels.dot(a.data(), b.data(), size), 0.001f);
+		});
+	}
+
+	TEST_METHOD(Dot4)
+	{
+		auto a = uniformRandomTensor(4 * size, -5.f, 5.f);
+		auto b = uniformRandomTensor(size, -5.f, 5.f);
+		float expected[4];
+		scalar().dot4(a.data(), size, b.data(), size, expected);
+
+		forEachIsa([&](const nn::math::Kernels& kernels)
+		{
+			float result[4];
+			kernels.dot4(a.data(), size, b.data(), size, result);
+			Assert::IsTrue(areWithinTolerance(expected, result, 4, 0.001f));
+		});
+	}
+
+	TEST_METHOD(Axpy)
+	{
+		auto x = uniformRandomTensor(size, -5.f, 5.f);
+		auto y = uniformRandomTensor(size, -5.f, 5.f);
+		auto expected = Tensor<>(size);
+		std::copy(y.data(), y.end(), expected.data());
+		scalar().axpy(0.5f, x.data(), expected.data(), size);
+
+		forEachIsa([&](const nn::math::Kernels& kernels)
+		{
+			auto result = Tensor<>(size);
+			std::copy(y.data(), y.end(), result.data());
+			kernels.axpy(0.5f, x.data(), result.data(), size);
+			Assert::IsTrue(areWithinTolerance(expected.data(), result.data(), size, 0.0001f));
+		});
+	}
+
+	TEST_METHOD(Sigmoid)
+	{
+		auto input = uniformRandomTensor(size, -20.f, 20.f);
+		auto expected = Tensor<>(size);
+		for (size_t i = 0; i < size; ++i)
+		{
+			expected[i] = nn::layer::Sigmoid::sigmoid(input[i]);
+		}
+
+		forEachIsa([&](const nn::math::Kernels& kernels)
+		{
+			auto result = Tensor<>(size);
+			kernels.sigmoid(input.data(), result.data(), size);
+			Assert::IsTrue(areWithinTolerance(expected.data(), result.data(), size, 0.000001f));
+		});
+	}
+
+	TEST_METHOD(SigmoidBackward)
+	{
+		auto input = uniformRandomTensor(size, -20.f, 20.f);
+		auto outputError = uniformRandomTensor(size, -5.f, 5.f);
+		auto expected = Tensor<>(size);
+		for (size_t i = 0; i < size; ++i)
+		{
+			expected[i] = nn::layer::Sigmoid::sigmoidPrime(input[i]) * outputError[i];
+		}
+
+		forEachIsa([&](const nn::math::Kernels& kernels)
+		{
+			auto result = Tensor<>(size);
+			kernels.sigmoidBackward(input.data(), outputError.data(), result.data(), size);
+			Assert::IsTrue(areWithinTolerance(expected.data(), result.data(), size, 0.00001f));
+		});
+	}
+
+	TEST_METHOD(LeakyRelu)
+	{
+		auto input = uniformRandomTensor(size, -5.f, 5.f);
+		auto expected = Tensor<>(size);
+		scalar().leakyRelu(input.data(), expected.data(), 0.1f, size);
+
+		forEachIsa([&](const nn::math::Kernels& kernels)
+		{
+			auto result = Tensor<>(size);
+			kernels.leakyRelu(input.data(), result.data(), 0.1f, size);
+			Assert::IsTrue(areWithinTolerance(expected.data(), result.data(), size, 0.000001f));
+
+			// in place
+			std::copy(input.data(), input.end(), result.data());
+			kernels.leakyRelu(result.data(), result.data(), 0.1f, size);
+			Assert::IsTrue(areWithinTolerance(expected.data(), result.data(), size, 0.000001f));
+		});
+	}
+
+	TEST_METHOD(LeakyReluBackward)
+	{
+		auto output = uniformRandomTensor(size, -5.f, 5.f);
+		auto outputError = uniformRandomTensor(size, -5.f, 5.f);
+		auto expected = Tensor<>(size);
+		scalar().leakyReluBackward(output.data(), outputError.data(), expected.data(), 0.1f, size);
+
+		forEachIsa([&](const nn::math::Kernels& kernels)
+		{
+			auto result = Tensor<>(size);
+			kernels.leakyReluBackward(output.data(), outputError.data(), result.data(), 0.1f, size);
+			Assert::IsTrue(areWithinTolerance(expected.data(), result.data(), size, 0.000001f));
+		});
+	}
+
+	TEST_METHOD(Tanh)
+	{
+		auto input = uniformRandomTensor(size, -20.f, 20.f);
+		auto expected = Tensor<>(size);
+		scalar().tanh(input.data(), expected.data(), size);
+
+		forEachIsa([&](const nn::math::Kernels& kernels)
+		{
+			auto result = Tensor<>(size);
+			kernels.tanh(input.data(), result.data(), size);
+			Assert::IsTrue(areWithinTolerance(expected.data(), result.data(), size, 0.000001f));
+		});
+	}
+
+	TEST_METHOD(TanhBackward)
+	{
+		auto output = uniformRandomTensor(size, -1.f, 1.f);
+		auto outputError = uniformRandomTensor(size, -5.f, 5.f);
+		auto expected = Tensor<>(size);
+		scalar().tanhBackward(output.data(), outputError.data(), expected.data(), size);
+
+		forEachIsa([&](const nn::math::Kernels& kernels)
+		{
+			auto result = Tensor<>(size);
+			kernels.tanhBackward(output.data(), outputError.data(), result.data(), size);
+			Assert::IsTrue(areWithinTolerance(expected.data(), result.data(), size, 0.00001f));
+		});
+	}
+
+private:
+	const nn::math::Kernels& scalar() { return *nn::math::getKernels(nn::math::Isa::Scalar); }
+
+	// Not a multiple of any vector width so the tails are exercised too
+	static const size_t size = 1001;
+};
+}
+}
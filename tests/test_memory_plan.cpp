@@ -0,0 +1,141 @@
+#include "pch.h"
+#include "..\src\memory_plan.hpp"
+#include "..\src\layers\dense.hpp"
+#include "..\src\layers\sigmoid.hpp"
+#include "..\src\layers\max_pooling.hpp"
+#include "..\src\layers\relu.hpp"
+#include "..\src\layers\tanh.hpp"
+#include <string>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace nn;
+using namespace std;
+
+namespace test
+{
+TEST_CLASS(MemoryPlanTest)
+{
+public:
+	// 64 -> 128 -> 128 -> 32 -> 32 -> 10 -> 10 (alternating Dense and Sigmoid)
+	static MemoryPlan::Layers makeLayers()
+	{
+		MemoryPlan::Layers layers;
+		layers.push_back(make_unique<layer::Dense>(64, 128));
+		layers.push_back(make_unique<layer::Sigmoid>(128));
+		layers.push_back(make_unique<layer::Dense>(128, 32));
+		layers.push_back(make_unique<layer::Sigmoid>(32));
+		layers.push_back(make_unique<layer::Dense>(32, 10));
+		layers.push_back(make_unique<layer::Sigmoid>(10));
+		return layers;
+	}
+
+	static bool overlaps(size_t offsetA, size_t sizeA, size_t offsetB, size_t sizeB)
+	{
+		return offsetA < offsetB + sizeB && offsetB < offsetA + sizeA;
+	}
+
+	static void report(const char* name, const MemoryPlan& plan)
+	{
+		const size_t batchSize = 128;
+		string message = string(name) + ": " + to_string(plan.getSize() * batchSize * sizeof(float)) +
+			" bytes peak, " + to_string(plan.getUnplannedSize() * batchSize * sizeof(float)) + " bytes unplanned\n";
+		Logger::WriteMessage(message.c_str());
+	}
+
+	TEST_METHOD(ForwardOnly)
+	{
+		auto layers = makeLayers();
+		auto plan = MemoryPlan(layers, false);
+		report("forward", plan);
+
+		// Only a layer's input and output are live at once, so two regions are enough
+		Assert::AreEqual(size_t(128 + 128), plan.getSize());
+		Assert::AreEqual(size_t(128 + 128 + 32 + 32 + 10 + 10), plan.getUnplannedSize());
+
+		for (size_t i = 1; i < layers.size(); ++i)
+		{
+			Assert::IsFalse(overlaps(plan.getOutputOffset(i - 1), layers[i - 1]->getOutputSize(),
+									 plan.getOutputOffset(i), layers[i]->getOutputSize()));
+		}
+	}
+
+	TEST_METHOD(Training)
+	{
+		auto layers = makeLayers();
+		auto plan = MemoryPlan(layers, true);
+		report("training", plan);
+
+		Assert::IsTrue(plan.getSize() < plan.getUnplannedSize());
+
+		// Layer outputs are kept for the whole backward pass
+		for (size_t i = 0; i < layers.size(); ++i)
+		{
+			for (size_t j = 0; j < i; ++j)
+			{
+				Assert::IsFalse(overlaps(plan.getOutputOffset(i), layers[i]->getOutputSize(),
+										 plan.getOutputOffset(j), layers[j]->getOutputSize()));
+			}
+		}
+
+		// Backpropagating layer i reads its input, its output and output error and writes its input error
+		for (size_t i = 1; i < layers.size(); ++i)
+		{
+			const size_t inputError = plan.getErrorOffset(i - 1);
+			const size_t inputSize = layers[i]->getInputSize();
+
+			Assert::IsFalse(overlaps(inputError, inputSize, plan.getErrorOffset(i), layers[i]->getOutputSize()));
+			Assert::IsFalse(overlaps(inputError, inputSize, plan.getOutputOffset(i), layers[i]->getOutputSize()));
+			Assert::IsFalse(overlaps(inputError, inputSize, plan.getOutputOffset(i - 1), inputSize));
+		}
+	}
+
+	TEST_METHOD(TrainingState)
+	{
+		// 1x8x8 -> 1x4x4 -> 16 -> 10, pooling saves one index per output
+		MemoryPlan::Layers layers;
+		layers.push_back(make_unique<layer::Sigmoid>(64));
+		layers.push_back(make_unique<layer::MaxPooling>(Shape<3>({ 1, 8, 8 }), Dim2{ 2, 2 }));
+		layers.push_back(make_unique<layer::Dense>(16, 10));
+
+		auto plan = MemoryPlan(layers, true);
+		const size_t state = plan.getStateOffset(1);
+		const size_t stateSize = layers[1]->getTrainingStateSize();
+		Assert::AreEqual(size_t(16), stateSize);
+
+		// Live from the pooling forward pass until its input error is written
+		Assert::IsFalse(overlaps(state, stateSize, plan.getOutputOffset(1), 16));
+		Assert::IsFalse(overlaps(state, stateSize, plan.getOutputOffset(2), 10));
+		Assert::IsFalse(overlaps(state, stateSize, plan.getErrorOffset(2), 10));
+		Assert::IsFalse(overlaps(state, stateSize, plan.getErrorOffset(1), 16));
+		Assert::IsFalse(overlaps(state, stateSize, plan.getErrorOffset(0), 64));
+
+		// Inference never stores it
+		auto inference = MemoryPlan(layers, false);
+		Assert::AreEqual(size_t(64 + 16), inference.getSize());
+	}
+
+	TEST_METHOD(InPlace)
+	{
+		// 64 -> 128 -> 128 -> 128 -> 10, the Relu and Tanh write over the Dense output
+		MemoryPlan::Layers layers;
+		layers.push_back(make_unique<layer::Dense>(64, 128));
+		layers.push_back(make_unique<layer::Relu>(128));
+		layers.push_back(make_unique<layer::Tanh>(128));
+		layers.push_back(make_unique<layer::Dense>(128, 10));
+
+		auto inference = MemoryPlan(layers, false);
+		Assert::AreEqual(inference.getOutputOffset(0), inference.getOutputOffset(1));
+		Assert::AreEqual(inference.getOutputOffset(0), inference.getOutputOffset(2));
+		Assert::AreEqual(size_t(128 + 10), inference.getSize());
+
+		// The Tanh cannot overwrite the Relu output, which the Relu needs to backpropagate
+		auto training = MemoryPlan(layers, true);
+		Assert::AreEqual(training.getOutputOffset(0), training.getOutputOffset(1));
+		Assert::AreEqual(training.getErrorOffset(0), training.getErrorOffset(1));
+		Assert::IsFalse(overlaps(training.getOutputOffset(1), 128, training.getOutputOffset(2), 128));
+		Assert::IsFalse(overlaps(training.getOutputOffset(2), 128, training.getErrorOffset(2), 128));
+		Assert::IsFalse(overlaps(training.getOutputOffset(2), 128, training.getErrorOffset(1), 128));
+		Assert::IsFalse(overlaps(training.getOutputOffset(1), 128, training.getErrorOffset(1), 128));
+	}
+};
+}
@@ -0,0 +1,117 @@
+#include "pch.h"
+#include "..\include\network.hpp"
+#include "..\utils\utils.hpp"
+#include <atomic>
+#include <new>
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace std;
+using namespace nn;
+
+// Counts every heap allocation made by the test process
+static std::atomic<size_t> allocationCount(0);
+
+void* operator new(size_t size)
+{
+	++allocationCount;
+
+	if (void* p = malloc(size ? size : 1))
+	{
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	free(p);
+}
+
+namespace test
+{
+namespace network
+{
+TEST_CLASS(Allocations)
+{
+public:
+	void SteadyStateInference(bool cl)
+	{
+		NetworkArgs args;
+		args.setInputShape({ 20 });
+		args.addLayerDense(30);
+		args.addLayerSigmoid();
+		args.addLayerDense(10);
+		args.enableOpenCLAcceleration(cl);
+		args.setThreadCount(2);
+		auto network = Network(move(args));
+
+		const size_t count = 300;
+		auto inputs = uniformRandomTensor(count * 20, -1.f, 1.f).as<2>({ count, 20 });
+		auto outputs = Tensor<>(count * 10);
+		auto classes = Tensor<1, uint32_t>(count);
+
+		network.reserve(count);
+
+		// warm up
+		network.forward(inputs, outputs);
+		network.clasify(inputs, classes);
+
+		const size_t allocationsBefore = allocationCount;
+
+		for (size_t i = 0; i < 10; ++i)
+		{
+			network.forward(inputs, outputs);
+			network.clasify(inputs, classes);
+		}
+
+		Assert::AreEqual(allocationsBefore, size_t(allocationCount));
+
+		// Results match the allocating overloads
+		auto expected = network.forward(inputs);
+		Assert::IsTrue(areWithinTolerance(expected.data(), outputs.data(), expected.size(), 0.f));
+	}
+
+	TEST_METHOD(SteadyStateInference)
+	{
+		SteadyStateInference(false);
+	}
+
+	TEST_METHOD(cl_SteadyStateInference)
+	{
+		SteadyStateInference(true);
+	}
+
+	TEST_METHOD(OutputTooSmall)
+	{
+		NetworkArgs args;
+		args.setInputShape({ 4 });
+		args.addLayerDense(3);
+		auto network = Network(move(args));
+
+		auto inputs = uniformRandomTensor(8, -1.f, 1.f).as<2>({ 2, 4 });
+		auto outputs = Tensor<>(5);
+		Assert::ExpectException<std::invalid_argument>([&] { network.forward(inputs, outputs); });
+	}
+};
+}
+}
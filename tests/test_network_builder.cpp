@@ -49,6 +49,84 @@ namespace test
 			Assert::IsTrue(args.getOutputShape() == Shape<>({ 16, 10 }));
 		}
 
+		TEST_METHOD(Conv2dOutputShape)
+		{
+			NetworkArgs args;
+			args.setInputShape({ 28, 28 });
+			args.addLayerConv2d(8, Shape<2>({ 5, 5 }));
+			Assert::IsTrue(args.getOutputShape() == Shape<>({ 8, 24, 24 }));
+			args.addLayerConv2d(4, Shape<2>({ 3, 3 }), Shape<2>({ 2, 2 }));
+			Assert::IsTrue(args.getOutputShape() == Shape<>({ 4, 11, 11 }));
+			args.addLayerSigmoid();
+			args.addLayerDense(10);
+			Assert::IsTrue(args.getOutputShape() == Shape<>({ 10 }));
+		}
+
+		TEST_METHOD(SeparableConv2dOutputShape)
+		{
+			NetworkArgs args;
+			args.setInputShape({ 3, 28, 28 });
+			args.addLayerDepthwiseConv2d(Shape<2>({ 3, 3 }), Shape<2>({ 2, 2 }));
+			Assert::IsTrue(args.getOutputShape() == Shape<>({ 3, 13, 13 }));
+			args.addLayerSeparableConv2d(8, Shape<2>({ 3, 3 }));
+			Assert::IsTrue(args.getOutputShape() == Shape<>({ 8, 11, 11 }));
+		}
+
+		TEST_METHOD(LstmOutputShape)
+		{
+			NetworkArgs args;
+			args.setInputShape({ 12, 5 });
+			args.addLayerLstm(8, true);
+			Assert::IsTrue(args.getOutputShape() == Shape<>({ 12, 8 }));
+			args.addLayerLstm(4);
+			Assert::IsTrue(args.getOutputShape() == Shape<>({ 4 }));
+
+			auto notSequence = [&]
+			{
+				args.addLayerLstm(4);
+			};
+			Assert::ExpectException<std::invalid_argument>(notSequence);
+		}
+
+		TEST_METHOD(Conv2dFilterTooLarge)
+		{
+			auto filterTooLarge = []
+			{
+				NetworkArgs args;
+				args.setInputShape({ 4, 4 });
+				args.addLayerConv2d(2, Shape<2>({ 5, 5 }));
+			};
+			Assert::ExpectException<std::invalid_argument>(filterTooLarge);
+		}
+
+		TEST_METHOD(AsyncTrainingWithAdam)
+		{
+			auto asyncAdam = []
+			{
+				NetworkArgs args;
+				args.setInputShape({ 4 });
+				args.addLayerDense(2);
+				args.setOptimizerAdam();
+				args.enableAsyncTraining(true);
+				auto network = Network(move(args));
+			};
+			Assert::ExpectException<std::invalid_argument>(asyncAdam);
+		}
+
+		TEST_METHOD(BatchNormWithThreads)
+		{
+			auto batchNormThreads = []
+			{
+				NetworkArgs args;
+				args.setInputShape({ 4 });
+				args.addLayerDense(2);
+				args.addLayerBatchNorm();
+				args.setThreadCount(2);
+				auto network = Network(move(args));
+			};
+			Assert::ExpectException<std::invalid_argument>(batchNormThreads);
+		}
+
 		TEST_METHOD(OpenClNetwork)
 		{
 			NetworkArgs args;
@@ -51,7 +51,7 @@ public:
 		Linear(true);
 	}
 
-	void Parabola(bool cl)
+	void Parabola(bool cl, uint32_t threadCount = 1, bool async = false)
 	{
 		auto makeSimpleNetwork = [=]()
 		{
@@ -63,6 +63,8 @@ public:
 			args.setLossMse();
 			args.setOptimizerGradientDescent(0.1f);
 			args.enableOpenCLAcceleration(cl);
+			args.setThreadCount(threadCount);
+			args.enableAsyncTraining(async);
 			return Network(move(args));
 		};
 
@@ -91,6 +93,325 @@ public:
 	{
 		Parabola(true);
 	}
+
+	TEST_METHOD(ParabolaMultithreaded)
+	{
+		Parabola(false, 4);
+	}
+
+	TEST_METHOD(ParabolaAsync)
+	{
+		Parabola(false, 4, true);
+	}
+
+	// Parabola again, with activations that write over the Dense outputs
+	void ParabolaInPlace(bool cl)
+	{
+		NetworkArgs args;
+		args.setInputShape({ 1 });
+		args.addLayerDense(16);
+		args.addLayerLrelu();
+		args.addLayerDense(16);
+		args.addLayerTanh();
+		args.addLayerDense(1);
+		args.setLossMse();
+		args.setOptimizerGradientDescent(0.05f);
+		args.enableOpenCLAcceleration(cl);
+		auto network = Network(move(args));
+
+		auto inputs = uniformRandomTensor(20000, -2.f, 2.f).as<2>({ 20000, 1 });
+		auto targets = Tensor<2>({ inputs.size(), 1u });
+		std::transform(inputs.data(), inputs.end(), targets.data(), [](float x) { return 1.f - x * x; });
+
+		network.train(inputs.section(0, 10000), targets.section(0, 10000), 10, 10);
+		auto error = network.test(inputs.section(10000, 20000), targets.section(10000, 20000));
+		Assert::IsTrue(error < 0.01f);
+	}
+
+	TEST_METHOD(ParabolaInPlace)
+	{
+		ParabolaInPlace(false);
+	}
+
+	TEST_METHOD(cl_ParabolaInPlace)
+	{
+		ParabolaInPlace(true);
+	}
+
+	void ParabolaDropout(bool cl)
+	{
+		NetworkArgs args;
+		args.setInputShape({ 1 });
+		args.addLayerDense(16);
+		args.addLayerTanh();
+		args.addLayerDense(16);
+		args.addLayerTanh();
+		args.addLayerDropout(0.1f);
+		args.addLayerDense(1);
+		args.setLossMse();
+		args.setOptimizerGradientDescent(0.05f);
+		args.enableOpenCLAcceleration(cl);
+		auto network = Network(move(args));
+
+		auto inputs = uniformRandomTensor(20000, -2.f, 2.f).as<2>({ 20000, 1 });
+		auto targets = Tensor<2>({ inputs.size(), 1u });
+		std::transform(inputs.data(), inputs.end(), targets.data(), [](float x) { return 1.f - x * x; });
+
+		network.train(inputs.section(0, 10000), targets.section(0, 10000), 10, 10);
+		auto error = network.test(inputs.section(10000, 20000), targets.section(10000, 20000));
+		Assert::IsTrue(error < 0.02f);
+	}
+
+	TEST_METHOD(ParabolaDropout)
+	{
+		ParabolaDropout(false);
+	}
+
+	TEST_METHOD(cl_ParabolaDropout)
+	{
+		ParabolaDropout(true);
+	}
+
+	// Freezing folds each batch norm into the dense layer before it without changing the outputs
+	void BatchNormFolded(bool cl)
+	{
+		// The error threshold leaves little room, so start from the same weights and data every run
+		seedRandom(1);
+		NetworkArgs args;
+		args.setInputShape({ 1 });
+		args.addLayerDense(16);
+		args.addLayerTanh();
+		args.addLayerDense(16);
+		args.addLayerBatchNorm();
+		args.addLayerTanh();
+		args.addLayerDense(1);
+		args.setLossMse();
+		args.setOptimizerGradientDescent(0.05f);
+		args.enableOpenCLAcceleration(cl);
+		auto network = Network(move(args));
+
+		auto inputs = uniformRandomTensor(20000, -2.f, 2.f).as<2>({ 20000, 1 });
+		auto targets = Tensor<2>({ inputs.size(), 1u });
+		std::transform(inputs.data(), inputs.end(), targets.data(), [](float x) { return 1.f - x * x; });
+
+		// Batch statistics of small batches are too noisy to learn from
+		network.train(inputs.section(0, 10000), targets.section(0, 10000), 10, 50);
+		auto error = network.test(inputs.section(10000, 20000), targets.section(10000, 20000));
+		auto outputs = network.forward(inputs.section(10000, 20000));
+
+		network.freeze();
+		auto frozenOutputs = network.forward(inputs.section(10000, 20000));
+
+		// Freezing again must not fold the statistics a second time
+		network.freeze();
+		auto refrozenOutputs = network.forward(inputs.section(10000, 20000));
+
+		Assert::IsTrue(error < 0.02f);
+		Assert::IsTrue(areWithinTolerance(outputs.data(), frozenOutputs.data(), outputs.size(), 0.001f));
+		Assert::IsTrue(areWithinTolerance(frozenOutputs.data(), refrozenOutputs.data(), outputs.size(), 0.f));
+	}
+
+	TEST_METHOD(BatchNormFolded)
+	{
+		BatchNormFolded(false);
+	}
+
+	TEST_METHOD(cl_BatchNormFolded)
+	{
+		BatchNormFolded(true);
+	}
+
+	// Which of 4 inputs is largest? Trained on labels with the final layer's logits going
+	// straight into the loss.
+	void SoftmaxCrossEntropy(bool cl)
+	{
+		NetworkArgs args;
+		args.setInputShape({ 4 });
+		args.addLayerDense(16);
+		args.addLayerTanh();
+		args.addLayerDense(4);
+		args.setLossSoftmaxCrossEntropy();
+		args.setOptimizerGradientDescent(0.1f);
+		args.enableOpenCLAcceleration(cl);
+		auto network = Network(move(args));
+
+		const size_t count = 6000;
+		auto inputs = uniformRandomTensor(count * 4, -1.f, 1.f).as<2>({ count, 4 });
+		auto labels = Tensor<1, uint32_t>(count);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			labels[i] = uint32_t(argMax(inputs.data() + i * 4, 4));
+		}
+
+		network.train(inputs.section(0, 5000), labels.section(0, 5000), 2, 10);
+		Assert::IsTrue(network.test(inputs.section(5000, 6000), labels.section(5000, 6000)) > 0.9);
+	}
+
+	TEST_METHOD(SoftmaxCrossEntropy)
+	{
+		SoftmaxCrossEntropy(false);
+	}
+
+	TEST_METHOD(cl_SoftmaxCrossEntropy)
+	{
+		SoftmaxCrossEntropy(true);
+	}
+
+	// Is the bright 2x2 square in the top or the bottom half of an 8x8 image?
+	void ConvPooling(bool cl)
+	{
+		NetworkArgs args;
+		args.setInputShape({ 8, 8 });
+		args.addLayerConv2d(4, Shape<2>({ 3, 3 }));
+		args.addLayerMaxPooling({ 2, 2 });
+		args.addLayerSigmoid();
+		args.addLayerDense(2);
+		args.addLayerSigmoid();
+		args.setOptimizerGradientDescent(0.5f);
+		args.enableOpenCLAcceleration(cl);
+		auto network = Network(move(args));
+
+		const size_t count = 2000;
+		auto inputs = Tensor<3>({ count, 8, 8 });
+		auto labels = Tensor<1, uint32_t>(count);
+		std::fill(inputs.data(), inputs.end(), 0.f);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const size_t y = rand() % 7;
+			const size_t x = rand() % 7;
+			float* image = inputs.data() + i * 64;
+			image[y * 8 + x] = image[y * 8 + x + 1] = image[y * 8 + x + 8] = image[y * 8 + x + 9] = 1.f;
+			labels[i] = y < 3 ? 0 : 1;
+		}
+
+		network.train(inputs.section(0, 1500), labels.section(0, 1500), 10, 5);
+		Assert::IsTrue(network.test(inputs.section(1500, 2000), labels.section(1500, 2000)) > 0.9);
+	}
+
+	TEST_METHOD(ConvPooling)
+	{
+		ConvPooling(false);
+	}
+
+	TEST_METHOD(cl_ConvPooling)
+	{
+		ConvPooling(true);
+	}
+
+	// Recall the first element of a sequence of 8 after seeing the rest
+	void SequenceMemory(bool cl)
+	{
+		NetworkArgs args;
+		args.setInputShape({ 8, 1 });
+		args.addLayerLstm(16);
+		args.addLayerDense(1);
+		args.setLossMse();
+		args.setOptimizerGradientDescent(0.2f);
+		args.enableOpenCLAcceleration(cl);
+		auto network = Network(move(args));
+
+		const size_t count = 4000;
+		auto inputs = uniformRandomTensor(count * 8, -1.f, 1.f).as<3>({ count, 8, 1 });
+		auto targets = Tensor<2>({ count, 1u });
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			targets.data()[i] = inputs.data()[i * 8];
+		}
+
+		network.train(inputs.section(0, 2000), targets.section(0, 2000), 10, 30);
+		Assert::IsTrue(network.test(inputs.section(2000, 4000), targets.section(2000, 4000)) < 0.02);
+	}
+
+	TEST_METHOD(SequenceMemory)
+	{
+		SequenceMemory(false);
+	}
+
+	TEST_METHOD(cl_SequenceMemory)
+	{
+		SequenceMemory(true);
+	}
+
+	TEST_METHOD(InferenceMultithreaded)
+	{
+		NetworkArgs args;
+		args.setInputShape({ 8 });
+		args.addLayerDense(16);
+		args.addLayerSigmoid();
+		args.addLayerDense(4);
+		args.setThreadCount(3);
+		auto network = Network(move(args));
+
+		const size_t count = 1000;
+		auto inputs = uniformRandomTensor(count * 8, -2.f, 2.f).as<2>({ count, 8 });
+		auto outputs = network.forward(inputs);
+		auto classes = network.clasify(inputs);
+
+		auto labels = Tensor<1, uint32_t>(count);
+		size_t expectedCorrect = 0;
+
+		// Every sample is written by exactly one thread and agrees with forward()
+		for (size_t i = 0; i < count; ++i)
+		{
+			const uint32_t expected = uint32_t(argMax(outputs.data() + i * 4, 4));
+			Assert::AreEqual(expected, classes[i]);
+
+			labels[i] = uint32_t(i % 4);
+			expectedCorrect += labels[i] == expected;
+		}
+
+		Assert::AreEqual(double(expectedCorrect) / double(count), network.test(inputs, labels), 0.000001);
+	}
+
+	TEST_METHOD(Freeze)
+	{
+		NetworkArgs args;
+		args.setInputShape({ 1 });
+		args.addLayerDense(10);
+		args.addLayerSigmoid();
+		args.addLayerDense(1);
+		args.setLossMse();
+		args.setOptimizerAdam();
+		auto network = Network(move(args));
+
+		auto inputs = uniformRandomTensor(100, -2.f, 2.f).as<2>({ 100, 1 });
+		auto targets = Tensor<2>({ inputs.size(), 1u });
+		std::transform(inputs.data(), inputs.end(), targets.data(), [](float x) { return x * x; });
+
+		network.train(inputs, targets);
+		auto expected = network.forward(inputs);
+		const double expectedError = network.test(inputs, targets);
+
+		network.freeze();
+
+		// Inference is unchanged, training is no longer possible
+		auto output = network.forward(inputs);
+		Assert::IsTrue(areWithinTolerance(expected.data(), output.data(), output.size(), 0.f));
+		Assert::AreEqual(expectedError, network.test(inputs, targets));
+		Assert::ExpectException<std::exception>([&] { network.train(inputs, targets); });
+	}
+
+	TEST_METHOD(InferenceOnly)
+	{
+		NetworkArgs args;
+		args.setInputShape({ 1 });
+		args.addLayerDense(10);
+		args.addLayerSigmoid();
+		args.addLayerDense(1);
+		args.setLossMse();
+		args.setOptimizerGradientDescent();
+		args.setInferenceOnly(true);
+		auto network = Network(move(args));
+
+		auto inputs = uniformRandomTensor(100, -2.f, 2.f).as<2>({ 100, 1 });
+		auto targets = Tensor<2>({ inputs.size(), 1u });
+
+		Assert::AreEqual(size_t(100), network.forward(inputs).size());
+		Assert::ExpectException<std::exception>([&] { network.train(inputs, targets); });
+	}
 };
 }
 }
\ No newline at end of file
@@ -5,23 +5,42 @@
 namespace nn
 {
 
-inline float fastUniformRand(float min, float max)
+// State shared by the generators below, see seedRandom()
+inline uint32_t& fastRandSeed()
 {
 	static uint32_t seed = 0;
+	return seed;
+}
+
+inline std::default_random_engine& randomEngine()
+{
+	static std::default_random_engine generator;
+	return generator;
+}
+
+// Restarts both generators, so a test does not depend on which tests ran before it
+inline void seedRandom(uint32_t seed)
+{
+	fastRandSeed() = seed;
+	randomEngine().seed(seed);
+}
+
+inline float fastUniformRand(float min, float max)
+{
+	uint32_t& seed = fastRandSeed();
 	seed = 214013 * seed + 2531011;
 	return (float((seed >> 16) & 0x7FFF) / float(0x7FFF)) * (max - min) + min;
 }
 
 inline Tensor<> uniformRandomTensor(size_t size, float min, float max)
 {
-	static std::default_random_engine generator;
 	std::uniform_real_distribution<float> distribution(min, max);
 
 	auto tensor = Tensor<>(size);
 
 	for (size_t i = 0; i < size; ++i)
 	{
-		tensor[i] = distribution(generator);
+		tensor[i] = distribution(randomEngine());
 	}
 
 	return tensor;